@@ -1,6 +1,7 @@
 /*LTC6804-2 Multicell Battery Monitor Library*/
 #include <Arduino.h>
 #include "LTC6804_2.h"
+#include "trace.h"
 
 /*Maps  global ADC control variables to the appropriate control bytes for each of the different ADC commands
 
@@ -95,6 +96,37 @@ void LTC6804_2::adcvax()
     delay(delay_on_send_ms);
 }
 
+/*Starts an open wire conversion on a single LTC6804
+
+ Same as adcv, but the cell inputs are loaded with 100uA current sources,
+ pulling them up (PUP = 1) or down (PUP = 0) during the conversion.
+ Only the addressed IC converts, so the rest of the stack keeps its cell codes.
+
+ Command Code:
+      |command  |  10   |   9   |   8   |   7   |   6   |   5   |   4   |   3   |   2   |   1   |   0   |
+      |-----------|-------|-------|-------|-------|-------|-------|-------|-------|-------|-------|-------|
+      |ADOW:      |   0   |   1   | MD[1] | MD[2] |  PUP  |   1   |  DCP  |   1   | CH[2] | CH[1] | CH[0] |*/
+void LTC6804_2::adow(uint8_t address, uint8_t pup)
+{
+    uint8_t cmd[4];
+    uint16_t temp_pec;
+
+    cmd[0] = 0x80 + (address<<3) + ADCV[0]; //Setting address
+    cmd[1] = (ADCV[1] & ~0x40) + 0x08 + (pup ? 0x40 : 0x00);
+
+    temp_pec = LTC6804_2::pec15_calc(2, cmd);
+    cmd[2] = (uint8_t)(temp_pec >> 8);
+    cmd[3] = (uint8_t)(temp_pec);
+
+    wakeup_idle (); //This will guarantee that the LTC6804 isoSPI port is awake. This command can be removed.
+
+    output_low(this->spi->cs);
+    this->spi_write_array(4,cmd);
+    output_high(this->spi->cs);
+
+    delay(delay_on_send_ms);
+}
+
 /*
   LTC6804_adcv Function sequence:
   1. Load adcv command into cmd array
@@ -222,7 +254,7 @@ uint8_t LTC6804_2::rdcv(uint8_t reg,uint8_t total_ic, uint16_t cell_codes[][12])
             }
             //b.iii
             received_pec = (cell_data[data_counter] << 8 )+ cell_data[data_counter + 1];
-            data_pec = pec15_calc(BYT_IN_REG, &cell_data[current_ic * NUM_RX_BYT * (reg-1)]);
+            data_pec = pec15_calc(BYT_IN_REG, &cell_data[current_ic * NUM_RX_BYT]);
             if(received_pec != data_pec)
             {
                 pec_error--;//pec_error = -1;
@@ -246,6 +278,159 @@ uint8_t LTC6804_2::rdcv(uint8_t reg,uint8_t total_ic, uint16_t cell_codes[][12])
 	2. Return pec_error flag*/
 
 
+/*Sends a command to a single LTC6804 and waits for it to take effect
+
+@param[in] uint8_t address; Address of the IC
+
+@param[in] uint16_t command; 11 bit command code, along with any MD/ST/CH bits*/
+void LTC6804_2::send_command(uint8_t address, uint16_t command)
+{
+    uint8_t cmd[4];
+    uint16_t temp_pec;
+
+    cmd[0] = 0x80 + (address<<3) + ((command >> 8) & 0x07); //Setting address
+    cmd[1] = command & 0xFF;
+
+    temp_pec = LTC6804_2::pec15_calc(2, cmd);
+    cmd[2] = (uint8_t)(temp_pec >> 8);
+    cmd[3] = (uint8_t)(temp_pec);
+
+    wakeup_idle (); //This will guarantee that the LTC6804 isoSPI port is awake. This command can be removed.
+
+    output_low(this->spi->cs);
+    this->spi_write_array(4,cmd);
+    output_high(this->spi->cs);
+
+    delay(delay_on_send_ms);
+}
+
+/*Reads a single 6 byte register group of a single LTC6804
+
+@param[in] uint8_t address; Address of the IC
+
+@param[in] uint16_t command; Read command code (RDCVA, RDAUXA, RDSTATA...)
+
+@param[out] uint8_t data[]; The 6 register bytes followed by the 2 PEC bytes
+
+ @return int8_t, PEC Status:
+	0: No PEC error detected
+	-1: PEC error detected, retry read*/
+int8_t LTC6804_2::read_ic(uint8_t address, uint16_t command, uint8_t data[8])
+{
+    uint8_t cmd[4];
+    uint16_t temp_pec;
+
+    cmd[0] = 0x80 + (address<<3) + ((command >> 8) & 0x07); //Setting address
+    cmd[1] = command & 0xFF;
+    temp_pec = LTC6804_2::pec15_calc(2, cmd);
+    cmd[2] = (uint8_t)(temp_pec >> 8);
+    cmd[3] = (uint8_t)(temp_pec);
+
+    wakeup_idle (); //This will guarantee that the LTC6804 isoSPI port is awake. This command can be removed.
+
+    output_low(this->spi->cs);
+    this->spi_write_read(cmd,4,data,8);
+    output_high(this->spi->cs);
+
+    temp_pec = (data[6] << 8) + data[7];
+    return temp_pec == LTC6804_2::pec15_calc(6, data) ? 0 : -1;
+}
+
+/*Self test & diagnostic conversions of a single LTC6804
+
+ Command Code:
+      |command  |  10   |   9   |   8   |   7   |   6   |   5   |   4   |   3   |   2   |   1   |   0   |
+      |-----------|-------|-------|-------|-------|-------|-------|-------|-------|-------|-------|-------|
+      |CVST:      |   0   |   1   | MD[1] | MD[2] | ST[1] | ST[0] |   0   |   0   |   1   |   1   |   1   |
+      |AXST:      |   1   |   0   | MD[1] | MD[2] | ST[1] | ST[0] |   0   |   0   |   1   |   1   |   1   |
+      |STATST:    |   1   |   0   | MD[1] | MD[2] | ST[1] | ST[0] |   0   |   1   |   1   |   1   |   1   |
+      |ADSTAT:    |   1   |   0   | MD[1] | MD[2] |   1   |   1   |   0   |   1   |CHST[2]|CHST[1]|CHST[0]|
+      |DIAGN:     |   1   |   1   |   1   |   0   |   0   |   0   |   1   |   0   |   1   |   0   |   1   |*/
+uint16_t LTC6804_2::md_bits()
+{
+    //MD is already encoded on the ADCV command
+    return ((ADCV[0] & 0x01) << 8) | (ADCV[1] & 0x80);
+}
+
+void LTC6804_2::cvst(uint8_t address, uint8_t st){ send_command(address, 0x0207 | md_bits() | ((st & 0x03) << 5)); }
+void LTC6804_2::axst(uint8_t address, uint8_t st){ send_command(address, 0x0407 | md_bits() | ((st & 0x03) << 5)); }
+void LTC6804_2::statst(uint8_t address, uint8_t st){ send_command(address, 0x040F | md_bits() | ((st & 0x03) << 5)); }
+void LTC6804_2::adstat(uint8_t address){ send_command(address, 0x0468 | md_bits()); }
+void LTC6804_2::diagn(uint8_t address){ send_command(address, 0x0715); }
+
+/*Expected output of the digital filter self tests, same for every self test command
+
+ |Self Test| 27kHz  | 14kHz  | 7kHz and slower |
+ |---------|--------|--------|-----------------|
+ | ST = 1  | 0x9565 | 0x9553 | 0x9555          |
+ | ST = 2  | 0x6A9A | 0x6AAC | 0x6AAA          |
+
+ MD_FAST is 27kHz with ADCOPT = 0 and 14kHz with ADCOPT = 1*/
+uint16_t LTC6804_2::self_test_code(uint8_t md, bool adcopt, uint8_t st)
+{
+    if(md == MD_FAST)
+    {
+        if(adcopt)
+        {
+            return st == 1 ? 0x9553 : 0x6AAC;
+        }
+        return st == 1 ? 0x9565 : 0x6A9A;
+    }
+    return st == 1 ? 0x9555 : 0x6AAA;
+}
+
+uint8_t LTC6804_2::get_md()
+{
+    return ((ADCV[0] & 0x01) << 1) | ((ADCV[1] & 0x80) >> 7);
+}
+
+/*Reads and parses every cell voltage register of a single LTC6804
+
+@param[in] uint8_t address; Address of the IC
+
+@param[out] uint16_t cell_codes[]; The 12 cell codes of the IC, lowest cell first
+
+ @return int8_t, PEC Status:
+	0: No PEC error detected
+	-1: PEC error detected, retry read*/
+int8_t LTC6804_2::rdcv_ic(uint8_t address, uint16_t cell_codes[12])
+{
+    const uint8_t CELL_IN_REG = 3;
+
+    uint8_t cmd[4];
+    uint8_t data[8];
+    uint16_t temp_pec;
+    int8_t pec_error = 0;
+
+    wakeup_idle (); //This will guarantee that the LTC6804 isoSPI port is awake. This command can be removed.
+
+    for(uint8_t cell_reg = 1; cell_reg < 5; cell_reg++)
+    {
+        cmd[0] = 0x80 + (address<<3); //Setting address
+        cmd[1] = 0x02 + 2 * cell_reg; //RDCVA 0x04 ~ RDCVD 0x0A
+        temp_pec = LTC6804_2::pec15_calc(2, cmd);
+        cmd[2] = (uint8_t)(temp_pec >> 8);
+        cmd[3] = (uint8_t)(temp_pec);
+
+        output_low(this->spi->cs);
+        this->spi_write_read(cmd,4,data,8);
+        output_high(this->spi->cs);
+
+        for(uint8_t current_cell = 0; current_cell < CELL_IN_REG; current_cell++)
+        {
+            cell_codes[current_cell + (cell_reg - 1) * CELL_IN_REG] = data[2 * current_cell] + (data[2 * current_cell + 1] << 8);
+        }
+
+        temp_pec = (data[6] << 8) + data[7];
+        if(temp_pec != LTC6804_2::pec15_calc(6, data))
+        {
+            pec_error = -1;
+        }
+    }
+
+    return pec_error;
+}
+
 /*Read the raw data from the LTC6804 cell voltage register
 
  The function reads a single cell voltage register and stores the read data
@@ -362,7 +547,7 @@ int8_t LTC6804_2::rdaux(uint8_t reg, uint8_t total_ic, uint16_t aux_codes[][6])
                 }
                 //a.iii
                 received_pec = (data[data_counter]<<8)+ data[data_counter+1];
-                data_pec = LTC6804_2::pec15_calc(BYT_IN_REG, &data[current_ic*NUM_RX_BYT*(gpio_reg-1)]);
+                data_pec = LTC6804_2::pec15_calc(BYT_IN_REG, &data[current_ic*NUM_RX_BYT]);
                 if(received_pec != data_pec)
                 {
                     pec_error = -1;
@@ -387,7 +572,7 @@ int8_t LTC6804_2::rdaux(uint8_t reg, uint8_t total_ic, uint16_t aux_codes[][6])
             }
             //b.iii
             received_pec = (data[data_counter]<<8) + data[data_counter+1];
-            data_pec = LTC6804_2::pec15_calc(6, &data[current_ic*8*(reg-1)]);
+            data_pec = LTC6804_2::pec15_calc(6, &data[current_ic*8]);
             if(received_pec != data_pec)
             {
                 pec_error = -1;
@@ -472,6 +657,63 @@ void LTC6804_2::rdaux_reg(uint8_t reg, uint8_t total_ic, uint8_t *data)
   4. Send Global Command to LTC6804 stack
 */
 
+/*Reads the LTC6804 status registers.
+
+ @param[in] uint8_t reg; This controls which status register group is read back.
+          1: Read back status group A (SOC, ITMP, VA)
+          2: Read back status group B (VD, cell UV/OV flags, REV, MUXFAIL, THSD)
+
+ @param[in] uint8_t total_ic; This is the number of ICs in the network
+
+ @param[out] uint8_t r_stat[][8]; The raw register bytes of every IC followed by the 2 PEC bytes
+ |r_stat[0][0]|r_stat[0][1]|  .....    |r_stat[0][5]|r_stat[0][6] |r_stat[0][7] |r_stat[1][0]|  .....    |
+ |------------|------------|-----------|------------|-------------|-------------|------------|-----------|
+ |IC1 STAR0   |IC1 STAR1   |  .....    |IC1 STAR5   |IC1 PEC High |IC1 PEC Low  |IC2 STAR0   |  .....    |
+
+ @return int8_t, PEC Status.
+	0: No PEC error detected
+	-1: PEC error detected, retry read*/
+int8_t LTC6804_2::rdstat(uint8_t reg, uint8_t total_ic, uint8_t r_stat[][8])
+{
+    uint8_t cmd[4];
+    uint16_t cmd_pec;
+    int8_t pec_error = 0;
+
+    //1
+    cmd[1] = reg == STAT_REG_B ? 0x12 : 0x10;
+
+    //2
+    wakeup_idle (); //This will guarantee that the LTC6804 isoSPI port is awake, this command can be removed.
+
+    for(uint8_t current_ic = 0; current_ic < total_ic; current_ic++)
+    {
+        //3
+        cmd[0] = 0x80 + (current_ic<<3); //Setting address
+        cmd_pec = LTC6804_2::pec15_calc(2, cmd);
+        cmd[2] = (uint8_t)(cmd_pec >> 8);
+        cmd[3] = (uint8_t)(cmd_pec);
+        output_low(this->spi->cs);
+        this->spi_write_read(cmd,4,r_stat[current_ic],8);
+        output_high(this->spi->cs);
+
+        //4
+        cmd_pec = (r_stat[current_ic][6]<<8) + r_stat[current_ic][7];
+        if(cmd_pec != LTC6804_2::pec15_calc(6, r_stat[current_ic]))
+        {
+            pec_error = -1;
+        }
+    }
+
+    return pec_error;
+}
+/*
+  LTC6804_rdstat Function Process:
+  1. Determine Command and initialize command array
+  2. Wake up isoSPI, this step is optional
+  3. Address every LTC6804 of the stack and read its register group
+  4. Check the PEC of the data read back vs the calculated PEC
+*/
+
 /********************************************************//**
  \brief Clears the LTC6804 cell voltage registers
 
@@ -552,80 +794,78 @@ void LTC6804_2::clraux()
 /*****************************************************//**
  \brief Write the LTC6804 configuration register
 
- This command will write the configuration registers of the stacks
- connected in a stack stack. The configuration is written in descending
- order so the last device's configuration is written first.
+ This command will write the configuration registers of the slaves
+ connected in a stack. Every slave is addressed on its own, so each one
+ gets its own 6 byte block.
 
 
 @param[in] uint8_t total_ic; The number of ICs being written.
 
 @param[in] uint8_t *config an array of the configuration data that will be written, the array should contain the 6 bytes for each
- IC in the stack. The lowest IC in the stack should be the first 6 byte block in the array. The array should
+ IC in the stack. The IC with address 0 should be the first 6 byte block in the array. The array should
  have the following format:
  |  config[0]| config[1] |  config[2]|  config[3]|  config[4]|  config[5]| config[6] |  config[7]|  config[8]|  .....    |
  |-----------|-----------|-----------|-----------|-----------|-----------|-----------|-----------|-----------|-----------|
  |IC1 CFGR0  |IC1 CFGR1  |IC1 CFGR2  |IC1 CFGR3  |IC1 CFGR4  |IC1 CFGR5  |IC2 CFGR0  |IC2 CFGR1  | IC2 CFGR2 |  .....    |
 
+@param[in] uint16_t mask; Bit n set means that the IC with address n is written, the rest are skipped
+
  The function will calculate the needed PEC codes for the write data
  and then transmit data to the ICs on a stack.
 ********************************************************/
-void LTC6804_2::wrcfg(uint8_t total_ic, uint8_t config[][6])
+void LTC6804_2::wrcfg(uint8_t total_ic, uint8_t config[][6], uint16_t mask)
 {
-    const uint8_t BYTES_IN_REG = 6;//it is 6 because tx_cfg[][] has 6 cells
-    const uint8_t CMD_LEN = 4+(8*total_ic);
-    uint8_t *cmd;
+    const uint8_t BYTES_IN_REG = 6;
+    uint8_t cmd[4 + 8];
     uint16_t temp_pec;
-    uint8_t cmd_index; //command counter
+    bool written = false;
 
-    cmd = (uint8_t *) malloc(CMD_LEN*sizeof(uint8_t));
     //1
-    cmd[0] = 0x00;//a1)first 8 bits of WRCFG command
-    cmd[1] = 0x01;//a2)rest of 8 bits of WRCFG command
-    cmd[2] = 0x3d;//b1)first 8 bits of PEC
-    cmd[3] = 0x6e;//b2 rest of 8 bits of PEC
+    cmd[1] = 0x01;
 
     //2
-    cmd_index = 4;
-    for (uint8_t current_ic = total_ic; current_ic > 0; current_ic--) 			// executes for each LTC6804 in stack,
+    wakeup_idle(); 															 //This will guarantee that the LTC6804 isoSPI port is awake.This command can be removed.
+
+    for(uint8_t current_ic = 0; current_ic < total_ic; current_ic++)
     {
-        for (uint8_t current_byte = 0; current_byte < BYTES_IN_REG; current_byte++) // executes for each byte in the CFGR register
+        if(!(mask & (1 << current_ic)))
         {
-            // i is the byte counter
-
-            cmd[cmd_index] = config[current_ic-1][current_byte]; 		//adding the config data to the array to be sent
-            cmd_index = cmd_index + 1;
+            continue;
         }
-        //3
-        temp_pec = (uint16_t) LTC6804_2::pec15_calc(BYTES_IN_REG, &config[current_ic-1][0]);// calculating the PEC for each board
-        cmd[cmd_index] = (uint8_t)(temp_pec >> 8);
-        cmd[cmd_index + 1] = (uint8_t)temp_pec;
-        cmd_index = cmd_index + 2;
-    }
 
-    //4
-    wakeup_idle(); 															 //This will guarantee that the LTC6804 isoSPI port is awake.This command can be removed.
-    //5
-    for(int current_ic = 0; current_ic<total_ic; current_ic++)
-    {
+        //3
         cmd[0] = 0x80 + (current_ic<<3); //Setting address //0x80 --> B10000000
         temp_pec = LTC6804_2::pec15_calc(2, cmd);
         cmd[2] = (uint8_t)(temp_pec >> 8);
         cmd[3] = (uint8_t)(temp_pec);
+
+        //4
+        for (uint8_t current_byte = 0; current_byte < BYTES_IN_REG; current_byte++)
+        {
+            cmd[4 + current_byte] = config[current_ic][current_byte];
+        }
+        temp_pec = (uint16_t) LTC6804_2::pec15_calc(BYTES_IN_REG, &config[current_ic][0]);
+        cmd[10] = (uint8_t)(temp_pec >> 8);
+        cmd[11] = (uint8_t)temp_pec;
+
+        //5
         output_low(this->spi->cs);
-        this->spi_write_array(4,cmd);
-        this->spi_write_array(8,&cmd[4+(8*current_ic)]);
+        this->spi_write_array(12,cmd);
         output_high(this->spi->cs);
+        written = true;
     }
-    free(cmd);
 
-    delay(delay_on_send_ms);
+    if(written)
+    {
+        delay(delay_on_send_ms);
+    }
 }
 /*
-	1. Load cmd array with the write configuration command and PEC
-	2. Load the cmd with LTC6804 configuration data
-	3. Calculate the pec for the LTC6804 configuration data being transmitted
-	4. wakeup isoSPI port, this step can be removed if isoSPI status is previously guaranteed
-	5. Write configuration of each LTC6804 on the stack
+	1. Load cmd array with the write configuration command
+	2. wakeup isoSPI port, this step can be removed if isoSPI status is previously guaranteed
+	3. Address the command to the current LTC6804 and calculate its PEC
+	4. Load the cmd with the LTC6804 configuration data and its PEC
+	5. Write configuration of the LTC6804
 
 */
 
@@ -701,6 +941,38 @@ int8_t LTC6804_2::rdcfg(uint8_t total_ic, uint8_t r_config[][8])
 	  b. calculate PEC of received data and compare against calculated PEC
 	5. Return PEC Error */
 
+/* Reads the configuration register of a single LTC6804 of the stack
+
+@param[in] uint8_t address: address of the IC
+
+@param[out] uint8_t *r_config: CFGR0~5 followed by the 2 PEC bytes
+
+@return int8_t PEC Status.
+	0: Data read back has matching PEC
+	-1: Data read back has incorrect PEC */
+int8_t LTC6804_2::rdcfg_ic(uint8_t address, uint8_t r_config[8])
+{
+    uint8_t cmd[4];
+    uint16_t data_pec;
+    uint16_t received_pec;
+
+    cmd[0] = 0x80 + (address<<3); //Setting address
+    cmd[1] = 0x02;
+    data_pec = LTC6804_2::pec15_calc(2, cmd);
+    cmd[2] = (uint8_t)(data_pec >> 8);
+    cmd[3] = (uint8_t)(data_pec);
+
+    wakeup_idle (); //This will guarantee that the LTC6804 isoSPI port is awake. This command can be removed.
+    output_low(this->spi->cs);
+    this->spi_write_read(cmd,4,r_config,8);
+    output_high(this->spi->cs);
+
+    received_pec = (r_config[6]<<8) + r_config[7];
+    data_pec = LTC6804_2::pec15_calc(6, r_config);
+
+    return received_pec == data_pec ? 0 : -1;
+}
+
 void LTC6804_2::wakeup_idle()
 {
     output_low(this->spi->cs);
@@ -716,8 +988,15 @@ void LTC6804_2::wakeup_sleep()
 
 
 //brief calaculates  and returns the CRC15
+uint32_t LTC6804_2::pec_num = 0;
+
+uint32_t LTC6804_2::get_spi_bytes(){ return this->spi_bytes; }
+uint32_t LTC6804_2::get_pec_num(){ return pec_num; }
+
 uint16_t LTC6804_2::pec15_calc(uint8_t len, uint8_t * data)
 {
+    TRACE_SCOPE(TRACE_PEC);
+    pec_num++;
     uint16_t remainder = 16,addr;
     for(uint8_t i = 0; i < len; i++)
     {
@@ -733,6 +1012,8 @@ uint16_t LTC6804_2::pec15_calc(uint8_t len, uint8_t * data)
 //brief Writes an array of bytes out of the SPI port
 void LTC6804_2::spi_write_array(uint8_t len, uint8_t data[])
 {
+    TRACE_SCOPE(TRACE_LTC_SPI);
+    this->spi_bytes += len;
     for(uint8_t i = 0; i < len; i++)
     {
         this->spi->write((char)data[i]);
@@ -742,6 +1023,8 @@ void LTC6804_2::spi_write_array(uint8_t len, uint8_t data[])
 //Writes and read a set number of bytes using the SPI port.
 void LTC6804_2::spi_write_read(uint8_t tx_Data[], uint8_t tx_len, uint8_t *rx_data, uint8_t rx_len)
 {
+    TRACE_SCOPE(TRACE_LTC_SPI);
+    this->spi_bytes += tx_len + rx_len;
     for(uint8_t i = 0; i < tx_len; i++)
     {
         this->spi->write(tx_Data[i]);
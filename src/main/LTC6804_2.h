@@ -53,6 +53,32 @@ const unsigned int crc15Table[256] = {0x0,0xc599, 0xceab, 0xb32, 0xd8cf, 0x1d56,
 #define AUX_CH_GPIO5 5
 #define AUX_CH_VREF2 6
 
+//Read commands of single register groups
+#define CMD_RDCVA 0x0004
+#define CMD_RDCVB 0x0006
+#define CMD_RDCVC 0x0008
+#define CMD_RDCVD 0x000A
+#define CMD_RDAUXA 0x000C
+#define CMD_RDAUXB 0x000E
+#define CMD_RDSTATA 0x0010
+#define CMD_RDSTATB 0x0012
+
+//Self test patterns
+#define ST_1 1
+#define ST_2 2
+
+//Open wire current sources
+#define PUP_DOWN 0
+#define PUP_UP 1
+
+//Status register groups
+#define STAT_REG_A 1
+#define STAT_REG_B 2
+
+//Under/Over voltage flags of STATB: CxUV is bit 2x, CxOV is bit 2x + 1
+//of the 24 bit word STBR2 | STBR3 << 8 | STBR4 << 16
+#define STATB_CELL_FLAGS(r_stat) ((uint32_t) (r_stat)[2] | (uint32_t) (r_stat)[3] << 8 | (uint32_t) (r_stat)[4] << 16)
+
 //Discharge Permitted During conversion
 #define DCP_DISABLED 0
 #define DCP_ENABLED 1
@@ -78,25 +104,49 @@ public:
     void adcv();
     void adax();
     void adcvax();
+    void adow(uint8_t address, uint8_t pup);
+
+    //Self tests & diagnostics, addressed to a single IC
+    void cvst(uint8_t address, uint8_t st);
+    void axst(uint8_t address, uint8_t st);
+    void statst(uint8_t address, uint8_t st);
+    void adstat(uint8_t address);
+    void diagn(uint8_t address);
+    static uint16_t self_test_code(uint8_t md, bool adcopt, uint8_t st);
+    uint8_t get_md();
+
+    void send_command(uint8_t address, uint16_t command);
+    int8_t read_ic(uint8_t address, uint16_t command, uint8_t data[8]);
 
     uint8_t rdcv(uint8_t reg, uint8_t total_ic, uint16_t cell_codes[][12]);
     void rdcv_reg(uint8_t reg, uint8_t total_ic, uint8_t *data);
+    int8_t rdcv_ic(uint8_t address, uint16_t cell_codes[12]);
 
     int8_t rdaux(uint8_t reg, uint8_t total_ic, uint16_t aux_codes[][6]);
     void rdaux_reg(uint8_t reg, uint8_t total_ic, uint8_t *data);
 
+    int8_t rdstat(uint8_t reg, uint8_t total_ic, uint8_t r_stat[][8]);
+
     void clrcell();
     void clraux();
 
-    void wrcfg(uint8_t total_ic, uint8_t config[][6]);
+    void wrcfg(uint8_t total_ic, uint8_t config[][6], uint16_t mask = 0xFFFF);
     int8_t rdcfg(uint8_t total_ic, uint8_t r_config[][8]);
+    int8_t rdcfg_ic(uint8_t address, uint8_t r_config[8]);
 
     void wakeup_idle();
     void wakeup_sleep();
 
+    //Bytes clocked over SPI & PECs computed since boot
+    uint32_t get_spi_bytes();
+    static uint32_t get_pec_num();
+
 protected:
     LT_SPI * const spi;
 
+    uint32_t spi_bytes = 0;
+    static uint32_t pec_num;
+
     //These delays will guarantee that the commands have took effect upon
     //each slave and occur after transmission of instructions:
     //Write Configuration, Start of Analog-Digital Conversions
@@ -109,6 +159,8 @@ protected:
 
     static uint16_t pec15_calc(uint8_t len, uint8_t *data);
 
+    uint16_t md_bits();
+
     void spi_write_array(uint8_t length, uint8_t *data);
 
     void spi_write_read(uint8_t *TxData, uint8_t TXlen, uint8_t *rx_data, uint8_t RXlen);
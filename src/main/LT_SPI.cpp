@@ -13,7 +13,7 @@ LT_SPI::LT_SPI(uint8_t sck,
                uint8_t miso,
                uint8_t cs,
                uint8_t spi_clock_divider,
-               uint8_t spi_mode) : cs(cs)
+               uint8_t spi_mode) : cs(cs), spi_clock_divider(spi_clock_divider), spi_mode(spi_mode)
 {
     //Setup the processor for hardware SPI communication.
     pinMode(sck, OUTPUT);
@@ -26,6 +26,12 @@ LT_SPI::LT_SPI(uint8_t sck,
     SPI.setDataMode(spi_mode);
 }
 
+void LT_SPI::claim()
+{
+    SPI.setClockDivider(spi_clock_divider);
+    SPI.setDataMode(spi_mode);
+}
+
 LT_SPI::~LT_SPI()
 {
     //Disable the SPI hardware port
@@ -17,15 +17,19 @@ public:
            uint8_t cs = SS,
            uint8_t spi_clock_divider = SPI_CLOCK_DIV16,
            uint8_t spi_mode = SPI_MODE3);
-    ~LT_SPI();
+    virtual ~LT_SPI();
 
     //Write a data byte
-    void write(int8_t data);
+    virtual void write(int8_t data);
 
     //Read and write a data byte
-    int8_t read(int8_t data);
+    virtual int8_t read(int8_t data);
+
+    //Puts the clock & mode back after anyone else used the bus (e.g. the SD card)
+    void claim();
 
     const uint8_t cs;
+    const uint8_t spi_clock_divider, spi_mode;
 };
 
 #endif  // LT_SPI_H
@@ -0,0 +1,166 @@
+#include <Arduino.h>
+#include "config.h"
+#include "balancing.h"
+
+Balancer::Balancer(uint8_t total_ic,
+                   uint8_t cell_start, uint8_t cell_end,
+                   uint16_t threshold,
+                   uint8_t max_bleeders,
+                   uint8_t dcto,
+                   uint8_t balance_ticks) :
+    total_ic(total_ic), cell_start(cell_start), cell_end(cell_end),
+    threshold(threshold), max_bleeders(max_bleeders), dcto(dcto), balance_ticks(balance_ticks)
+{
+    this->dcc = (uint16_t *) malloc(sizeof(uint16_t) * total_ic);
+
+    for(uint8_t ic = 0; ic < total_ic; ic++)
+    {
+        *(dcc + ic) = 0;
+    }
+}
+
+Balancer::~Balancer()
+{
+    free(this->dcc);
+}
+
+void Balancer::enable()
+{
+    //Start by resting, so that the first decision is made on relaxed cells
+    this->schedule = balance_ticks;
+    this->enabled = true;
+}
+
+void Balancer::disable()
+{
+    this->enabled = false;
+
+    for(uint8_t ic = 0; ic < total_ic; ic++)
+    {
+        *(dcc + ic) = 0;
+    }
+}
+
+bool Balancer::is_enabled(){ return this->enabled; }
+
+bool Balancer::is_measurement_window(){ return schedule == balance_ticks + rest_ticks - 1; }
+
+bool Balancer::is_balanced(){ return this->balanced; }
+
+void Balancer::set_floor(uint16_t code){ this->floor = code; }
+
+uint16_t Balancer::get_dcc(uint8_t ic){ return *(dcc + ic); }
+
+uint8_t Balancer::get_bleeding_num()
+{
+    uint8_t num = 0;
+    for(uint8_t ic = 0; ic < total_ic; ic++)
+    {
+        for(uint16_t bits = *(dcc + ic); bits != 0; bits &= bits - 1)
+        {
+            num++;
+        }
+    }
+    return num;
+}
+
+void Balancer::apply(Slave_Config * cfg)
+{
+    bool bleed = enabled && schedule < balance_ticks;
+
+    for(uint8_t ic = 0; ic < total_ic; ic++)
+    {
+        cfg->set_dcc(ic, bleed ? *(dcc + ic) : 0, enabled ? dcto : DCTO_DISABLED);
+    }
+}
+
+void Balancer::update(const uint16_t * cell_codes)
+{
+    if(!enabled)
+    {
+        return;
+    }
+
+    if(is_measurement_window())
+    {
+        decide(cell_codes);
+    }
+
+    schedule = (schedule + 1) % (balance_ticks + rest_ticks);
+}
+
+void Balancer::decide(const uint16_t * cell_codes)
+{
+    const uint8_t range = cell_end - cell_start;
+
+    //Balance towards the lowest cell of the box, or of the pack if that is lower
+    uint16_t min_code = floor;
+    for(uint16_t i = 0; i < total_ic * range; i++)
+    {
+        uint16_t code = *(cell_codes + i);
+        if(code < min_code)
+        {
+            min_code = code;
+        }
+    }
+
+    this->balanced = true;
+
+    for(uint8_t ic = 0; ic < total_ic; ic++)
+    {
+        const uint16_t * codes = cell_codes + ic * range;
+        uint16_t previous = *(dcc + ic);
+        uint16_t candidates = 0;
+
+        for(uint8_t cell = 0; cell < range; cell++)
+        {
+            uint16_t code = *(codes + cell);
+            uint16_t bit = 1 << (cell + cell_start);
+
+            //0xFFFF is a cleared register, never bleed on that
+            if(code == 0xFFFF)
+            {
+                continue;
+            }
+
+            //Cells that are already bleeding keep on until they are within half the threshold
+            uint16_t limit = (previous & bit) ? threshold / 2 : threshold;
+            if(code - min_code > limit)
+            {
+                candidates |= bit;
+            }
+            if(code - min_code > threshold)
+            {
+                this->balanced = false;
+            }
+        }
+
+        //Keep the highest 'max_bleeders' cells of the slave
+        uint16_t chosen = 0;
+        for(uint8_t n = 0; n < max_bleeders && candidates != 0; n++)
+        {
+            uint16_t highest = 0;
+            uint8_t highest_cell = 0;
+            for(uint8_t cell = 0; cell < range; cell++)
+            {
+                uint16_t bit = 1 << (cell + cell_start);
+                if((candidates & bit) && *(codes + cell) >= highest)
+                {
+                    highest = *(codes + cell);
+                    highest_cell = cell;
+                }
+            }
+            chosen |= 1 << (highest_cell + cell_start);
+            candidates &= ~(1 << (highest_cell + cell_start));
+        }
+
+        *(dcc + ic) = chosen;
+
+#if DEBUG
+        Serial.print("Slave #");
+        Serial.print(ic);
+        Serial.print(" balancing mask -> ");
+        Serial.println(chosen, BIN);
+#endif
+    }
+}
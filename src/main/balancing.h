@@ -0,0 +1,80 @@
+/* Passive cell balancing through the discharge (S) switches of the LTC6804 */
+#ifndef BALANCING_H
+#define BALANCING_H
+
+#include <stdint.h>
+#include "slave_config.h"
+
+//Discharge timeout values (DCTO[3~0] of CFGR5)
+//The slave stops bleeding on its own if it is not reconfigured within the timeout
+#define DCTO_DISABLED 0x0
+#define DCTO_30_SEC 0x1
+#define DCTO_1_MIN 0x2
+#define DCTO_2_MIN 0x3
+#define DCTO_3_MIN 0x4
+#define DCTO_4_MIN 0x5
+#define DCTO_5_MIN 0x6
+
+//Decides which cells should be discharged based on the cell array of the BMS
+//and packs the decision into the DCC & DCTO bits of every slave's configuration.
+//Balancing works in periods: 'balance_ticks' ticks of bleeding, followed by a couple of
+//ticks where every bleeder is off. Decisions are only taken upon measurements made
+//on the last of those ticks, so that IR drop of the bleed resistors does not fool us.
+class Balancer
+{
+public:
+    Balancer(uint8_t total_ic,
+             uint8_t cell_start, uint8_t cell_end,
+             uint16_t threshold, //Raw cell code difference (100uV/LSB) from the min cell to start bleeding
+             uint8_t max_bleeders, //Max cells bleeding at the same time on a single slave (thermal limit)
+             uint8_t dcto, //Discharge timeout, see DCTO_* above
+             uint8_t balance_ticks);
+
+    ~Balancer();
+
+    void enable();
+    void disable();
+    bool is_enabled();
+
+    //Stages CFGR4 & CFGR5 of every slave with the decisions for the upcoming measurement
+    void apply(Slave_Config * cfg);
+
+    //Feeds the latest cell array (BMS layout, [slave * (range) + slot]) and advances the schedule
+    void update(const uint16_t * cell_codes);
+
+    //True if the upcoming measurement is going to be taken with every bleeder off
+    bool is_measurement_window();
+
+    uint16_t get_dcc(uint8_t ic);
+    uint8_t get_bleeding_num();
+
+    //True if the last bleeder-free measurement found no cell above the threshold
+    bool is_balanced();
+
+    //Lowest cell (100uV/LSB) of the whole pack, so every box balances towards the same target.
+    //0xFFFF balances towards the lowest cell of this box only
+    void set_floor(uint16_t code);
+
+    const uint8_t total_ic;
+    const uint8_t cell_start, cell_end;
+    const uint16_t threshold;
+    const uint8_t max_bleeders;
+    const uint8_t dcto;
+    const uint8_t balance_ticks;
+
+protected:
+    //Ticks with every bleeder off. The first one lets the cells relax, the last one is measured
+    static const uint8_t rest_ticks = 2;
+
+    void decide(const uint16_t * cell_codes);
+
+    bool enabled = false;
+    bool balanced = true;
+    uint8_t schedule = 0;
+    uint16_t floor = 0xFFFF;
+
+    //Discharge bitmask per slave, bit 0 is cell 1 (DCC1)
+    uint16_t * dcc;
+};
+
+#endif //BALANCING_H
@@ -0,0 +1,73 @@
+#include <Arduino.h>
+#include "config.h"
+#include "charging.h"
+
+Charge_Controller::Charge_Controller(float cc_amps, float cv_volts, float taper_amps, uint32_t taper_ms) :
+    cc_amps(cc_amps), cv_volts(cv_volts), taper_amps(taper_amps), taper_ms(taper_ms) {}
+
+uint8_t Charge_Controller::get_state(){ return this->state; }
+bool Charge_Controller::is_done(){ return state == CHARGE_DONE; }
+float Charge_Controller::get_amps(){ return this->amps; }
+
+void Charge_Controller::start()
+{
+    this->state = CHARGE_CC;
+    this->amps = 0;
+    this->tapering = false;
+}
+
+void Charge_Controller::update(uint32_t now_ms, float max_cell_volts, float limit_amps)
+{
+    float max_amps = limit_amps < cc_amps ? limit_amps : cc_amps;
+    if(max_amps < 0)
+    {
+        max_amps = 0;
+    }
+
+    switch(state)
+    {
+        case CHARGE_CC:
+            if(max_cell_volts >= cv_volts)
+            {
+#if DEBUG
+                Serial.println("Charge -> CV");
+#endif
+                this->state = CHARGE_CV;
+            }
+            else
+            {
+                this->amps = max_amps;
+                break;
+            }
+            //Fall through - the highest cell is already there
+        case CHARGE_CV:
+            this->amps -= (max_cell_volts - cv_volts) * CHARGE_CV_GAIN;
+            this->amps = amps < 0 ? 0 : (amps > max_amps ? max_amps : amps);
+
+            //A derated current is not a taper, only the cell voltage ends the charge
+            if(amps <= taper_amps && max_amps > taper_amps)
+            {
+                if(!tapering)
+                {
+                    this->taper_since_ms = now_ms;
+                    this->tapering = true;
+                }
+                else if(now_ms - taper_since_ms >= taper_ms)
+                {
+#if DEBUG
+                    Serial.println("Charge -> Done");
+#endif
+                    this->state = CHARGE_DONE;
+                    this->amps = 0;
+                }
+            }
+            else
+            {
+                this->tapering = false;
+            }
+            break;
+        default:
+            this->amps = 0;
+            break;
+    }
+}
@@ -0,0 +1,50 @@
+/* CC-CV charge control */
+#ifndef CHARGING_H
+#define CHARGING_H
+
+#include <stdint.h>
+
+#define CHARGE_IDLE 0
+#define CHARGE_CC 1 /* Constant current, until the highest cell reaches the CV voltage */
+#define CHARGE_CV 2 /* Current follows the highest cell, tapering down */
+#define CHARGE_DONE 3
+
+//Current change (A) per volt that the highest cell is off the CV voltage, on every update
+#define CHARGE_CV_GAIN 20.0
+
+//The current has to stay below the taper one for this long to end the charge
+#define CHARGE_TAPER_MS 30000
+
+//Drives the charger current out of the highest cell voltage.
+//Updates should only be fed with cells measured while no bleeder is on, balancing would
+//otherwise drag the highest cell down and make the charger push harder.
+class Charge_Controller
+{
+public:
+    Charge_Controller(float cc_amps,
+                      float cv_volts, //Cell voltage held during CV
+                      float taper_amps,
+                      uint32_t taper_ms = CHARGE_TAPER_MS);
+
+    void start();
+
+    //limit_amps is the max charge current allowed right now (temperature derating etc)
+    void update(uint32_t now_ms, float max_cell_volts, float limit_amps);
+
+    uint8_t get_state();
+    bool is_done();
+
+    //Current to command the charger with
+    float get_amps();
+
+    const float cc_amps, cv_volts, taper_amps;
+    const uint32_t taper_ms;
+
+protected:
+    uint8_t state = CHARGE_IDLE;
+    float amps = 0;
+    uint32_t taper_since_ms = 0;
+    bool tapering = false;
+};
+
+#endif //CHARGING_H
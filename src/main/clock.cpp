@@ -0,0 +1,33 @@
+#include <Arduino.h>
+#include "clock.h"
+
+uint64_t (* Clock::source_us)() = &Clock::board_us;
+
+void Clock::set_source(uint64_t (* source_us)())
+{
+    Clock::source_us = source_us;
+}
+
+uint32_t Clock::now_us()
+{
+    return (uint32_t) source_us();
+}
+
+uint32_t Clock::now_ms()
+{
+    return (uint32_t) (source_us() / 1000);
+}
+
+uint64_t Clock::board_us()
+{
+    static uint32_t last = 0;
+    static uint64_t high = 0;
+
+    uint32_t now = micros();
+    if(now < last)
+    {
+        high += (uint64_t) 1 << 32;
+    }
+    last = now;
+    return high | now;
+}
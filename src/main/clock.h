@@ -0,0 +1,27 @@
+/* Single time source of every timer of the firmware */
+#ifndef CLOCK_H
+#define CLOCK_H
+
+#include <stdint.h>
+
+//Debounces, timeouts, periods & sample timestamps all read the time from here, so swapping
+//the source (for the virtual clock of a simulation) moves every one of them together.
+//Defaults to micros() of the board, extended to 64 bits so us & ms wrap at their usual spots.
+//Execution time (cycle durations, trace spans, benchmarks) is not a timer and stays on micros().
+class Clock
+{
+public:
+    //'source_us' is a free running us count
+    static void set_source(uint64_t (* source_us)());
+
+    static uint32_t now_us();
+    static uint32_t now_ms();
+
+protected:
+    static uint64_t (* source_us)();
+
+    //micros() wraps every ~71 minutes, which is fine as long as it is read more often than that
+    static uint64_t board_us();
+};
+
+#endif //CLOCK_H
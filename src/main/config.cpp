@@ -1,35 +1,192 @@
+#include <Arduino.h>
 #include "config.h"
 
+//CRC-16/CCITT, bit by bit, only ever runs on a couple dozen bytes at boot & on commit
+static uint16_t crc16(uint16_t crc, uint8_t byte){
+  crc ^= (uint16_t) byte << 8;
+  for(uint8_t i = 0; i < 8; i++){
+    crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+  }
+  return crc;
+}
+
+//Valid range of every value
+static const int16_t ranges[CONFIG_VALUE_NUM][2] =
+{
+  {200, 350}, //Undervolts
+  {380, 430}, //Overvolts
+  {-4000, 2000}, //Undertemp
+  {3000, 10000}, //Overtemp
+  {1, 2}, //ADC mode, filtered conversions outlast the delay after ADCV
+  {1, 100} //Scan period
+};
+
 Configuration::Configuration(){
-  if(EEPROM.read(CONFIG_ADDRESS_VALIDITY) != CONFIG_ADDRESS_VALIDITY_VAL || EEPROM.read(CONFIG_ADDRESS_VALIDITY) == 0xFF || EEPROM.read(CONFIG_ADDRESS_VALIDITY) == 0x00){
-    uint16_t uv = default_undervolt * 100;
-    write_uint16(CONFIG_ADDRESS_START + CONFIG_OFFSET_UV, uv);
-    
-    uint16_t ov = default_overvolt * 100;
-    write_uint16(CONFIG_ADDRESS_START + CONFIG_OFFSET_OV, ov);
-    
-    uint16_t ut = default_undertemp * 100;
-    write_uint16(CONFIG_ADDRESS_START + CONFIG_OFFSET_UT, ut);
-    
-    uint16_t ot = default_overtemp * 100;
-    write_uint16(CONFIG_ADDRESS_START + CONFIG_OFFSET_OT, ot);
-    
-    EEPROM.write(CONFIG_ADDRESS_VALIDITY, CONFIG_ADDRESS_VALIDITY_VAL);
+  int16_t a[CONFIG_VALUE_NUM], b[CONFIG_VALUE_NUM];
+  uint8_t gen_a, gen_b;
+  bool valid_a = read_slot(CONFIG_SLOT_A, a, &gen_a);
+  bool valid_b = read_slot(CONFIG_SLOT_B, b, &gen_b);
+
+  if(valid_a && (!valid_b || (int8_t) (gen_a - gen_b) > 0)){
+    memcpy(values, a, sizeof(values));
+    this->generation = gen_a;
+    this->slot = CONFIG_SLOT_A;
+  }else if(valid_b){
+    memcpy(values, b, sizeof(values));
+    this->generation = gen_b;
+    this->slot = CONFIG_SLOT_B;
+  }else{
+    if(!migrate_legacy(values)){
+      defaults(values);
+    }
+    this->slot = CONFIG_SLOT_B;
+  }
+
+  //Nothing out of range ever reaches the BMS, whatever the EEPROM had
+  if(!is_valid(values)){
+    defaults(values);
+  }
+  memcpy(staged, values, sizeof(staged));
+
+  //Fresh, older schema or fixed up record, rewrite it with the current version
+  if(!read_slot(slot, a, &gen_a) || EEPROM.read(slot + 1) != CONFIG_VERSION || memcmp(a, values, sizeof(values)) != 0){
+    write(slot == CONFIG_SLOT_A ? CONFIG_SLOT_B : CONFIG_SLOT_A);
+#if DEBUG
+    Serial.println("Config record rewritten");
+#endif
+  }
+}
+
+float Configuration::get_undertemp(){ return values[CONFIG_OFFSET_UT / 2] * 0.01; }
+float Configuration::get_overtemp(){ return values[CONFIG_OFFSET_OT / 2] * 0.01; }
+
+float Configuration::get_undervolts(){ return values[CONFIG_OFFSET_UV / 2] * 0.01; }
+float Configuration::get_overvolts(){ return values[CONFIG_OFFSET_OV / 2] * 0.01; }
+
+uint8_t Configuration::get_adc_mode(){ return values[CONFIG_OFFSET_ADC_MODE / 2]; }
+uint8_t Configuration::get_scan_period(){ return values[CONFIG_OFFSET_SCAN_PERIOD / 2]; }
+
+uint8_t Configuration::get_generation(){ return this->generation; }
+
+bool Configuration::stage(uint8_t offset, uint8_t byte){
+  if(offset >= CONFIG_VALUE_NUM * 2){
+    return false;
+  }
+  uint16_t val = staged[offset / 2];
+  if(offset % 2 == 0){
+    val = (val & 0x00FF) | ((uint16_t) byte << 8);
+  }else{
+    val = (val & 0xFF00) | byte;
+  }
+  staged[offset / 2] = val;
+  return true;
+}
+
+void Configuration::stage_defaults(){
+  defaults(staged);
+}
+
+void Configuration::discard(){
+  memcpy(staged, values, sizeof(staged));
+}
+
+bool Configuration::is_valid(const int16_t * values){
+  for(uint8_t i = 0; i < CONFIG_VALUE_NUM; i++){
+    if(*(values + i) < ranges[i][0] || *(values + i) > ranges[i][1]){
+      return false;
+    }
   }
+  return *(values + CONFIG_OFFSET_UV / 2) < *(values + CONFIG_OFFSET_OV / 2) &&
+         *(values + CONFIG_OFFSET_UT / 2) < *(values + CONFIG_OFFSET_OT / 2);
 }
 
-float Configuration::get_undertemp(){ return read_uint16(CONFIG_ADDRESS_START + CONFIG_OFFSET_UT) * 0.01; }
-float Configuration::get_overtemp(){ return read_uint16(CONFIG_ADDRESS_START + CONFIG_OFFSET_OT) * 0.01; }
+uint8_t Configuration::commit(){
+  if(!is_valid(staged)){
+    discard();
+    return CONFIG_COMMIT_RANGE;
+  }
+
+  write(slot == CONFIG_SLOT_A ? CONFIG_SLOT_B : CONFIG_SLOT_A);
+  return CONFIG_COMMIT_OK;
+}
+
+void Configuration::write(uint16_t target){
+  uint8_t gen = generation + 1;
+
+  //Invalidate first, then payload, the CRC going in last is what makes the slot valid
+  EEPROM.write(target, 0xFF);
+
+  uint16_t crc = 0xFFFF;
+  uint8_t header[4] = {CONFIG_MAGIC, CONFIG_VERSION, gen, CONFIG_VALUE_NUM};
+  for(uint8_t i = 1; i < 4; i++){
+    EEPROM.write(target + i, header[i]);
+  }
+  for(uint8_t i = 0; i < 4; i++){
+    crc = crc16(crc, header[i]);
+  }
+  for(uint8_t i = 0; i < CONFIG_VALUE_NUM; i++){
+    uint8_t hi = (uint16_t) staged[i] >> 8, lo = (uint16_t) staged[i] & 0xFF;
+    EEPROM.write(target + 4 + i * 2, hi);
+    EEPROM.write(target + 5 + i * 2, lo);
+    crc = crc16(crc16(crc, hi), lo);
+  }
+  EEPROM.write(target + 4 + CONFIG_VALUE_NUM * 2, crc >> 8);
+  EEPROM.write(target + 5 + CONFIG_VALUE_NUM * 2, crc & 0xFF);
+  EEPROM.write(target, CONFIG_MAGIC);
+
+  //Only now the getters see the new thresholds, all of them at once
+  memcpy(values, staged, sizeof(values));
+  this->generation = gen;
+  this->slot = target;
+}
+
+bool Configuration::read_slot(uint16_t slot, int16_t * values, uint8_t * generation){
+  if(EEPROM.read(slot) != CONFIG_MAGIC){
+    return false;
+  }
+  uint8_t num = EEPROM.read(slot + 3);
+  if(4 + num * 2 + 2 > CONFIG_SLOT_SIZE){
+    return false;
+  }
+
+  uint16_t crc = 0xFFFF;
+  for(uint8_t i = 0; i < 4 + num * 2; i++){
+    crc = crc16(crc, EEPROM.read(slot + i));
+  }
+  if(read_uint16(slot + 4 + num * 2) != crc){
+    return false;
+  }
+
+  //Values the record predates keep their defaults
+  defaults(values);
+  for(uint8_t i = 0; i < num && i < CONFIG_VALUE_NUM; i++){
+    *(values + i) = read_uint16(slot + 4 + i * 2);
+  }
+  *generation = EEPROM.read(slot + 2);
+  return true;
+}
 
-float Configuration::get_undervolts(){ return read_uint16(CONFIG_ADDRESS_START + CONFIG_OFFSET_UV) * 0.01; }
-float Configuration::get_overvolts(){ return read_uint16(CONFIG_ADDRESS_START + CONFIG_OFFSET_OV) * 0.01; }
+bool Configuration::migrate_legacy(int16_t * values){
+  if(EEPROM.read(CONFIG_ADDRESS_VALIDITY) != CONFIG_ADDRESS_VALIDITY_VAL){
+    return false;
+  }
+  defaults(values);
+  //Only the 4 limits existed back then
+  for(uint8_t i = 0; i <= CONFIG_OFFSET_OT / 2; i++){
+    *(values + i) = read_uint16(CONFIG_ADDRESS_START + i * 2);
+  }
+  return true;
+}
 
-void Configuration::write_uint16(uint16_t start_addr, uint16_t val){
-  EEPROM.write(start_addr, (val >> 8) & 0xFF); 
-  EEPROM.write(start_addr + 1, (val) & 0xFF); 
+void Configuration::defaults(int16_t * values){
+  *(values + CONFIG_OFFSET_UV / 2) = default_undervolt * 100;
+  *(values + CONFIG_OFFSET_OV / 2) = default_overvolt * 100;
+  *(values + CONFIG_OFFSET_UT / 2) = default_undertemp * 100;
+  *(values + CONFIG_OFFSET_OT / 2) = default_overtemp * 100;
+  *(values + CONFIG_OFFSET_ADC_MODE / 2) = default_adc_mode;
+  *(values + CONFIG_OFFSET_SCAN_PERIOD / 2) = default_scan_period;
 }
 
 uint16_t Configuration::read_uint16(uint16_t start_addr){
   return EEPROM.read(start_addr) << 8 | EEPROM.read(start_addr + 1);
 }
-
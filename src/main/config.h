@@ -5,47 +5,132 @@
 
 #include <EEPROM.h>
 
+//Every flag can be overridden from the command line (e.g. -DCAN_ENABLE=1, see src/test/Makefile)
+#ifndef DEBUG
 #define DEBUG 1
+#endif
+#ifndef DEBUG_PEC
 #define DEBUG_PEC 1
+#endif
+#ifndef DEBUG_CELL_VALUES
 #define DEBUG_CELL_VALUES 1
+#endif
+#ifndef DEBUG_TEMP_VALUES
 #define DEBUG_TEMP_VALUES 1
+#endif
+#ifndef DEBUG_CURRENT_VALUES
 #define DEBUG_CURRENT_VALUES 1
+#endif
+#ifndef DEBUG_CAN
 #define DEBUG_CAN 1
+#endif
 
 //Only takes effect when DEBUG = 1
 #define MEASURE_CYCLE_DEBUG_DELAY_MS 100
 
+#ifndef CAN_ENABLE
 #define CAN_ENABLE 0
+#endif
 
+//Cycle counts of the hot paths (see trace.h), compiled out otherwise
+#ifndef TRACE_ENABLE
+#define TRACE_ENABLE 0
+#endif
+
+//Cells, slaves & IVT are simulated (see sim.h), the firmware runs on a virtual clock faster than real time
+#ifndef SIMULATION_ENABLE
+#define SIMULATION_ENABLE 0
+#endif
+
+//Tick by tick log on the SD card (see logger.h)
+#ifndef LOG_ENABLE
+#define LOG_ENABLE 0
+#endif
+
+//Layout of the first firmware, only read back to migrate it
 #define CONFIG_ADDRESS_VALIDITY 0
 #define CONFIG_ADDRESS_VALIDITY_VAL 0xAB
-
 #define CONFIG_ADDRESS_START 10
 
-/* The following are uin16_t's with 2 decimal points of resolution*/
-#define CONFIG_OFFSET_UV 0 
+/* Every value is an int16_t, limits have 2 decimal points of resolution. The offsets are the ones
+   of the first layout (in bytes), which is also what the configuration can messages address */
+#define CONFIG_OFFSET_UV 0
 #define CONFIG_OFFSET_OV 2
 
-#define CONFIG_OFFSET_UT 4 
+#define CONFIG_OFFSET_UT 4
 #define CONFIG_OFFSET_OT 6
 
+//MD_FAST or MD_NORMAL
+#define CONFIG_OFFSET_ADC_MODE 8
+//Ticks between full cell scans
+#define CONFIG_OFFSET_SCAN_PERIOD 10
+
+#define CONFIG_VALUE_NUM 6
+
+//commit() results
+#define CONFIG_COMMIT_OK 0
+#define CONFIG_COMMIT_RANGE 1 /* A value is out of its range, or a low limit is not below its high one */
+
+/* The record lives in 2 slots and every commit goes to the older one, so a power loss
+   halfway through a write leaves the previous record intact. Slot layout:
+   [0] Magic, [1] Version, [2] Generation, [3] Number of values, [4~] Values (high byte first), CRC-16 */
+#define CONFIG_SLOT_A 128
+#define CONFIG_SLOT_B 160
+#define CONFIG_SLOT_SIZE 32
+#define CONFIG_MAGIC 0xC5
+
+//Bump whenever values are added, older records get the defaults for the new ones
+#define CONFIG_VERSION 2
 
 class Configuration{
   public:
+    //Loads the newest valid record (migrating it if needed) into RAM
     Configuration();
 
-    //YAGN Caching
     float get_undertemp();
     float get_overtemp();
 
     float get_undervolts();
     float get_overvolts();
+
+    uint8_t get_adc_mode();
+    uint8_t get_scan_period();
+
+    //Updates are staged in RAM until commit(), false for an unknown offset
+    bool stage(uint8_t offset, uint8_t byte);
+    void stage_defaults();
+    //Drops whatever was staged
+    void discard();
+
+    //Validates the staged record and, if it is fine, writes it to the older slot
+    //and makes it the active one. A rejected record is discarded
+    uint8_t commit();
+
+    uint8_t get_generation();
+
   private:
     //Temperature Voltage Read for Undertemping and Overtemping
     static constexpr float default_undertemp = 0, default_overtemp = 100;
-    static constexpr float default_undervolt = 4.2, default_overvolt = 5.2;
+    //INR18650-13Q discharge cut-off & charge voltage
+    static constexpr float default_undervolt = 2.5, default_overvolt = 4.2;
+    //MD_FAST, same full scan period as FULL_CELL_SCAN_PERIOD
+    static const int16_t default_adc_mode = 1, default_scan_period = 10;
+
+    void write(uint16_t target);
+
+    //Reads a slot into values, false if it is not a valid record
+    bool read_slot(uint16_t slot, int16_t * values, uint8_t * generation);
+    bool migrate_legacy(int16_t * values);
+    static void defaults(int16_t * values);
+    static bool is_valid(const int16_t * values);
+
+    //Active record & the one being staged
+    int16_t values[CONFIG_VALUE_NUM];
+    int16_t staged[CONFIG_VALUE_NUM];
+
+    uint8_t generation = 0;
+    uint16_t slot = CONFIG_SLOT_A;
 
-    void write_uint16(uint16_t start_addr, uint16_t val);
     uint16_t read_uint16(uint16_t start_addr);
 };
 
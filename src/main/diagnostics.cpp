@@ -0,0 +1,336 @@
+#include <Arduino.h>
+#include "config.h"
+#include "diagnostics.h"
+
+Open_Wire_Detector::Open_Wire_Detector(LTC6804_2 * ltc, uint8_t total_ic,
+                                       uint8_t cell_start, uint8_t cell_end,
+                                       int16_t threshold) :
+    total_ic(total_ic), cell_start(cell_start), cell_end(cell_end), threshold(threshold), ltc(ltc) {}
+
+uint8_t Open_Wire_Detector::get_ic(){ return this->checked_ic; }
+uint16_t Open_Wire_Detector::get_open_wires(){ return this->open_wires; }
+
+uint8_t Open_Wire_Detector::get_cell_index(uint8_t wire)
+{
+    //C0 sits under cell 1, the rest sit under the cell above them (C12 tops cell 12)
+    uint8_t cell = wire == 0 ? 0 : (wire >= 12 ? 11 : wire);
+    if(cell < cell_start)
+    {
+        cell = cell_start;
+    }
+    else if(cell >= cell_end)
+    {
+        cell = cell_end - 1;
+    }
+    return checked_ic * (cell_end - cell_start) + (cell - cell_start);
+}
+
+int8_t Open_Wire_Detector::step()
+{
+    uint8_t pup = pulled_up ? PUP_DOWN : PUP_UP;
+
+    for(uint8_t i = 0; i < OPEN_WIRE_CONVERSIONS; i++)
+    {
+        ltc->adow(ic, pup);
+    }
+
+    if(pup == PUP_UP)
+    {
+        pulled_up = true;
+        return ltc->rdcv_ic(ic, pu_codes) == -1 ? OPEN_WIRE_PEC : OPEN_WIRE_NONE;
+    }
+
+    //Pulled down conversions, the slave is done after this one
+    uint16_t pd_codes[12];
+    int8_t pec = ltc->rdcv_ic(ic, pd_codes);
+    pulled_up = false;
+
+    if(pec == -1)
+    {
+        return OPEN_WIRE_PEC;
+    }
+
+    open_wires = 0;
+
+    if(pu_codes[cell_start] == 0)
+    {
+        open_wires |= 1 << cell_start;
+    }
+    if(pd_codes[cell_end - 1] == 0)
+    {
+        open_wires |= 1 << cell_end;
+    }
+
+    //Wire C(n) is shared by cell n and cell n + 1, both have to be wired in
+    for(uint8_t wire = 1; wire < 12; wire++)
+    {
+        if(wire - 1 < cell_start || wire >= cell_end)
+        {
+            continue;
+        }
+
+        int32_t delta = (int32_t) pu_codes[wire] - (int32_t) pd_codes[wire];
+        if(delta < threshold)
+        {
+            open_wires |= 1 << wire;
+        }
+    }
+
+#if DEBUG
+    Serial.print("Slave #");
+    Serial.print(ic);
+    Serial.print(" open wires -> ");
+    Serial.println(open_wires, BIN);
+#endif
+
+    int8_t result = open_wires != 0 ? OPEN_WIRE_FOUND : OPEN_WIRE_NONE;
+
+    //Move on to the next slave for the upcoming cycle
+    checked_ic = ic;
+    ic = (ic + 1) % total_ic;
+
+    return result;
+}
+
+Self_Test::Self_Test(LTC6804_2 * ltc, Slave_Config * cfg, uint8_t total_ic) :
+    total_ic(total_ic), ltc(ltc), cfg(cfg)
+{
+    this->health = (Slave_Health_t *) malloc(sizeof(Slave_Health_t) * total_ic);
+
+    for(uint8_t i = 0; i < total_ic; i++)
+    {
+        *(health + i) = Slave_Health_t{0, 0, 0, 0, 0, 0};
+    }
+}
+
+Self_Test::~Self_Test()
+{
+    free(this->health);
+}
+
+uint8_t Self_Test::get_ic(){ return this->last_ic; }
+uint8_t Self_Test::get_step(){ return this->last_test; }
+
+Slave_Health_t const * Self_Test::get_health(uint8_t ic){ return health + ic; }
+
+uint16_t Self_Test::expected_code(uint8_t ic)
+{
+    //ADCOPT is bit 0 of CFGR0
+    return LTC6804_2::self_test_code(ltc->get_md(), *(cfg->get(ic)) & 0x01, ST_1);
+}
+
+uint8_t Self_Test::run_cvst(uint8_t ic, int8_t * pec)
+{
+    uint16_t codes[12];
+
+    ltc->cvst(ic, ST_1);
+    *pec = ltc->rdcv_ic(ic, codes);
+
+    uint16_t expected = expected_code(ic);
+    for(uint8_t i = 0; i < 12; i++)
+    {
+        if(codes[i] != expected)
+        {
+            return HEALTH_CVST;
+        }
+    }
+    return 0;
+}
+
+uint8_t Self_Test::run_axst(uint8_t ic, int8_t * pec)
+{
+    uint8_t a[8], b[8];
+
+    ltc->axst(ic, ST_1);
+    *pec = ltc->read_ic(ic, CMD_RDAUXA, a) | ltc->read_ic(ic, CMD_RDAUXB, b);
+
+    //GPIO1~3 on A, GPIO4~5 & VREF2 on B
+    uint16_t expected = expected_code(ic);
+    for(uint8_t i = 0; i < 6; i += 2)
+    {
+        if((a[i] | a[i + 1] << 8) != expected || (b[i] | b[i + 1] << 8) != expected)
+        {
+            return HEALTH_AXST;
+        }
+    }
+    return 0;
+}
+
+uint8_t Self_Test::run_statst(uint8_t ic, int8_t * pec)
+{
+    uint8_t a[8], b[8];
+
+    ltc->statst(ic, ST_1);
+    *pec = ltc->read_ic(ic, CMD_RDSTATA, a) | ltc->read_ic(ic, CMD_RDSTATB, b);
+
+    //SOC, ITMP & VA on A, VD on B
+    uint16_t expected = expected_code(ic);
+    for(uint8_t i = 0; i < 6; i += 2)
+    {
+        if((a[i] | a[i + 1] << 8) != expected)
+        {
+            return HEALTH_STATST;
+        }
+    }
+    if((b[0] | b[1] << 8) != expected)
+    {
+        return HEALTH_STATST;
+    }
+    return 0;
+}
+
+/* STATA: SOC = code * 100uV * 20, ITMP = code * 100uV / 7.5mV/C - 273C, VA = code * 100uV
+   STATB: VD = code * 100uV, STBR5 bit 0 is THSD */
+uint8_t Self_Test::run_adstat(uint8_t ic, int8_t * pec)
+{
+    uint8_t a[8], b[8];
+    Slave_Health_t * h = health + ic;
+
+    ltc->adstat(ic);
+    *pec = ltc->read_ic(ic, CMD_RDSTATA, a) | ltc->read_ic(ic, CMD_RDSTATB, b);
+
+    h->sum_of_cells = (a[0] | a[1] << 8) * 0.0001 * 20;
+    h->die_temp = (a[2] | a[3] << 8) * 0.0001 / 0.0075 - 273;
+    h->va = (a[4] | a[5] << 8) * 0.0001;
+    h->vd = (b[0] | b[1] << 8) * 0.0001;
+
+    uint8_t failed = 0;
+    if(h->va < SELF_TEST_VA_MIN || h->va > SELF_TEST_VA_MAX)
+    {
+        failed |= HEALTH_VA;
+    }
+    if(h->vd < SELF_TEST_VD_MIN || h->vd > SELF_TEST_VD_MAX)
+    {
+        failed |= HEALTH_VD;
+    }
+    if(b[5] & 0x01)
+    {
+        failed |= HEALTH_THSD;
+    }
+    return failed;
+}
+
+//STBR5 bit 1 is MUXFAIL
+uint8_t Self_Test::run_diagn(uint8_t ic, int8_t * pec)
+{
+    uint8_t b[8];
+
+    ltc->diagn(ic);
+    *pec = ltc->read_ic(ic, CMD_RDSTATB, b);
+
+    return (b[5] & 0x02) ? HEALTH_MUX : 0;
+}
+
+uint8_t Self_Test::get_next_step(){ return this->test; }
+
+int8_t Self_Test::step()
+{
+    int8_t pec = 0;
+    uint8_t failed = 0;
+    uint8_t mask = 0;
+
+    switch(test)
+    {
+        case SELF_TEST_STEP_CVST:
+            mask = HEALTH_CVST;
+            failed = run_cvst(ic, &pec);
+            break;
+        case SELF_TEST_STEP_AXST:
+            mask = HEALTH_AXST;
+            failed = run_axst(ic, &pec);
+            break;
+        case SELF_TEST_STEP_STATST:
+            mask = HEALTH_STATST;
+            failed = run_statst(ic, &pec);
+            break;
+        case SELF_TEST_STEP_ADSTAT:
+            mask = HEALTH_VA | HEALTH_VD | HEALTH_THSD;
+            failed = run_adstat(ic, &pec);
+            break;
+        case SELF_TEST_STEP_DIAGN:
+            mask = HEALTH_MUX;
+            failed = run_diagn(ic, &pec);
+            break;
+    }
+
+    last_ic = ic;
+    last_test = test;
+
+    test = (test + 1) % SELF_TEST_STEPS;
+    if(test == 0)
+    {
+        (health + ic)->cycles++;
+        ic = (ic + 1) % total_ic;
+    }
+
+    if(pec != 0)
+    {
+        return SELF_TEST_PEC;
+    }
+
+    Slave_Health_t * h = health + last_ic;
+    h->failed = (h->failed & ~mask) | failed;
+
+    if(failed != 0)
+    {
+#if DEBUG
+        Serial.print("Slave #");
+        Serial.print(last_ic);
+        Serial.print(" failed self test -> ");
+        Serial.println(failed, BIN);
+#endif
+        return SELF_TEST_FAILED;
+    }
+    return SELF_TEST_OK;
+}
+
+int8_t Self_Test::run_all()
+{
+    int8_t result = SELF_TEST_OK;
+
+    this->ic = 0;
+    this->test = 0;
+
+    for(uint16_t i = 0; i < total_ic * SELF_TEST_STEPS; i++)
+    {
+        int8_t r = step();
+        if(result == SELF_TEST_OK)
+        {
+            result = r;
+        }
+    }
+    return result;
+}
+
+bool Self_Test::cross_check_cells(uint8_t ic, float volts)
+{
+    Slave_Health_t * h = health + ic;
+    float diff = h->sum_of_cells - volts;
+
+    if(diff > SELF_TEST_SUM_OF_CELLS_TOLERANCE || diff < -SELF_TEST_SUM_OF_CELLS_TOLERANCE)
+    {
+        h->failed |= HEALTH_SUM_OF_CELLS;
+        return false;
+    }
+    h->failed &= ~HEALTH_SUM_OF_CELLS;
+    return true;
+}
+
+float Self_Test::get_stack_volts()
+{
+    float volts = 0;
+    for(uint8_t i = 0; i < total_ic; i++)
+    {
+        volts += (health + i)->sum_of_cells;
+    }
+    return volts;
+}
+
+bool Self_Test::cross_check_stack(float volts, float tolerance)
+{
+    float diff = get_stack_volts() - volts;
+    this->stack_consistent = diff <= tolerance && diff >= -tolerance;
+    return this->stack_consistent;
+}
+
+bool Self_Test::is_stack_consistent(){ return this->stack_consistent; }
@@ -0,0 +1,160 @@
+/* Background diagnostics of the LTC6804 stack. Every diagnostic is split
+   into small steps, one per BMS tick, so that none blows the tick budget */
+#ifndef DIAGNOSTICS_H
+#define DIAGNOSTICS_H
+
+#include <stdint.h>
+#include "LTC6804_2.h"
+#include "slave_config.h"
+
+//Pull-up minus pull-down difference (100uV/LSB) below which the wire under the cell is open
+#define OPEN_WIRE_THRESHOLD -4000
+
+//Each current source direction has to be converted at least twice to settle the cell input
+#define OPEN_WIRE_CONVERSIONS 2
+
+#define OPEN_WIRE_NONE 0
+#define OPEN_WIRE_FOUND 1
+#define OPEN_WIRE_PEC -1
+
+//ADOW open wire check. Checks a single slave per cycle, a cycle being 2 steps:
+//pulled up conversions and pulled down conversions. On the pull-down step the two
+//readings are compared and wire C(n) is open when:
+//  C0: CELL1 pulled up reads 0
+//  C12: CELL12 pulled down reads 0
+//  C1~C11: CELL(n+1) pulled up - CELL(n+1) pulled down < threshold
+//The outer wires of a partial cell range are checked like C0 & C12, on the cells next to them
+class Open_Wire_Detector
+{
+public:
+    Open_Wire_Detector(LTC6804_2 * ltc, uint8_t total_ic,
+                       uint8_t cell_start, uint8_t cell_end,
+                       int16_t threshold = OPEN_WIRE_THRESHOLD);
+
+    //Runs the next step. Returns OPEN_WIRE_FOUND when the slave just checked has open wires
+    int8_t step();
+
+    //Slave that was checked last, along with its open wires (bit n is C(n))
+    uint8_t get_ic();
+    uint16_t get_open_wires();
+
+    //Index of the cell sitting on top of wire C(n), in the BMS layout [slave * (range) + slot]
+    uint8_t get_cell_index(uint8_t wire);
+
+    const uint8_t total_ic;
+    const uint8_t cell_start, cell_end;
+    const int16_t threshold;
+
+protected:
+    LTC6804_2 * const ltc;
+
+    uint8_t ic = 0;
+    uint8_t checked_ic = 0;
+    bool pulled_up = false;
+
+    uint16_t pu_codes[12];
+    uint16_t open_wires = 0;
+};
+
+//Self test steps, run in this order on a slave before moving to the next one
+#define SELF_TEST_STEP_CVST 0
+#define SELF_TEST_STEP_AXST 1
+#define SELF_TEST_STEP_STATST 2
+#define SELF_TEST_STEP_ADSTAT 3
+#define SELF_TEST_STEP_DIAGN 4
+#define SELF_TEST_STEPS 5
+
+//Failed checks of a slave (Slave_Health.failed bits)
+#define HEALTH_CVST 0x01 /* Cell ADC digital filter */
+#define HEALTH_AXST 0x02 /* GPIO ADC digital filter */
+#define HEALTH_STATST 0x04 /* Status ADC digital filter */
+#define HEALTH_VA 0x08 /* Analog supply out of range */
+#define HEALTH_VD 0x10 /* Digital supply out of range */
+#define HEALTH_MUX 0x20 /* Multiplexer self test (MUXFAIL) */
+#define HEALTH_THSD 0x40 /* Thermal shutdown has occurred */
+#define HEALTH_SUM_OF_CELLS 0x80 /* Sum of cells does not match the cell codes */
+
+#define SELF_TEST_OK 0
+#define SELF_TEST_FAILED 1
+#define SELF_TEST_PEC -1
+
+//Supply ranges of the LTC6804
+#define SELF_TEST_VA_MIN 4.5
+#define SELF_TEST_VA_MAX 5.5
+#define SELF_TEST_VD_MIN 2.7
+#define SELF_TEST_VD_MAX 3.6
+
+//Max difference between the sum of cells (ADSTAT) and the summed cell codes of a slave
+#define SELF_TEST_SUM_OF_CELLS_TOLERANCE 0.25
+//Both are only compared below this pack current, or a current step between the two conversions
+//would move 12 cells by 12 * R0 * dI (~0.24V at 20mOhm & 1A) and eat up the whole tolerance
+#define SELF_TEST_SUM_OF_CELLS_MAX_AMPS 0.5
+
+typedef struct slave_health
+{
+    uint8_t failed; //HEALTH_* bits
+    float sum_of_cells; //V
+    float die_temp; //C
+    float va; //V
+    float vd; //V
+    uint16_t cycles; //Times every step has been run on the slave
+} Slave_Health_t;
+
+//LTC6804 built-in self tests (CVST, AXST, STATST), status conversions (ADSTAT) and
+//the mux diagnostic (DIAGN). Runs on a single slave, one step per call, and keeps a
+//health table of every slave with the outcome of the latest run of every step.
+class Self_Test
+{
+public:
+    Self_Test(LTC6804_2 * ltc, Slave_Config * cfg, uint8_t total_ic);
+    ~Self_Test();
+
+    //Runs the next step, see SELF_TEST_* above
+    int8_t step();
+
+    //Runs every step on every slave, returns the first failure if any
+    int8_t run_all();
+
+    //Slave & step that were run last
+    uint8_t get_ic();
+    uint8_t get_step();
+    //Step the next call runs
+    uint8_t get_next_step();
+
+    Slave_Health_t const * get_health(uint8_t ic);
+
+    //Compares the sum of cells of a slave against the sum of its cell codes
+    bool cross_check_cells(uint8_t ic, float volts);
+
+    //Sum of cells of the whole stack as of the latest ADSTAT of every slave
+    float get_stack_volts();
+
+    //Compares the stack against an external measurement (IVT)
+    bool cross_check_stack(float volts, float tolerance);
+    bool is_stack_consistent();
+
+    const uint8_t total_ic;
+
+protected:
+    uint8_t run_cvst(uint8_t ic, int8_t * pec);
+    uint8_t run_axst(uint8_t ic, int8_t * pec);
+    uint8_t run_statst(uint8_t ic, int8_t * pec);
+    uint8_t run_adstat(uint8_t ic, int8_t * pec);
+    uint8_t run_diagn(uint8_t ic, int8_t * pec);
+
+    uint16_t expected_code(uint8_t ic);
+
+    LTC6804_2 * const ltc;
+    Slave_Config * const cfg;
+
+    Slave_Health_t * health;
+
+    uint8_t ic = 0;
+    uint8_t test = 0;
+    uint8_t last_ic = 0;
+    uint8_t last_test = 0;
+
+    bool stack_consistent = true;
+};
+
+#endif //DIAGNOSTICS_H
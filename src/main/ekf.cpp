@@ -0,0 +1,152 @@
+#include <Arduino.h>
+#include "config.h"
+#include "soc.h"
+#include "ekf.h"
+
+//Process noise per second of every state
+static const float process_noise[EKF_STATES] = {1e-8, 1e-6, 1e-10, 1e-12};
+//Voltage measurement noise (10mV standard deviation)
+static const float measurement_noise = 1e-4;
+//Initial uncertainty of every state
+static const float initial_covariance[EKF_STATES] = {1e-2, 1e-4, 1e-5, 1e-3};
+
+Soc_Ekf::Soc_Ekf(float capacity_ah, float r0, float r1, float tau) :
+    capacity_ah(capacity_ah), r1(r1), tau(tau)
+{
+    x[EKF_SOC] = 0.5;
+    x[EKF_V1] = 0;
+    x[EKF_R0] = r0;
+    x[EKF_CAPACITY] = 1;
+
+    for(uint8_t i = 0; i < EKF_STATES; i++)
+    {
+        for(uint8_t j = 0; j < EKF_STATES; j++)
+        {
+            P[i][j] = i == j ? initial_covariance[i] : 0;
+        }
+    }
+}
+
+float Soc_Ekf::get_soc(){ return x[EKF_SOC]; }
+float Soc_Ekf::get_r0(){ return x[EKF_R0]; }
+float Soc_Ekf::get_capacity_ratio(){ return x[EKF_CAPACITY]; }
+float Soc_Ekf::get_residual(){ return this->residual; }
+
+void Soc_Ekf::update(float amps, float volts, uint32_t now_us)
+{
+    if(!initialized)
+    {
+        //Best guess is the rest voltage, the filter takes it from there
+        x[EKF_SOC] = Coulomb_Counter::ocv_to_soc(volts * 10000) * (1.0 / SOC_FULL);
+        initialized = true;
+    }
+    else
+    {
+        //The previous current has been flowing since the last update
+        predict(last_amps, (now_us - last_us) * 0.000001);
+    }
+
+    correct(amps, volts);
+    clamp();
+
+    last_us = now_us;
+    last_amps = amps;
+}
+
+/* x(k+1) = f(x(k), I):
+   SOC -= I * dt / (3600 * Q * C)
+   V1 = a * V1 + R1 * (1 - a) * I, a = e^(-dt / tau)
+   R0, C are constant
+
+   F is the identity, apart from F[SOC][C] = I * dt / (3600 * Q * C^2) and F[V1][V1] = a */
+void Soc_Ekf::predict(float amps, float dt)
+{
+    float a = expf(-dt / tau);
+    float q = 3600 * capacity_ah * x[EKF_CAPACITY];
+
+    x[EKF_SOC] -= amps * dt / q;
+    x[EKF_V1] = a * x[EKF_V1] + r1 * (1 - a) * amps;
+
+    float F[EKF_STATES][EKF_STATES] = {
+        {1, 0, 0, amps * dt / (q * x[EKF_CAPACITY])},
+        {0, a, 0, 0},
+        {0, 0, 1, 0},
+        {0, 0, 0, 1}
+    };
+
+    //P = F * P * F' + Q * dt
+    float FP[EKF_STATES][EKF_STATES];
+    for(uint8_t i = 0; i < EKF_STATES; i++)
+    {
+        for(uint8_t j = 0; j < EKF_STATES; j++)
+        {
+            float sum = 0;
+            for(uint8_t k = 0; k < EKF_STATES; k++)
+            {
+                sum += F[i][k] * P[k][j];
+            }
+            FP[i][j] = sum;
+        }
+    }
+    for(uint8_t i = 0; i < EKF_STATES; i++)
+    {
+        for(uint8_t j = 0; j < EKF_STATES; j++)
+        {
+            float sum = 0;
+            for(uint8_t k = 0; k < EKF_STATES; k++)
+            {
+                sum += FP[i][k] * F[j][k];
+            }
+            P[i][j] = sum + (i == j ? process_noise[i] * dt : 0);
+        }
+    }
+}
+
+/* V = OCV(SOC) - V1 - R0 * I
+   H = [dOCV/dSOC, -1, -I, 0] */
+void Soc_Ekf::correct(float amps, float volts)
+{
+    float slope;
+    float predicted = cell_ocv(x[EKF_SOC], &slope) - x[EKF_V1] - x[EKF_R0] * amps;
+    float H[EKF_STATES] = {slope, -1, -amps, 0};
+
+    //P * H'
+    float PH[EKF_STATES];
+    for(uint8_t i = 0; i < EKF_STATES; i++)
+    {
+        float sum = 0;
+        for(uint8_t j = 0; j < EKF_STATES; j++)
+        {
+            sum += P[i][j] * H[j];
+        }
+        PH[i] = sum;
+    }
+
+    float S = measurement_noise;
+    for(uint8_t i = 0; i < EKF_STATES; i++)
+    {
+        S += H[i] * PH[i];
+    }
+
+    residual = volts - predicted;
+
+    //K = P * H' / S, x += K * residual, P -= K * H * P (P is symmetric)
+    for(uint8_t i = 0; i < EKF_STATES; i++)
+    {
+        x[i] += PH[i] / S * residual;
+    }
+    for(uint8_t i = 0; i < EKF_STATES; i++)
+    {
+        for(uint8_t j = 0; j < EKF_STATES; j++)
+        {
+            P[i][j] -= PH[i] * PH[j] / S;
+        }
+    }
+}
+
+void Soc_Ekf::clamp()
+{
+    x[EKF_SOC] = x[EKF_SOC] < 0 ? 0 : (x[EKF_SOC] > 1 ? 1 : x[EKF_SOC]);
+    x[EKF_R0] = x[EKF_R0] < 0.001 ? 0.001 : (x[EKF_R0] > 0.5 ? 0.5 : x[EKF_R0]);
+    x[EKF_CAPACITY] = x[EKF_CAPACITY] < 0.5 ? 0.5 : (x[EKF_CAPACITY] > 1.2 ? 1.2 : x[EKF_CAPACITY]);
+}
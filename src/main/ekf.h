@@ -0,0 +1,61 @@
+/* Model based state of charge & health estimation */
+#ifndef EKF_H
+#define EKF_H
+
+#include <stdint.h>
+
+#define EKF_STATES 4
+
+//State indexes
+#define EKF_SOC 0 /* 0~1 */
+#define EKF_V1 1 /* Voltage across the RC pair (V) */
+#define EKF_R0 2 /* Ohmic resistance (Ohm) */
+#define EKF_CAPACITY 3 /* Actual over nominal capacity (capacity fade) */
+
+//INR18650-13Q equivalent circuit defaults (single cell)
+#define EKF_DEFAULT_R0 0.020
+#define EKF_DEFAULT_R1 0.015
+#define EKF_DEFAULT_TAU 30.0
+
+//Extended Kalman filter over a 1-RC equivalent circuit model of a cell:
+//  V = OCV(SOC) - V1 - R0 * I  (I > 0 on discharge)
+//R0 and the capacity are carried as (slowly) random walking states, so the
+//filter tracks SOC, ohmic resistance and capacity fade at the same time.
+//Everything lives in fixed size matrices, each update is a constant amount of float math.
+//One instance per pack runs on the average cell, more can run on cell groups.
+class Soc_Ekf
+{
+public:
+    Soc_Ekf(float capacity_ah,
+            float r0 = EKF_DEFAULT_R0,
+            float r1 = EKF_DEFAULT_R1,
+            float tau = EKF_DEFAULT_TAU);
+
+    //Current of the cell (A, > 0 on discharge), its voltage (V) and the time they were taken at
+    void update(float amps, float volts, uint32_t now_us);
+
+    float get_soc();
+    float get_r0();
+    float get_capacity_ratio();
+
+    //Innovation of the last update (V), a big one means the model does not fit
+    float get_residual();
+
+    const float capacity_ah;
+    const float r1, tau;
+
+protected:
+    void predict(float amps, float dt);
+    void correct(float amps, float volts);
+    void clamp();
+
+    float x[EKF_STATES];
+    float P[EKF_STATES][EKF_STATES];
+
+    bool initialized = false;
+    uint32_t last_us = 0;
+    float last_amps = 0;
+    float residual = 0;
+};
+
+#endif //EKF_H
@@ -0,0 +1,136 @@
+#include <Arduino.h>
+#include "config.h"
+#include "fault_policy.h"
+
+#define NEVER 0xFFFF
+
+static const Fault_Rule_t rules[FAULT_MODES][FAULT_CLASSES] =
+{
+    /* Drive: anything off-limits opens the shutdown circuit at once */
+    {
+        {0, FAULT_ACTION_SHUTDOWN, NEVER, FAULT_ACTION_SHUTDOWN}, //Overvolt
+        {0, FAULT_ACTION_SHUTDOWN, NEVER, FAULT_ACTION_SHUTDOWN}, //Undervolt
+        {0, FAULT_ACTION_SHUTDOWN, NEVER, FAULT_ACTION_SHUTDOWN}, //Overtemp
+        {0, FAULT_ACTION_SHUTDOWN, NEVER, FAULT_ACTION_SHUTDOWN}, //Undertemp
+        {0, FAULT_ACTION_SHUTDOWN, NEVER, FAULT_ACTION_SHUTDOWN}, //Amps
+        {0, FAULT_ACTION_SHUTDOWN, NEVER, FAULT_ACTION_SHUTDOWN}, //LTC
+        {0, FAULT_ACTION_SHUTDOWN, NEVER, FAULT_ACTION_SHUTDOWN}, //Open wire
+        {0, FAULT_ACTION_SHUTDOWN, NEVER, FAULT_ACTION_SHUTDOWN}, //Self test
+        {0, FAULT_ACTION_SHUTDOWN, NEVER, FAULT_ACTION_SHUTDOWN}, //IVT
+        {0, FAULT_ACTION_SHUTDOWN, NEVER, FAULT_ACTION_SHUTDOWN}, //Unknown
+        {0, FAULT_ACTION_SHUTDOWN, NEVER, FAULT_ACTION_SHUTDOWN}  //Link, the loss timeout already debounced it
+    },
+    /* Precharge: same, the relays open along with it */
+    {
+        {0, FAULT_ACTION_SHUTDOWN, NEVER, FAULT_ACTION_SHUTDOWN},
+        {0, FAULT_ACTION_SHUTDOWN, NEVER, FAULT_ACTION_SHUTDOWN},
+        {0, FAULT_ACTION_SHUTDOWN, NEVER, FAULT_ACTION_SHUTDOWN},
+        {0, FAULT_ACTION_SHUTDOWN, NEVER, FAULT_ACTION_SHUTDOWN},
+        {0, FAULT_ACTION_SHUTDOWN, NEVER, FAULT_ACTION_SHUTDOWN},
+        {0, FAULT_ACTION_SHUTDOWN, NEVER, FAULT_ACTION_SHUTDOWN},
+        {0, FAULT_ACTION_SHUTDOWN, NEVER, FAULT_ACTION_SHUTDOWN},
+        {0, FAULT_ACTION_SHUTDOWN, NEVER, FAULT_ACTION_SHUTDOWN},
+        {0, FAULT_ACTION_SHUTDOWN, NEVER, FAULT_ACTION_SHUTDOWN},
+        {0, FAULT_ACTION_SHUTDOWN, NEVER, FAULT_ACTION_SHUTDOWN},
+        {0, FAULT_ACTION_SHUTDOWN, NEVER, FAULT_ACTION_SHUTDOWN}
+    },
+    /* Charge: stop pushing current first, open the shutdown circuit if it does not go away */
+    {
+        {0, FAULT_ACTION_STOP_CHARGER, 2000, FAULT_ACTION_SHUTDOWN}, //Overvolt
+        {0, FAULT_ACTION_DERATE, NEVER, FAULT_ACTION_DERATE}, //Undervolt, deeply discharged cells take a gentle charge
+        {0, FAULT_ACTION_DERATE, 5000, FAULT_ACTION_STOP_CHARGER}, //Overtemp
+        {0, FAULT_ACTION_STOP_CHARGER, NEVER, FAULT_ACTION_STOP_CHARGER}, //Undertemp, no charging below the limit (plating)
+        {0, FAULT_ACTION_STOP_CHARGER, 1000, FAULT_ACTION_SHUTDOWN}, //Amps
+        {0, FAULT_ACTION_STOP_CHARGER, 1000, FAULT_ACTION_SHUTDOWN}, //LTC, cells are blind
+        {0, FAULT_ACTION_STOP_CHARGER, 1000, FAULT_ACTION_SHUTDOWN}, //Open wire
+        {0, FAULT_ACTION_STOP_CHARGER, NEVER, FAULT_ACTION_STOP_CHARGER}, //Self test
+        {500, FAULT_ACTION_STOP_CHARGER, NEVER, FAULT_ACTION_STOP_CHARGER}, //IVT
+        {0, FAULT_ACTION_SHUTDOWN, NEVER, FAULT_ACTION_SHUTDOWN}, //Unknown
+        {0, FAULT_ACTION_STOP_CHARGER, NEVER, FAULT_ACTION_STOP_CHARGER}  //Link, boxes can't balance together anymore
+    }
+};
+
+Fault_Policy::Fault_Policy()
+{
+    for(uint8_t i = 0; i < FAULT_CLASSES; i++)
+    {
+        first_ms[i] = 0;
+        last_ms[i] = 0;
+        seen[i] = false;
+    }
+}
+
+const Fault_Rule_t * Fault_Policy::get_rule(uint8_t mode, uint8_t fault)
+{
+    if(mode >= FAULT_MODES || fault >= FAULT_CLASSES)
+    {
+        return &rules[FAULT_MODE_DRIVE][FAULT_UNKNOWN];
+    }
+    return &rules[mode][fault];
+}
+
+uint8_t Fault_Policy::report(uint8_t mode, uint8_t fault, uint32_t now_ms)
+{
+    const Fault_Rule_t * rule = get_rule(mode, fault);
+    if(fault >= FAULT_CLASSES)
+    {
+        fault = FAULT_UNKNOWN;
+    }
+
+    //Debounce timer of the class starts over if the fault went away for a while
+    if(!seen[fault] || now_ms - last_ms[fault] > FAULT_CLEAR_MS)
+    {
+        first_ms[fault] = now_ms;
+        seen[fault] = true;
+    }
+    last_ms[fault] = now_ms;
+
+    uint32_t duration = now_ms - first_ms[fault];
+
+    uint8_t action = FAULT_ACTION_NONE;
+    if(rule->escalate_ms != NEVER && duration >= rule->escalate_ms)
+    {
+        action = rule->escalated;
+    }
+    else if(duration >= rule->debounce_ms)
+    {
+        action = rule->action;
+    }
+
+    if(action == FAULT_ACTION_DERATE)
+    {
+        this->derating = true;
+        this->derate_ms = now_ms;
+    }
+    else if(action >= FAULT_ACTION_STOP_CHARGER)
+    {
+        this->charger_stopped = true;
+    }
+
+    return action;
+}
+
+bool Fault_Policy::is_derating(uint32_t now_ms)
+{
+    return derating && now_ms - derate_ms <= FAULT_CLEAR_MS;
+}
+
+bool Fault_Policy::is_charger_stopped(){ return this->charger_stopped; }
+
+uint8_t Fault_Policy::get_action(uint32_t now_ms)
+{
+    if(charger_stopped)
+    {
+        return FAULT_ACTION_STOP_CHARGER;
+    }
+    return is_derating(now_ms) ? FAULT_ACTION_DERATE : FAULT_ACTION_NONE;
+}
+
+float Fault_Policy::limit_charge_amps(float amps, uint32_t now_ms)
+{
+    if(charger_stopped)
+    {
+        return 0;
+    }
+    return is_derating(now_ms) ? amps * FAULT_DERATE_FACTOR : amps;
+}
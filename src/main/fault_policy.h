@@ -0,0 +1,82 @@
+/* Mode aware reaction to critical frames */
+#ifndef FAULT_POLICY_H
+#define FAULT_POLICY_H
+
+#include <stdint.h>
+
+//Modes
+#define FAULT_MODE_DRIVE 0
+#define FAULT_MODE_PRECHARGE 1
+#define FAULT_MODE_CHARGE 2
+#define FAULT_MODES 3
+
+//Fault classes
+#define FAULT_OVERVOLT 0
+#define FAULT_UNDERVOLT 1
+#define FAULT_OVERTEMP 2
+#define FAULT_UNDERTEMP 3
+#define FAULT_AMPS 4
+#define FAULT_LTC 5 /* Pec errors */
+#define FAULT_OPEN_WIRE 6
+#define FAULT_SELF_TEST 7
+#define FAULT_IVT 8
+#define FAULT_UNKNOWN 9
+#define FAULT_LINK 10 /* Another box went silent */
+#define FAULT_CLASSES 11
+
+//Actions, in order of severity
+#define FAULT_ACTION_NONE 0
+#define FAULT_ACTION_DERATE 1 /* Charger current is cut down */
+#define FAULT_ACTION_STOP_CHARGER 2
+#define FAULT_ACTION_SHUTDOWN 3 /* Shutdown circuit opens */
+
+//A fault not reported for this long is considered gone, its timer starts over
+#define FAULT_CLEAR_MS 1000
+
+//Charger current is multiplied by this while derating
+#define FAULT_DERATE_FACTOR 0.5
+
+//A fault takes 'action' once it has been reported for 'debounce_ms' and
+//'escalated' once it has been reported for 'escalate_ms' (0xFFFF never escalates)
+typedef struct fault_rule
+{
+    uint16_t debounce_ms;
+    uint8_t action;
+    uint16_t escalate_ms;
+    uint8_t escalated;
+} Fault_Rule_t;
+
+//Table driven (mode x fault class) policy with a debounce timer per fault class.
+//Every report is a table lookup and a couple of comparisons.
+//Stopping the charger & opening the shutdown circuit latch, derating lasts as long as reports keep coming.
+class Fault_Policy
+{
+public:
+    Fault_Policy();
+
+    //Returns the action to take right now for this report
+    uint8_t report(uint8_t mode, uint8_t fault, uint32_t now_ms);
+
+    //Any derate reported within FAULT_CLEAR_MS
+    bool is_derating(uint32_t now_ms);
+    bool is_charger_stopped();
+
+    //Worst standing action (FAULT_ACTION_NONE, DERATE or STOP_CHARGER)
+    uint8_t get_action(uint32_t now_ms);
+
+    //Charge current after the actions taken so far
+    float limit_charge_amps(float amps, uint32_t now_ms);
+
+    static const Fault_Rule_t * get_rule(uint8_t mode, uint8_t fault);
+
+protected:
+    uint32_t first_ms[FAULT_CLASSES];
+    uint32_t last_ms[FAULT_CLASSES];
+    bool seen[FAULT_CLASSES];
+
+    uint32_t derate_ms = 0;
+    bool derating = false;
+    bool charger_stopped = false;
+};
+
+#endif //FAULT_POLICY_H
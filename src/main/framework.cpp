@@ -14,19 +14,19 @@ void output_high(uint8_t pin)
     digitalWrite(pin, HIGH);
 }
 
+uint32_t Can_Sensor::now_us(){ return Clock::now_us(); }
+
 void IVT::update(CAN_message_t message)
 {
     uint32_t val = message.buf[2] << 24 | message.buf[3] << 16 | message.buf[4] << 8 | message.buf[5];
-    float si = val * 0.001;
+    float si = (int32_t) val * 0.001;
 
     switch(message.id){
         case IVT_CURRENT_CANID:
-            this->old_amps = false;
-            this->amps = si;
+            put_amps(si, now_us());
             break;
         case IVT_VOLTAGE_CANID:
-            this->old_volts = false;
-            this->volts = si;
+            this->volts.put(si, now_us());
             break;
         default:
 #if DEBUG
@@ -34,36 +34,59 @@ void IVT::update(CAN_message_t message)
             Serial.print(message.id);
             Serial.println(" not handled!");
 #endif
-            this->amps = 999;
-            this->volts = 999;
-            this->old_amps = true;
-            this->old_volts = true;
+            break;
+    }
+}
+
+void IVT::put_amps(float value, uint32_t now)
+{
+    this->amps.put(value, now);
+    if(amps_callback != nullptr)
+    {
+        amps_callback(&this->amps);
     }
 }
 
+void IVT::set_amps_callback(void (* callback)(Sample_Cache const *)){ this->amps_callback = callback; }
+
 uint32_t const * IVT::get_ids(){ return this->ids; }
 uint32_t IVT::get_id_num(){ return IVT::id_num; }
 
+Sample_Cache const * IVT::get_amps(){ return &this->amps; }
+Sample_Cache const * IVT::get_volts(){ return &this->volts; }
+
 IVTMeasureFrame_t IVT::tick()
 {
-    if(this->old_amps || this->old_volts)
+    uint32_t now = now_us();
+
+    if(!this->amps.is_fresh(now) || !this->volts.is_fresh(now))
     {
-        return {IVT_OLD_MEASUREMENT, this->amps, this->volts};
+        return {IVT_OLD_MEASUREMENT, this->amps.get_value(), this->volts.get_value()};
     }
 
-    this->old_amps = true;
-    this->old_volts = true;
-    return {IVT_OLD_MEASUREMENT, this->amps, this->volts};
+    return {IVT_SUCCESS, this->amps.get_value(), this->volts.get_value()};
+}
+
+bool IVT::is_lost()
+{
+    //Samples that were never received are as old as the uptime
+    uint32_t now = now_us();
+    return this->amps.get_age_us(now) > IVT_LOSS_TIMEOUT_US || this->volts.get_age_us(now) > IVT_LOSS_TIMEOUT_US;
 }
 
-IVT_Dummy::IVT_Dummy(float amps, float volts) : amps(amps), volts(volts){}
+IVT_Dummy::IVT_Dummy(float amps, float volts) : dummy_amps(amps), dummy_volts(volts){}
 
 IVTMeasureFrame_t IVT_Dummy::tick()
 {
-    return {IVT_SUCCESS, this->amps, this->volts};
+    uint32_t now = now_us();
+    put_amps(this->dummy_amps, now);
+    this->volts.put(this->dummy_volts, now);
+    return {IVT_SUCCESS, this->dummy_amps, this->dummy_volts};
 }
 
-void IVT_Dummy::update(CAN_message_t message) {}
+void IVT_Dummy::update(CAN_message_t) {}
+
+bool IVT_Dummy::is_lost(){ return false; }
 
 BMS::BMS(LTC6804_2 * ltc, IVT * ivt,
          uint8_t total_ic,
@@ -80,7 +103,7 @@ BMS::BMS(LTC6804_2 * ltc, IVT * ivt,
     ltc(ltc), ivt(ivt), total_ic(total_ic),
     ov(overvolts), uv(undervolts), ot(overtemp), ut(undertemp),
     cell_start(cell_start), cell_end(cell_end), aux_start(aux_start), aux_end(aux_end),
-    config(conf),
+    config(conf), slave_config(new Slave_Config(ltc, total_ic, conf)),
     critical_callback(critical_callback), uv_to_float(uv_to_float), v_to_celsius(v_to_celsius)
 {
     this->cell_codes = (uint16_t *) malloc(sizeof(uint16_t) * total_ic * (cell_end - cell_start));
@@ -90,58 +113,27 @@ BMS::BMS(LTC6804_2 * ltc, IVT * ivt,
     Serial.println("Writing configuration to slaves");
 #endif
 
-    //Write new configuration to each slave
-    //WRCFG (Write Configuration) Command
-    uint8_t cfg[total_ic][6];
-
-    for(uint8_t i = 0; i < total_ic; i++)
-    {
-        for(uint8_t j = 0; j < 6; j++)
-        {
-            cfg[i][j] = *(config + j);
-        }
-    }
+    //Let the slaves compare every cell against the limits on their own
+    apply_thresholds();
 
+    //Write new configuration to each slave (WRCFG) and read it
+    //again (RDCFG) to evaluate that it indeed took effect
     ltc->wakeup_sleep();
-    ltc->wrcfg(total_ic, cfg);
-
-#if DEBUG
-    Serial.println("Evaluating wether configuration was indeed changed");
-#endif
+    int8_t verified = slave_config->write_all_and_verify();
 
-    uint8_t r_cfg[total_ic][8];
-    //Read Configuration again to evaluate that previous step took effect
-    //RDCFG Command
-    int pec = ltc->rdcfg(total_ic, r_cfg);
-
-    if(pec == -1)
+    if(verified == SLAVE_CONFIG_PEC)
     {
 #if DEBUG_PEC
         Serial.print("Slaves failed to send correct configuration back!");
 #endif
         critical_callback(bms_pec_error);
     }
-
-    for(uint8_t addr = 0; addr < total_ic; addr++)
+    else if(verified != SLAVE_CONFIG_OK)
     {
-        uint8_t check = 0xFF;
-
-        //No need to check the 2 PEC bytes again
-        for (uint8_t i = 0; i < 6; i++)
-        {
-            uint8_t b = r_cfg[addr][i];
-            check &= (b == *(config + i));
-        }
-
-        if(check == 0)
-        {
 #if DEBUG
-            Serial.print("Slave ");
-            Serial.print(addr);
-            Serial.println(" was not properly configured!");
+        Serial.println("Slaves were not properly configured!");
 #endif
-            critical_callback(bms_critical_error);
-        }
+        critical_callback(bms_critical_error);
     }
 
 #if DEBUG
@@ -162,7 +154,7 @@ BMS::BMS(LTC6804_2 * ltc, IVT * ivt,
 #endif
     //Start reading everything
     uint16_t cell_codez[total_ic][12];
-    pec = ltc->rdcv(CELL_CH_ALL, total_ic, cell_codez);
+    int pec = ltc->rdcv(CELL_CH_ALL, total_ic, cell_codez);
 
     if(pec == -1)
     {
@@ -232,7 +224,7 @@ BMS::BMS(LTC6804_2 * ltc, IVT * ivt,
     }
 
 #if DEBUG
-    Serial.println("Performing 1 measurement and ignoring the results");
+    Serial.println("Performing 1 measurement to start from");
 #endif
 
     ltc->adcv();
@@ -259,6 +251,20 @@ BMS::BMS(LTC6804_2 * ltc, IVT * ivt,
         critical_callback(bms_pec_error);
     }
 
+    //Everything that reads the cells before the first tick (the boot self tests) gets real values
+    for(uint8_t addr = 0; addr < total_ic; addr++)
+    {
+        for(uint8_t cell = 0; cell < (cell_end - cell_start); cell++)
+        {
+            *(cell_codes + addr * (cell_end - cell_start) + cell) = cell_codez[addr][cell + cell_start];
+        }
+        for(uint8_t temp = 0; temp < (aux_end - aux_start + 1); temp++) // +1 to include VRef
+        {
+            *(this->aux_codes + addr * (aux_end - aux_start + 1) + temp) = aux_codez[addr][temp + aux_start];
+        }
+    }
+    this->scanned = true;
+
 #if DEBUG
     Serial.println("> Setup Complete...Starting in 2 Seconds!");
 #endif
@@ -271,11 +277,11 @@ Float_Index_Tuple_t BMS::get_volts(bool greater){
   uint16_t target_volts = *(cell_codes);
   uint8_t index = 0;
   for(uint8_t slave = 0; slave < total_ic; slave++){
-    for(uint8_t cell = cell_start; cell < cell_end; cell++){
+    for(uint8_t cell = 0; cell < (cell_end - cell_start); cell++){
         uint16_t volts = *(cell_codes + slave * (cell_end - cell_start) + cell);
         if((volts > target_volts) == greater){
           target_volts = volts;
-          index = slave * (cell_start - cell_end) + cell;
+          index = slave * (cell_end - cell_start) + cell;
         }
     }
   }
@@ -283,21 +289,22 @@ Float_Index_Tuple_t BMS::get_volts(bool greater){
 }
 
 Float_Index_Tuple_t BMS::get_temp(bool greater){
-  uint16_t target_temp = *(aux_codes);
-  uint16_t target_vref = *(aux_codes + 5);
+  //Every slave has its GPIOs followed by VRef2. Thermistor codes fall or rise with
+  //the temperature depending on how they are wired, so compare in Celsius
+  const uint8_t range = aux_end - aux_start + 1;
+  float target_temp = v_to_celsius(uv_to_float(*(aux_codes)), uv_to_float(*(aux_codes + range - 1)));
   uint8_t index = 0;
   for(uint8_t slave = 0; slave < total_ic; slave++){
-    uint16_t vref = *(aux_codes + slave * (aux_end - aux_start) + 5);
-    for(uint8_t aux = aux_start; aux < aux_end; aux++){  
-        uint16_t temp = *(aux_codes + slave * (aux_end - aux_start) + aux);
+    float vref = uv_to_float(*(aux_codes + slave * range + range - 1));
+    for(uint8_t aux = 0; aux < (aux_end - aux_start); aux++){
+        float temp = v_to_celsius(uv_to_float(*(aux_codes + slave * range + aux)), vref);
         if((temp > target_temp) == greater){
           target_temp = temp;
-          target_vref = vref;
           index = slave * (aux_end - aux_start) + aux;
         }
     }
   }
-  return Float_Index_Tuple_t{ v_to_celsius(uv_to_float(target_temp), uv_to_float(target_vref)) ,index};
+  return Float_Index_Tuple_t{ target_temp ,index};
 }
 
 Float_Index_Tuple_t BMS::get_min_volts(){ return get_volts(false); }
@@ -310,65 +317,210 @@ Float_Index_Tuple_t BMS::get_max_temp(){ return get_temp(true); }
 void BMS::set_cfg(const uint8_t cfg[6])
 {
     this->config = cfg;
+    slave_config->set_all(cfg);
+    apply_thresholds();
+}
+
+void BMS::apply_thresholds()
+{
+    uint16_t vuv = Slave_Config::encode_vuv(uv);
+    uint16_t vov = Slave_Config::encode_vov(ov);
+
+    for(uint8_t ic = 0; ic < total_ic; ic++)
+    {
+        slave_config->set_thresholds(ic, vuv, vov);
+    }
+}
+
+void BMS::set_open_wire_detector(Open_Wire_Detector * open_wire)
+{
+    this->open_wire = open_wire;
+}
+
+void BMS::set_limits(float overvolts, float undervolts, float overtemp, float undertemp)
+{
+    this->ov = overvolts;
+    this->uv = undervolts;
+    this->ot = overtemp;
+    this->ut = undertemp;
+    apply_thresholds();
+}
+
+void BMS::set_full_scan_period(uint8_t ticks)
+{
+    this->full_scan_period = ticks == 0 ? 1 : ticks;
+}
+
+void BMS::set_step_scan(float amps){ this->step_scan_amps = amps; }
+
+void BMS::check_volts()
+{
+    Float_Index_Tuple_t min = get_min_volts();
+    if(min.value < uv)
+    {
+        BmsCriticalFrame_t frame = bms_volts_error;
+        frame.volts = min;
+        critical_callback(frame);
+    }
+
+    Float_Index_Tuple_t max = get_max_volts();
+    if(max.value > ov)
+    {
+        BmsCriticalFrame_t frame = bms_volts_error;
+        frame.volts = max;
+        critical_callback(frame);
+    }
+}
+
+void BMS::check_temps()
+{
+    Float_Index_Tuple_t min = get_min_temp();
+    if(min.value < ut)
+    {
+        BmsCriticalFrame_t frame = bms_temp_error;
+        frame.temp = min;
+        critical_callback(frame);
+    }
+
+    Float_Index_Tuple_t max = get_max_temp();
+    if(max.value > ot)
+    {
+        BmsCriticalFrame_t frame = bms_temp_error;
+        frame.temp = max;
+        critical_callback(frame);
+    }
+}
+
+void BMS::set_balancer(Balancer * balancer)
+{
+    this->balancer = balancer;
 }
 
 BMS::~BMS()
 {
+    delete this->slave_config;
     free(this->aux_codes);
     free(this->cell_codes);
 }
 
 void BMS::tick()
 {
+    TRACE_SCOPE(TRACE_BMS_TICK);
+
+    //Measurements older than a few IVT periods mean the sensor is gone
+    if(ivt->is_lost())
+    {
+#if DEBUG_CURRENT_VALUES
+        Serial.println("No IVT measurements received for too long!");
+#endif
+        critical_callback(bms_current_error);
+    }
+
     uint16_t cell_codez[total_ic][12];
     uint16_t aux_codez[total_ic][6];
 
-    //Write configuration to each slave
-    uint8_t cfg[total_ic][6];
-
-    for(uint8_t i = 0; i < total_ic; i++)
+    //DCC & DCTO bits are decided per slave
+    if(balancer != nullptr)
     {
-        for(uint8_t j = 0; j < 6; j++)
-        {
-            cfg[i][j] = *(config + j);
-        }
+        balancer->apply(slave_config);
     }
 
-    //Write the configuration on every slave on each loop because it gets lost after some time
+    //Only slaves whose configuration changed get written, along with a periodic
+    //refresh because it gets lost after some time (watchdog)
     ltc->wakeup_sleep();
-    ltc->wrcfg(total_ic, cfg);
+    slave_config->flush(Clock::now_ms());
 
     //Transmit Analog-Digital Conversion Start Broadcast to measure CELLS
     //ADCV Command
     ltc->adcv();
 
-    //Start reading everything back
-    int pec = ltc->rdcv(CELL_CH_ALL, total_ic, cell_codez);
+    //The cells are compared against VUV/VOV during the conversion, so reading the flags
+    //back is a cheap first pass. Cells are only read on the slow schedule, when something
+    //is flagged, or when the balancer needs a bleeder-free measurement
+    //The sum of cells check needs cells converted in the same tick as ADSTAT
+    //A current step is read back at once, for the resistance estimate
+    float amps = ivt->get_amps()->get_value();
+    bool full_scan = (ticks++ % full_scan_period) == 0 ||
+                     (balancer != nullptr && balancer->is_measurement_window()) ||
+                     (is_self_test_turn() && self_test->get_next_step() == SELF_TEST_STEP_ADSTAT) ||
+                     (step_scan_amps > 0 && ivt->get_amps()->has_value() && fabsf(amps - scan_amps) >= step_scan_amps);
+    this->scanned = false;
+
+    //RDSTATB Command
+    uint8_t stat_codez[total_ic][8];
+    int pec = ltc->rdstat(STAT_REG_B, total_ic, stat_codez);
 
     if(pec == -1)
     {
 #if DEBUG_PEC
-        Serial.println("Slaves sent back incorrect response to RDCV!");
+        Serial.println("Slaves sent back incorrect response to RDSTATB!");
 #endif
         critical_callback(bms_critical_error);
     }
 
+    uint32_t flag_mask = 0;
+    for(uint8_t cell = cell_start; cell < cell_end; cell++)
+    {
+        flag_mask |= (uint32_t) 0x03 << (2 * cell);
+    }
+
     for(uint8_t addr = 0; addr < total_ic; addr++)
     {
-        for(uint8_t cell = cell_start; cell < cell_end; cell++)
+        if(STATB_CELL_FLAGS(stat_codez[addr]) & flag_mask)
         {
-#if DEBUG_CELL_VALUES
+#if DEBUG
             Serial.print("Slave #");
             Serial.print(addr);
-            Serial.print("'s cell #");
-            Serial.print(cell);
-            Serial.print(" -> ");
-            Serial.print(uv_to_float(cell_codez[addr][cell]),4);
-            Serial.println(" V");
+            Serial.println(" flagged an under/over voltage");
 #endif
+            full_scan = true;
         }
     }
 
+    if(full_scan)
+    {
+        //Start reading everything back
+        pec = ltc->rdcv(CELL_CH_ALL, total_ic, cell_codez);
+
+        if(pec == -1)
+        {
+#if DEBUG_PEC
+            Serial.println("Slaves sent back incorrect response to RDCV!");
+#endif
+            critical_callback(bms_critical_error);
+        }
+
+        for(uint8_t addr = 0; addr < total_ic; addr++)
+        {
+            for(uint8_t cell = cell_start; cell < cell_end; cell++)
+            {
+#if DEBUG_CELL_VALUES
+                Serial.print("Slave #");
+                Serial.print(addr);
+                Serial.print("'s cell #");
+                Serial.print(cell);
+                Serial.print(" -> ");
+                Serial.print(uv_to_float(cell_codez[addr][cell]),4);
+                Serial.println(" V");
+#endif
+            }
+        }
+
+        //Defensively copy the measurements just so they can be read only
+        for(uint8_t addr = 0; addr < total_ic; addr++)
+        {
+            for(uint8_t cell = 0; cell < (cell_end - cell_start); cell++)
+            {
+                *(cell_codes + addr * (cell_end - cell_start) + cell) = cell_codez[addr][cell + cell_start];
+            }
+        }
+
+        scan_sequence++;
+        this->scanned = true;
+        this->scan_amps = amps;
+        check_volts();
+    }
+
     //Transmit Analog-Digital Conversion Start Broadcast to measure GPIOs (Auxiliary)
     //ADAX Command
     ltc->adax();
@@ -412,20 +564,147 @@ void BMS::tick()
     //Defensively copy the measurements just so they can be read only
     for(uint8_t addr = 0; addr < total_ic; addr++)
     {
-        for(uint8_t cell = 0; cell < (cell_end - cell_start); cell++)
+        for(uint8_t temp = 0; temp < (aux_end - aux_start + 1); temp++) // +1 to include VRef
         {
-            *(cell_codes + addr * (cell_end - cell_start) + cell) = cell_codez[addr][cell + cell_start];
+            *(this->aux_codes + addr * (aux_end - aux_start + 1) + temp) = aux_codez[addr][temp + aux_start];
         }
     }
-    for(uint8_t addr = 0; addr < total_ic; addr++)
+
+    check_temps();
+
+    if(balancer != nullptr)
     {
-        for(uint8_t temp = 0; temp < (aux_end - aux_start + 1); temp++) // +1 to include VRef
+        balancer->update(cell_codes);
+    }
+
+    //Staggered read back of a single slave's configuration
+    int8_t verified = slave_config->verify_next();
+
+    if(verified == SLAVE_CONFIG_PEC)
+    {
+#if DEBUG_PEC
+        Serial.println("Slaves sent back incorrect response to RDCFG!");
+#endif
+        critical_callback(bms_pec_error);
+    }
+    else if(verified == SLAVE_CONFIG_LOST)
+    {
+#if DEBUG
+        Serial.println("Slave keeps losing its configuration!");
+#endif
+        critical_callback(bms_critical_error);
+    }
+
+    background_diagnostics();
+}
+
+//Diagnostic conversions overwrite the registers of a single slave,
+//which is fine after everything has been read back (next tick restores them)
+void BMS::background_diagnostics()
+{
+    if(is_self_test_turn())
+    {
+        step_self_test();
+    }
+    else if(open_wire != nullptr)
+    {
+        step_open_wire();
+    }
+}
+
+//Odd ticks are the open wire check's, when there is one
+bool BMS::is_self_test_turn()
+{
+    return self_test != nullptr && (open_wire == nullptr || !(ticks & 1));
+}
+
+void BMS::step_open_wire()
+{
+    int8_t result = open_wire->step();
+
+    if(result == OPEN_WIRE_PEC)
+    {
+#if DEBUG_PEC
+        Serial.println("Slave sent back incorrect response to open wire check!");
+#endif
+        critical_callback(bms_pec_error);
+    }
+    else if(result == OPEN_WIRE_FOUND)
+    {
+        uint16_t wires = open_wire->get_open_wires();
+        for(uint8_t wire = 0; wire < 13; wire++)
         {
-            *(this->aux_codes + addr * (aux_end - aux_start + 1) + temp) = aux_codez[addr][temp + aux_start];
+            if(wires & (1 << wire))
+            {
+                BmsCriticalFrame_t frame = bms_open_wire_error;
+                frame.volts = Float_Index_Tuple_t{(float) wire, open_wire->get_cell_index(wire)};
+                critical_callback(frame);
+            }
+        }
+    }
+}
+
+void BMS::step_self_test()
+{
+    int8_t result = self_test->step();
+    uint8_t ic = self_test->get_ic();
+
+    if(result == SELF_TEST_PEC)
+    {
+#if DEBUG_PEC
+        Serial.println("Slave sent back incorrect response to self test!");
+#endif
+        critical_callback(bms_pec_error);
+        return;
+    }
+
+    //Ignored cells may still be populated, so only a full slave can be cross checked, against
+    //cells of the same tick & only while no current flows (contactors are open before the first IVT sample)
+    Sample_Cache const * amps = ivt->get_amps();
+    bool resting = !amps->has_value() || fabs(amps->get_value()) <= SELF_TEST_SUM_OF_CELLS_MAX_AMPS;
+    if(self_test->get_step() == SELF_TEST_STEP_ADSTAT && (cell_end - cell_start) == 12 && scanned && resting)
+    {
+        float volts = 0;
+        for(uint8_t cell = 0; cell < 12; cell++)
+        {
+            volts += uv_to_float(*(cell_codes + ic * 12 + cell));
         }
+
+        if(!self_test->cross_check_cells(ic, volts))
+        {
+            result = SELF_TEST_FAILED;
+        }
+    }
+
+    if(result == SELF_TEST_FAILED)
+    {
+        BmsCriticalFrame_t frame = bms_self_test_error;
+        frame.volts = Float_Index_Tuple_t{(float) self_test->get_health(ic)->failed, ic};
+        critical_callback(frame);
+    }
+}
+
+void BMS::set_self_test(Self_Test * self_test)
+{
+    this->self_test = self_test;
+}
+
+void BMS::run_self_test()
+{
+#if DEBUG
+    Serial.println("Running self tests on every slave");
+#endif
+
+    ltc->wakeup_sleep();
+
+    for(uint16_t i = 0; i < total_ic * SELF_TEST_STEPS; i++)
+    {
+        step_self_test();
     }
 }
 
+Slave_Config * BMS::get_slave_config(){ return this->slave_config; }
+
 float BMS::get_total_voltage(){
     float total_volts = 0;
     for(uint8_t addr = 0; addr < total_ic; addr++)
@@ -438,9 +717,15 @@ float BMS::get_total_voltage(){
     return total_volts;
 }
 
+float BMS::get_avg_volts(){
+    return get_total_voltage() / (total_ic * (cell_end - cell_start));
+}
+
+uint32_t BMS::get_scan_sequence(){ return this->scan_sequence; }
+
 CAN_message_t Liion_Bms_Can_Adapter::VoltageMinMax(BMS * bms){
   CAN_message_t msg;
-  msg.id = LIION_START_CANID + LIION_VOLT_MIN_MAX_OFFSET;
+  msg.id = box_identity.liion_start_canid + LIION_VOLT_MIN_MAX_OFFSET;
   msg.len = 8;
 
   Float_Index_Tuple_t min = bms->get_min_volts();
@@ -451,7 +736,199 @@ CAN_message_t Liion_Bms_Can_Adapter::VoltageMinMax(BMS * bms){
   return msg;
 }
 
-Charger::Charger(FlexCAN * can, uint16_t initial_volts, uint16_t initial_amps) : can(can), volts(initial_volts), amps(initial_amps) {}
+CAN_message_t Soc_Can_Adapter::pack(Coulomb_Counter * soc){
+  CAN_message_t msg;
+  msg.id = box_identity.telemetry_canid + SOC_PACK_OFFSET;
+  msg.len = 8;
+
+  uint16_t pack = soc->get_soc();
+  uint16_t min_soc = soc->get_min_cell_soc();
+  uint16_t max_soc = soc->get_max_cell_soc();
+
+  msg.buf[0] = box_identity.error_offset;
+  msg.buf[1] = (pack >> 8) & 0xFF;
+  msg.buf[2] = pack & 0xFF;
+  msg.buf[3] = (min_soc >> 8) & 0xFF;
+  msg.buf[4] = min_soc & 0xFF;
+  msg.buf[5] = (max_soc >> 8) & 0xFF;
+  msg.buf[6] = max_soc & 0xFF;
+  msg.buf[7] = soc->is_resting() ? 1 : 0;
+
+  return msg;
+}
+
+CAN_message_t Soc_Can_Adapter::cells(Coulomb_Counter * soc, uint16_t first){
+  CAN_message_t msg;
+  msg.id = box_identity.telemetry_canid + SOC_CELLS_OFFSET;
+  msg.len = 8;
+
+  msg.buf[0] = box_identity.error_offset;
+  msg.buf[1] = first;
+
+  for(uint8_t i = 0; i < 3; i++){
+    uint16_t cell = first + i;
+    uint16_t val = cell < soc->cell_num ? soc->get_cell_soc(cell) : 0xFFFF;
+
+    msg.buf[2 + 2 * i] = (val >> 8) & 0xFF;
+    msg.buf[3 + 2 * i] = val & 0xFF;
+  }
+
+  return msg;
+}
+
+CAN_message_t Dcir_Can_Adapter::pack(Dcir_Estimator * dcir){
+  CAN_message_t msg;
+  msg.id = box_identity.telemetry_canid + DCIR_OFFSET;
+  msg.len = 7;
+
+  uint16_t worst = dcir->get_worst();
+  uint16_t worst_dcir = worst == 0xFFFF ? 0 : dcir->get_cell(worst) * 10000;
+  uint16_t average = dcir->get_average() * 10000;
+  uint16_t weak = dcir->get_weak_num();
+
+  msg.buf[0] = box_identity.error_offset;
+  msg.buf[1] = worst == 0xFFFF ? 0xFF : worst;
+  msg.buf[2] = (worst_dcir >> 8) & 0xFF;
+  msg.buf[3] = worst_dcir & 0xFF;
+  msg.buf[4] = (average >> 8) & 0xFF;
+  msg.buf[5] = average & 0xFF;
+  msg.buf[6] = weak > 0xFF ? 0xFF : weak;
+
+  return msg;
+}
+
+CAN_message_t Sop_Can_Adapter::limits(Power_Limits * sop){
+  CAN_message_t msg;
+  msg.id = box_identity.telemetry_canid + SOP_OFFSET;
+  msg.len = 7;
+
+  uint16_t discharge = sop->get_discharge_amps() * 10;
+  uint16_t charge = sop->get_charge_amps() * 10;
+
+  msg.buf[0] = box_identity.error_offset;
+  msg.buf[1] = (discharge >> 8) & 0xFF;
+  msg.buf[2] = discharge & 0xFF;
+  msg.buf[3] = (charge >> 8) & 0xFF;
+  msg.buf[4] = charge & 0xFF;
+  msg.buf[5] = sop->get_discharge_reason();
+  msg.buf[6] = sop->get_charge_reason();
+
+  return msg;
+}
+
+CAN_message_t Precharge_Can_Adapter::progress(Precharge * precharge, uint32_t now_ms){
+  CAN_message_t msg;
+  msg.id = box_identity.telemetry_canid + PRECHARGE_OFFSET;
+  msg.len = 8;
+
+  uint16_t bus = precharge->get_bus_volts() < 0 ? 0 : precharge->get_bus_volts() * 10;
+  uint16_t target = precharge->get_target_volts() * 10;
+  uint16_t percent = target == 0 ? 0 : (uint32_t) bus * 100 / target;
+  uint32_t elapsed = precharge->get_state_ms(now_ms) / 100;
+
+  msg.buf[0] = box_identity.error_offset;
+  msg.buf[1] = precharge->get_state();
+  msg.buf[2] = (bus >> 8) & 0xFF;
+  msg.buf[3] = bus & 0xFF;
+  msg.buf[4] = (target >> 8) & 0xFF;
+  msg.buf[5] = target & 0xFF;
+  msg.buf[6] = percent > 0xFF ? 0xFF : percent;
+  msg.buf[7] = elapsed > 0xFF ? 0xFF : elapsed;
+
+  return msg;
+}
+
+static void put_uint16_sat(uint8_t * buf, uint32_t value){
+  value = value > 0xFFFF ? 0xFFFF : value;
+  buf[0] = (value >> 8) & 0xFF;
+  buf[1] = value & 0xFF;
+}
+
+CAN_message_t Latency_Can_Adapter::stats(Cycle_Monitor * monitor, uint8_t message){
+  CAN_message_t msg;
+  msg.id = box_identity.telemetry_canid + CYCLE_STATS_OFFSET;
+  msg.len = 8;
+  msg.buf[0] = box_identity.error_offset;
+
+  if(message >= LATENCY_MODES * 2){
+    uint32_t misses = 0;
+    for(uint8_t mode = 0; mode < LATENCY_MODES; mode++){
+      misses += monitor->get_misses(mode);
+    }
+    msg.buf[1] = 0x0F | 2 << 4;
+    put_uint16_sat(msg.buf + 2, monitor->get_mean_us(monitor->get_jitter()) / 100);
+    put_uint16_sat(msg.buf + 4, monitor->get_jitter()->max_us / 100);
+    put_uint16_sat(msg.buf + 6, misses);
+    return msg;
+  }
+
+  uint8_t mode = message / 2;
+  Latency_Histogram_t const * h = monitor->get_cycles(mode);
+  if(message % 2 == 0){
+    msg.buf[1] = mode;
+    put_uint16_sat(msg.buf + 2, monitor->get_mean_us(h) / 100);
+    put_uint16_sat(msg.buf + 4, monitor->get_percentile_us(h, 99) / 100);
+    put_uint16_sat(msg.buf + 6, h->max_us / 100);
+  }else{
+    msg.buf[1] = mode | 1 << 4;
+    for(uint8_t level = 0; level < LATENCY_NEAR_MISS_LEVELS; level++){
+      put_uint16_sat(msg.buf + 2 + level * 2, monitor->get_near_misses(mode, level));
+    }
+  }
+  return msg;
+}
+
+CAN_message_t Recorder_Can_Adapter::chunk(Flight_Recorder * recorder, uint16_t chunk){
+  CAN_message_t msg;
+  msg.id = box_identity.telemetry_canid + RECORDER_OFFSET;
+  msg.len = 8;
+
+  msg.buf[0] = box_identity.error_offset;
+  msg.buf[1] = (chunk >> 8) & 0xFF;
+  msg.buf[2] = chunk & 0xFF;
+
+  if(chunk == 0){
+    msg.buf[3] = (recorder->get_record_size() >> 8) & 0xFF;
+    msg.buf[4] = recorder->get_record_size() & 0xFF;
+    msg.buf[5] = (recorder->get_count() >> 8) & 0xFF;
+    msg.buf[6] = recorder->get_count() & 0xFF;
+    msg.buf[7] = 0;
+  }else{
+    uint32_t offset = (uint32_t) (chunk - 1) * RECORDER_CHUNK_BYTES;
+    for(uint8_t i = 0; i < RECORDER_CHUNK_BYTES; i++){
+      msg.buf[3 + i] = recorder->read(offset + i);
+    }
+  }
+
+  return msg;
+}
+
+CAN_message_t Sim_Can_Adapter::ivt_current(Pack_Simulator * sim, int8_t current_sign){
+  return ivt(IVT_CURRENT_CANID, 0x00, sim->get_steps(), current_sign * sim->get_pack()->get_amps());
+}
+
+CAN_message_t Sim_Can_Adapter::ivt_voltage(Pack_Simulator * sim){
+  return ivt(IVT_VOLTAGE_CANID, 0x01, sim->get_steps(), sim->get_pack()->get_pack_volts());
+}
+
+//buf[0] => Mux, buf[1] => Counter, buf[2~5] => Value (mA / mV, signed, high byte first)
+CAN_message_t Sim_Can_Adapter::ivt(uint32_t id, uint8_t mux, uint8_t counter, float si){
+  CAN_message_t msg;
+  msg.id = id;
+  msg.len = 6;
+
+  int32_t val = si * 1000;
+  msg.buf[0] = mux;
+  msg.buf[1] = counter;
+  msg.buf[2] = (val >> 24) & 0xFF;
+  msg.buf[3] = (val >> 16) & 0xFF;
+  msg.buf[4] = (val >> 8) & 0xFF;
+  msg.buf[5] = val & 0xFF;
+
+  return msg;
+}
+
+Charger::Charger(FlexCAN * can, uint16_t initial_volts, float initial_amps) : can(can), volts(initial_volts), amps(initial_amps) {}
 
 void Charger::send_charge_message(){
   CAN_message_t msg;
@@ -475,8 +952,8 @@ void Charger::send_charge_message(){
 }
 
 void Charger::set_volts(uint16_t v){ this->volts = v; }
-void Charger::set_amps(uint16_t a){ this->amps = a; }
-void Charger::set_volts_amps(uint16_t v, uint16_t a)
+void Charger::set_amps(float a){ this->amps = a; }
+void Charger::set_volts_amps(uint16_t v, float a)
 {
   set_volts(v);
   set_amps(a);  
@@ -491,7 +968,7 @@ CAN_message_t Shutdown_Message_Factory::simple(uint8_t error){
   msg.id = SHUTDOWN_ERROR_CANID;
   msg.len = 8;
 
-  msg.buf[7] = error + ERROR_OFFSET;
+  msg.buf[7] = error + box_identity.error_offset;
   msg.buf[6] = 0;
   msg.buf[5] = 0;
   msg.buf[4] = 0;
@@ -507,7 +984,7 @@ CAN_message_t Shutdown_Message_Factory::data(uint8_t error, uint32_t data){
   msg.id = SHUTDOWN_ERROR_CANID;
   msg.len = 5;
 
-  msg.buf[7] = error + ERROR_OFFSET;
+  msg.buf[7] = error + box_identity.error_offset;
   
   msg.buf[6] = (data >> 24) & 0xFF;
   msg.buf[5] = (data >> 16) & 0xFF;
@@ -525,7 +1002,7 @@ CAN_message_t Shutdown_Message_Factory::full(uint8_t error, uint32_t data, uint8
   msg.id = SHUTDOWN_ERROR_CANID;
   msg.len = 8;
 
-  msg.buf[7] = error + ERROR_OFFSET;
+  msg.buf[7] = error + box_identity.error_offset;
   
   msg.buf[6] = (data >> 24) & 0xFF;
   msg.buf[5] = (data >> 16) & 0xFF;
@@ -539,60 +1016,475 @@ CAN_message_t Shutdown_Message_Factory::full(uint8_t error, uint32_t data, uint8
   return msg;
 }
 
-Other_Battery_Box::Other_Battery_Box(FlexCAN * can) : can(can) {}
+void Can_Dispatch::add(Can_Sensor * sensor){
+  for(uint32_t i = 0; i < sensor->get_id_num(); i++){
+    add_id(*(sensor->get_ids() + i), sensor);
+  }
+}
+
+void Can_Dispatch::listen(uint32_t id){ add_id(id, nullptr); }
 
-void Other_Battery_Box::update(CAN_message_t message){
-  if(message.id == OTHER_BOX_VOLTAGE_CANID){
-    float volts = (message.buf[7] << 8 | message.buf[6]) * 0.01;
-    this->volts = volts;
+void Can_Dispatch::add_id(uint32_t id, Can_Sensor * sensor){
+  if(id_num >= CAN_DISPATCH_MAX_IDS){
+#if DEBUG_CAN
+    Serial.println("Can dispatch table is full!");
+#endif
+    return;
   }
+  ids[id_num] = id;
+  sensors[id_num] = sensor;
+  id_num++;
 }
 
-void Other_Battery_Box::send_total_voltage(float volts){
+void Can_Dispatch::begin(FlexCAN * can){
+  sort();
+
+  if(id_num == 0){
+    mask = 0;
+    can->begin();
+    return;
+  }
+
+  uint32_t filters[CAN_HW_FILTERS];
+  mask = 0x7FF;
+  uint8_t filter_num = get_filters(mask, filters);
+  while(filter_num > CAN_HW_FILTERS){
+    mask = (mask << 1) & 0x7FF;
+    filter_num = get_filters(mask, filters);
+  }
+
+#if DEBUG_CAN
+  Serial.print("Can filter mask: ");
+  Serial.println(mask, HEX);
+#endif
+
+  //Filters can only be set while frozen (before begin), unused ones repeat the last one
+  for(uint8_t n = 0; n < CAN_HW_FILTERS; n++){
+    CAN_filter_t filter = {0, 0, filters[n < filter_num ? n : filter_num - 1]};
+    can->setFilter(filter, n);
+  }
+
+  CAN_filter_t global = {0, 0, mask};
+  can->begin(global);
+}
+
+uint8_t Can_Dispatch::get_filters(uint32_t mask, uint32_t * filters){
+  //Clearing low bits keeps the table sorted, so equal ids are next to each other
+  uint8_t filter_num = 0;
+  for(uint8_t i = 0; i < id_num; i++){
+    uint32_t filter = ids[i] & mask;
+    if(i > 0 && (ids[i - 1] & mask) == filter){
+      continue;
+    }
+    if(filter_num < CAN_HW_FILTERS){
+      filters[filter_num] = filter;
+    }
+    filter_num++;
+  }
+  return filter_num;
+}
+
+void Can_Dispatch::sort(){
+  //Insertion sort, runs once
+  for(uint8_t i = 1; i < id_num; i++){
+    uint32_t id = ids[i];
+    Can_Sensor * sensor = sensors[i];
+    uint8_t j = i;
+    for(; j > 0 && ids[j - 1] > id; j--){
+      ids[j] = ids[j - 1];
+      sensors[j] = sensors[j - 1];
+    }
+    ids[j] = id;
+    sensors[j] = sensor;
+  }
+}
+
+bool Can_Dispatch::dispatch(CAN_message_t message){
+  uint8_t low = 0, high = id_num;
+  while(low < high){
+    uint8_t mid = (low + high) / 2;
+    if(ids[mid] < message.id){
+      low = mid + 1;
+    }else{
+      high = mid;
+    }
+  }
+
+  if(low == id_num || ids[low] != message.id || sensors[low] == nullptr){
+    return false;
+  }
+  sensors[low]->update(message);
+  return true;
+}
+
+uint8_t Can_Dispatch::get_id_num(){ return this->id_num; }
+uint32_t Can_Dispatch::get_mask(){ return this->mask; }
+
+static uint8_t clamp_byte(float value)
+{
+    return value <= 0 ? 0 : (value >= 255 ? 255 : (uint8_t) value);
+}
+
+Pack_Link::Pack_Link(FlexCAN * can, uint8_t box_id, uint8_t box_num) :
+    box_id(box_id), box_num(box_num > PACK_MAX_BOXES ? PACK_MAX_BOXES : box_num), can(can)
+{
+  for(uint8_t box = 0; box < PACK_MAX_BOXES; box++){
+    boxes[box] = Box_Status_t{};
+    reported_lost[box] = false;
+
+    //Listen to every other box
+    if(box != box_id && box < this->box_num){
+      for(uint8_t frame = 0; frame < 3; frame++){
+        ids[id_num++] = PACK_LINK_CANID + box * 3 + frame;
+      }
+    }
+  }
+}
+
+void Pack_Link::update(CAN_message_t message){
+  uint8_t box = (message.id - PACK_LINK_CANID) / 3;
+  uint8_t frame = (message.id - PACK_LINK_CANID) % 3;
+  if(message.id < PACK_LINK_CANID || box >= box_num || box == box_id){
+    return;
+  }
+
+  Box_Status_t * status = &boxes[box];
+  uint8_t sequence = message.buf[0];
+
+  switch(frame){
+    case 0: /* Cells, heartbeat */
+      if(status->seen && sequence != (uint8_t) (status->sequence + 1)){
+        status->missed += (uint8_t) (sequence - status->sequence - 1);
+      }
+      status->min_volts = message.buf[1] << 8 | message.buf[2];
+      status->min_volts_index = message.buf[3];
+      status->max_volts = message.buf[4] << 8 | message.buf[5];
+      status->max_volts_index = message.buf[6];
+      status->mode = message.buf[7] >> 4;
+      status->action = message.buf[7] & 0x0F;
+      status->sequence = sequence;
+      status->rx_us = now_us();
+      status->seen = true;
+      break;
+    case 1: /* Temperatures, SOC */
+      status->min_temp = (int16_t) message.buf[1] - 40;
+      status->min_temp_index = message.buf[2];
+      status->max_temp = (int16_t) message.buf[3] - 40;
+      status->max_temp_index = message.buf[4];
+      status->soc = message.buf[5] << 8 | message.buf[6];
+      break;
+    default: /* Box voltage */
+      status->volts = (message.buf[1] << 8 | message.buf[2]) * 0.01;
+      break;
+  }
+}
+
+void Pack_Link::set_local(BMS * bms, uint16_t soc, uint8_t mode, uint8_t action){
+  Box_Status_t * status = &boxes[box_id];
+
+  Float_Index_Tuple_t min_volts = bms->get_min_volts(), max_volts = bms->get_max_volts();
+  Float_Index_Tuple_t min_temp = bms->get_min_temp(), max_temp = bms->get_max_temp();
+
+  status->min_volts = min_volts.value * 10000;
+  status->min_volts_index = min_volts.index;
+  status->max_volts = max_volts.value * 10000;
+  status->max_volts_index = max_volts.index;
+  status->min_temp = min_temp.value;
+  status->min_temp_index = min_temp.index;
+  status->max_temp = max_temp.value;
+  status->max_temp_index = max_temp.index;
+  status->soc = soc;
+  status->volts = bms->get_total_voltage();
+  status->mode = mode;
+  status->action = action;
+  status->seen = true;
+}
+
+void Pack_Link::tick(uint32_t now_ms){
+  if(now_ms - last_send_ms < PACK_LINK_PERIOD_MS){
+    return;
+  }
+  this->last_send_ms = now_ms;
+
+  for(uint8_t frame = 0; frame < 3; frame++){
+    send(frame);
+  }
+  this->sequence++;
+}
+
+void Pack_Link::send(uint8_t frame){
+  Box_Status_t * status = &boxes[box_id];
+
   CAN_message_t msg;
-  msg.id = CURRENT_BOX_VOLTAGE_CANID;
+  msg.id = PACK_LINK_CANID + box_id * 3 + frame;
   msg.len = 8;
 
-  uint16_t v = volts * 100;
+  for(uint8_t i = 0; i < 8; i++){
+    msg.buf[i] = 0;
+  }
+  msg.buf[0] = sequence;
+
+  if(frame == 0){
+    msg.buf[1] = (status->min_volts >> 8) & 0xFF;
+    msg.buf[2] = status->min_volts & 0xFF;
+    msg.buf[3] = status->min_volts_index;
+    msg.buf[4] = (status->max_volts >> 8) & 0xFF;
+    msg.buf[5] = status->max_volts & 0xFF;
+    msg.buf[6] = status->max_volts_index;
+    msg.buf[7] = status->mode << 4 | (status->action & 0x0F);
+  }else if(frame == 1){
+    msg.buf[1] = clamp_byte(status->min_temp + 40);
+    msg.buf[2] = status->min_temp_index;
+    msg.buf[3] = clamp_byte(status->max_temp + 40);
+    msg.buf[4] = status->max_temp_index;
+    msg.buf[5] = (status->soc >> 8) & 0xFF;
+    msg.buf[6] = status->soc & 0xFF;
+  }else{
+    uint16_t v = status->volts * 100;
+    msg.buf[1] = (v >> 8) & 0xFF;
+    msg.buf[2] = v & 0xFF;
+  }
 
-  msg.buf[7] = (v >> 8) & 0xFF;
-  msg.buf[6] = (v) & 0xFF;
-  msg.buf[5] = 0;
-  msg.buf[4] = 0;
-  msg.buf[3] = 0;
-  msg.buf[2] = 0;
-  msg.buf[1] = 0;
-  msg.buf[0] = 0;
   can->write(msg);
 }
 
-float Other_Battery_Box::get_volts(){ return this->volts; }
+bool Pack_Link::is_alive(uint8_t box){
+  if(box == box_id){
+    return true;
+  }
+  return box < box_num && boxes[box].seen &&
+         now_us() - boxes[box].rx_us <= (uint32_t) PACK_LINK_LOSS_PERIODS * PACK_LINK_PERIOD_MS * 1000;
+}
 
-uint32_t const * Other_Battery_Box::get_ids(){ return this->ids; }
-uint32_t Other_Battery_Box::get_id_num(){ return this->id_num; }
+bool Pack_Link::all_alive(){
+  for(uint8_t box = 0; box < box_num; box++){
+    if(!is_alive(box)){
+      return false;
+    }
+  }
+  return true;
+}
 
-Configurator::Configurator(FlexCAN * can) : can(can) {}
+uint8_t Pack_Link::check_lost(){
+  for(uint8_t box = 0; box < box_num; box++){
+    if(is_alive(box)){
+      reported_lost[box] = false;
+    }else if(boxes[box].seen && !reported_lost[box]){
+      reported_lost[box] = true;
+      return box;
+    }
+  }
+  return 0xFF;
+}
+
+Box_Status_t const * Pack_Link::get_box(uint8_t box){ return &boxes[box]; }
+
+Pack_Extreme_t Pack_Link::get_min_volts(){
+  Pack_Extreme_t extreme = {(float) boxes[box_id].min_volts, box_id, boxes[box_id].min_volts_index};
+  for(uint8_t box = 0; box < box_num; box++){
+    if(is_alive(box) && boxes[box].min_volts < extreme.value){
+      extreme = Pack_Extreme_t{(float) boxes[box].min_volts, box, boxes[box].min_volts_index};
+    }
+  }
+  extreme.value *= 0.0001;
+  return extreme;
+}
+
+Pack_Extreme_t Pack_Link::get_max_volts(){
+  Pack_Extreme_t extreme = {(float) boxes[box_id].max_volts, box_id, boxes[box_id].max_volts_index};
+  for(uint8_t box = 0; box < box_num; box++){
+    if(is_alive(box) && boxes[box].max_volts > extreme.value){
+      extreme = Pack_Extreme_t{(float) boxes[box].max_volts, box, boxes[box].max_volts_index};
+    }
+  }
+  extreme.value *= 0.0001;
+  return extreme;
+}
+
+Pack_Extreme_t Pack_Link::get_min_temp(){
+  Pack_Extreme_t extreme = {(float) boxes[box_id].min_temp, box_id, boxes[box_id].min_temp_index};
+  for(uint8_t box = 0; box < box_num; box++){
+    if(is_alive(box) && boxes[box].min_temp < extreme.value){
+      extreme = Pack_Extreme_t{(float) boxes[box].min_temp, box, boxes[box].min_temp_index};
+    }
+  }
+  return extreme;
+}
+
+Pack_Extreme_t Pack_Link::get_max_temp(){
+  Pack_Extreme_t extreme = {(float) boxes[box_id].max_temp, box_id, boxes[box_id].max_temp_index};
+  for(uint8_t box = 0; box < box_num; box++){
+    if(is_alive(box) && boxes[box].max_temp > extreme.value){
+      extreme = Pack_Extreme_t{(float) boxes[box].max_temp, box, boxes[box].max_temp_index};
+    }
+  }
+  return extreme;
+}
+
+uint16_t Pack_Link::get_min_soc(){
+  uint16_t min_soc = boxes[box_id].soc;
+  for(uint8_t box = 0; box < box_num; box++){
+    if(is_alive(box) && boxes[box].soc < min_soc){
+      min_soc = boxes[box].soc;
+    }
+  }
+  return min_soc;
+}
+
+uint16_t Pack_Link::get_balance_floor(){
+  uint16_t floor = 0xFFFF;
+  for(uint8_t box = 0; box < box_num; box++){
+    if(box != box_id && is_alive(box) && boxes[box].min_volts < floor){
+      floor = boxes[box].min_volts;
+    }
+  }
+  return floor;
+}
+
+float Pack_Link::get_others_volts(){
+  float volts = 0;
+  for(uint8_t box = 0; box < box_num; box++){
+    if(box == box_id){
+      continue;
+    }
+    if(!is_alive(box)){
+      return 0;
+    }
+    volts += boxes[box].volts;
+  }
+  return volts;
+}
+
+uint32_t const * Pack_Link::get_ids(){ return this->ids; }
+uint32_t Pack_Link::get_id_num(){ return this->id_num; }
+
+Health_Reporter::Health_Reporter(FlexCAN * can, Self_Test * self_test, uint32_t request_id, uint32_t response_id) :
+  response_id(response_id), can(can), self_test(self_test) {
+  ids[0] = request_id;
+}
+
+void Health_Reporter::update(CAN_message_t message){
+  if(message.id != ids[0]){
+    return;
+  }
+
+  for(uint8_t ic = 0; ic < self_test->total_ic; ic++){
+    Slave_Health_t const * h = self_test->get_health(ic);
+
+    CAN_message_t msg;
+    msg.id = response_id;
+    msg.len = 8;
+
+    uint16_t soc = h->sum_of_cells * 100;
+
+    msg.buf[0] = box_identity.error_offset;
+    msg.buf[1] = ic | (self_test->is_stack_consistent() ? 0 : 0x80);
+    msg.buf[2] = h->failed;
+    msg.buf[3] = (soc >> 8) & 0xFF;
+    msg.buf[4] = soc & 0xFF;
+    msg.buf[5] = clamp_byte(h->die_temp + 40);
+    msg.buf[6] = clamp_byte((h->va - 4) * 100);
+    msg.buf[7] = clamp_byte((h->vd - 2) * 100);
+    can->write(msg);
+  }
+}
+
+uint32_t const * Health_Reporter::get_ids(){ return this->ids; }
+uint32_t Health_Reporter::get_id_num(){ return this->id_num; }
+
+Trace_Reporter::Trace_Reporter(FlexCAN * can, uint32_t request_id, uint32_t response_id) : response_id(response_id), can(can) {
+  ids[0] = request_id;
+}
+
+#if TRACE_ENABLE
+static void put_uint24(uint8_t * buf, uint32_t value){
+  value = value > 0xFFFFFF ? 0xFFFFFF : value;
+  buf[0] = (value >> 16) & 0xFF;
+  buf[1] = (value >> 8) & 0xFF;
+  buf[2] = value & 0xFF;
+}
+#endif
+
+void Trace_Reporter::update(CAN_message_t message){
+#if TRACE_ENABLE
+  if(message.id != ids[0]){
+    return;
+  }
+
+  for(uint8_t span = 0; span < TRACE_SPANS; span++){
+    Trace_Span_t const * s = trace_get(span);
+
+    CAN_message_t msg;
+    msg.id = response_id;
+    msg.len = 8;
+    msg.buf[0] = box_identity.error_offset;
+
+    msg.buf[1] = span;
+    put_uint24(msg.buf + 2, s->count == 0 ? 0 : s->min);
+    put_uint24(msg.buf + 5, s->max);
+    can->write(msg);
+
+    msg.buf[1] = span | 1 << 5;
+    put_uint24(msg.buf + 2, trace_mean(span));
+    put_uint24(msg.buf + 5, trace_percentile(span, 99));
+    can->write(msg);
+
+    msg.buf[1] = span | 2 << 5;
+    msg.buf[2] = (s->count >> 24) & 0xFF;
+    msg.buf[3] = (s->count >> 16) & 0xFF;
+    msg.buf[4] = (s->count >> 8) & 0xFF;
+    msg.buf[5] = s->count & 0xFF;
+    msg.buf[6] = 0;
+    msg.buf[7] = 0;
+    can->write(msg);
+  }
+#else
+  (void) message;
+#endif
+}
+
+uint32_t const * Trace_Reporter::get_ids(){ return this->ids; }
+uint32_t Trace_Reporter::get_id_num(){ return this->id_num; }
+
+Configurator::Configurator(FlexCAN * can, Configuration * config, uint32_t rx_id, uint32_t ack_id) :
+  ack_id(ack_id), can(can), config(config) {
+  ids[0] = rx_id;
+}
 
 void Configurator::update(CAN_message_t message){
-  if(message.id == CONFIGURATION_CANID){
+  if(message.id == ids[0]){
     uint8_t addr = message.buf[7];
     uint8_t num = message.buf[6];
-
-    if(addr == 0xFF){
-      EEPROM.write(CONFIG_ADDRESS_VALIDITY, 0xFF);
-    }else if(addr < CONFIG_ADDRESS_START || addr > EEPROM.length() || num > 6){
-      return; 
-    }else{
+    uint8_t status = CONFIGURATION_ACK_STAGED;
+
+    if(addr == CONFIGURATION_COMMIT){
+      status = config->commit() == CONFIG_COMMIT_OK ? CONFIGURATION_ACK_COMMITTED : CONFIGURATION_ACK_RANGE;
+    }else if(addr == CONFIGURATION_DISCARD){
+      config->discard();
+    }else if(addr == CONFIGURATION_DEFAULTS){
+      config->stage_defaults();
+    }else if(num > 6){
+      status = CONFIGURATION_ACK_ADDRESS;
+    }else if(addr >= CONFIG_ADDRESS_START && addr + num <= CONFIG_ADDRESS_START + CONFIG_VALUE_NUM * 2){
       for(uint8_t i = 0; i < num; i++){
-        EEPROM.write(addr + i, message.buf[5 + i]);
+        config->stage(addr - CONFIG_ADDRESS_START + i, message.buf[5 - i]);
       }
+    }else if(addr >= BOX_ID_EEPROM_ADDRESS && addr + num <= BOX_ID_EEPROM_ADDRESS + 2){
+      for(uint8_t i = 0; i < num; i++){
+        EEPROM.write(addr + i, message.buf[5 - i]);
+      }
+    }else{
+      status = CONFIGURATION_ACK_ADDRESS;
     }
 
     CAN_message_t ack;
-    ack.id = CONFIGURATION_ACK_CANID;
-    ack.len = 1;
+    ack.id = ack_id;
+    ack.len = 4;
     
-    ack.buf[0] = BOX_ID * 32;
+    ack.buf[0] = box_identity.error_offset;
+    ack.buf[1] = status;
+    ack.buf[2] = config->get_generation();
+    ack.buf[3] = CONFIG_VERSION;
 
     can->write(ack);
   }
@@ -601,3 +1493,226 @@ void Configurator::update(CAN_message_t message){
 uint32_t const * Configurator::get_ids(){ return this->ids; }
 uint32_t Configurator::get_id_num(){ return this->id_num; }
 
+
+//Frame types (upper nibble of the first byte)
+#define ISO_TP_SINGLE 0x00
+#define ISO_TP_FIRST 0x10
+#define ISO_TP_CONSECUTIVE 0x20
+#define ISO_TP_FLOW 0x30
+
+//Flow control status
+#define ISO_TP_FLOW_CTS 0
+#define ISO_TP_FLOW_WAIT 1
+#define ISO_TP_FLOW_OVERFLOW 2
+
+Iso_Tp::Iso_Tp(FlexCAN * can, uint32_t rx_id, uint32_t tx_id) : rx_id(rx_id), tx_id(tx_id), can(can) {
+  ids[0] = rx_id;
+}
+
+uint32_t const * Iso_Tp::get_ids(){ return this->ids; }
+uint32_t Iso_Tp::get_id_num(){ return this->id_num; }
+
+bool Iso_Tp::is_sending(){ return this->tx_active; }
+bool Iso_Tp::available(){ return this->rx_ready; }
+uint8_t const * Iso_Tp::get_rx(){ return this->rx; }
+uint16_t Iso_Tp::get_rx_len(){ return this->rx_len; }
+uint32_t Iso_Tp::get_errors(){ return this->errors; }
+
+void Iso_Tp::release(){
+  this->rx_ready = false;
+}
+
+void Iso_Tp::update(CAN_message_t message){
+  if(message.id != rx_id || message.len == 0){
+    return;
+  }
+  uint32_t now_ms = Clock::now_ms();
+
+  switch(message.buf[0] & 0xF0){
+    case ISO_TP_SINGLE:
+    {
+      uint8_t len = message.buf[0] & 0x0F;
+      if(rx_ready || len == 0 || len > 7 || len >= message.len){
+        return;
+      }
+      memcpy(rx, message.buf + 1, len);
+      this->rx_len = len;
+      this->rx_active = false;
+      this->rx_ready = true;
+      break;
+    }
+    case ISO_TP_FIRST:
+    {
+      uint16_t len = (message.buf[0] & 0x0F) << 8 | message.buf[1];
+      if(rx_ready || len > ISO_TP_MAX_LEN){
+        send_flow_control(ISO_TP_FLOW_OVERFLOW);
+        this->errors++;
+        return;
+      }
+      if(len < 8){
+        return;
+      }
+      memcpy(rx, message.buf + 2, 6);
+      this->rx_len = len;
+      this->rx_pos = 6;
+      this->rx_sequence = 1;
+      this->rx_block = 0;
+      this->rx_active = true;
+      this->rx_last_ms = now_ms;
+      send_flow_control(ISO_TP_FLOW_CTS);
+      break;
+    }
+    case ISO_TP_CONSECUTIVE:
+    {
+      if(!rx_active){
+        return;
+      }
+      if((message.buf[0] & 0x0F) != rx_sequence){
+        this->rx_active = false;
+        this->errors++;
+        return;
+      }
+      uint16_t left = rx_len - rx_pos;
+      uint8_t num = left < 7 ? left : 7;
+      memcpy(rx + rx_pos, message.buf + 1, num);
+      this->rx_pos += num;
+      this->rx_sequence = (rx_sequence + 1) & 0x0F;
+      this->rx_last_ms = now_ms;
+
+      if(rx_pos >= rx_len){
+        this->rx_active = false;
+        this->rx_ready = true;
+      }else if(++rx_block == ISO_TP_BLOCK_SIZE){
+        this->rx_block = 0;
+        send_flow_control(ISO_TP_FLOW_CTS);
+      }
+      break;
+    }
+    case ISO_TP_FLOW:
+    {
+      if(!tx_active || !tx_waiting){
+        return;
+      }
+      uint8_t status = message.buf[0] & 0x0F;
+      if(status == ISO_TP_FLOW_OVERFLOW || status > ISO_TP_FLOW_OVERFLOW){
+        this->tx_active = false;
+        this->errors++;
+        return;
+      }
+      this->tx_last_ms = now_ms;
+      if(status == ISO_TP_FLOW_WAIT){
+        return;
+      }
+
+      //STmin: 0~127 ms, 0xF1~0xF9 100~900 us, anything else is reserved (treated as 127 ms)
+      uint8_t st_min = message.buf[2];
+      if(st_min <= 0x7F){
+        this->tx_st_min_us = st_min * 1000UL;
+      }else if(st_min >= 0xF1 && st_min <= 0xF9){
+        this->tx_st_min_us = (st_min - 0xF0) * 100UL;
+      }else{
+        this->tx_st_min_us = 127000UL;
+      }
+      this->tx_block_size = message.buf[1];
+      this->tx_block = 0;
+      this->tx_waiting = false;
+      break;
+    }
+  }
+}
+
+bool Iso_Tp::send(uint8_t const * data, uint16_t len){
+  if(tx_active || len == 0 || len > ISO_TP_MAX_LEN){
+    return false;
+  }
+
+  CAN_message_t msg;
+  msg.id = tx_id;
+  msg.len = 8;
+  msg.timeout = ISO_TP_WRITE_TIMEOUT_MS;
+  memset(msg.buf, ISO_TP_PADDING, 8);
+
+  if(len <= 7){
+    msg.buf[0] = ISO_TP_SINGLE | len;
+    memcpy(msg.buf + 1, data, len);
+    can->write(msg);
+    return true;
+  }
+
+  memcpy(tx, data, len);
+  msg.buf[0] = ISO_TP_FIRST | (len >> 8);
+  msg.buf[1] = len & 0xFF;
+  memcpy(msg.buf + 2, tx, 6);
+  can->write(msg);
+
+  this->tx_len = len;
+  this->tx_pos = 6;
+  this->tx_sequence = 1;
+  this->tx_active = true;
+  this->tx_waiting = true;
+  this->tx_last_ms = Clock::now_ms();
+  return true;
+}
+
+bool Iso_Tp::send_consecutive(){
+  CAN_message_t msg;
+  msg.id = tx_id;
+  msg.len = 8;
+  msg.timeout = ISO_TP_WRITE_TIMEOUT_MS;
+  memset(msg.buf, ISO_TP_PADDING, 8);
+
+  uint16_t left = tx_len - tx_pos;
+  uint8_t num = left < 7 ? left : 7;
+  msg.buf[0] = ISO_TP_CONSECUTIVE | tx_sequence;
+  memcpy(msg.buf + 1, tx + tx_pos, num);
+  if(!can->write(msg)){
+    return false;
+  }
+
+  this->tx_pos += num;
+  this->tx_sequence = (tx_sequence + 1) & 0x0F;
+  this->tx_last_us = Clock::now_us();
+
+  if(tx_pos >= tx_len){
+    this->tx_active = false;
+  }else if(tx_block_size != 0 && ++tx_block == tx_block_size){
+    this->tx_waiting = true;
+  }
+  return true;
+}
+
+void Iso_Tp::tick(uint32_t now_ms){
+  if(rx_active && now_ms - rx_last_ms > ISO_TP_TIMEOUT_MS){
+    this->rx_active = false;
+    this->errors++;
+  }
+
+  if(tx_active && tx_waiting && now_ms - tx_last_ms > ISO_TP_TIMEOUT_MS){
+    this->tx_active = false;
+    this->errors++;
+  }
+
+  //Without a separation time up to ISO_TP_FRAMES_PER_TICK go out at once, otherwise a frame per tick at most
+  for(uint8_t i = 0; i < ISO_TP_FRAMES_PER_TICK && tx_active && !tx_waiting && Clock::now_us() - tx_last_us >= tx_st_min_us; i++){
+    if(!send_consecutive()){
+      break;
+    }
+    this->tx_last_ms = now_ms;
+    if(tx_st_min_us != 0){
+      break;
+    }
+  }
+}
+
+void Iso_Tp::send_flow_control(uint8_t status){
+  CAN_message_t msg;
+  msg.id = tx_id;
+  msg.len = 8;
+  msg.timeout = ISO_TP_WRITE_TIMEOUT_MS;
+  memset(msg.buf, ISO_TP_PADDING, 8);
+
+  msg.buf[0] = ISO_TP_FLOW | status;
+  msg.buf[1] = ISO_TP_BLOCK_SIZE;
+  msg.buf[2] = ISO_TP_ST_MIN_MS;
+  can->write(msg);
+}
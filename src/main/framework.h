@@ -8,6 +8,25 @@ importantly LTC60842 functions to make them work for teensy. */
 #include "LTC6804_2.h"
 #include "FlexCAN.h"
 #include "config.h"
+#include "slave_config.h"
+#include "balancing.h"
+#include "diagnostics.h"
+#include "sample_cache.h"
+#include "soc.h"
+#include "ekf.h"
+#include "resistance.h"
+#include "sop.h"
+#include "precharge.h"
+#include "charging.h"
+#include "fault_policy.h"
+#include "identity.h"
+#include "journal.h"
+#include "logger.h"
+#include "recorder.h"
+#include "trace.h"
+#include "latency.h"
+#include "sim.h"
+#include "clock.h"
 
 #define DRIVE_MODE 0
 #define CHARGE_MODE 1
@@ -15,26 +34,18 @@ importantly LTC60842 functions to make them work for teensy. */
 void output_low(uint8_t pin);
 void output_high(uint8_t pin);
 
-//Index of the battery box, can be anything
-//Used only to send data metrics to the can bus as the first byte of the bms messages
-#define BOX_LEFT 0
-#define BOX_RIGHT 1
-#define BOX_ID BOX_LEFT
-
-// Look at http://liionbms.com/php/standards.php
-#if BOX_ID == BOX_LEFT
-  #define LIION_START_CANID 0x64D
-#else
-  #define LIION_START_CANID 0x61D
-#endif
-
+//Box specific ids come from box_identity (see identity.h), ERROR_OFFSET below is its error_offset
 
 #define LIION_VOLT_MIN_MAX_OFFSET 3
 
 #define CHARGER_COMMAND_CANID 0x618
+//The charger stops on its own if it does not get a command for a while
+#define CHARGER_COMMAND_PERIOD_MS 1000
 
-#define SEND_ALL_VOLTS_REQUEST_CANID 0x4FE
-#define SEND_ALL_VOLTS_RESPONSE_CANID 0x4FF
+/* Requests & telemetry of a box go out on box_identity.telemetry_canid + *_OFFSET below (0x4F0 on
+   box 0, every next box 0x10 lower, see identity.cpp), so any number of boxes can share the bus */
+#define SEND_ALL_VOLTS_REQUEST_OFFSET 0xE
+#define SEND_ALL_VOLTS_RESPONSE_OFFSET 0xF
 
 #ifndef IVT_CURRENT_CANID
   #define IVT_CURRENT_CANID 0x521
@@ -43,37 +54,130 @@ void output_high(uint8_t pin);
   #define IVT_VOLTAGE_CANID 0x522
 #endif
 
-#if BOX_ID == BOX_LEFT
-  #define OTHER_BOX_VOLTAGE_CANID 0x404
-  #define CURRENT_BOX_VOLTAGE_CANID 0x405
-#else
-  #define OTHER_BOX_VOLTAGE_CANID 0x405
-  #define CURRENT_BOX_VOLTAGE_CANID 0x404
-#endif
-
-
-/* Every time a configuration message is received, byte(s) are written into the EEPROM:*/
-//buf[7] : Start Address
+/* Pack link, every box sends its status every PACK_LINK_PERIOD_MS on 3 consecutive ids
+   starting from PACK_LINK_CANID + box * 3. buf[0] of every frame is the heartbeat sequence */
+// +0: buf[1~2] => Min cell (100uV), buf[3] => Its index, buf[4~5] => Max cell (100uV), buf[6] => Its index,
+//     buf[7] => Mode (FAULT_MODE_*) << 4 | Worst action taken (FAULT_ACTION_*)
+// +1: buf[1] => Min temp (Celsius + 40), buf[2] => Its index, buf[3] => Max temp (Celsius + 40), buf[4] => Its index,
+//     buf[5~6] => SOC (0.01%)
+// +2: buf[1~2] => Box voltage (0.01V)
+#define PACK_LINK_CANID 0x500
+#define PACK_LINK_PERIOD_MS 100
+//A box is lost once it misses this many periods in a row
+#define PACK_LINK_LOSS_PERIODS 3
+
+
+/* Every time a configuration message is received on box_identity.config_canid (0x6AA on box 0,
+   every next box 2 higher), byte(s) are staged into the config record:*/
+//buf[7] : Start Address (CONFIG_ADDRESS_START + CONFIG_OFFSET_*, or BOX_ID_EEPROM_ADDRESS)
 //buf[6] : # Of Bytes to write (1~6)
 //buf[5~0] : Actual values
-//if address == 0xFF, config is being reset on defaults on next boot.
-#define CONFIGURATION_CANID 0x6AA
-
-//first bit of buf[8] is box left (0) and box right (1)
-#define CONFIGURATION_ACK_CANID 0x6AB
+//Nothing takes effect until a commit, which validates the whole record, stores it & applies it
+//to the running BMS on its next tick. Box id bytes are written at once and take effect on next boot.
+#define CONFIGURATION_COMMIT 0xFE
+#define CONFIGURATION_DISCARD 0xFD
+#define CONFIGURATION_DEFAULTS 0xFF /* Stages the defaults */
+
+/* Sent back on the next id for every configuration message: */
+//buf[0] : ERROR_OFFSET of the box
+//buf[1] : Status (CONFIGURATION_ACK_*)
+//buf[2] : Generation of the applied record, bumped on every commit
+//buf[3] : CONFIG_VERSION
+#define CONFIGURATION_ACK_OFFSET 1
+#define CONFIGURATION_ACK_STAGED 0
+#define CONFIGURATION_ACK_COMMITTED 1
+#define CONFIGURATION_ACK_RANGE 2 /* Commit rejected, the staged values were dropped */
+#define CONFIGURATION_ACK_ADDRESS 3 /* Unknown address or byte count, nothing staged */
+
+/* Any message on the request id is answered with one message per slave: */
+// buf[0] => ERROR_OFFSET
+// buf[1] => Slave, last bit is set if the stack does not match the IVT
+// buf[2] => Failed checks (HEALTH_* bits)
+// buf[3~4] => Sum of cells (10mV resolution)
+// buf[5] => Die temperature (Celsius + 40)
+// buf[6] => VA ((V - 4) * 100)
+// buf[7] => VD ((V - 2) * 100)
+/* State of charge, sent periodically (SOC in 0.01% resolution) */
+// Pack: buf[0] => ERROR_OFFSET, buf[1~2] => Pack SOC, buf[3~4] => Min cell SOC, buf[5~6] => Max cell SOC,
+//       buf[7] => First bit is set while resting
+// Cells: buf[0] => ERROR_OFFSET, buf[1] => Index of the first cell, buf[2~7] => SOC of 3 cells
+#define SOC_PACK_OFFSET 0x0
+#define SOC_CELLS_OFFSET 0x1
+
+/* Cell resistance, sent periodically (0.1mOhm resolution) */
+// buf[0] => ERROR_OFFSET, buf[1] => Worst cell (0xFF until any is settled), buf[2~3] => Worst cell DCIR,
+// buf[4~5] => Pack average DCIR, buf[6] => Weak cells
+#define DCIR_OFFSET 0x2
+
+/* Current limits, sent periodically (0.1A resolution) */
+// buf[0] => ERROR_OFFSET, buf[1~2] => Max discharge current, buf[3~4] => Max charge (regen) current,
+// buf[5] => What limits discharge (SOP_LIMIT_*), buf[6] => What limits charge (SOP_LIMIT_*)
+#define SOP_OFFSET 0x3
+
+/* Precharge progress, sent while precharging */
+// buf[0] => ERROR_OFFSET, buf[1] => State (PRECHARGE_*), buf[2~3] => Bus voltage (0.1V),
+// buf[4~5] => Target voltage (0.1V), buf[6] => Bus over target (%), buf[7] => Time in state (100ms, saturates)
+#define PRECHARGE_OFFSET 0x4
+
+/* Measure cycle statistics, every CYCLE_STATS_PERIOD_MS. buf[0] => ERROR_OFFSET, buf[1] => Mode | Message << 4 */
+// Message 0 => buf[2~3] Mean, buf[4~5] 99th percentile, buf[6~7] Max (100us, per mode)
+// Message 1 => buf[2~3], buf[4~5], buf[6~7] Cycles past 50, 75 & 90% of the budget (per mode, saturate)
+// Message 2 (mode 0xF) => buf[2~3] Jitter mean, buf[4~5] Jitter max (100us), buf[6~7] Budget misses
+#define CYCLE_STATS_OFFSET 0x6
+#define CYCLE_STATS_PERIOD_MS 1000
+
+/* Flight recorder read out, repeated from inside the shutdown loop (see recorder.h) */
+// buf[0] => ERROR_OFFSET, buf[1~2] => Chunk
+// Chunk 0 => buf[3~4] Record size, buf[5~6] Number of records, buf[7] 0
+// Chunk n => buf[3~7] Bytes (n - 1) * 5 ~ n * 5 - 1 of the records, oldest first
+#define RECORDER_OFFSET 0x5
+#define RECORDER_CHUNK_BYTES 5
+
+#define HEALTH_REQUEST_OFFSET 0xC
+#define HEALTH_RESPONSE_OFFSET 0xD
+
+/* Any message on the request id is answered with 3 messages per span (TRACE_*): */
+// buf[0] => ERROR_OFFSET, buf[1] => Span | Message << 5
+// Message 0 => buf[2~4] Min, buf[5~7] Max
+// Message 1 => buf[2~4] Mean, buf[5~7] 99th percentile
+// Message 2 => buf[2~5] Count
+// Cycles (F_CPU), high byte first, saturated to 24 bits. Only answered with TRACE_ENABLE
+#define TRACE_REQUEST_OFFSET 0xA
+#define TRACE_RESPONSE_OFFSET 0xB
+
+/* ISO-TP (ISO 15765-2) session of every box: requests come in on ISO_TP_CANID + box * 2,
+   responses & flow control go out on the next id. First byte of every request is the service: */
+// ISO_TP_SERVICE_CONFIG => [1] Offset (CONFIG_OFFSET_*), [2~] Values. Staged & committed at once,
+//                          answered with [0] 0x41, [1] CONFIGURATION_ACK_*, [2] Generation, [3] CONFIG_VERSION
+// ISO_TP_SERVICE_DUMP => Answered with [0] 0x42, [1] Slaves, [2] Cells per slave, [3] Aux per slave (VRef included),
+//                        then every cell & aux code (100uV/LSB, high byte first)
+// Anything else is answered with [0] 0x7F, [1] Service
+#define ISO_TP_CANID 0x700
+#define ISO_TP_SERVICE_CONFIG 0x01
+#define ISO_TP_SERVICE_DUMP 0x02
+#define ISO_TP_RESPONSE 0x40 /* Added to the service */
+#define ISO_TP_NEGATIVE 0x7F
+
+//Largest message either way
+#define ISO_TP_MAX_LEN 1024
+//Flow control we ask senders for
+#define ISO_TP_BLOCK_SIZE 8
+#define ISO_TP_ST_MIN_MS 1
+//N_Bs / N_Cr, a session waiting this long for the other side is dropped
+#define ISO_TP_TIMEOUT_MS 1000
+//Frames are written in blocking mode (a single mailbox keeps them in order), each waiting this long at most
+#define ISO_TP_WRITE_TIMEOUT_MS 2
+#define ISO_TP_FRAMES_PER_TICK 16
+#define ISO_TP_PADDING 0xCC
 
 
 /* Can Message Layout on shutdown */
-// buf[7] => First bit is for left or right battery box, other 6 for the error code
+// buf[7] => Top 3 bits are the box (ERROR_OFFSET), other 5 for the error code
 // buf[6 ~ 3] => Value (mV, mA, Celsius (negative ~ positive)])
 // buf[2] => Index (If any) 
 #define SHUTDOWN_ERROR_CANID 0x600
 
-#if BOX_ID == BOX_LEFT
-  #define ERROR_OFFSET 0
-#else
-  #define ERROR_OFFSET 32 //B 100000
-#endif
+
 
 #define ERROR_UNKNOWN_CRITICAL 0
 #define ERROR_LTC_LOSS 1 /* Pec is wrong */
@@ -82,10 +186,20 @@ void output_high(uint8_t pin);
 #define ERROR_AMPS 4 /* Overcurrent */
 #define ERROR_TEMP 5 /* Too Cold / Too Hot */
 #define ERROR_MAX_MEASURE_DURATION 6 /* > 500mS loop time */
+#define ERROR_OPEN_WIRE 7 /* Broken sense lead, index is the cell on top of the wire */
+#define ERROR_SELF_TEST 8 /* Slave failed a self test, index is the slave, value the HEALTH_* bits */
+#define ERROR_PRECHARGE 9 /* Precharge timed out or was aborted, value is the state it failed in */
+#define ERROR_LINK_LOSS 10 /* Another box stopped sending its heartbeat, index is the box */
+#define ERROR_BOX_ID 11 /* Strapped as a box past the end of the pack, index is the box */
 
 #define IVT_SUCCESS 1
 #define IVT_OLD_MEASUREMENT -1
 
+//A measurement older than this is not a new one
+#define IVT_MAX_AGE_US 100000
+//No measurement for this long means the sensor is lost (ERROR_IVT_LOSS)
+#define IVT_LOSS_TIMEOUT_US 500000
+
 typedef struct ivt_measure_frame
 {
     int success;//see constants declared above
@@ -102,25 +216,79 @@ public:
 
     virtual uint32_t const * get_ids() = 0;
     virtual uint32_t get_id_num() = 0;
+
+    //Time source of every sample (us), see Clock
+    static uint32_t now_us();
+};
+
+//Most ids that can be dispatched & hardware filters of the FlexCAN rx fifo
+#define CAN_DISPATCH_MAX_IDS 16
+#define CAN_HW_FILTERS 8
+
+//Id -> Can_Sensor table, built once at boot out of the ids of every sensor (which may depend
+//on the box identity). Each message is matched with a binary search. The hardware filters
+//drop everything else before it reaches the fifo: with more ids than filters, low bits of the
+//mask are cleared until they fit, so a filter passes a small range & the search drops the rest.
+class Can_Dispatch
+{
+public:
+    //Every id the sensor reports is routed to it
+    void add(Can_Sensor * sensor);
+    //Id that gets through the filters, but is handled by the caller
+    void listen(uint32_t id);
+
+    //Sorts the table, programs the filters and starts the bus
+    void begin(FlexCAN * can);
+    //Only sorts the table, for messages that don't come from the bus (SIMULATION_ENABLE)
+    void sort();
+
+    //Hands the message to its sensor, false if none listens to it
+    bool dispatch(CAN_message_t message);
+
+    uint8_t get_id_num();
+
+    //Mask begin() programmed, 0 if it accepts everything
+    uint32_t get_mask();
+
+protected:
+    void add_id(uint32_t id, Can_Sensor * sensor);
+    //Distinct ids under the mask (sorted table), the first CAN_HW_FILTERS go into 'filters'
+    uint8_t get_filters(uint32_t mask, uint32_t * filters);
+
+    uint32_t ids[CAN_DISPATCH_MAX_IDS];
+    Can_Sensor * sensors[CAN_DISPATCH_MAX_IDS];
+    uint8_t id_num = 0;
+    uint32_t mask = 0;
 };
 
 //Current measure Can_Sensor that returns measure frames
-//and caches last successful measurement
+//and caches every signal along with the time it was received on
 class IVT : public Can_Sensor
 {
 public:
+    //success is IVT_SUCCESS as long as both signals are no older than IVT_MAX_AGE_US
     virtual IVTMeasureFrame_t tick();
     void update(CAN_message_t message);
 
+    //True if either signal has not been received for IVT_LOSS_TIMEOUT_US
+    virtual bool is_lost();
+
+    Sample_Cache const * get_amps();
+    Sample_Cache const * get_volts();
+
+    //Called with every current sample as soon as it is received, so it can be consumed
+    //at the rate of the sensor instead of once per tick (e.g. integrated)
+    void set_amps_callback(void (* callback)(Sample_Cache const *));
+
     uint32_t const * get_ids();
     uint32_t get_id_num();
 
 protected:
-    bool old_amps = false;
-    bool old_volts = false;
-    //Last successful measurement frame
-    float amps = 0;
-    float volts = 0;
+    void put_amps(float value, uint32_t now);
+
+    Sample_Cache amps{IVT_MAX_AGE_US};
+    Sample_Cache volts{IVT_MAX_AGE_US};
+    void (* amps_callback)(Sample_Cache const *) = nullptr;
 
     static const uint32_t id_num = 2;
     const uint32_t ids[id_num] = {IVT_CURRENT_CANID, IVT_VOLTAGE_CANID};
@@ -134,9 +302,10 @@ public:
     IVT_Dummy(float amps, float volts);
     IVTMeasureFrame_t tick();
     void update(CAN_message_t message);
+    bool is_lost();
     private:
-        const float amps;
-        const float volts;
+        const float dummy_amps;
+        const float dummy_volts;
 };
 
 typedef struct float_index_tuple{
@@ -146,13 +315,9 @@ typedef struct float_index_tuple{
 
 static constexpr Float_Index_Tuple_t empty_float_index = {0,0};
 
-//If volts = temp = 0 and mode != 1 | 2 => warning
-//If volts = temp = amps = -1 => critical error
-//If volts = temp = 0 , amps = -1 => Can_Sensor loss
-//Else, normal values indicate whats off-limit
 //In general, if mode < 0, something bad happened,
-//else, actual critical frame is provided and the non-zero member
-//tells what went wrong
+//else, actual critical frame is provided and its mode
+//tells which member went off-limit (any value, 0 included)
 typedef struct bms_critical_frame
 {
     int mode;
@@ -161,9 +326,21 @@ typedef struct bms_critical_frame
     Float_Index_Tuple_t amps;
 } BmsCriticalFrame_t;
 
+//volts holds the cell below uv or above ov
+static constexpr BmsCriticalFrame_t bms_volts_error{1, empty_float_index, empty_float_index, empty_float_index};
+//temp holds the sensor below ut or above ot
+static constexpr BmsCriticalFrame_t bms_temp_error{2, empty_float_index, empty_float_index, empty_float_index};
+//amps holds the current off-limit
+static constexpr BmsCriticalFrame_t bms_amps_error{3, empty_float_index, empty_float_index, empty_float_index};
 static constexpr BmsCriticalFrame_t bms_critical_error{-10, empty_float_index, empty_float_index, empty_float_index};
 static constexpr BmsCriticalFrame_t bms_pec_error{-1, empty_float_index, empty_float_index, empty_float_index};
 static constexpr BmsCriticalFrame_t bms_current_error{-2, empty_float_index, empty_float_index, empty_float_index};
+//volts.index holds the cell on top of the open wire, volts.value the wire number (C0~C12)
+static constexpr BmsCriticalFrame_t bms_open_wire_error{-3, empty_float_index, empty_float_index, empty_float_index};
+//volts.index holds the slave, volts.value the failed checks (HEALTH_* bits)
+static constexpr BmsCriticalFrame_t bms_self_test_error{-4, empty_float_index, empty_float_index, empty_float_index};
+//volts.index holds the box that got lost
+static constexpr BmsCriticalFrame_t bms_link_error{-5, empty_float_index, empty_float_index, empty_float_index};
 
 //The actual,non-dumb BMS class. It monitors through the Can_Sensors (Currently LTC6804_2 and IVT). You need to plug in
 //Some logic for it to work properly. All it does is to report values as a 'Critical BMS Frame'
@@ -188,6 +365,27 @@ class BMS
     
         void tick();
         void set_cfg(const uint8_t conf[6]);
+
+        //Balancing is off as long as no balancer is set
+        void set_balancer(Balancer * balancer);
+
+        //Open wire checks run in the background as long as a detector is set
+        void set_open_wire_detector(Open_Wire_Detector * open_wire);
+
+        //Self tests run in the background as long as they are set. run_self_test() runs all of them at once
+        void set_self_test(Self_Test * self_test);
+        void run_self_test();
+
+        Slave_Config * get_slave_config();
+
+        //Cells are fully read back every 'ticks' ticks, or whenever a slave flags a cell
+        void set_full_scan_period(uint8_t ticks);
+        //Also whenever the IVT current moved by 'amps' since the last read back, so a current
+        //step is seen by the cells right after it happened (0 turns it off)
+        void set_step_scan(float amps);
+
+        //New limits, the slaves get their VUV/VOV on the next tick. Call between ticks
+        void set_limits(float overvolts, float undervolts, float overtemp, float undertemp);
     
         uint16_t * cell_codes;
         uint16_t * aux_codes;
@@ -196,11 +394,39 @@ class BMS
         IVT * const ivt;
     
         const uint8_t total_ic;
-        const float ov, uv, ot, ut;
+        //Only changed through set_limits()
+        float ov, uv, ot, ut;
         const uint8_t cell_start, cell_end, aux_start, aux_end;
 
     protected:
       uint8_t const * config;
+      Slave_Config * const slave_config;
+      Balancer * balancer = nullptr;
+      Open_Wire_Detector * open_wire = nullptr;
+      Self_Test * self_test = nullptr;
+
+      uint8_t full_scan_period = 1;
+      float step_scan_amps = 0;
+      //IVT current at the last read back
+      float scan_amps = 0;
+      uint32_t ticks = 0;
+      uint32_t scan_sequence = 0;
+      //Cells were read back this tick (or by the constructor, before the first one)
+      bool scanned = false;
+
+      //Encodes uv/ov into VUV/VOV of every slave
+      void apply_thresholds();
+
+      //Software scan of the cell array, fires critical frames for any cell off-limits
+      void check_volts();
+      //Same for the temperatures
+      void check_temps();
+
+      //Runs a single step of the background diagnostics (open wire & self tests take turns)
+      void background_diagnostics();
+      bool is_self_test_turn();
+      void step_open_wire();
+      void step_self_test();
 
     public:
     
@@ -219,6 +445,10 @@ class BMS
       Float_Index_Tuple_t get_max_temp();
 
       float get_total_voltage();
+      float get_avg_volts();
+
+      //Bumped on every full read back of the cells, so consumers can tell fresh cell_codes apart
+      uint32_t get_scan_sequence();
 };
 
 //Drop in replacement for http://liionbms.com/php/standards.php
@@ -228,22 +458,73 @@ class Liion_Bms_Can_Adapter{
     static CAN_message_t VoltageMinMax(BMS * bms);
 };
 
+//Produces the state of charge can messages
+class Soc_Can_Adapter{
+  public:
+    static CAN_message_t pack(Coulomb_Counter * soc);
+
+    //3 cells per message, starting from the provided one
+    static CAN_message_t cells(Coulomb_Counter * soc, uint16_t first);
+};
+
+//Produces the cell resistance can messages
+class Dcir_Can_Adapter{
+  public:
+    static CAN_message_t pack(Dcir_Estimator * dcir);
+};
+
+//Produces the current limit can messages
+class Sop_Can_Adapter{
+  public:
+    static CAN_message_t limits(Power_Limits * sop);
+};
+
+//Produces the precharge progress can messages
+class Precharge_Can_Adapter{
+  public:
+    static CAN_message_t progress(Precharge * precharge, uint32_t now_ms);
+};
+
+//Produces the measure cycle statistics can messages
+class Latency_Can_Adapter{
+  public:
+    //Message 0 & 1 of every mode, then message 2 (see CYCLE_STATS_OFFSET)
+    static const uint8_t message_num = LATENCY_MODES * 2 + 1;
+    static CAN_message_t stats(Cycle_Monitor * monitor, uint8_t message);
+};
+
+//Produces the flight recorder read out can messages
+class Recorder_Can_Adapter{
+  public:
+    static CAN_message_t chunk(Flight_Recorder * recorder, uint16_t chunk);
+};
+
+//Produces the IVT frames of the simulated pack, laid out the way IVT::update() reads them
+class Sim_Can_Adapter{
+  public:
+    //Discharge is positive when current_sign is 1 (see SOC_CURRENT_SIGN)
+    static CAN_message_t ivt_current(Pack_Simulator * sim, int8_t current_sign);
+    static CAN_message_t ivt_voltage(Pack_Simulator * sim);
+  protected:
+    static CAN_message_t ivt(uint32_t id, uint8_t mux, uint8_t counter, float si);
+};
+
 // Accepts configuration 
 //and sends out proper can messages to the actual charger
 class Charger{
   public:
-    Charger(FlexCAN * can, uint16_t initial_volts, uint16_t initial_amps);
+    Charger(FlexCAN * can, uint16_t initial_volts, float initial_amps);
 
     virtual void send_charge_message();
 
     void set_volts(uint16_t v);
-    void set_amps(uint16_t a);
-    void set_volts_amps(uint16_t v, uint16_t a);
+    void set_amps(float a);
+    void set_volts_amps(uint16_t v, float a);
     
   protected:
     FlexCAN * const can;
     uint16_t volts = 0;
-    uint16_t amps = 0;
+    float amps = 0;
 };
 
 class Charger_Dummy : public Charger{
@@ -262,32 +543,125 @@ class Shutdown_Message_Factory{
     static CAN_message_t full(uint8_t error, uint32_t data, uint8_t index);
 };
 
-//The other battery box
-class Other_Battery_Box : public Can_Sensor{
+//Latest status of a box on the pack link
+typedef struct box_status
+{
+    uint16_t min_volts, max_volts; /* 100uV/LSB */
+    uint8_t min_volts_index, max_volts_index;
+    int16_t min_temp, max_temp; /* Celsius */
+    uint8_t min_temp_index, max_temp_index;
+    uint16_t soc; /* 0.01% */
+    float volts;
+    uint8_t mode, action;
+
+    bool seen;
+    uint8_t sequence;
+    uint32_t rx_us;
+    uint32_t missed;
+} Box_Status_t;
+
+//Extreme of the whole pack, along with where it is
+typedef struct pack_extreme
+{
+    float value;
+    uint8_t box;
+    uint8_t index;
+} Pack_Extreme_t;
+
+//Periodic status exchange between the battery boxes (any number up to PACK_MAX_BOXES).
+//Every box keeps the latest status of all the others, so any of them can work out the
+//whole pack statistics. Boxes that stop sending their heartbeat are lost after
+//PACK_LINK_LOSS_PERIODS periods.
+class Pack_Link : public Can_Sensor{
     public:
-      Other_Battery_Box(FlexCAN * can);
-    
+      Pack_Link(FlexCAN * can, uint8_t box_id, uint8_t box_num);
+
       void update(CAN_message_t message);
 
-      void send_total_voltage(float volts);
+      //Status of this box, out of the latest BMS statistics
+      void set_local(BMS * bms, uint16_t soc, uint8_t mode, uint8_t action);
+
+      //Sends the status of this box whenever a period is due
+      void tick(uint32_t now_ms);
+
+      bool is_alive(uint8_t box);
+      bool all_alive();
+
+      //A box that was seen and got lost since the last call, 0xFF if none
+      uint8_t check_lost();
+
+      Box_Status_t const * get_box(uint8_t box);
+
+      //Over every box that is alive
+      Pack_Extreme_t get_min_volts();
+      Pack_Extreme_t get_max_volts();
+      Pack_Extreme_t get_min_temp();
+      Pack_Extreme_t get_max_temp();
+      uint16_t get_min_soc();
+
+      //Lowest cell (100uV/LSB) of the pack, the balancing target of every box
+      uint16_t get_balance_floor();
+
+      //Voltage of every other box, 0 unless all of them are alive
+      float get_others_volts();
 
-      float get_volts();
-  
       uint32_t const * get_ids();
       uint32_t get_id_num();
+
+      const uint8_t box_id, box_num;
     protected:
-      static const uint32_t id_num = 1;
-      const uint32_t ids[id_num] = {OTHER_BOX_VOLTAGE_CANID};
+      void send(uint8_t frame);
+
+      FlexCAN * const can;
+
+      uint32_t ids[PACK_MAX_BOXES * 3];
+      uint32_t id_num = 0;
+
+      Box_Status_t boxes[PACK_MAX_BOXES];
+      bool reported_lost[PACK_MAX_BOXES];
+
+      uint8_t sequence = 0;
+      uint32_t last_send_ms = 0;
+};
+
+//Answers health requests with the self test table of every slave
+class Health_Reporter : public Can_Sensor{
+  public:
+      Health_Reporter(FlexCAN * can, Self_Test * self_test, uint32_t request_id, uint32_t response_id);
+
+      void update(CAN_message_t message);
 
-      FlexCAN * const can; 
+      uint32_t const * get_ids();
+      uint32_t get_id_num();
+  protected:
+     static const uint32_t id_num = 1;
+     uint32_t ids[id_num];
+     const uint32_t response_id;
 
-      //volts being 0 is illegal value // uncached
-      float volts = 0;
+     FlexCAN * const can;
+     Self_Test * const self_test;
+};
+
+//Answers trace requests with the statistics of every span
+class Trace_Reporter : public Can_Sensor{
+  public:
+      Trace_Reporter(FlexCAN * can, uint32_t request_id, uint32_t response_id);
+
+      void update(CAN_message_t message);
+
+      uint32_t const * get_ids();
+      uint32_t get_id_num();
+  protected:
+     static const uint32_t id_num = 1;
+     uint32_t ids[id_num];
+     const uint32_t response_id;
+
+     FlexCAN * const can;
 };
 
 class Configurator : public Can_Sensor{
   public:
-      Configurator(FlexCAN * can);
+      Configurator(FlexCAN * can, Configuration * config, uint32_t rx_id, uint32_t ack_id);
   
       void update(CAN_message_t message);
   
@@ -295,9 +669,66 @@ class Configurator : public Can_Sensor{
       uint32_t get_id_num();
   protected:
      static const uint32_t id_num = 1;
-     const uint32_t ids[id_num] = {CONFIGURATION_CANID};
+     uint32_t ids[id_num];
+     const uint32_t ack_id;
 
      FlexCAN * const can; 
+     Configuration * const config;
+};
+
+//Segmented transport over a pair of ids (normal addressing, 8 byte frames).
+//One session each way, both in fixed buffers. Sending is stepped from tick(), so
+//nothing ever waits on the other side: consecutive frames go out as fast as its
+//block size & STmin allow, and a session that stalls for ISO_TP_TIMEOUT_MS is dropped.
+class Iso_Tp : public Can_Sensor{
+    public:
+      Iso_Tp(FlexCAN * can, uint32_t rx_id, uint32_t tx_id);
+
+      void update(CAN_message_t message);
+
+      //Copies the message and starts sending it, false while busy or if too long
+      bool send(uint8_t const * data, uint16_t len);
+      bool is_sending();
+
+      //Sends whatever is due and drops stalled sessions
+      void tick(uint32_t now_ms);
+
+      //A complete message is held until released, anything coming in meanwhile is refused
+      bool available();
+      uint8_t const * get_rx();
+      uint16_t get_rx_len();
+      void release();
+
+      //Sessions dropped on timeouts, bad sequence numbers or overflows
+      uint32_t get_errors();
+
+      uint32_t const * get_ids();
+      uint32_t get_id_num();
+
+      const uint32_t rx_id, tx_id;
+    protected:
+      void send_flow_control(uint8_t status);
+      bool send_consecutive();
+
+      FlexCAN * const can;
+
+      static const uint32_t id_num = 1;
+      uint32_t ids[id_num];
+
+      uint8_t rx[ISO_TP_MAX_LEN];
+      uint16_t rx_len = 0, rx_pos = 0;
+      uint8_t rx_sequence = 0, rx_block = 0;
+      bool rx_active = false, rx_ready = false;
+      uint32_t rx_last_ms = 0;
+
+      uint8_t tx[ISO_TP_MAX_LEN];
+      uint16_t tx_len = 0, tx_pos = 0;
+      uint8_t tx_sequence = 0;
+      uint8_t tx_block_size = 0, tx_block = 0;
+      uint32_t tx_st_min_us = 0, tx_last_us = 0, tx_last_ms = 0;
+      bool tx_active = false, tx_waiting = false; /* Waiting for flow control */
+
+      uint32_t errors = 0;
 };
 
 #endif //FRAMEWORK_H
@@ -0,0 +1,40 @@
+#include <Arduino.h>
+#include "config.h"
+#include "identity.h"
+
+//Per box ids, the first 2 are the ones the left & right images used to be built with
+static const Box_Identity_t id_map[PACK_MAX_BOXES] =
+{
+    {BOX_LEFT, 0, 0x64D, 0x4F0, 0x6AA, 0},
+    {BOX_RIGHT, 32, 0x61D, 0x4E0, 0x6AC, 0},
+    {2, 64, 0x62D, 0x4D0, 0x6AE, 0},
+    {3, 96, 0x63D, 0x4C0, 0x6B0, 0}
+};
+
+Box_Identity_t box_identity = id_map[BOX_LEFT];
+
+bool load_box_identity(uint8_t pin_0, uint8_t pin_1, uint8_t box_num)
+{
+    uint8_t id = EEPROM.read(BOX_ID_EEPROM_ADDRESS);
+    uint8_t check = EEPROM.read(BOX_ID_EEPROM_ADDRESS + 1);
+    uint8_t source = BOX_ID_SOURCE_EEPROM;
+
+    if((uint8_t) ~check != id || id >= box_num || id >= PACK_MAX_BOXES)
+    {
+        pinMode(pin_0, INPUT_PULLUP);
+        pinMode(pin_1, INPUT_PULLUP);
+        id = (digitalRead(pin_0) == LOW ? 1 : 0) | (digitalRead(pin_1) == LOW ? 2 : 0);
+        source = id < box_num ? BOX_ID_SOURCE_PINS : BOX_ID_SOURCE_INVALID;
+    }
+
+    box_identity = id_map[id];
+    box_identity.source = source;
+
+#if DEBUG
+    Serial.print("Box #");
+    Serial.print(id);
+    Serial.println(source == BOX_ID_SOURCE_EEPROM ? " (EEPROM)" : source == BOX_ID_SOURCE_PINS ? " (pins)" : " (invalid)");
+#endif
+
+    return source != BOX_ID_SOURCE_INVALID;
+}
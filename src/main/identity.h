@@ -0,0 +1,39 @@
+/* Identity of the battery box, picked at boot so one image serves every box */
+#ifndef IDENTITY_H
+#define IDENTITY_H
+
+#include <stdint.h>
+
+#define PACK_MAX_BOXES 4
+
+//Box indexes of the original 2 box pack
+#define BOX_LEFT 0
+#define BOX_RIGHT 1
+
+/* EEPROM layout: box id, inverted box id. Writable through the configuration id,
+   anything invalid (e.g. a blank EEPROM, a box past the end of the pack) falls back to the strapping pins */
+#define BOX_ID_EEPROM_ADDRESS 20
+
+//Where the identity came from
+#define BOX_ID_SOURCE_EEPROM 0
+#define BOX_ID_SOURCE_PINS 1
+#define BOX_ID_SOURCE_INVALID 2 /* The pins too point past the end of the pack */
+
+typedef struct box_identity
+{
+    uint8_t box_id;
+    uint8_t error_offset; /* Added to every error code, tells the boxes apart on the bus */
+    uint16_t liion_start_canid; /* http://liionbms.com/php/standards.php */
+    uint16_t telemetry_canid; /* Base of the *_OFFSET ids in framework.h */
+    uint16_t config_canid; /* Configuration messages, acked on the next id */
+    uint8_t source;
+} Box_Identity_t;
+
+//Loaded once by load_box_identity(), plain reads from then on
+extern Box_Identity_t box_identity;
+
+//Reads the box id from the EEPROM or, if not set, from 2 strapping pins (grounded = 1).
+//False if neither gives a box below box_num, the identity of the pins is kept but flagged
+bool load_box_identity(uint8_t pin_0, uint8_t pin_1, uint8_t box_num);
+
+#endif //IDENTITY_H
@@ -0,0 +1,184 @@
+#include <Arduino.h>
+#include "config.h"
+#include "journal.h"
+
+#define RECORD_NUM (JOURNAL_PAGES * JOURNAL_PAGE_RECORDS)
+#define RECORD_ADDRESS(r) (JOURNAL_START + (r) * JOURNAL_RECORD_SIZE)
+
+//CRC-8 (poly 0x07)
+static uint8_t crc8(uint8_t crc, uint8_t byte)
+{
+    crc ^= byte;
+    for(uint8_t i = 0; i < 8; i++)
+    {
+        crc = crc & 0x80 ? (crc << 1) ^ 0x07 : crc << 1;
+    }
+    return crc;
+}
+
+Eeprom_Journal::Eeprom_Journal()
+{
+    for(uint8_t i = 0; i < JOURNAL_MAX_KEYS; i++)
+    {
+        records[i] = 0;
+        values[i] = 0;
+        present[i] = false;
+    }
+}
+
+uint32_t Eeprom_Journal::get_scan_us(){ return this->scan_us; }
+uint32_t Eeprom_Journal::get_sequence(){ return this->sequence; }
+uint32_t Eeprom_Journal::get_writes(){ return this->writes; }
+
+void Eeprom_Journal::load()
+{
+    uint32_t start_us = micros();
+    uint32_t sequences[JOURNAL_MAX_KEYS];
+    bool any = false;
+
+    for(uint16_t r = 0; r < RECORD_NUM; r++)
+    {
+        uint8_t key;
+        uint32_t seq, value;
+        if(!read_record(r, &key, &seq, &value))
+        {
+            continue;
+        }
+
+        if(!present[key] || seq > sequences[key])
+        {
+            present[key] = true;
+            sequences[key] = seq;
+            records[key] = r;
+            values[key] = value;
+        }
+
+        //Head goes right after the newest record
+        if(!any || seq > sequence)
+        {
+            any = true;
+            this->sequence = seq;
+            this->head = (r + 1) % RECORD_NUM;
+        }
+    }
+    this->scan_us = micros() - start_us;
+
+#if DEBUG
+    Serial.print("Journal scan (us) -> ");
+    Serial.print(scan_us);
+    Serial.print(" seq -> ");
+    Serial.println(sequence);
+#endif
+}
+
+bool Eeprom_Journal::read(uint8_t key, uint32_t * value)
+{
+    if(key >= JOURNAL_MAX_KEYS || !present[key])
+    {
+        return false;
+    }
+    *value = values[key];
+    return true;
+}
+
+void Eeprom_Journal::write(uint8_t key, uint32_t value)
+{
+    if(key >= JOURNAL_MAX_KEYS || (present[key] && values[key] == value))
+    {
+        return;
+    }
+    uint16_t r = next_free();
+    write_record(r, key, value);
+}
+
+uint16_t Eeprom_Journal::next_free()
+{
+    while(head % JOURNAL_PAGE_RECORDS >= JOURNAL_PAGE_RECORDS - JOURNAL_RESERVED_RECORDS)
+    {
+        uint16_t next_page = (head / JOURNAL_PAGE_RECORDS + 1) % JOURNAL_PAGES;
+
+        //First live record of the next page, if any, gets copied here
+        uint8_t live = JOURNAL_MAX_KEYS;
+        for(uint8_t k = 0; k < JOURNAL_MAX_KEYS; k++)
+        {
+            if(present[k] && records[k] / JOURNAL_PAGE_RECORDS == next_page)
+            {
+                live = k;
+                break;
+            }
+        }
+
+        if(live == JOURNAL_MAX_KEYS)
+        {
+            //Nothing left in there, the rest of the reserve is skipped
+            this->head = next_page * JOURNAL_PAGE_RECORDS;
+            break;
+        }
+        write_record(head, live, values[live]);
+    }
+    return head;
+}
+
+bool Eeprom_Journal::read_record(uint16_t record, uint8_t * key, uint32_t * sequence, uint32_t * value)
+{
+    uint16_t address = RECORD_ADDRESS(record);
+    uint8_t crc = 0;
+    uint8_t bytes[JOURNAL_RECORD_SIZE];
+
+    for(uint8_t i = 0; i < JOURNAL_RECORD_SIZE; i++)
+    {
+        bytes[i] = EEPROM.read(address + i);
+        if(i < JOURNAL_RECORD_SIZE - 1)
+        {
+            crc = crc8(crc, bytes[i]);
+        }
+    }
+
+    //Blank records (0xFF) fail the key check
+    if(bytes[0] >= JOURNAL_MAX_KEYS || bytes[JOURNAL_RECORD_SIZE - 1] != crc)
+    {
+        return false;
+    }
+
+    *key = bytes[0];
+    *sequence = (uint32_t) bytes[1] << 24 | (uint32_t) bytes[2] << 16 | (uint32_t) bytes[3] << 8 | bytes[4];
+    *value = (uint32_t) bytes[5] << 24 | (uint32_t) bytes[6] << 16 | (uint32_t) bytes[7] << 8 | bytes[8];
+    return true;
+}
+
+void Eeprom_Journal::write_record(uint16_t record, uint8_t key, uint32_t value)
+{
+    uint16_t address = RECORD_ADDRESS(record);
+    uint32_t seq = sequence + 1;
+    uint8_t bytes[JOURNAL_RECORD_SIZE] =
+    {
+        key,
+        (uint8_t) (seq >> 24), (uint8_t) (seq >> 16), (uint8_t) (seq >> 8), (uint8_t) seq,
+        (uint8_t) (value >> 24), (uint8_t) (value >> 16), (uint8_t) (value >> 8), (uint8_t) value,
+        0
+    };
+
+    uint8_t crc = 0;
+    for(uint8_t i = 0; i < JOURNAL_RECORD_SIZE - 1; i++)
+    {
+        crc = crc8(crc, bytes[i]);
+    }
+    bytes[JOURNAL_RECORD_SIZE - 1] = crc;
+
+    //The key commits the record: blanked first & written last, so a record torn anywhere in
+    //between has no key instead of relying on the CRC to catch a half old, half new record
+    EEPROM.write(address, 0xFF);
+    for(uint8_t i = 1; i < JOURNAL_RECORD_SIZE; i++)
+    {
+        EEPROM.write(address + i, bytes[i]);
+    }
+    EEPROM.write(address, bytes[0]);
+
+    this->sequence = seq;
+    this->head = (record + 1) % RECORD_NUM;
+    this->writes++;
+
+    records[key] = record;
+    values[key] = value;
+    present[key] = true;
+}
@@ -0,0 +1,66 @@
+/* Wear leveled key/value journal for state that changes while running */
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <stdint.h>
+
+//Keys, at most JOURNAL_MAX_KEYS of them
+#define JOURNAL_KEY_SOC 0 /* 0.01% */
+#define JOURNAL_KEY_CHARGE_CYCLES 1 /* Completed charges */
+#define JOURNAL_KEY_SHUTDOWNS 2 /* Number of shutdowns */
+#define JOURNAL_KEY_LAST_SHUTDOWN 3 /* Error code of the last shutdown */
+#define JOURNAL_MAX_KEYS 6
+
+/* EEPROM region, after the configuration slots. Record layout:
+   [0] Key, [1~4] Sequence, [5~8] Value (high byte first), [9] CRC-8 */
+#define JOURNAL_START 256
+#define JOURNAL_RECORD_SIZE 10
+#define JOURNAL_PAGE_RECORDS 22
+#define JOURNAL_PAGES 8
+
+//Last records of every page are kept for moving the live records out of the next page
+#define JOURNAL_RESERVED_RECORDS JOURNAL_MAX_KEYS
+
+//Log structured journal: every write appends a record with the next sequence number,
+//so the cells are written in turn instead of in place. Before the head enters a page,
+//whatever is still live in it is copied into the reserved records of the current page,
+//so a power loss at any point leaves either the old or the new record readable.
+//The boot scan reads every record once (JOURNAL_PAGES * JOURNAL_PAGE_RECORDS), reads
+//afterwards come from RAM.
+class Eeprom_Journal
+{
+public:
+    Eeprom_Journal();
+
+    //Recovery scan, rebuilds the index & finds the head
+    void load();
+
+    //False if the key was never written
+    bool read(uint8_t key, uint32_t * value);
+    void write(uint8_t key, uint32_t value);
+
+    uint32_t get_scan_us();
+    uint32_t get_sequence();
+    //Records written since boot, relocations included
+    uint32_t get_writes();
+
+protected:
+    bool read_record(uint16_t record, uint8_t * key, uint32_t * sequence, uint32_t * value);
+    void write_record(uint16_t record, uint8_t key, uint32_t value);
+
+    //Moves the head forward, relocating the live records of the next page when needed
+    uint16_t next_free();
+
+    uint16_t head = 0;
+    uint32_t sequence = 0;
+
+    //Index of the live record of every key
+    uint16_t records[JOURNAL_MAX_KEYS];
+    uint32_t values[JOURNAL_MAX_KEYS];
+    bool present[JOURNAL_MAX_KEYS];
+
+    uint32_t scan_us = 0;
+    uint32_t writes = 0;
+};
+
+#endif //JOURNAL_H
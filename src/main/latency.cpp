@@ -0,0 +1,103 @@
+#include <Arduino.h>
+#include "config.h"
+#include "latency.h"
+
+const uint8_t Cycle_Monitor::near_miss_percent[LATENCY_NEAR_MISS_LEVELS] = {50, 75, 90};
+
+Cycle_Monitor::Cycle_Monitor(uint32_t budget_us) : budget_us(budget_us)
+{
+    for(uint8_t mode = 0; mode < LATENCY_MODES; mode++)
+    {
+        cycles[mode] = Latency_Histogram_t{};
+        misses[mode] = 0;
+        for(uint8_t level = 0; level < LATENCY_NEAR_MISS_LEVELS; level++)
+        {
+            near_misses[mode][level] = 0;
+        }
+    }
+    jitter = Latency_Histogram_t{};
+}
+
+void Cycle_Monitor::put(Latency_Histogram_t * h, uint32_t us)
+{
+    uint8_t b = us == 0 ? 0 : 32 - __builtin_clz(us);
+    b = b >= LATENCY_BUCKETS ? LATENCY_BUCKETS - 1 : b;
+
+    h->count++;
+    h->sum_us += us;
+    h->max_us = us > h->max_us ? us : h->max_us;
+    if(h->buckets[b] != 0xFFFF)
+    {
+        h->buckets[b]++;
+    }
+}
+
+bool Cycle_Monitor::update(uint8_t mode, uint32_t start_us, uint32_t end_us)
+{
+    mode = mode >= LATENCY_MODES ? 0 : mode;
+    uint32_t us = end_us - start_us;
+    this->last_us = us;
+
+    put(&cycles[mode], us);
+
+    //Jitter needs 2 periods, so 3 starts
+    if(starts > 0)
+    {
+        uint32_t period = start_us - last_start_us;
+        if(starts > 1)
+        {
+            put(&jitter, period > last_period_us ? period - last_period_us : last_period_us - period);
+        }
+        this->last_period_us = period;
+    }
+    this->starts = starts < 2 ? starts + 1 : 2;
+    this->last_start_us = start_us;
+
+    for(uint8_t level = 0; level < LATENCY_NEAR_MISS_LEVELS; level++)
+    {
+        if((uint64_t) us * 100 >= (uint64_t) budget_us * near_miss_percent[level])
+        {
+            near_misses[mode][level]++;
+        }
+    }
+
+    if(us > budget_us)
+    {
+        misses[mode]++;
+        return true;
+    }
+    return false;
+}
+
+Latency_Histogram_t const * Cycle_Monitor::get_cycles(uint8_t mode){ return &cycles[mode >= LATENCY_MODES ? 0 : mode]; }
+Latency_Histogram_t const * Cycle_Monitor::get_jitter(){ return &jitter; }
+
+uint32_t Cycle_Monitor::get_near_misses(uint8_t mode, uint8_t level){ return near_misses[mode][level]; }
+uint32_t Cycle_Monitor::get_misses(uint8_t mode){ return misses[mode]; }
+uint32_t Cycle_Monitor::get_last_us(){ return this->last_us; }
+
+uint32_t Cycle_Monitor::get_mean_us(Latency_Histogram_t const * h)
+{
+    return h->count == 0 ? 0 : h->sum_us / h->count;
+}
+
+uint32_t Cycle_Monitor::get_percentile_us(Latency_Histogram_t const * h, uint8_t percent)
+{
+    uint32_t total = 0;
+    for(uint8_t b = 0; b < LATENCY_BUCKETS; b++)
+    {
+        total += h->buckets[b];
+    }
+
+    uint32_t target = (total * percent + 99) / 100, seen = 0;
+    for(uint8_t b = 0; b < LATENCY_BUCKETS; b++)
+    {
+        seen += h->buckets[b];
+        if(seen >= target && seen != 0)
+        {
+            uint32_t top = b == 0 ? 0 : (b == LATENCY_BUCKETS - 1 ? 0xFFFFFFFF : (1UL << b) - 1);
+            return top < h->max_us ? top : h->max_us;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,63 @@
+/* Measure cycle latency monitor */
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <stdint.h>
+
+//Same modes as the fault policy (FAULT_MODE_*)
+#define LATENCY_MODES 3
+
+//Bucket b holds [2^(b-1), 2^b) us, bucket 0 holds 0 us. The last one takes anything longer
+#define LATENCY_BUCKETS 24
+
+//Near misses are counted at these fractions (%) of the budget
+#define LATENCY_NEAR_MISS_LEVELS 3
+
+typedef struct latency_histogram
+{
+    uint32_t count;
+    uint64_t sum_us;
+    uint32_t max_us;
+    uint16_t buckets[LATENCY_BUCKETS]; /* Saturate */
+} Latency_Histogram_t;
+
+//Keeps a log bucketed histogram of the cycle time of every mode, one of the jitter
+//(difference between consecutive start to start periods) and counts the cycles that got
+//past 50/75/90% of the budget or missed it. Every update is a handful of integer ops.
+class Cycle_Monitor
+{
+public:
+    Cycle_Monitor(uint32_t budget_us);
+
+    //Returns true if the cycle missed the budget
+    bool update(uint8_t mode, uint32_t start_us, uint32_t end_us);
+
+    Latency_Histogram_t const * get_cycles(uint8_t mode);
+    Latency_Histogram_t const * get_jitter();
+
+    uint32_t get_mean_us(Latency_Histogram_t const * h);
+    //Upper bound of the bucket the percentile (0~100) falls in, capped to the max
+    uint32_t get_percentile_us(Latency_Histogram_t const * h, uint8_t percent);
+
+    uint32_t get_near_misses(uint8_t mode, uint8_t level);
+    uint32_t get_misses(uint8_t mode);
+    uint32_t get_last_us();
+
+    static const uint8_t near_miss_percent[LATENCY_NEAR_MISS_LEVELS];
+
+    const uint32_t budget_us;
+
+protected:
+    static void put(Latency_Histogram_t * h, uint32_t us);
+
+    Latency_Histogram_t cycles[LATENCY_MODES];
+    Latency_Histogram_t jitter;
+
+    uint32_t near_misses[LATENCY_MODES][LATENCY_NEAR_MISS_LEVELS];
+    uint32_t misses[LATENCY_MODES];
+
+    uint32_t last_start_us = 0, last_period_us = 0, last_us = 0;
+    uint8_t starts = 0;
+};
+
+#endif //LATENCY_H
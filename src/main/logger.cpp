@@ -0,0 +1,201 @@
+#include <Arduino.h>
+#include <SD.h>
+#include "config.h"
+#include "logger.h"
+
+static File file;
+
+//Worst case sizes (varints of 32 bit values take 5 bytes, of 16 bit deltas 3)
+#define MAX_EVENT_SIZE (1 + 5 + 1 + 5)
+#define MAX_TICK_SIZE(values) (1 + 5 + (values) * 3 + 5 + 5)
+
+Data_Logger::Data_Logger(uint8_t cs_pin, uint16_t cell_num, uint8_t aux_num) :
+    cs_pin(cs_pin), cell_num(cell_num), aux_num(aux_num)
+{
+    this->last_codes = (uint16_t *) malloc(sizeof(uint16_t) * (cell_num + aux_num));
+}
+
+bool Data_Logger::is_enabled(){ return this->enabled; }
+uint32_t Data_Logger::get_dropped(){ return this->dropped; }
+uint32_t Data_Logger::get_blocks(){ return this->written; }
+
+bool Data_Logger::begin()
+{
+    if(MAX_TICK_SIZE(cell_num + aux_num) > LOG_BLOCK_SIZE - LOG_HEADER_SIZE || !SD.begin(cs_pin))
+    {
+#if DEBUG
+        Serial.println("No SD card, logging is off");
+#endif
+        return false;
+    }
+
+    char name[] = "LOG00.BIN";
+    for(uint8_t i = 0; i < 100; i++)
+    {
+        name[3] = '0' + i / 10;
+        name[4] = '0' + i % 10;
+        if(!SD.exists(name))
+        {
+            file = SD.open(name, FILE_WRITE);
+            this->enabled = file;
+            break;
+        }
+    }
+
+#if DEBUG
+    Serial.print("Logging to ");
+    Serial.println(enabled ? name : "nowhere");
+#endif
+    return enabled;
+}
+
+void Data_Logger::put(uint8_t byte)
+{
+    blocks[active][pos++] = byte;
+}
+
+void Data_Logger::put_varint(uint32_t value)
+{
+    while(value >= 0x80)
+    {
+        put((value & 0x7F) | 0x80);
+        value >>= 7;
+    }
+    put(value);
+}
+
+void Data_Logger::put_delta(int32_t value, int32_t last)
+{
+    int32_t delta = value - last;
+    put_varint(((uint32_t) delta << 1) ^ (uint32_t) (delta >> 31));
+}
+
+bool Data_Logger::reserve(uint16_t size, uint32_t now_ms)
+{
+    //Record count is a byte too
+    if(pos + size > LOG_BLOCK_SIZE || (pos > LOG_HEADER_SIZE && blocks[active][3] == 0xFF))
+    {
+        if(pending[active ^ 1])
+        {
+            this->dropped++;
+            return false;
+        }
+        close_block();
+        this->active ^= 1;
+        this->pos = LOG_HEADER_SIZE;
+    }
+
+    if(pos == LOG_HEADER_SIZE)
+    {
+        uint8_t * block = blocks[active];
+        memset(block, LOG_RECORD_END, LOG_BLOCK_SIZE);
+        block[0] = 'B';
+        block[1] = 'L';
+        block[2] = LOG_FORMAT_VERSION;
+        block[3] = 0;
+        block[4] = sequence >> 24;
+        block[5] = sequence >> 16;
+        block[6] = sequence >> 8;
+        block[7] = sequence;
+        block[8] = now_ms >> 24;
+        block[9] = now_ms >> 16;
+        block[10] = now_ms >> 8;
+        block[11] = now_ms;
+        block[12] = cell_num >> 8;
+        block[13] = cell_num;
+        block[14] = aux_num;
+
+        this->sequence++;
+        this->last_ms = now_ms;
+        this->keyframe = true;
+    }
+
+    blocks[active][3]++;
+    return true;
+}
+
+void Data_Logger::close_block()
+{
+    if(pos > LOG_HEADER_SIZE)
+    {
+        pending[active] = true;
+    }
+}
+
+void Data_Logger::log_tick(uint32_t now_ms, const uint16_t * cell_codes, const uint16_t * aux_codes, float amps, float volts)
+{
+    if(!enabled || !reserve(MAX_TICK_SIZE(cell_num + aux_num), now_ms))
+    {
+        return;
+    }
+
+    put(LOG_RECORD_TICK);
+    put_varint(now_ms - last_ms);
+    this->last_ms = now_ms;
+
+    for(uint16_t i = 0; i < cell_num + aux_num; i++)
+    {
+        uint16_t code = i < cell_num ? *(cell_codes + i) : *(aux_codes + i - cell_num);
+        put_delta(code, keyframe ? 0 : *(last_codes + i));
+        *(last_codes + i) = code;
+    }
+
+    int32_t ma = amps * 1000, mv = volts * 1000;
+    put_delta(ma, keyframe ? 0 : last_ma);
+    put_delta(mv, keyframe ? 0 : last_mv);
+    this->last_ma = ma;
+    this->last_mv = mv;
+    this->keyframe = false;
+}
+
+void Data_Logger::log_event(uint32_t now_ms, uint8_t event, uint32_t data)
+{
+    if(!enabled || !reserve(MAX_EVENT_SIZE, now_ms))
+    {
+        return;
+    }
+
+    put(LOG_RECORD_EVENT);
+    put_varint(now_ms - last_ms);
+    this->last_ms = now_ms;
+    put(event);
+    put_varint(data);
+}
+
+bool Data_Logger::service()
+{
+    if(!enabled)
+    {
+        return false;
+    }
+
+    //Older block first, the active one is never pending
+    uint8_t full = active ^ 1;
+    if(!pending[full])
+    {
+        return false;
+    }
+
+    file.write(blocks[full], LOG_BLOCK_SIZE);
+    this->pending[full] = false;
+    if(++written % LOG_SYNC_BLOCKS == 0)
+    {
+        file.flush();
+    }
+    return true;
+}
+
+void Data_Logger::flush()
+{
+    if(!enabled)
+    {
+        return;
+    }
+
+    service();
+    close_block();
+    this->active ^= 1;
+    this->pos = LOG_HEADER_SIZE;
+    service();
+    file.flush();
+}
@@ -0,0 +1,86 @@
+/* Tick by tick data logger on an SD card */
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include <stdint.h>
+
+/* Logs are a sequence of LOG_BLOCK_SIZE blocks, each one decodable on its own:
+   [0~1] "BL", [2] LOG_FORMAT_VERSION, [3] Number of records, [4~7] Block sequence,
+   [8~11] Time of the first record (ms), [12~13] Cells per tick, [14] Aux per tick, [15] Reserved.
+   Every record then starts with its type & the time since the previous record (ms, varint):
+   LOG_RECORD_TICK => Cell codes, aux codes, IVT current (mA) & voltage (mV), each one as the
+                      zigzag varint of the difference with the previous tick of the block
+                      (the first tick of every block is against 0)
+   LOG_RECORD_EVENT => [0] LOG_EVENT_*, then its data as a varint
+   The rest of a block is 0 (LOG_RECORD_END). Blocks are in time order and fixed size,
+   so a reader can seek by time with a binary search over the block headers */
+#define LOG_BLOCK_SIZE 512
+#define LOG_HEADER_SIZE 16
+#define LOG_FORMAT_VERSION 1
+
+#define LOG_RECORD_END 0
+#define LOG_RECORD_TICK 1
+#define LOG_RECORD_EVENT 2
+
+#define LOG_EVENT_FAULT 1 /* Fault class << 8 | Action */
+#define LOG_EVENT_CONFIG 2 /* Generation of the applied config */
+#define LOG_EVENT_SHUTDOWN 3 /* Error code as sent on the bus */
+
+//The file is synced every this many blocks
+#define LOG_SYNC_BLOCKS 8
+
+//Records are encoded into one block while the other one waits to be written. Writing is left
+//to service(), which the loop calls once its tick is done, so logging itself is a few
+//hundred cycles of encoding. If both blocks are full the record is dropped, never waited for.
+class Data_Logger
+{
+public:
+    Data_Logger(uint8_t cs_pin, uint16_t cell_num, uint8_t aux_num);
+
+    //Opens the next free LOGnn.BIN, false (and every call a no-op) without a card
+    bool begin();
+
+    void log_tick(uint32_t now_ms, const uint16_t * cell_codes, const uint16_t * aux_codes, float amps, float volts);
+    void log_event(uint32_t now_ms, uint8_t event, uint32_t data);
+
+    //Writes a full block, if any. True if the SPI bus was used
+    bool service();
+
+    //Closes the current block & writes everything, blocking
+    void flush();
+
+    bool is_enabled();
+    uint32_t get_dropped();
+    uint32_t get_blocks();
+
+    const uint8_t cs_pin;
+    const uint16_t cell_num;
+    const uint8_t aux_num;
+
+protected:
+    //Room for any record in a fresh block, false if there is no block to write into
+    bool reserve(uint16_t size, uint32_t now_ms);
+    void close_block();
+
+    void put(uint8_t byte);
+    void put_varint(uint32_t value);
+    void put_delta(int32_t value, int32_t last);
+
+    uint8_t blocks[2][LOG_BLOCK_SIZE];
+    uint8_t active = 0;
+    uint16_t pos = LOG_HEADER_SIZE;
+    bool pending[2] = {false, false};
+
+    //Previous tick of the block, for the deltas
+    uint16_t * last_codes;
+    int32_t last_ma = 0, last_mv = 0;
+    bool keyframe = true;
+
+    uint32_t last_ms = 0;
+    uint32_t sequence = 0;
+    uint32_t dropped = 0;
+    uint32_t written = 0;
+    bool enabled = false;
+};
+
+#endif //LOGGER_H
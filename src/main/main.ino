@@ -10,6 +10,14 @@
 #define CHARGE_PIN 16
 #define CHARGE_PIN_IDLE 0 //If CHARGE_PIN == CHARGE_PIN_IDLE => Drive Mode
 
+//Strapping pins of the box id, only used when the EEPROM has none (see identity.h)
+#define BOX_ID_PIN_0 22
+#define BOX_ID_PIN_1 23
+
+//Relays of the precharge circuit (only on the box that owns it), HIGH closes them
+#define PRECHARGE_RELAY_PIN 17
+#define MAIN_CONTACTOR_PIN 18
+
 //Number of LTC6811-2 Multicell battery monitors
 //When setting up, make sure that id's start from 0 and go up by increments of 1
 #define SLAVE_NUM 1
@@ -31,6 +39,51 @@
 #define GPIO_IGNORE_INDEX_START 0
 #define GPIO_IGNORE_INDEX_END 5
 
+//Slaves flag under/over voltages on their own on every conversion, so the
+//whole cell array is only read back every few ticks (or when flagged).
+//The period & the ADC mode are part of the configuration (CONFIG_OFFSET_SCAN_PERIOD)
+
+//Passive balancing while charging
+//A cell starts bleeding when it is BALANCE_THRESHOLD (100uV/LSB) above the lowest cell
+#define BALANCE_THRESHOLD 100
+//Bleed resistors of a slave share the same board, so limit how many are on at once
+#define BALANCE_MAX_BLEEDERS_PER_SLAVE 4
+//Slaves stop bleeding on their own if we stop talking to them
+#define BALANCE_DCTO DCTO_30_SEC
+//Ticks of bleeding between each bleeder-free measurement
+#define BALANCE_TICKS 10
+
+//Capacity of a cell group (INR18650-13Q is 1300mAh, times the cells in parallel)
+#define SOC_CAPACITY_MAH 1300
+//Set to -1 if the IVT reads discharge currents as negative
+#define SOC_CURRENT_SIGN 1
+
+//Rated currents of a cell group (INR18650-13Q: 20A continuous discharge, 4A charge), times the cells in parallel
+#define SOP_MAX_DISCHARGE_AMPS 20.0
+#define SOP_MAX_CHARGE_AMPS 4.0
+
+//CC-CV charging of the INR18650-13Q (standard charge is 0.65A, times the cells in parallel)
+#define CHARGE_CC_AMPS 0.65
+#define CHARGE_CV_VOLTS 4.2
+//Charge ends once the current tapers down to 0.05C
+#define CHARGE_TAPER_AMPS 0.065
+
+//Battery boxes on the pack link
+#define PACK_BOX_NUM 2
+//Voltage the charger is capped to, every cell of every box in series at CHARGE_CV_VOLTS (SI resolution)
+#define CHARGE_PACK_VOLTS (PACK_BOX_NUM * SLAVE_NUM * (CELL_IGNORE_INDEX_END - CELL_IGNORE_INDEX_START) * CHARGE_CV_VOLTS)
+//The box that sees the bus through the IVT and drives the precharge circuit
+#define PRECHARGE_OWNER_BOX BOX_RIGHT
+
+//Max difference between the sum of cells of every slave and the IVT (minus the other boxes)
+#define STACK_IVT_TOLERANCE 2.0
+
+//Chip select of the SD card, shares the SPI bus with the slaves (only with LOG_ENABLE)
+#define LOG_SD_CS_PIN 4
+
+//Seed of the cell to cell spread of the simulated pack (only with SIMULATION_ENABLE)
+#define SIM_PACK_SEED 13
+
 //This is the configuration that will be written to every slave while driving
 //REFON=1 -> Always at idle mode, no sleep
 const uint8_t drive_config[6] =
@@ -44,23 +97,70 @@ const uint8_t drive_config[6] =
 };
 
 void shut_car_down(CAN_message_t);
+void shutdown_cycle();
+void measure_cycle();
 void critical_callback(BmsCriticalFrame_t);
+uint8_t fault_class(BmsCriticalFrame_t);
+CAN_message_t shutdown_message(BmsCriticalFrame_t, uint8_t);
+void log_event(uint8_t, uint32_t);
+bool stream_recorder(uint16_t *);
+void print_recorder();
 
 void tick_can_sensors();
+void send_all_volts();
 
 float volts_to_celsius(float, float);
 float uint16_volts_to_float(uint16_t);
 
 Configuration * config;
+uint8_t applied_config;
+
+Eeprom_Journal * journal;
 
 LT_SPI * lt_spi;
 LTC6804_2 * ltc;
 
+Data_Logger * logger;
+
+Pack_Simulator * simulator;
+
+Flight_Recorder * recorder;
+//CAN frames received since the last flight recorder record
+uint16_t can_rx_frames = 0;
+
 BMS * bms;
 
+Balancer * balancer;
+
+Open_Wire_Detector * open_wire;
+
+Self_Test * self_test;
+
+Health_Reporter * health_reporter;
+
+Trace_Reporter * trace_reporter;
+
+Cycle_Monitor * cycle_monitor;
+
+Coulomb_Counter * soc;
+
+Soc_Ekf * ekf;
+
+Dcir_Estimator * dcir;
+
+Power_Limits * sop;
+
+Precharge * precharger;
+
+Charge_Controller * charge_controller;
+
+Fault_Policy * fault_policy;
+
 IVT * ivt;
 
-Other_Battery_Box * other_box;
+Pack_Link * pack_link;
+
+Iso_Tp * iso_tp;
 
 FlexCAN Can(500000);
 
@@ -68,52 +168,292 @@ Charger * charger;
 
 Configurator * configurator;
 
-//Collection of all the Can_Sensors that are going
-//to be pinged whenever there is a new message
-//matching their id
-#define CAN_SENSOR_NUM 3
-Can_Sensor * can_sensors[]
-{
-    ivt,
-    other_box,
-    configurator
-};
+//Routes every message to the Can_Sensor matching its id
+//Filled in on setup(), once the sensors are created
+Can_Dispatch can_dispatch;
+
+//Latched by shut_car_down(), from then on loop() only keeps the shutdown message going
+bool shut_down = false;
+CAN_message_t shutdown_periodic;
+uint32_t shutdown_refresh_ms, shutdown_chunk_ms;
+uint16_t shutdown_chunk;
+
+//Last command sent to the charger (only while charging)
+uint32_t charger_command_ms;
 
 inline int isCharging()
 {
     return digitalRead(CHARGE_PIN) != CHARGE_PIN_IDLE;
 }
 
-static int prech = 0;
-
 inline int isPrecharging(){
-    return prech;
+    return precharger != nullptr && precharger->is_active();
 }
 
-void precharge(){
-    prech = 1;
+inline uint8_t current_mode(){
+    return isPrecharging() ? FAULT_MODE_PRECHARGE : (isCharging() ? FAULT_MODE_CHARGE : FAULT_MODE_DRIVE);
+}
 
-    #if BOX_ID == BOX_RIGHT
-      while(other_box->get_volts() == 0){
-        tick_can_sensors();
-      }
+//Relay actuation on every precharge state change
+void precharge_relays(uint8_t state){
+    digitalWrite(PRECHARGE_RELAY_PIN, state == PRECHARGE_CHARGING || state == PRECHARGE_CLOSING);
+    digitalWrite(MAIN_CONTACTOR_PIN, state == PRECHARGE_CLOSING || state == PRECHARGE_DONE);
+}
+
+//Cycle statistics of every mode, every CYCLE_STATS_PERIOD_MS
+void send_cycle_stats(){
+#if CAN_ENABLE
+  static uint32_t last_ms = 0;
+  if(Clock::now_ms() - last_ms < CYCLE_STATS_PERIOD_MS)
+  {
+    return;
+  }
+  last_ms = Clock::now_ms();
 
-      bms->tick();
-      float target_voltage = bms->get_total_voltage() + other_box->get_volts();
+  for(uint8_t message = 0; message < Latency_Can_Adapter::message_num; message++)
+  {
+    Can.write(Latency_Can_Adapter::stats(cycle_monitor, message));
+  }
+#endif
+}
 
-      while(ivt->tick().volts < 0.9 * target_voltage){
-        tick_can_sensors();
-      }
-      //Activate some pin
-    #else
-      bms->tick();
-      other_box->send_total_voltage(bms->get_total_voltage());
-    #endif
+//Steps the simulated pack and puts its IVT frames on the virtual bus
+void tick_simulation(){
+#if SIMULATION_ENABLE
+  //Contactors are open while precharging or shut down, the charger pushes whatever the charge loop asked for last
+  float amps = isPrecharging() || shut_down ? 0 : simulator->get_drive_amps();
+  if(isCharging() && !shut_down){
+    amps = -fault_policy->limit_charge_amps(charge_controller->get_amps(), Clock::now_ms());
+  }
+  simulator->step(amps);
+
+  can_dispatch.dispatch(Sim_Can_Adapter::ivt_current(simulator, SOC_CURRENT_SIGN));
+  can_dispatch.dispatch(Sim_Can_Adapter::ivt_voltage(simulator));
+#endif
+}
+
+//Hands a committed configuration to the BMS, always right before a tick
+void apply_config(){
+  if(config->get_generation() == applied_config){
+    return;
+  }
+  applied_config = config->get_generation();
+
+  bms->set_limits(config->get_overvolts(), config->get_undervolts(), config->get_overtemp(), config->get_undertemp());
+  bms->set_full_scan_period(config->get_scan_period());
+  ltc->set_adc(config->get_adc_mode(), DCP_DISABLED, CELL_CH_ALL, AUX_CH_ALL);
+
+  log_event(LOG_EVENT_CONFIG, applied_config);
+
+#if DEBUG
+  Serial.print("Applied config #");
+  Serial.println(applied_config);
+#endif
+}
+
+//Latest cells, aux & IVT into the log
+void log_tick(){
+#if LOG_ENABLE
+  Sample_Cache const * amps = ivt->get_amps();
+  Sample_Cache const * volts = ivt->get_volts();
+  logger->log_tick(Clock::now_ms(), bms->cell_codes, bms->aux_codes,
+                   amps->has_value() ? amps->get_value() : 0, volts->has_value() ? volts->get_value() : 0);
+#endif
+}
+
+void log_event(uint8_t event, uint32_t data){
+#if LOG_ENABLE
+  logger->log_event(Clock::now_ms(), event, data);
+#else
+  (void) event;
+  (void) data;
+#endif
+}
+
+//Writes a full log block, if any. Only called once the tick is done
+void service_logger(){
+#if LOG_ENABLE
+  if(logger->service())
+  {
+    lt_spi->claim();
+  }
+#endif
+}
+
+//Every current sample goes into the SOC as it is received, not once per tick
+void integrate_amps(Sample_Cache const * amps){
+    soc->update(amps);
+}
+
+//Current limits out of the latest pack statistics
+void update_power_limits(){
+    //Worst known cell resistance, so the weakest cell sets the pace
+    uint16_t worst = dcir->get_worst();
+    float amps = ivt->get_amps()->has_value() ? SOC_CURRENT_SIGN * ivt->get_amps()->get_value() : 0;
+    sop->compute(bms->get_min_volts().value, bms->get_max_volts().value, amps,
+                 bms->get_min_temp().value, bms->get_max_temp().value,
+                 worst == 0xFFFF ? 0 : dcir->get_cell(worst),
+                 bms->uv, bms->ov, bms->ut, bms->ot,
+                 Clock::now_ms());
+}
+
+//Shares the status of this box with the others & watches their heartbeat
+void tick_pack_link(){
+#if CAN_ENABLE
+    pack_link->set_local(bms, soc->get_soc(), current_mode(), fault_policy->get_action(Clock::now_ms()));
+    pack_link->tick(Clock::now_ms());
+
+    uint8_t lost = pack_link->check_lost();
+    if(lost != 0xFF)
+    {
+        BmsCriticalFrame_t frame = bms_link_error;
+        frame.volts.index = lost;
+        critical_callback(frame);
+    }
+#endif
+}
+
+//Answers a complete ISO-TP request, if any (see ISO_TP_CANID)
+void serve_iso_tp(){
+#if CAN_ENABLE
+    iso_tp->tick(Clock::now_ms());
+    if(!iso_tp->available() || iso_tp->is_sending())
+    {
+        return;
+    }
 
-    prech = 0;
+    static uint8_t response[ISO_TP_MAX_LEN];
+    uint8_t const * request = iso_tp->get_rx();
+    uint16_t len = iso_tp->get_rx_len();
+    uint16_t n = 0;
+
+    switch(request[0])
+    {
+        case ISO_TP_SERVICE_CONFIG:
+        {
+            bool staged = len >= 3;
+            for(uint16_t i = 2; i < len && staged; i++)
+            {
+                staged = config->stage(request[1] + i - 2, request[i]);
+            }
+
+            uint8_t status = CONFIGURATION_ACK_ADDRESS;
+            if(!staged)
+            {
+                config->discard();
+            }
+            else
+            {
+                status = config->commit() == CONFIG_COMMIT_OK ? CONFIGURATION_ACK_COMMITTED : CONFIGURATION_ACK_RANGE;
+            }
+
+            response[n++] = ISO_TP_SERVICE_CONFIG + ISO_TP_RESPONSE;
+            response[n++] = status;
+            response[n++] = config->get_generation();
+            response[n++] = CONFIG_VERSION;
+            break;
+        }
+        case ISO_TP_SERVICE_DUMP:
+        {
+            const uint16_t cells = SLAVE_NUM * (bms->cell_end - bms->cell_start);
+            const uint16_t auxs = SLAVE_NUM * (bms->aux_end - bms->aux_start + 1);
+
+            response[n++] = ISO_TP_SERVICE_DUMP + ISO_TP_RESPONSE;
+            response[n++] = SLAVE_NUM;
+            response[n++] = bms->cell_end - bms->cell_start;
+            response[n++] = bms->aux_end - bms->aux_start + 1;
+            for(uint16_t i = 0; i < cells + auxs && n + 2 <= ISO_TP_MAX_LEN; i++)
+            {
+                uint16_t code = i < cells ? *(bms->cell_codes + i) : *(bms->aux_codes + i - cells);
+                response[n++] = (code >> 8) & 0xFF;
+                response[n++] = code & 0xFF;
+            }
+            break;
+        }
+        default:
+            response[n++] = ISO_TP_NEGATIVE;
+            response[n++] = request[0];
+            break;
+    }
+
+    iso_tp->release();
+    iso_tp->send(response, n);
+#endif
 }
 
-void charge(){}
+//Charging is picked on boot, loop() runs the charge cycle instead of the measure cycle from then on
+void start_charge(){
+    bms->set_balancer(balancer);
+    balancer->enable();
+
+    charge_controller->start();
+    charger_command_ms = Clock::now_ms() - CHARGER_COMMAND_PERIOD_MS;
+}
+
+void charge_cycle(){
+    static uint32_t scan = 0;
+    uint32_t tick_start_us = micros();
+    tick_can_sensors();
+
+    //Bleeders are off for this tick's cells, so the charge loop can trust them
+    bool bleeder_free = balancer->is_measurement_window();
+
+    apply_config();
+    bms->tick();
+    log_tick();
+
+    //Once per read back, not on every tick that skipped the scan
+    if(bms->get_scan_sequence() != scan)
+    {
+        scan = bms->get_scan_sequence();
+        soc->rest_correct(bms->cell_codes);
+    }
+
+    update_power_limits();
+
+    tick_pack_link();
+    serve_iso_tp();
+    //Every box balances towards the lowest cell of the pack
+    balancer->set_floor(pack_link->get_balance_floor());
+
+    if(bleeder_free)
+    {
+        charge_controller->update(Clock::now_ms(), bms->get_max_volts().value, sop->get_charge_amps());
+    }
+
+    //A shutdown in this tick already stopped the charger
+    if(!shut_down && Clock::now_ms() - charger_command_ms >= CHARGER_COMMAND_PERIOD_MS)
+    {
+        charger_command_ms = Clock::now_ms();
+        charger->set_volts_amps(CHARGE_PACK_VOLTS, fault_policy->limit_charge_amps(charge_controller->get_amps(), Clock::now_ms()));
+        charger->send_charge_message();
+    }
+
+    //Keep bleeding after the charger is done, until the cells are even
+    if(charge_controller->is_done() && balancer->is_balanced() && balancer->is_enabled())
+    {
+#if DEBUG
+        Serial.println("Charged & balanced");
+#endif
+        balancer->disable();
+
+        uint32_t cycles = 0;
+        journal->read(JOURNAL_KEY_CHARGE_CYCLES, &cycles);
+        journal->write(JOURNAL_KEY_CHARGE_CYCLES, cycles + 1);
+    }
+
+    uint32_t tick_end_us = micros();
+    cycle_monitor->update(FAULT_MODE_CHARGE, tick_start_us, tick_end_us);
+    send_cycle_stats();
+
+    recorder->record(Clock::now_ms(), (tick_end_us - tick_start_us) / 1000,
+                     bms->cell_codes, bms->aux_codes,
+                     ivt->get_amps()->get_value(), ivt->get_volts()->get_value(), can_rx_frames,
+                     FAULT_MODE_CHARGE, fault_policy->get_action(Clock::now_ms()));
+    can_rx_frames = 0;
+
+    service_logger();
+}
 
 //This is the entry point. loop() is called after
 void setup()
@@ -122,114 +462,308 @@ void setup()
     digitalWrite(SHUTDOWN_PIN, SHUTDOWN_PIN_IDLE);
 
     pinMode(CHARGE_PIN, INPUT);
+
+    pinMode(PRECHARGE_RELAY_PIN, OUTPUT);
+    pinMode(MAIN_CONTACTOR_PIN, OUTPUT);
+    precharge_relays(PRECHARGE_IDLE);
 #if DEBUG
     Serial.begin(SERIAL_BAUD_RATE);
     delay(2000);
 #endif
 
-#if DEBUG_CAN
-    Serial.println("Starting FlexCAN");
-#endif
+    trace_init();
 
-#if CAN_ENABLE
-    Can.begin();
-#endif 
+    //Everything box specific depends on it
+    bool box_valid = load_box_identity(BOX_ID_PIN_0, BOX_ID_PIN_1, PACK_BOX_NUM);
 
     config = new Configuration();
+
+    journal = new Eeprom_Journal();
+    journal->load();
+
+    cycle_monitor = new Cycle_Monitor((uint32_t) MAX_MEASURE_CYCLE_DURATION_MS * 1000);
+
+    //Before anything can shut the car down
+    recorder = new Flight_Recorder(SLAVE_NUM * (CELL_IGNORE_INDEX_END - CELL_IGNORE_INDEX_START),
+                                   SLAVE_NUM * (GPIO_IGNORE_INDEX_END - GPIO_IGNORE_INDEX_START + 1));
+
+    //First thing, critical frames can come in as soon as the slaves are talked to
+    fault_policy = new Fault_Policy();
     
     /* Initialize all the sensors and external hardware as needed.
        They are modelled properly as classes in framework.h*/
+#if SIMULATION_ENABLE
+    //Every timer & sample runs on the virtual clock of the simulator from here on
+    simulator = new Pack_Simulator(SLAVE_NUM, SIM_PACK_SEED, &volts_to_celsius);
+    Clock::set_source(&Pack_Simulator::now_us);
+    lt_spi = simulator->get_spi();
+#else
     lt_spi = new LT_SPI();
-    ltc = new LTC6804_2(lt_spi);
+#endif
+
+#if LOG_ENABLE
+    logger = new Data_Logger(LOG_SD_CS_PIN,
+                             SLAVE_NUM * (CELL_IGNORE_INDEX_END - CELL_IGNORE_INDEX_START),
+                             SLAVE_NUM * (GPIO_IGNORE_INDEX_END - GPIO_IGNORE_INDEX_START + 1));
+    logger->begin();
+    lt_spi->claim();
+#endif
+#if SIMULATION_ENABLE
+    //Emulated slaves convert at once
+    ltc = new LTC6804_2(lt_spi, config->get_adc_mode(), DCP_DISABLED, CELL_CH_ALL, AUX_CH_ALL, 0);
+#else
+    ltc = new LTC6804_2(lt_spi, config->get_adc_mode());
+#endif
     
-#if CAN_ENABLE
+#if CAN_ENABLE || SIMULATION_ENABLE
     ivt = new IVT();
 #else
     ivt = new IVT_Dummy(2, 500);
 #endif
     bms = new BMS(ltc, ivt, SLAVE_NUM,
-                  config->get_overvolts(), config->get_undervolts(), config->get_undertemp(), config->get_overtemp(),
+                  config->get_overvolts(), config->get_undervolts(), config->get_overtemp(), config->get_undertemp(),
                   CELL_IGNORE_INDEX_START, CELL_IGNORE_INDEX_END, GPIO_IGNORE_INDEX_START, GPIO_IGNORE_INDEX_END,
                   drive_config,
                   &critical_callback,
                   &uint16_volts_to_float,
                   &volts_to_celsius);
+    bms->set_full_scan_period(config->get_scan_period());
+    bms->set_step_scan(DCIR_STEP_AMPS);
+    applied_config = config->get_generation();
+
+    open_wire = new Open_Wire_Detector(ltc, SLAVE_NUM,
+                                       CELL_IGNORE_INDEX_START, CELL_IGNORE_INDEX_END,
+                                       OPEN_WIRE_THRESHOLD);
+    bms->set_open_wire_detector(open_wire);
+
+    //Every self test runs once on boot and then keeps running in the background
+    self_test = new Self_Test(ltc, bms->get_slave_config(), SLAVE_NUM);
+    bms->set_self_test(self_test);
+    bms->run_self_test();
+
+    balancer = new Balancer(SLAVE_NUM,
+                            CELL_IGNORE_INDEX_START, CELL_IGNORE_INDEX_END,
+                            BALANCE_THRESHOLD, BALANCE_MAX_BLEEDERS_PER_SLAVE,
+                            BALANCE_DCTO, BALANCE_TICKS);
+
+    soc = new Coulomb_Counter(SOC_CAPACITY_MAH,
+                              SLAVE_NUM * (CELL_IGNORE_INDEX_END - CELL_IGNORE_INDEX_START),
+                              journal,
+                              SOC_CURRENT_SIGN);
+    soc->load();
+    ivt->set_amps_callback(&integrate_amps);
+
+    //Runs on the average cell, so the capacity is the one of a single cell group
+    ekf = new Soc_Ekf(SOC_CAPACITY_MAH / 1000.0);
+
+    dcir = new Dcir_Estimator(SLAVE_NUM * (CELL_IGNORE_INDEX_END - CELL_IGNORE_INDEX_START));
+
+    sop = new Power_Limits(SOP_MAX_DISCHARGE_AMPS, SOP_MAX_CHARGE_AMPS);
+
+    precharger = new Precharge(box_identity.box_id == PRECHARGE_OWNER_BOX, &precharge_relays);
 
-    other_box = new Other_Battery_Box(&Can);
+    charge_controller = new Charge_Controller(CHARGE_CC_AMPS, CHARGE_CV_VOLTS, CHARGE_TAPER_AMPS);
 
-    configurator = new Configurator(&Can);
+    pack_link = new Pack_Link(&Can, box_identity.box_id, PACK_BOX_NUM);
+    iso_tp = new Iso_Tp(&Can, ISO_TP_CANID + box_identity.box_id * 2, ISO_TP_CANID + box_identity.box_id * 2 + 1);
 
-    if(isCharging()){
+    configurator = new Configurator(&Can, config, box_identity.config_canid, box_identity.config_canid + CONFIGURATION_ACK_OFFSET);
+
+    health_reporter = new Health_Reporter(&Can, self_test, box_identity.telemetry_canid + HEALTH_REQUEST_OFFSET,
+                                          box_identity.telemetry_canid + HEALTH_RESPONSE_OFFSET);
+    trace_reporter = new Trace_Reporter(&Can, box_identity.telemetry_canid + TRACE_REQUEST_OFFSET,
+                                        box_identity.telemetry_canid + TRACE_RESPONSE_OFFSET);
+
+    can_dispatch.add(ivt);
+    can_dispatch.add(pack_link);
+    can_dispatch.add(configurator);
+    can_dispatch.add(health_reporter);
+    can_dispatch.add(trace_reporter);
+    can_dispatch.add(iso_tp);
+    can_dispatch.listen(box_identity.telemetry_canid + SEND_ALL_VOLTS_REQUEST_OFFSET);
+
+#if DEBUG_CAN
+    Serial.println("Starting FlexCAN");
+#endif
+
+#if CAN_ENABLE
+    //Filters depend on the ids of every sensor, so the bus starts once they exist
+    can_dispatch.begin(&Can);
+#elif SIMULATION_ENABLE
+    can_dispatch.sort();
+#endif
+
+    //IVT frames are there before the first tick
+    tick_simulation();
+
+    //Ticks before the last reset (a fault, the watchdog) are read out once, then recording starts over
+    if(recorder->was_recovered())
+    {
+        print_recorder();
+        uint16_t chunk = 0;
+        while(stream_recorder(&chunk))
+        {
+            delay(1);
+        }
+        recorder->clear();
+    }
+
+    //Would answer on the ids of a box that is not in the pack, nothing gets switched on
+    if(!box_valid)
+    {
+      shut_car_down(Shutdown_Message_Factory::full(ERROR_BOX_ID, 0, box_identity.box_id));
+    }
+    else if(isCharging()){
+#if CAN_ENABLE
+      charger = new Charger(&Can, 0, 0);
+#else
       charger = new Charger_Dummy();
-      //charger = new Charger(&Can, 0, 0);
-      charge();
-      while(1){}
+#endif
+      start_charge();
+    }
+    else
+    {
+      //Precharge is stepped from loop(), along with everything else
+      precharger->start(Clock::now_ms());
     }
 
-    precharge();
+#if DEBUG
+    Serial.println("Running loop()");
+#endif
 }
 
-//Runs repeatedly after setup()
+//Runs repeatedly after setup(), a cycle per call
 void loop()
 {
+    if(shut_down)
+    {
+        shutdown_cycle();
+    }
+    else if(charger != nullptr)
+    {
+        charge_cycle();
+    }
+    else
+    {
+        measure_cycle();
+    }
+}
+
+//Setup has been completed, so we are ready to start making some measurements
+void measure_cycle(){
+#if CAN_ENABLE
+    static uint16_t soc_cell = 0;
+#endif
+    static uint32_t scan = 0;
+    uint32_t measure_cycle_start = 0, measure_cycle_end = 0; //us
+
 #if DEBUG
-    Serial.println("Running loop()");
+    delay(MEASURE_CYCLE_DEBUG_DELAY_MS);
 #endif
 
-    uint32_t measure_cycle_start = 0, measure_cycle_end = 0xFFFFFFFF, measure_cycle_mean = 0;
+    measure_cycle_start = micros();
+
+    tick_can_sensors();
+
+    //Tick BMS
+    apply_config();
+    bms->tick();
+    log_tick();
 
-    //Setup has been completed, so we are ready to start making some measurements
-    while(1)
+    //The models only learn from cells that were actually read back this tick
+    if(bms->get_scan_sequence() != scan)
     {
-#if DEBUG
-        delay(MEASURE_CYCLE_DEBUG_DELAY_MS);
-#endif
+        scan = bms->get_scan_sequence();
+
+        soc->rest_correct(bms->cell_codes);
+
+        if(ivt->get_amps()->has_value())
+        {
+            ekf->update(SOC_CURRENT_SIGN * ivt->get_amps()->get_value(), bms->get_avg_volts(), Can_Sensor::now_us());
+        }
 
-        measure_cycle_start = millis();
+        dcir->update(bms->cell_codes, ivt->get_amps(), SOC_CURRENT_SIGN, Can_Sensor::now_us());
+    }
 
-        tick_can_sensors();
+    update_power_limits();
 
-        //Tick BMS
-        bms->tick();
+    tick_pack_link();
+    serve_iso_tp();
 
+    if(precharger->is_active())
+    {
+        precharger->step(Clock::now_ms(), Can_Sensor::now_us(), ivt->get_volts(), bms->get_total_voltage(), pack_link->get_others_volts());
 #if CAN_ENABLE
-        Can.write(Liion_Bms_Can_Adapter::VoltageMinMax(bms));
+        Can.write(Precharge_Can_Adapter::progress(precharger, Clock::now_ms()));
+#endif
+    }
+
+    if(precharger->get_state() == PRECHARGE_FAILED)
+    {
+        shut_car_down(Shutdown_Message_Factory::full(ERROR_PRECHARGE, precharger->get_failed_state(), 0));
+    }
+
+#if CAN_ENABLE
+    Can.write(Liion_Bms_Can_Adapter::VoltageMinMax(bms));
+
+    //Pack SOC every tick, cells 3 at a time
+    Can.write(Soc_Can_Adapter::pack(soc));
+    Can.write(Soc_Can_Adapter::cells(soc, soc_cell));
+    soc_cell = soc_cell + 3 < soc->cell_num ? soc_cell + 3 : 0;
+
+    Can.write(Dcir_Can_Adapter::pack(dcir));
+    Can.write(Sop_Can_Adapter::limits(sop));
+
+    //The IVT sees every box, so the stack can only be checked once the others are known
+    IVTMeasureFrame_t ivt_frame = ivt->tick();
+    if(pack_link->get_others_volts() != 0 && ivt_frame.success == IVT_SUCCESS)
+    {
+        self_test->cross_check_stack(ivt_frame.volts - pack_link->get_others_volts(), STACK_IVT_TOLERANCE);
+    }
 #endif 
 
-        measure_cycle_end = millis();
+    measure_cycle_end = micros();
 
-        uint32_t measure_cycle_duration = measure_cycle_end - measure_cycle_start;
+    recorder->record(Clock::now_ms(), (measure_cycle_end - measure_cycle_start) / 1000,
+                     bms->cell_codes, bms->aux_codes,
+                     ivt->get_amps()->get_value(), ivt->get_volts()->get_value(), can_rx_frames,
+                     current_mode(), fault_policy->get_action(Clock::now_ms()));
+    can_rx_frames = 0;
 
-        if(measure_cycle_mean == 0)
-        {
-            measure_cycle_mean = measure_cycle_duration;
-        }
-        else
-        {
-            measure_cycle_mean = (measure_cycle_mean + measure_cycle_duration) / 2;
-        }
+    service_logger();
+
+#if DEBUG && TRACE_ENABLE
+    //'t' over serial prints the spans
+    if(Serial.available() && Serial.read() == 't')
+    {
+        trace_print();
+    }
+#endif
+
+    uint8_t mode = current_mode();
+    bool missed = cycle_monitor->update(mode, measure_cycle_start, measure_cycle_end);
+    send_cycle_stats();
 
 #if DEBUG
-        Serial.print("Measure cycle mean: ");
-        Serial.print(measure_cycle_mean);
-        Serial.println(" ms");
+    Serial.print("Measure cycle mean: ");
+    Serial.print(cycle_monitor->get_mean_us(cycle_monitor->get_cycles(mode)));
+    Serial.println(" us");
 #endif
 
 #if DEBUG
-        Serial.print("Measure cycle duration: ");
-        Serial.print(measure_cycle_duration);
-        Serial.println(" ms");
+    Serial.print("Measure cycle duration: ");
+    Serial.print(cycle_monitor->get_last_us());
+    Serial.println(" us");
 #endif
 
-        if(measure_cycle_duration > MAX_MEASURE_CYCLE_DURATION_MS)
-        {
+    if(missed)
+    {
 #if DEBUG
-            Serial.print("> Measure cycle duration > ");
-            Serial.print(MAX_MEASURE_CYCLE_DURATION_MS);
-            Serial.println(" ms. Shutting car down!");
+        Serial.print("> Measure cycle duration > ");
+        Serial.print(MAX_MEASURE_CYCLE_DURATION_MS);
+        Serial.println(" ms. Shutting car down!");
 #endif
-            shut_car_down(Shutdown_Message_Factory::simple(ERROR_MAX_MEASURE_DURATION));
-        }
+        shut_car_down(Shutdown_Message_Factory::simple(ERROR_MAX_MEASURE_DURATION));
     }
 }
 
@@ -247,95 +781,273 @@ void critical_callback(BmsCriticalFrame_t frame)
     Serial.print(">>> Critical BMS Frame : ");
 #endif
 
-    if(isPrecharging() == 1){
+    uint8_t mode = current_mode();
+    uint8_t fault = fault_class(frame);
+    uint8_t action = fault_policy->report(mode, fault, Clock::now_ms());
+    log_event(LOG_EVENT_FAULT, fault << 8 | action);
 
-    }else if(isCharging() == 0){ /* Drive mode */
-        switch(frame.mode){
-            case 0: /* Volts, Temps or Amps*/
-                if(frame.volts.value > 0){
 #if DEBUG
-                  Serial.println(frame.volts.value);
-                  Serial.println(" V");
+    Serial.print("mode ");
+    Serial.print(mode);
+    Serial.print(", fault ");
+    Serial.print(fault);
+    Serial.print(" -> action ");
+    Serial.println(action);
 #endif
 
-                  uint32_t mv = frame.volts.value * 1000;
-                  shut_car_down(Shutdown_Message_Factory::full(ERROR_VOLTS, mv, frame.volts.index));
-                }else if(frame.temp.value > 0){
+    switch(action){
+        case FAULT_ACTION_SHUTDOWN:
+            if(mode == FAULT_MODE_PRECHARGE){
+                precharger->abort(Clock::now_ms());
+            }else if(mode == FAULT_MODE_CHARGE && charger != nullptr){
+                charger->set_amps(0);
+                charger->send_charge_message();
+            }
+            shut_car_down(shutdown_message(frame, fault));
+            break;
+        case FAULT_ACTION_STOP_CHARGER:
+            //Don't wait for the next command period
+            if(charger != nullptr){
+                charger->set_amps(0);
+                charger->send_charge_message();
+            }
+            break;
+        default: /* Derating is picked up by the charge loop, warnings need nothing */
+            break;
+    }
+}
+
+/* Maps a critical frame to its FAULT_* class */
+uint8_t fault_class(BmsCriticalFrame_t frame)
+{
+    switch(frame.mode){
+        //By the member that went off-limit, a shorted tap reads 0V & a cold sensor 0C or less
+        case bms_volts_error.mode:
+            return frame.volts.value > (bms->ov + bms->uv) / 2 ? FAULT_OVERVOLT : FAULT_UNDERVOLT;
+        case bms_temp_error.mode:
+            return frame.temp.value > (bms->ot + bms->ut) / 2 ? FAULT_OVERTEMP : FAULT_UNDERTEMP;
+        case bms_amps_error.mode:
+            return FAULT_AMPS;
+        case bms_pec_error.mode:
+            return FAULT_LTC;
+        case bms_open_wire_error.mode:
+            return FAULT_OPEN_WIRE;
+        case bms_self_test_error.mode:
+            return FAULT_SELF_TEST;
+        case bms_link_error.mode:
+            return FAULT_LINK;
+        case bms_current_error.mode:
+            return FAULT_IVT;
+        default: /* bms_critical_error, where we don't know what happened exactly */
+            return FAULT_UNKNOWN;
+    }
+}
+
+/* Periodic shutdown message of a critical frame */
+CAN_message_t shutdown_message(BmsCriticalFrame_t frame, uint8_t fault)
+{
+    switch(fault){
+        case FAULT_OVERVOLT:
+        case FAULT_UNDERVOLT:
 #if DEBUG
-                  Serial.println(frame.temp.value);
-                  Serial.println(" C");
-#endif                
-                  
-                  uint32_t celsius = frame.temp.value;
-                  shut_car_down(Shutdown_Message_Factory::full(ERROR_TEMP, celsius, frame.temp.index));
-                }else if(frame.amps.value > 0){
+            Serial.print(frame.volts.value);
+            Serial.println(" V");
+#endif
+            return Shutdown_Message_Factory::full(ERROR_VOLTS, (uint32_t) (frame.volts.value * 1000), frame.volts.index);
+        case FAULT_OVERTEMP:
+        case FAULT_UNDERTEMP:
 #if DEBUG
-                  Serial.println(frame.amps.value);
-                  Serial.println(" A");
-#endif
-  
-                  uint32_t ma = frame.amps.value * 1000;
-                  shut_car_down(Shutdown_Message_Factory::full(ERROR_TEMP, ma, frame.amps.index));
-                }
-                break;
-            case bms_pec_error.mode:
+            Serial.print(frame.temp.value);
+            Serial.println(" C");
+#endif
+            return Shutdown_Message_Factory::full(ERROR_TEMP, (int32_t) frame.temp.value, frame.temp.index);
+        case FAULT_AMPS:
 #if DEBUG
-                Serial.println("Possible LTC disconnect or malfunction (check for open wires, broken board, liquid damage, etc)");
-#endif      
-                shut_car_down(Shutdown_Message_Factory::simple(ERROR_LTC_LOSS));
-                break;
-            case bms_current_error.mode:
+            Serial.print(frame.amps.value);
+            Serial.println(" A");
+#endif
+            return Shutdown_Message_Factory::full(ERROR_AMPS, (uint32_t) (frame.amps.value * 1000), frame.amps.index);
+        case FAULT_LTC:
 #if DEBUG
-                Serial.println("Possible IVT Sensor malfunction (can't read data or data invalid/cached for too long)");
-#endif      
-                shut_car_down(Shutdown_Message_Factory::simple(ERROR_IVT_LOSS));
-                break;
-            case bms_critical_error.mode: /* Worse case scenario, where we don't know what happened exactly */
+            Serial.println("Possible LTC disconnect or malfunction (check for open wires, broken board, liquid damage, etc)");
+#endif
+            return Shutdown_Message_Factory::simple(ERROR_LTC_LOSS);
+        case FAULT_OPEN_WIRE:
 #if DEBUG
-                Serial.println("Unknown critical error (generalized)!");
-#endif      
-                shut_car_down(Shutdown_Message_Factory::simple(ERROR_UNKNOWN_CRITICAL));
-                break;      
-            default: /* Should never end up here */
+            Serial.print("Open wire C");
+            Serial.println((uint8_t) frame.volts.value);
+#endif
+            return Shutdown_Message_Factory::full(ERROR_OPEN_WIRE, (uint32_t) frame.volts.value, frame.volts.index);
+        case FAULT_SELF_TEST:
 #if DEBUG
-                Serial.println("Unrecognizable critical frame mode!");
+            Serial.print("Self test failed on slave #");
+            Serial.println(frame.volts.index);
 #endif
-                break;
-        }
-    }else{ /* Charging Mode */
-
+            return Shutdown_Message_Factory::full(ERROR_SELF_TEST, (uint32_t) frame.volts.value, frame.volts.index);
+        case FAULT_IVT:
+#if DEBUG
+            Serial.println("Possible IVT Sensor malfunction (can't read data or data invalid/cached for too long)");
+#endif
+            return Shutdown_Message_Factory::simple(ERROR_IVT_LOSS);
+        case FAULT_LINK:
+#if DEBUG
+            Serial.print("Lost the heartbeat of box #");
+            Serial.println(frame.volts.index);
+#endif
+            return Shutdown_Message_Factory::full(ERROR_LINK_LOSS, 0, frame.volts.index);
+        default:
+#if DEBUG
+            Serial.println("Unknown critical error (generalized)!");
+#endif
+            return Shutdown_Message_Factory::simple(ERROR_UNKNOWN_CRITICAL);
     }
-
-    return;
-    shut_car_down(Shutdown_Message_Factory::simple(ERROR_UNKNOWN_CRITICAL));
 }
 
 /* Actual car shut down code */
 void shut_car_down(CAN_message_t periodic)
 {
+    //The first cause is the one that sticks
+    if(shut_down)
+    {
+        return;
+    }
+    shut_down = true;
+
 #if DEBUG
     Serial.println(">>>> SHUTTING CAR DOWN <<<<");
 #endif
 
     digitalWrite(SHUTDOWN_PIN, SHUTDOWN_PIN_IDLE == 1 ? 0 : 1);
+    recorder->freeze();
+    print_recorder();
+
+    //Fault history, the shutdown circuit is already open
+    uint32_t shutdowns = 0;
+    journal->read(JOURNAL_KEY_SHUTDOWNS, &shutdowns);
+    journal->write(JOURNAL_KEY_SHUTDOWNS, shutdowns + 1);
+    journal->write(JOURNAL_KEY_LAST_SHUTDOWN, periodic.buf[7]);
+
+    //Whatever led up to it goes to the card
+    log_event(LOG_EVENT_SHUTDOWN, periodic.buf[7]);
+#if LOG_ENABLE
+    logger->flush();
+#endif
     
-    unsigned long lastRefreshTime = millis();
+    shutdown_periodic = periodic;
+    shutdown_refresh_ms = Clock::now_ms();
+    shutdown_chunk_ms = Clock::now_ms();
+    shutdown_chunk = 0;
+}
+
+//Keeps the shutdown message & the flight recorder going out, loops endlessly in chaos
+void shutdown_cycle()
+{
+    tick_simulation();
+
+    uint32_t now_ms = Clock::now_ms();
+    if(now_ms - shutdown_refresh_ms >= 1000){
+      shutdown_refresh_ms = now_ms;
 
-    while(1)
-    {   
-        unsigned long nowRefreshTime = millis();
-        if(nowRefreshTime - lastRefreshTime >= 1000){
-          lastRefreshTime = nowRefreshTime;
+#if CAN_ENABLE
+      Can.write(shutdown_periodic);
+#endif
+    }
 
-#if CAN_ENABLED
-          Can.write(periodic);
-#endif          
+    //The flight recorder goes out over and over, a chunk per ms
+    if(now_ms != shutdown_chunk_ms){
+      shutdown_chunk_ms = now_ms;
+      if(!stream_recorder(&shutdown_chunk)){
+        shutdown_chunk = 0;
+      }
+    }
+}
+
+//Prints the flight recorder as hex, a record per line
+void print_recorder(){
+#if DEBUG
+    Serial.print("Flight recorder: ");
+    Serial.print(recorder->get_count());
+    Serial.println(" records");
+    for(uint16_t r = 0; r < recorder->get_count(); r++)
+    {
+        for(uint16_t i = 0; i < recorder->get_record_size(); i++)
+        {
+            uint8_t byte = recorder->read((uint32_t) r * recorder->get_record_size() + i);
+            if(byte < 0x10)
+            {
+                Serial.print('0');
+            }
+            Serial.print(byte, HEX);
         }
-        //Loop endlessly in chaos
+        Serial.println();
     }
+#endif
+}
+
+//Sends the next chunk of the flight recorder, false once all of it is out
+bool stream_recorder(uint16_t * chunk){
+    uint32_t size = (uint32_t) recorder->get_count() * recorder->get_record_size();
+    if(*chunk > 0 && (uint32_t) (*chunk - 1) * RECORDER_CHUNK_BYTES >= size)
+    {
+        return false;
+    }
+
+#if CAN_ENABLE
+    Can.write(Recorder_Can_Adapter::chunk(recorder, *chunk));
+#endif
+    (*chunk)++;
+    return true;
+}
+
+//Every cell & aux code of this box, a frame each (see SEND_ALL_VOLTS_REQUEST_OFFSET)
+void send_all_volts(){
+#if CAN_ENABLE
+    const uint8_t cells = bms->cell_end - bms->cell_start;
+    const uint8_t auxs = bms->aux_end - bms->aux_start + 1; // +1 to include VRef
+
+    CAN_message_t msg;
+    msg.id = box_identity.telemetry_canid + SEND_ALL_VOLTS_RESPONSE_OFFSET;
+    msg.ext = 0;
+    msg.len = 8;
+    msg.timeout = 0;
+    memset(msg.buf, 0, 8);
+    msg.buf[0] = box_identity.error_offset;
+
+    for(uint8_t addr = 0; addr < bms->total_ic; addr++)
+    {
+        for(uint8_t cell = 0; cell < cells; cell++)
+        {
+            uint16_t val = *(bms->cell_codes + addr * cells + cell);
+
+            msg.buf[6] = (val >> 8) & 0xFF;
+            msg.buf[5] = val & 0xFF;
+            msg.buf[4] = cell;
+            msg.buf[3] = addr;
+            msg.buf[1] = 0;
+            Can.write(msg);
+        }
+    }
+    for(uint8_t addr = 0; addr < bms->total_ic; addr++)
+    {
+        for(uint8_t temp = 0; temp < auxs; temp++)
+        {
+            uint16_t val = *(bms->aux_codes + addr * auxs + temp);
+
+            msg.buf[6] = (val >> 8) & 0xFF;
+            msg.buf[5] = val & 0xFF;
+            msg.buf[4] = temp;
+            msg.buf[3] = addr;
+            msg.buf[1] = 0xFF;
+            Can.write(msg);
+        }
+    }
+#endif
 }
 
 void tick_can_sensors(){
+  TRACE_SCOPE(TRACE_CAN_RX);
+  tick_simulation();
+
   #if CAN_ENABLE
         // Gather input from CAN -- there is a need to centralize this because you can't have multiple isntances reading all
         // messages and only grabbing their own, if you read a message, you consume it forever.
@@ -343,57 +1055,14 @@ void tick_can_sensors(){
         {
             CAN_message_t msg;
             Can.read(msg);
+            can_rx_frames++;
 
-            msg.len = 8;
-            msg.id = SEND_ALL_VOLTS_RESPONSE_CANID;
-            if(msg.id == SEND_ALL_VOLTS_REQUEST_CANID){
-                for(uint8_t addr = 0; addr < total_ic; addr++)
-                {
-                    for(uint8_t cell = 0; cell < (cell_end - cell_start); cell++)
-                    {
-                        uint16_t val = *(cell_codes + addr * (cell_end - cell_start) + cell);
-
-                        msg.buf[6] = (val >> 8) & 0xFF;
-                        msg.buf[5] = val & 0xFF;
-                        msg.buf[4] = cell;
-                        msg.buf[3] = addr;
-                        msg.buf[2] = 0;
-                        msg.buf[1] = 0;
-                        msg.buf[0] = ERROR_OFFSET;
-                        Can.write(msg);
-                    }
-                }
-                for(uint8_t addr = 0; addr < total_ic; addr++)
-                {
-                    for(uint8_t temp = 0; temp < (aux_end - aux_start + 1); temp++) // +1 to include VRef
-                    {
-                        uint16_t val = *(this->aux_codes + addr * (aux_end - aux_start + 1) + temp);
-
-                        msg.buf[6] = (val >> 8) & 0xFF;
-                        msg.buf[5] = val & 0xFF;
-                        msg.buf[4] = cell;
-                        msg.buf[3] = addr;
-                        msg.buf[2] = 0;
-                        msg.buf[1] = 0xFF;
-                        msg.buf[0] = ERROR_OFFSET;
-                        Can.write(msg);
-                    }
-                }
+            if(msg.id == (uint32_t) (box_identity.telemetry_canid + SEND_ALL_VOLTS_REQUEST_OFFSET)){
+                send_all_volts();
             }
-            /* For every sensor declared, update it with the new message, if IDs match
+            /* Update the sensor listening to this id, if any.
                BMS needs new sensor data, this is why it's done first.*/
-            for(uint32_t i = 0; i < CAN_SENSOR_NUM; i++)
-            {
-                Can_Sensor * s = can_sensors[i];
-
-                for(uint32_t j = 0; j < s->get_id_num(); j++){
-                    if(msg.id == *(s->get_ids() + j))
-                    {
-                        s->update(msg);
-                        break;
-                    }
-                }  
-            }
+            can_dispatch.dispatch(msg);
         }
 #endif
 }
@@ -0,0 +1,105 @@
+#include <Arduino.h>
+#include "config.h"
+#include "precharge.h"
+
+Precharge::Precharge(bool owns_precharge, void (* relays)(uint8_t state), float ratio, float max_dvdt) :
+    owns_precharge(owns_precharge), ratio(ratio), max_dvdt(max_dvdt), relays(relays) {}
+
+bool Precharge::is_active(){ return state != PRECHARGE_IDLE && state != PRECHARGE_DONE && state != PRECHARGE_FAILED; }
+uint8_t Precharge::get_state(){ return this->state; }
+uint8_t Precharge::get_failed_state(){ return this->failed_state; }
+float Precharge::get_bus_volts(){ return this->bus_volts; }
+float Precharge::get_target_volts(){ return this->target_volts; }
+float Precharge::get_dvdt(){ return this->dvdt; }
+uint32_t Precharge::get_state_ms(uint32_t now_ms){ return now_ms - state_since_ms; }
+
+void Precharge::set_state(uint8_t state, uint32_t now_ms)
+{
+#if DEBUG
+    Serial.print("Precharge state -> ");
+    Serial.println(state);
+#endif
+
+    this->state = state;
+    this->state_since_ms = now_ms;
+
+    if(owns_precharge)
+    {
+        relays(state);
+    }
+}
+
+void Precharge::fail(uint32_t now_ms)
+{
+    this->failed_state = state;
+    set_state(PRECHARGE_FAILED, now_ms);
+}
+
+void Precharge::abort(uint32_t now_ms)
+{
+    if(is_active())
+    {
+        fail(now_ms);
+    }
+}
+
+void Precharge::start(uint32_t now_ms)
+{
+    set_state(owns_precharge ? PRECHARGE_WAIT : PRECHARGE_DONE, now_ms);
+}
+
+void Precharge::step(uint32_t now_ms, uint32_t now_us, Sample_Cache const * bus, float pack_volts, float other_volts)
+{
+    //Bus slope between consecutive IVT samples
+    if(bus->get_sequence() != bus_sequence)
+    {
+        float volts = bus->get_value();
+        uint32_t dt = bus->get_rx_us() - bus_rx_us;
+
+        if(bus_sequence != 0 && dt != 0)
+        {
+            this->dvdt = (volts - bus_volts) * 1000000.0 / dt;
+        }
+
+        this->bus_volts = volts;
+        this->bus_rx_us = bus->get_rx_us();
+        this->bus_sequence = bus->get_sequence();
+    }
+
+    uint32_t elapsed = now_ms - state_since_ms;
+
+    switch(state)
+    {
+        case PRECHARGE_WAIT:
+            if(other_volts != 0 && pack_volts != 0)
+            {
+                this->target_volts = pack_volts + other_volts;
+                this->charging_sequence = bus_sequence;
+                set_state(PRECHARGE_CHARGING, now_ms);
+            }
+            else if(elapsed > PRECHARGE_WAIT_TIMEOUT_MS)
+            {
+                fail(now_ms);
+            }
+            break;
+        case PRECHARGE_CHARGING:
+            if(bus_sequence != charging_sequence && bus->get_age_us(now_us) <= PRECHARGE_MAX_BUS_AGE_US &&
+               bus_volts >= ratio * target_volts && dvdt <= max_dvdt)
+            {
+                set_state(PRECHARGE_CLOSING, now_ms);
+            }
+            else if(elapsed > PRECHARGE_CHARGING_TIMEOUT_MS)
+            {
+                fail(now_ms);
+            }
+            break;
+        case PRECHARGE_CLOSING:
+            if(elapsed >= PRECHARGE_CLOSING_MS)
+            {
+                set_state(PRECHARGE_DONE, now_ms);
+            }
+            break;
+        default:
+            break;
+    }
+}
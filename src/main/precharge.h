@@ -0,0 +1,79 @@
+/* Precharge of the tractive system */
+#ifndef PRECHARGE_H
+#define PRECHARGE_H
+
+#include <stdint.h>
+#include "sample_cache.h"
+
+//States, the relays hook is called on every change
+#define PRECHARGE_IDLE 0
+#define PRECHARGE_WAIT 1 /* Waiting on the pack & other box voltage, relays open */
+#define PRECHARGE_CHARGING 2 /* Precharge relay closed, bus is rising */
+#define PRECHARGE_CLOSING 3 /* Main contactor closed along with the precharge relay */
+#define PRECHARGE_DONE 4 /* Main contactor closed, precharge relay open */
+#define PRECHARGE_FAILED 5 /* Timed out or aborted, relays open */
+
+//Bus over pack voltage that counts as precharged
+#define PRECHARGE_DEFAULT_RATIO 0.90
+//Max bus voltage slope (V/s) when precharged, the RC curve has to have flattened out
+#define PRECHARGE_DEFAULT_MAX_DVDT 50.0
+//Bus voltage older than this (us) can't tell the bus is precharged
+#define PRECHARGE_MAX_BUS_AGE_US 100000
+
+//Per phase timeouts
+#define PRECHARGE_WAIT_TIMEOUT_MS 5000
+#define PRECHARGE_CHARGING_TIMEOUT_MS 10000
+//Both relays stay closed this long before the precharge one opens
+#define PRECHARGE_CLOSING_MS 100
+
+//Non blocking precharge, stepped from the main loop so the cells keep being monitored.
+//Only the box that owns the precharge circuit (and sees the bus through the IVT) runs
+//the sequence, the other one is done as soon as it starts.
+class Precharge
+{
+public:
+    Precharge(bool owns_precharge,
+              void (* relays)(uint8_t state),
+              float ratio = PRECHARGE_DEFAULT_RATIO,
+              float max_dvdt = PRECHARGE_DEFAULT_MAX_DVDT);
+
+    void start(uint32_t now_ms);
+
+    //Bus voltage as seen by the IVT, pack voltage of this box and the other box one (0 if unknown).
+    //Only a fresh bus sample received after the precharge relay closed ends CHARGING
+    void step(uint32_t now_ms, uint32_t now_us, Sample_Cache const * bus, float pack_volts, float other_volts);
+
+    //Opens the relays, precharge ends up FAILED
+    void abort(uint32_t now_ms);
+
+    bool is_active();
+    uint8_t get_state();
+    //State that failed, if FAILED
+    uint8_t get_failed_state();
+
+    float get_bus_volts();
+    float get_target_volts();
+    float get_dvdt();
+    uint32_t get_state_ms(uint32_t now_ms);
+
+    const bool owns_precharge;
+    const float ratio, max_dvdt;
+
+protected:
+    void set_state(uint8_t state, uint32_t now_ms);
+    void fail(uint32_t now_ms);
+
+    void (* const relays)(uint8_t state);
+
+    uint8_t state = PRECHARGE_IDLE;
+    uint8_t failed_state = PRECHARGE_IDLE;
+    uint32_t state_since_ms = 0;
+
+    float bus_volts = 0, target_volts = 0, dvdt = 0;
+    uint32_t bus_rx_us = 0;
+    uint32_t bus_sequence = 0;
+    //Last bus sample before CHARGING
+    uint32_t charging_sequence = 0;
+};
+
+#endif //PRECHARGE_H
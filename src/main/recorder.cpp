@@ -0,0 +1,152 @@
+#include <Arduino.h>
+#include "config.h"
+#include "recorder.h"
+
+#define RECORDER_MAGIC 0x46524543
+
+//Not touched by the startup code, survives anything short of a power cycle
+static struct
+{
+    uint32_t magic;
+    uint16_t record_size;
+    uint16_t capacity;
+    uint16_t head;
+    uint16_t count;
+    uint32_t frozen;
+    uint32_t check;
+    uint8_t data[RECORDER_BYTES];
+} ring __attribute__((section(".noinit")));
+
+static uint32_t header_check()
+{
+    return ring.magic ^ ((uint32_t) ring.record_size << 16 | ring.capacity) ^ ((uint32_t) ring.head << 16 | ring.count) ^ ring.frozen;
+}
+
+Flight_Recorder::Flight_Recorder(uint16_t cell_num, uint8_t aux_num) : cell_num(cell_num), aux_num(aux_num)
+{
+    uint16_t size = RECORDER_HEADER_SIZE + cell_num + aux_num;
+
+    if(ring.magic == RECORDER_MAGIC && ring.check == header_check() && ring.record_size == size &&
+       ring.capacity == RECORDER_BYTES / size && ring.head < ring.capacity && ring.count <= ring.capacity)
+    {
+        this->recovered = ring.count > 0;
+#if DEBUG
+        Serial.print("Flight recorder kept ");
+        Serial.print(ring.count);
+        Serial.println(" records");
+#endif
+    }
+
+    if(!recovered)
+    {
+        ring.magic = RECORDER_MAGIC;
+        ring.record_size = size;
+        ring.capacity = RECORDER_BYTES / size;
+        ring.head = 0;
+        ring.count = 0;
+        ring.frozen = 0;
+    }
+    else
+    {
+        ring.frozen = 1;
+    }
+    seal();
+}
+
+void Flight_Recorder::seal()
+{
+    ring.check = header_check();
+}
+
+bool Flight_Recorder::is_frozen(){ return ring.frozen != 0; }
+bool Flight_Recorder::was_recovered(){ return this->recovered; }
+uint16_t Flight_Recorder::get_count(){ return ring.count; }
+uint16_t Flight_Recorder::get_record_size(){ return ring.record_size; }
+
+void Flight_Recorder::freeze()
+{
+    ring.frozen = 1;
+    seal();
+}
+
+void Flight_Recorder::clear()
+{
+    ring.head = 0;
+    ring.count = 0;
+    ring.frozen = 0;
+    this->recovered = false;
+    seal();
+}
+
+void Flight_Recorder::record(uint32_t now_ms, uint16_t duration_ms,
+                             const uint16_t * cell_codes, const uint16_t * aux_codes,
+                             float amps, float volts, uint16_t rx_frames,
+                             uint8_t mode, uint8_t action)
+{
+    if(ring.frozen)
+    {
+        return;
+    }
+
+    uint8_t * r = ring.data + (uint32_t) ring.head * ring.record_size;
+
+    uint16_t lowest = 0xFFFF;
+    for(uint16_t i = 0; i < cell_num; i++)
+    {
+        if(*(cell_codes + i) < lowest)
+        {
+            lowest = *(cell_codes + i);
+        }
+    }
+
+    int16_t deciamps = amps * 10;
+    uint16_t decivolts = volts < 0 ? 0 : volts * 10;
+
+    r[0] = now_ms >> 24;
+    r[1] = now_ms >> 16;
+    r[2] = now_ms >> 8;
+    r[3] = now_ms;
+    r[4] = duration_ms >> 8;
+    r[5] = duration_ms;
+    r[6] = (uint16_t) deciamps >> 8;
+    r[7] = deciamps;
+    r[8] = decivolts >> 8;
+    r[9] = decivolts;
+    r[10] = rx_frames >> 8;
+    r[11] = rx_frames;
+    r[12] = lowest >> 8;
+    r[13] = lowest;
+    r[14] = mode;
+    r[15] = action;
+
+    r += RECORDER_HEADER_SIZE;
+    for(uint16_t i = 0; i < cell_num; i++)
+    {
+        uint16_t step = (*(cell_codes + i) - lowest) >> 4;
+        *(r++) = step > 0xFF ? 0xFF : step;
+    }
+    for(uint8_t i = 0; i < aux_num; i++)
+    {
+        *(r++) = *(aux_codes + i) >> 8;
+    }
+
+    ring.head = ring.head + 1 == ring.capacity ? 0 : ring.head + 1;
+    if(ring.count < ring.capacity)
+    {
+        ring.count++;
+    }
+    seal();
+}
+
+uint8_t Flight_Recorder::read(uint32_t offset)
+{
+    if(offset >= (uint32_t) ring.count * ring.record_size)
+    {
+        return 0;
+    }
+
+    //Oldest record is at the head once the ring wrapped
+    uint16_t first = ring.count < ring.capacity ? 0 : ring.head;
+    uint16_t record = (first + offset / ring.record_size) % ring.capacity;
+    return ring.data[(uint32_t) record * ring.record_size + offset % ring.record_size];
+}
@@ -0,0 +1,52 @@
+/* Pre-fault flight recorder, kept across warm resets */
+#ifndef RECORDER_H
+#define RECORDER_H
+
+#include <stdint.h>
+
+//RAM given to the records, the number of them depends on the number of cells
+#define RECORDER_BYTES 8192
+
+/* Record layout, one per tick:
+   [0~3] Time (ms), [4~5] Tick duration (ms), [6~7] IVT current (0.1A, signed), [8~9] IVT voltage (0.1V),
+   [10~11] CAN frames received since the previous record, [12~13] Lowest cell code (100uV/LSB),
+   [14] Mode (FAULT_MODE_*), [15] Standing fault action,
+   then every cell as (code - lowest) / 16 (1.6mV/LSB, saturates) & every aux code / 256 */
+#define RECORDER_HEADER_SIZE 16
+
+//Fixed size records in a ring that lives in .noinit, so a warm reset (watchdog, lockup)
+//leaves the last RECORDER_BYTES worth of ticks behind. Writing one is a few dozen stores.
+//freeze() stops any further writes, so whatever led to a fault stays there to be read out.
+class Flight_Recorder
+{
+public:
+    //Picks up the previous run's records if they survived the reset
+    Flight_Recorder(uint16_t cell_num, uint8_t aux_num);
+
+    void record(uint32_t now_ms, uint16_t duration_ms,
+                const uint16_t * cell_codes, const uint16_t * aux_codes,
+                float amps, float volts, uint16_t rx_frames,
+                uint8_t mode, uint8_t action);
+
+    void freeze();
+    bool is_frozen();
+
+    //Records from before the reset are there, frozen until clear()
+    bool was_recovered();
+    void clear();
+
+    uint16_t get_count();
+    uint16_t get_record_size();
+
+    //Byte of the records, oldest first
+    uint8_t read(uint32_t offset);
+
+    const uint16_t cell_num;
+    const uint8_t aux_num;
+
+protected:
+    void seal();
+    bool recovered = false;
+};
+
+#endif //RECORDER_H
@@ -0,0 +1,144 @@
+#include <Arduino.h>
+#include "config.h"
+#include "resistance.h"
+
+Dcir_Estimator::Dcir_Estimator(uint16_t cell_num, float weak_ratio) :
+    cell_num(cell_num), weak_ratio(weak_ratio)
+{
+    this->last_codes = (uint16_t *) malloc(sizeof(uint16_t) * cell_num);
+    this->estimates = (float *) malloc(sizeof(float) * cell_num);
+    this->settled = (uint8_t *) malloc(sizeof(uint8_t) * cell_num);
+
+    for(uint16_t i = 0; i < cell_num; i++)
+    {
+        *(last_codes + i) = 0;
+        *(estimates + i) = 0;
+        *(settled + i) = 0;
+    }
+}
+
+Dcir_Estimator::~Dcir_Estimator()
+{
+    free(this->last_codes);
+    free(this->estimates);
+    free(this->settled);
+}
+
+float Dcir_Estimator::get_cell(uint16_t cell){ return *(estimates + cell); }
+float Dcir_Estimator::get_average(){ return this->average; }
+uint16_t Dcir_Estimator::get_worst(){ return this->worst; }
+uint16_t Dcir_Estimator::get_weak_num(){ return this->weak_num; }
+uint32_t Dcir_Estimator::get_steps(){ return this->steps; }
+uint32_t Dcir_Estimator::get_rejected(){ return this->rejected; }
+
+bool Dcir_Estimator::is_weak(uint16_t cell)
+{
+    return *(settled + cell) >= DCIR_SETTLE_STEPS && *(estimates + cell) > average * weak_ratio;
+}
+
+bool Dcir_Estimator::update(const uint16_t * cell_codes, Sample_Cache const * amps, int8_t current_sign, uint32_t now_us)
+{
+    //A current that was not sampled along with the cells breaks the pair
+    if(!amps->has_value() || amps->get_age_us(now_us) > DCIR_MAX_SKEW_US)
+    {
+        primed = false;
+        return false;
+    }
+
+    float now_amps = amps->get_value() * current_sign;
+    float di = now_amps - last_amps;
+    //The previous scan ages too, a stale one is only good to start a new pair
+    bool step = primed && now_us - last_us <= DCIR_MAX_PAIR_US && (di >= DCIR_STEP_AMPS || di <= -DCIR_STEP_AMPS);
+
+    for(uint16_t i = 0; i < cell_num; i++)
+    {
+        uint16_t code = *(cell_codes + i);
+
+        if(step)
+        {
+            //Discharging harder drops the cell voltage
+            float r = ((int32_t) *(last_codes + i) - code) * 0.0001 / di;
+            float estimate = *(estimates + i);
+            uint8_t n = *(settled + i);
+
+            if(r < DCIR_MIN_OHMS || r > DCIR_MAX_OHMS ||
+               (n >= DCIR_SETTLE_STEPS && fabsf(r - estimate) > estimate * DCIR_OUTLIER_RATIO))
+            {
+                rejected++;
+            }
+            else if(n < DCIR_SETTLE_STEPS)
+            {
+                //Plain average until settled
+                n++;
+                *(estimates + i) = estimate + (r - estimate) / n;
+                *(settled + i) = n;
+            }
+            else
+            {
+                *(estimates + i) = estimate + (r - estimate) * (1.0 / (1 << DCIR_GAIN_SHIFT));
+            }
+        }
+
+        *(last_codes + i) = code;
+    }
+
+    last_amps = now_amps;
+    last_us = now_us;
+    primed = true;
+
+    if(step)
+    {
+        steps++;
+        refresh_stats();
+    }
+
+    return step;
+}
+
+void Dcir_Estimator::refresh_stats()
+{
+    float sum = 0;
+    uint16_t count = 0;
+    for(uint16_t i = 0; i < cell_num; i++)
+    {
+        if(*(settled + i) >= DCIR_SETTLE_STEPS)
+        {
+            sum += *(estimates + i);
+            count++;
+        }
+    }
+    this->average = count == 0 ? 0 : sum / count;
+
+    uint16_t weak = 0;
+    this->worst = 0xFFFF;
+    for(uint16_t i = 0; i < cell_num; i++)
+    {
+        if(*(settled + i) < DCIR_SETTLE_STEPS)
+        {
+            continue;
+        }
+        if(worst == 0xFFFF || *(estimates + i) > *(estimates + worst))
+        {
+            worst = i;
+        }
+        if(is_weak(i))
+        {
+            weak++;
+        }
+    }
+
+#if DEBUG
+    if(weak > weak_num)
+    {
+        Serial.print("Weak cells -> ");
+        Serial.print(weak);
+        Serial.print(", worst cell #");
+        Serial.print(worst);
+        Serial.print(" -> ");
+        Serial.print(*(estimates + worst) * 1000, 2);
+        Serial.println(" mOhm");
+    }
+#endif
+
+    this->weak_num = weak;
+}
@@ -0,0 +1,78 @@
+/* Online internal resistance (DCIR) estimation */
+#ifndef RESISTANCE_H
+#define RESISTANCE_H
+
+#include <stdint.h>
+#include "sample_cache.h"
+
+//Smallest current change (A) between 2 scans that counts as a step
+#define DCIR_STEP_AMPS 10.0
+//Max age of the current sample on a scan, anything older is not from the same conversion window
+#define DCIR_MAX_SKEW_US 20000
+//Max time between the 2 scans of a pair, the cells relax & the current moves in between
+#define DCIR_MAX_PAIR_US 1500000
+
+//Any single step outside of this range (Ohm) is noise
+#define DCIR_MIN_OHMS 0.001
+#define DCIR_MAX_OHMS 1.0
+
+//Steps averaged before a cell estimate is trusted, EWMA (1 / 2^n) after that
+#define DCIR_SETTLE_STEPS 4
+#define DCIR_GAIN_SHIFT 3
+//Steps further than this (relative) from a settled estimate are rejected
+#define DCIR_OUTLIER_RATIO 0.5
+
+//A settled cell this many times over the pack average is weak
+#define DCIR_WEAK_RATIO 1.5
+
+//Pairs every current step seen by the IVT with the cell voltage change of the same
+//2 scans, so each cell gets R = -dV / dI (I > 0 on discharge). Both scans have to be
+//recent (see BMS::set_step_scan() for a scan right after the step).
+//Only the previous scan is kept around and each step costs O(cells).
+class Dcir_Estimator
+{
+public:
+    Dcir_Estimator(uint16_t cell_num, float weak_ratio = DCIR_WEAK_RATIO);
+
+    ~Dcir_Estimator();
+
+    //Feeds a freshly read cell array (BMS layout) along with the current (sign makes discharge positive).
+    //Returns true if a step was found
+    bool update(const uint16_t * cell_codes, Sample_Cache const * amps, int8_t current_sign, uint32_t now_us);
+
+    //Ohm, 0 until the first accepted step
+    float get_cell(uint16_t cell);
+    float get_average();
+
+    //Worst settled cell, 0xFFFF if none is settled yet
+    uint16_t get_worst();
+
+    bool is_weak(uint16_t cell);
+    uint16_t get_weak_num();
+
+    uint32_t get_steps();
+    uint32_t get_rejected();
+
+    const uint16_t cell_num;
+    const float weak_ratio;
+
+protected:
+    void refresh_stats();
+
+    uint16_t * last_codes;
+    float last_amps = 0;
+    uint32_t last_us = 0;
+    bool primed = false;
+
+    float * estimates;
+    uint8_t * settled;
+
+    float average = 0;
+    uint16_t worst = 0xFFFF;
+    uint16_t weak_num = 0;
+
+    uint32_t steps = 0;
+    uint32_t rejected = 0;
+};
+
+#endif //RESISTANCE_H
@@ -0,0 +1,53 @@
+#include "sample_cache.h"
+
+Sample_Cache::Sample_Cache(uint32_t max_age_us) : max_age_us(max_age_us) {}
+
+void Sample_Cache::put(float value, uint32_t now_us)
+{
+    if(sequence > 0)
+    {
+        uint32_t interval = now_us - rx_us;
+
+        //Running average with a weight of 1/8 on the latest interval
+        if(period_us == 0)
+        {
+            period_us = interval;
+        }
+        else
+        {
+            period_us = period_us - (period_us >> 3) + (interval >> 3);
+        }
+    }
+
+    this->value = value;
+    this->rx_us = now_us;
+    this->sequence++;
+}
+
+bool Sample_Cache::get(float * value, uint32_t max_age_us, uint32_t now_us) const
+{
+    if(sequence == 0 || now_us - rx_us > max_age_us)
+    {
+        return false;
+    }
+
+    *value = this->value;
+    return true;
+}
+
+bool Sample_Cache::is_fresh(uint32_t now_us) const
+{
+    return sequence != 0 && now_us - rx_us <= max_age_us;
+}
+
+bool Sample_Cache::has_value() const { return sequence != 0; }
+float Sample_Cache::get_value() const { return this->value; }
+uint32_t Sample_Cache::get_rx_us() const { return this->rx_us; }
+uint32_t Sample_Cache::get_age_us(uint32_t now_us) const { return now_us - rx_us; }
+uint32_t Sample_Cache::get_sequence() const { return this->sequence; }
+uint32_t Sample_Cache::get_period_us() const { return this->period_us; }
+
+float Sample_Cache::get_rate_hz() const
+{
+    return period_us == 0 ? 0 : 1000000.0 / period_us;
+}
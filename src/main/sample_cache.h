@@ -0,0 +1,42 @@
+/* Timestamped cache of a single signal received from a sensor */
+#ifndef SAMPLE_CACHE_H
+#define SAMPLE_CACHE_H
+
+#include <stdint.h>
+
+//Keeps the latest value of a signal along with the time (us) it was received on,
+//how many samples have been received so far and a running estimate of the period.
+//Every query is O(1), so consumers can ask for the latest value no older than X on every tick.
+class Sample_Cache
+{
+public:
+    Sample_Cache(uint32_t max_age_us);
+
+    void put(float value, uint32_t now_us);
+
+    //Provides the latest value only if it is no older than max_age_us
+    bool get(float * value, uint32_t max_age_us, uint32_t now_us) const;
+
+    //Same as above, using the max age of the signal
+    bool is_fresh(uint32_t now_us) const;
+
+    bool has_value() const;
+    float get_value() const;
+    uint32_t get_rx_us() const;
+    uint32_t get_age_us(uint32_t now_us) const;
+    uint32_t get_sequence() const;
+
+    //Estimated period between samples (0 until 2 samples are received)
+    uint32_t get_period_us() const;
+    float get_rate_hz() const;
+
+    const uint32_t max_age_us;
+
+protected:
+    float value = 0;
+    uint32_t rx_us = 0;
+    uint32_t sequence = 0;
+    uint32_t period_us = 0;
+};
+
+#endif //SAMPLE_CACHE_H
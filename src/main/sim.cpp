@@ -0,0 +1,551 @@
+#include <Arduino.h>
+#include "config.h"
+#include "soc.h"
+#include "LTC6804_2.h"
+#include "sim.h"
+
+//Register groups & commands the slaves answer to (11 bit command codes)
+#define CMD_WRCFG 0x001
+#define CMD_RDCFG 0x002
+#define CMD_CLRCELL 0x711
+#define CMD_CLRAUX 0x712
+#define CMD_CLRSTAT 0x713
+#define CMD_DIAGN 0x715
+
+//Every slave is addressed, or all of them at once
+#define BROADCAST 0xFF
+
+/* A lap: launch, straights, braking (regen) & corners, then a standstill.
+   ~3A on average, a full cell group lasts about as long as an endurance (~25 min) */
+static const Sim_Segment_t drive_cycle[] =
+{
+    {5000, 0},
+    {3000, 10},
+    {6000, 3},
+    {1500, -3},
+    {2500, 6},
+    {4000, 2},
+    {1000, -2},
+    {3000, 8},
+    {2000, 1},
+    {2000, -1}
+};
+static const uint8_t drive_cycle_len = sizeof(drive_cycle) / sizeof(drive_cycle[0]);
+
+Pack_Model::Pack_Model(uint16_t cell_num, uint32_t seed) : cell_num(cell_num), seed(seed == 0 ? 1 : seed)
+{
+    this->cells = (Sim_Cell_t *) malloc(sizeof(Sim_Cell_t) * cell_num);
+    for(uint16_t i = 0; i < cell_num; i++)
+    {
+        Sim_Cell_t * cell = cells + i;
+        cell->capacity_ah = SIM_CAPACITY_AH * (1 + SIM_CAPACITY_SPREAD * spread());
+        cell->r0 = SIM_R0 * (1 + SIM_R0_SPREAD * spread());
+        cell->soc = SIM_INITIAL_SOC + SIM_SOC_SPREAD * spread();
+        cell->v1 = 0;
+        cell->temp = SIM_AMBIENT_C;
+        cell->bleeding = false;
+    }
+}
+
+Pack_Model::~Pack_Model()
+{
+    free(this->cells);
+}
+
+//xorshift32, the pack only depends on the seed
+float Pack_Model::spread()
+{
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    return (seed & 0xFFFF) / 32768.0 - 1;
+}
+
+float Pack_Model::bleed_amps(uint16_t cell)
+{
+    float slope;
+    return (cells + cell)->bleeding ? cell_ocv((cells + cell)->soc, &slope) / SIM_BLEED_OHMS : 0;
+}
+
+void Pack_Model::step(float amps, float dt_s)
+{
+    this->amps = amps;
+    float decay = exp(-dt_s / SIM_TAU_S);
+
+    for(uint16_t i = 0; i < cell_num; i++)
+    {
+        Sim_Cell_t * cell = cells + i;
+        float i_cell = amps + bleed_amps(i);
+
+        cell->soc -= i_cell * dt_s / (cell->capacity_ah * 3600);
+        cell->soc = cell->soc < 0 ? 0 : (cell->soc > 1 ? 1 : cell->soc);
+
+        cell->v1 = cell->v1 * decay + SIM_R1 * amps * (1 - decay);
+
+        //Ohmic & polarization losses heat the cell, the rest of the box cools it
+        float r0 = cell->r0 * (1 + SIM_R0_TEMP_COEFF * (SIM_AMBIENT_C - cell->temp));
+        float heat = amps * amps * r0 + amps * cell->v1;
+        cell->temp += (heat - SIM_COOLING * (cell->temp - SIM_AMBIENT_C)) * dt_s / SIM_HEAT_CAPACITY;
+    }
+}
+
+void Pack_Model::set_bleeding(uint16_t cell, bool on)
+{
+    if(cell < cell_num)
+    {
+        (cells + cell)->bleeding = on;
+    }
+}
+
+float Pack_Model::get_cell_volts(uint16_t cell)
+{
+    Sim_Cell_t * c = cells + cell;
+    float slope;
+    float r0 = c->r0 * (1 + SIM_R0_TEMP_COEFF * (SIM_AMBIENT_C - c->temp));
+    return cell_ocv(c->soc, &slope) - c->v1 - r0 * (amps + bleed_amps(cell));
+}
+
+float Pack_Model::get_cell_temp(uint16_t cell){ return (cells + cell)->temp; }
+float Pack_Model::get_cell_soc(uint16_t cell){ return (cells + cell)->soc; }
+float Pack_Model::get_amps(){ return this->amps; }
+
+float Pack_Model::get_pack_volts()
+{
+    float volts = 0;
+    for(uint16_t i = 0; i < cell_num; i++)
+    {
+        volts += get_cell_volts(i);
+    }
+    return volts;
+}
+
+LTC_Emulator::LTC_Emulator(Pack_Model * pack, uint8_t total_ic, float (* v_to_celsius)(float, float)) :
+    total_ic(total_ic), pack(pack), v_to_celsius(v_to_celsius)
+{
+    this->slaves = (Sim_Slave_t *) malloc(sizeof(Sim_Slave_t) * total_ic);
+    for(uint8_t ic = 0; ic < total_ic; ic++)
+    {
+        Sim_Slave_t * slave = slaves + ic;
+        memset(slave, 0, sizeof(Sim_Slave_t));
+        memset(slave->cells, 0xFF, sizeof(slave->cells));
+        memset(slave->aux, 0xFF, sizeof(slave->aux));
+        memset(slave->stat, 0xFF, sizeof(slave->stat));
+    }
+}
+
+LTC_Emulator::~LTC_Emulator()
+{
+    free(this->slaves);
+}
+
+/* Same CRC15 as LTC6804_2::pec15_calc(), kept apart so it does not count as firmware work */
+uint16_t LTC_Emulator::pec(uint8_t len, uint8_t * data)
+{
+    uint16_t remainder = 16, addr;
+    for(uint8_t i = 0; i < len; i++)
+    {
+        addr = ((remainder >> 7) ^ data[i]) & 0xff;
+        remainder = (remainder << 8) ^ crc15Table[addr];
+    }
+    return remainder * 2;
+}
+
+/* Every transfer starts with CMD0 CMD1 PEC0 PEC1. CMD0 is 1 AAAA CCC when addressed, 0 0000 CCC on broadcasts.
+   WRCFG is followed by 6 bytes & their PEC, register reads shift out 6 bytes & their PEC */
+void LTC_Emulator::write(int8_t data)
+{
+    rx[rx_len++] = data;
+
+    if(writing_cfg)
+    {
+        if(rx_len == 4 + 8)
+        {
+            store_cfg(target);
+            writing_cfg = false;
+            rx_len = 0;
+        }
+        return;
+    }
+
+    if(rx_len < 4)
+    {
+        return;
+    }
+    rx_len = 0;
+
+    //A broken command is ignored, like the slaves do
+    if(pec(2, rx) != (uint16_t) (rx[2] << 8 | rx[3]))
+    {
+        return;
+    }
+
+    uint16_t command = (rx[0] & 0x07) << 8 | rx[1];
+    this->target = (rx[0] & 0x80) ? (rx[0] >> 3) & 0x0F : BROADCAST;
+
+    if(command == CMD_WRCFG)
+    {
+        writing_cfg = true;
+        rx_len = 4;
+        return;
+    }
+
+    execute(command, target);
+    load(command, target);
+}
+
+//The byte the master clocks out while reading is a dummy one, the slaves ignore it
+int8_t LTC_Emulator::read(int8_t)
+{
+    if(tx_pos < tx_len)
+    {
+        return tx[tx_pos++];
+    }
+    //Nobody drives the bus
+    return 0xFF;
+}
+
+void LTC_Emulator::store_cfg(uint8_t ic)
+{
+    if(ic == BROADCAST || ic >= total_ic || pec(6, rx + 4) != (uint16_t) (rx[10] << 8 | rx[11]))
+    {
+        return;
+    }
+
+    Sim_Slave_t * slave = slaves + ic;
+    memcpy(slave->cfg, rx + 4, 6);
+    slave->dcto_ms = millis();
+
+    //CFGR4: DCC8~1, CFGR5: DCTO[3~0] DCC12~9
+    uint16_t dcc = slave->cfg[4] | (slave->cfg[5] & 0x0F) << 8;
+    for(uint8_t c = 0; c < SIM_CELLS_PER_IC; c++)
+    {
+        pack->set_bleeding(ic * SIM_CELLS_PER_IC + c, dcc & (1 << c));
+    }
+}
+
+/* Conversions & clears, see the command codes on LTC6804_2 */
+void LTC_Emulator::execute(uint16_t command, uint8_t target)
+{
+    uint8_t md = (command >> 7) & 0x03;
+
+    for(uint8_t ic = 0; ic < total_ic; ic++)
+    {
+        if(target != BROADCAST && target != ic)
+        {
+            continue;
+        }
+
+        Sim_Slave_t * slave = slaves + ic;
+        uint16_t st_code = LTC6804_2::self_test_code(md, slave->cfg[0] & 0x01, (command >> 5) & 0x03);
+
+        if((command & 0x0668) == 0x0260) //ADCV
+        {
+            convert_cells(ic, command & 0x07);
+        }
+        else if((command & 0x0628) == 0x0228) //ADOW
+        {
+            convert_cells(ic, command & 0x07);
+            convert_open_wires(ic, command & 0x40);
+        }
+        else if((command & 0x061F) == 0x0207) //CVST
+        {
+            for(uint8_t c = 0; c < SIM_CELLS_PER_IC; c++)
+            {
+                slave->cells[c] = st_code;
+            }
+        }
+        else if((command & 0x066F) == 0x046F) //ADCVAX
+        {
+            convert_cells(ic, 0);
+            convert_aux(ic, 0);
+        }
+        else if((command & 0x0678) == 0x0460) //ADAX
+        {
+            convert_aux(ic, command & 0x07);
+        }
+        else if((command & 0x061F) == 0x0407) //AXST
+        {
+            for(uint8_t g = 0; g < SIM_AUX_PER_IC; g++)
+            {
+                slave->aux[g] = st_code;
+            }
+        }
+        else if((command & 0x061F) == 0x040F) //STATST
+        {
+            for(uint8_t s = 0; s < 4; s++)
+            {
+                slave->stat[s] = st_code;
+            }
+        }
+        else if((command & 0x0678) == 0x0468) //ADSTAT
+        {
+            convert_stat(ic);
+        }
+        else if(command == CMD_DIAGN)
+        {
+            slave->stbr5 &= ~0x02; //MUXFAIL
+        }
+        else if(command == CMD_CLRCELL)
+        {
+            memset(slave->cells, 0xFF, sizeof(slave->cells));
+        }
+        else if(command == CMD_CLRAUX)
+        {
+            memset(slave->aux, 0xFF, sizeof(slave->aux));
+        }
+        else if(command == CMD_CLRSTAT)
+        {
+            memset(slave->stat, 0xFF, sizeof(slave->stat));
+            slave->flags = 0xFFFFFF;
+        }
+    }
+}
+
+/* DCTO reads back as the time left on the discharge timer, in the same steps it is written in */
+uint8_t LTC_Emulator::dcto_left(Sim_Slave_t const * slave)
+{
+    //Minutes of DCTO 1~F
+    static const float dcto_min[15] = {0.5, 1, 2, 3, 4, 5, 10, 15, 20, 30, 40, 60, 75, 90, 120};
+
+    uint8_t dcto = slave->cfg[5] >> 4;
+    if(dcto == 0)
+    {
+        return 0;
+    }
+
+    float left = dcto_min[dcto - 1] - (millis() - slave->dcto_ms) / 60000.0;
+    for(uint8_t code = 1; code <= dcto; code++)
+    {
+        if(left > 0 && left <= dcto_min[code - 1])
+        {
+            return code;
+        }
+    }
+    //Timed out
+    return 0;
+}
+
+/* Register group the next reads shift out, if the command was a read addressed to a slave that exists */
+void LTC_Emulator::load(uint16_t command, uint8_t ic)
+{
+    this->tx_len = 0;
+    this->tx_pos = 0;
+
+    if(ic == BROADCAST || ic >= total_ic)
+    {
+        return;
+    }
+
+    Sim_Slave_t * slave = slaves + ic;
+    uint16_t const * words = nullptr;
+
+    switch(command)
+    {
+        case CMD_RDCFG:
+            memcpy(tx, slave->cfg, 6);
+            tx[5] = dcto_left(slave) << 4 | (tx[5] & 0x0F);
+            break;
+        case CMD_RDCVA:
+        case CMD_RDCVB:
+        case CMD_RDCVC:
+        case CMD_RDCVD:
+            words = slave->cells + (command - CMD_RDCVA) / 2 * 3;
+            break;
+        case CMD_RDAUXA:
+        case CMD_RDAUXB:
+            words = slave->aux + (command - CMD_RDAUXA) / 2 * 3;
+            break;
+        case CMD_RDSTATA:
+            words = slave->stat;
+            break;
+        case CMD_RDSTATB:
+            tx[0] = slave->stat[3] & 0xFF;
+            tx[1] = slave->stat[3] >> 8;
+            tx[2] = slave->flags & 0xFF;
+            tx[3] = (slave->flags >> 8) & 0xFF;
+            tx[4] = (slave->flags >> 16) & 0xFF;
+            tx[5] = slave->stbr5;
+            break;
+        default:
+            return;
+    }
+
+    if(words != nullptr)
+    {
+        for(uint8_t w = 0; w < 3; w++)
+        {
+            tx[w * 2] = words[w] & 0xFF;
+            tx[w * 2 + 1] = words[w] >> 8;
+        }
+    }
+
+    uint16_t data_pec = pec(6, tx);
+    tx[6] = data_pec >> 8;
+    tx[7] = data_pec & 0xFF;
+    this->tx_len = 8;
+}
+
+/* CH = 0 converts every cell, CH = n cells n & n + 6. The comparators run on every conversion:
+   CxUV when below (VUV + 1) * 16, CxOV when above VOV * 16 (100uV/LSB) */
+void LTC_Emulator::set_open_wire(uint8_t ic, uint8_t wire, bool open)
+{
+    if(ic < total_ic && wire <= SIM_CELLS_PER_IC)
+    {
+        Sim_Slave_t * slave = slaves + ic;
+        slave->open_wires = open ? slave->open_wires | 1 << wire : slave->open_wires & ~(1 << wire);
+    }
+}
+
+/* An open wire follows the current source: pulled up it sits on the wire above, pulled down
+   on the wire below. The cell under it reads 0 and the cell on the other side both cells */
+void LTC_Emulator::convert_open_wires(uint8_t ic, bool pull_up)
+{
+    Sim_Slave_t * slave = slaves + ic;
+
+    for(uint8_t wire = 0; wire <= SIM_CELLS_PER_IC; wire++)
+    {
+        if(!(slave->open_wires & 1 << wire))
+        {
+            continue;
+        }
+
+        //Cell 'wire' (1 based) is below C(wire), cell 'wire + 1' above it
+        uint16_t * below = wire > 0 ? slave->cells + wire - 1 : nullptr;
+        uint16_t * above = wire < SIM_CELLS_PER_IC ? slave->cells + wire : nullptr;
+        uint16_t * zero = pull_up ? above : below;
+        uint16_t * both = pull_up ? below : above;
+
+        if(both != nullptr && zero != nullptr)
+        {
+            *both = *both + *zero > 0xFFFF ? 0xFFFF : *both + *zero;
+        }
+        if(zero != nullptr)
+        {
+            *zero = 0;
+        }
+    }
+}
+
+void LTC_Emulator::convert_cells(uint8_t ic, uint8_t ch)
+{
+    Sim_Slave_t * slave = slaves + ic;
+    uint16_t vuv = slave->cfg[1] | (slave->cfg[2] & 0x0F) << 8;
+    uint16_t vov = slave->cfg[2] >> 4 | slave->cfg[3] << 4;
+
+    for(uint8_t c = 0; c < SIM_CELLS_PER_IC; c++)
+    {
+        if(ch != 0 && c % 6 != ch - 1)
+        {
+            continue;
+        }
+
+        float volts = pack->get_cell_volts(ic * SIM_CELLS_PER_IC + c);
+        uint16_t code = volts <= 0 ? 0 : (volts >= 6.5535 ? 0xFFFF : volts * 10000);
+        slave->cells[c] = code;
+
+        slave->flags &= ~(0x03UL << (2 * c));
+        if(code < (uint32_t) (vuv + 1) * 16)
+        {
+            slave->flags |= 1UL << (2 * c);
+        }
+        if(code > (uint32_t) vov * 16)
+        {
+            slave->flags |= 2UL << (2 * c);
+        }
+    }
+}
+
+/* GPIOn reads the thermistor of a cell spread evenly along the slave, CHG = n only GPIOn (6 is VREF2) */
+void LTC_Emulator::convert_aux(uint8_t ic, uint8_t chg)
+{
+    Sim_Slave_t * slave = slaves + ic;
+
+    for(uint8_t g = 0; g < SIM_AUX_PER_IC - 1; g++)
+    {
+        if(chg == 0 || chg == g + 1)
+        {
+            uint16_t cell = ic * SIM_CELLS_PER_IC + g * SIM_CELLS_PER_IC / (SIM_AUX_PER_IC - 1);
+            slave->aux[g] = thermistor_code(pack->get_cell_temp(cell));
+        }
+    }
+    if(chg == 0 || chg == SIM_AUX_PER_IC)
+    {
+        slave->aux[SIM_AUX_PER_IC - 1] = SIM_VREF2_CODE;
+    }
+}
+
+/* SOC is the sum of cells / 20, ITMP (code * 100uV / 7.5mV/C - 273C) the die temperature */
+void LTC_Emulator::convert_stat(uint8_t ic)
+{
+    Sim_Slave_t * slave = slaves + ic;
+
+    float sum = 0;
+    for(uint8_t c = 0; c < SIM_CELLS_PER_IC; c++)
+    {
+        sum += pack->get_cell_volts(ic * SIM_CELLS_PER_IC + c);
+    }
+
+    slave->stat[0] = sum * 10000 / 20;
+    slave->stat[1] = (SIM_AMBIENT_C + SIM_DIE_RISE_C + 273) * 0.0075 / 0.0001;
+    slave->stat[2] = SIM_VA_CODE;
+    slave->stat[3] = SIM_VD_CODE;
+    slave->stbr5 &= ~0x01; //THSD
+}
+
+/* Code of the thermistor divider at this temperature, through the same conversion the BMS uses
+   (bisection, the code rises as the thermistor cools down) */
+uint16_t LTC_Emulator::thermistor_code(float celsius)
+{
+    uint16_t low = 1, high = SIM_VREF2_CODE - 1;
+    while(low < high)
+    {
+        uint16_t mid = (low + high) / 2;
+        if(v_to_celsius(mid * 0.0001, SIM_VREF2_CODE * 0.0001) > celsius)
+        {
+            low = mid + 1;
+        }
+        else
+        {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+uint64_t Pack_Simulator::clock_us = 0;
+
+Pack_Simulator::Pack_Simulator(uint8_t total_ic, uint32_t seed, float (* v_to_celsius)(float, float)) :
+    pack(total_ic * SIM_CELLS_PER_IC, seed), ltc(&pack, total_ic, v_to_celsius) {}
+
+void Pack_Simulator::step(float amps)
+{
+    pack.step(amps, SIM_STEP_MS * 0.001);
+    clock_us += (uint32_t) SIM_STEP_MS * 1000;
+    steps++;
+}
+
+float Pack_Simulator::get_drive_amps()
+{
+    uint32_t lap_ms = 0;
+    for(uint8_t i = 0; i < drive_cycle_len; i++)
+    {
+        lap_ms += drive_cycle[i].ms;
+    }
+
+    uint32_t t = (uint32_t) ((clock_us / 1000) % lap_ms);
+    for(uint8_t i = 0; i < drive_cycle_len; i++)
+    {
+        if(t < drive_cycle[i].ms)
+        {
+            return drive_cycle[i].amps;
+        }
+        t -= drive_cycle[i].ms;
+    }
+    return 0;
+}
+
+LT_SPI * Pack_Simulator::get_spi(){ return &this->ltc; }
+Pack_Model * Pack_Simulator::get_pack(){ return &this->pack; }
+uint32_t Pack_Simulator::get_steps(){ return this->steps; }
+
+uint64_t Pack_Simulator::now_us(){ return clock_us; }
@@ -0,0 +1,182 @@
+/* Pack simulator, stands in for the cells, the slaves & the IVT (SIMULATION_ENABLE) */
+#ifndef SIM_H
+#define SIM_H
+
+#include <stdint.h>
+#include "LT_SPI.h"
+
+//Equivalent circuit of a single INR18650-13Q (see spec/), same model the EKF runs on
+#define SIM_CAPACITY_AH 1.3
+#define SIM_R0 0.020 /* Ohm, at SIM_AMBIENT_C */
+#define SIM_R1 0.015
+#define SIM_TAU_S 30.0
+//R0 grows by this fraction per degree below SIM_AMBIENT_C (and shrinks above it)
+#define SIM_R0_TEMP_COEFF 0.01
+
+//Cell to cell spread, every cell gets nominal * (1 +- spread), same seed same pack
+#define SIM_CAPACITY_SPREAD 0.03
+#define SIM_R0_SPREAD 0.10
+#define SIM_SOC_SPREAD 0.02
+#define SIM_INITIAL_SOC 0.9
+
+//Lumped thermal model of a cell (~45g): heat capacity (J/K) & conductance to ambient (W/K)
+#define SIM_HEAT_CAPACITY 40.0
+#define SIM_COOLING 0.05
+#define SIM_AMBIENT_C 25.0
+//Die of the slaves sits this much above ambient
+#define SIM_DIE_RISE_C 10.0
+
+//Bleed resistors of the slave boards
+#define SIM_BLEED_OHMS 33.0
+
+//Rails & reference the emulated slaves report (100uV/LSB)
+#define SIM_VA_CODE 50000
+#define SIM_VD_CODE 30000
+#define SIM_VREF2_CODE 30000
+
+//Every step advances the virtual clock by this much
+#define SIM_STEP_MS 100
+
+#define SIM_CELLS_PER_IC 12
+#define SIM_AUX_PER_IC 6 /* GPIO1~5 & VREF2 */
+
+typedef struct sim_cell
+{
+    float soc; /* 0~1 */
+    float v1; /* Voltage across the RC pair */
+    float temp; /* Celsius */
+    float capacity_ah;
+    float r0;
+    bool bleeding;
+} Sim_Cell_t;
+
+//Drive cycle segment, 'amps' (> 0 on discharge) for 'ms'
+typedef struct sim_segment
+{
+    uint16_t ms;
+    float amps;
+} Sim_Segment_t;
+
+//String of cells in series, each a 1-RC equivalent circuit with its own capacity & R0
+//around the nominal ones, a lumped thermal mass heated by its losses and a bleed resistor.
+//Deterministic: the spread comes out of a seeded xorshift and every step is a fixed one.
+class Pack_Model
+{
+public:
+    Pack_Model(uint16_t cell_num, uint32_t seed);
+    ~Pack_Model();
+
+    //Advances every cell by dt_s with 'amps' through the string (> 0 on discharge)
+    void step(float amps, float dt_s);
+
+    void set_bleeding(uint16_t cell, bool on);
+
+    float get_cell_volts(uint16_t cell);
+    float get_cell_temp(uint16_t cell);
+    float get_cell_soc(uint16_t cell);
+    float get_pack_volts();
+    float get_amps();
+
+    const uint16_t cell_num;
+
+protected:
+    Sim_Cell_t * cells;
+    float amps = 0;
+    uint32_t seed;
+
+    //-1 ~ 1
+    float spread();
+    float bleed_amps(uint16_t cell);
+};
+
+//LTC6804-2 stack behind the SPI bus. Commands are decoded & PEC checked byte by byte the way
+//the slaves do it, so LTC6804_2 runs unchanged on top of it. Conversions latch the cells
+//of the pack model, GPIOs read 10k thermistors at the cell temperatures, the comparators &
+//the self tests behave like the datasheet says and DCC bits turn the bleed resistors on.
+//Slaves past total_ic don't answer (the bus reads 0xFF), like a broken isoSPI link would.
+class LTC_Emulator : public LT_SPI
+{
+public:
+    LTC_Emulator(Pack_Model * pack, uint8_t total_ic, float (* v_to_celsius)(float, float));
+    ~LTC_Emulator();
+
+    void write(int8_t data);
+    int8_t read(int8_t data);
+
+    //Breaks sense wire C(n) (0~12) of a slave. Only the ADOW current sources notice,
+    //regular conversions still read the cells
+    void set_open_wire(uint8_t ic, uint8_t wire, bool open);
+
+    const uint8_t total_ic;
+
+protected:
+    typedef struct sim_slave
+    {
+        uint8_t cfg[6];
+        uint16_t cells[SIM_CELLS_PER_IC];
+        uint16_t aux[SIM_AUX_PER_IC];
+        uint16_t stat[4]; /* SOC, ITMP, VA, VD */
+        uint32_t flags; /* CxUV & CxOV, as in STATB */
+        uint8_t stbr5;
+        uint16_t open_wires; /* Bit n is C(n) */
+        uint32_t dcto_ms; /* Discharge timer started (last WRCFG) */
+    } Sim_Slave_t;
+
+    Pack_Model * const pack;
+    float (* const v_to_celsius)(float, float);
+    Sim_Slave_t * slaves;
+
+    //Command being shifted in, a register group being shifted out or configuration shifted in
+    uint8_t rx[4 + 8];
+    uint8_t rx_len = 0;
+    uint8_t tx[8];
+    uint8_t tx_len = 0;
+    uint8_t tx_pos = 0;
+    bool writing_cfg = false;
+    uint8_t target = 0;
+
+    void execute(uint16_t command, uint8_t ic);
+    void load(uint16_t command, uint8_t ic);
+    uint8_t dcto_left(Sim_Slave_t const * slave);
+    void store_cfg(uint8_t ic);
+
+    void convert_cells(uint8_t ic, uint8_t ch);
+    void convert_open_wires(uint8_t ic, bool pull_up);
+    void convert_aux(uint8_t ic, uint8_t chg);
+    void convert_stat(uint8_t ic);
+    uint16_t thermistor_code(float celsius);
+
+    static uint16_t pec(uint8_t len, uint8_t * data);
+};
+
+//Owns the pack model & the slaves, and keeps the virtual clock the firmware runs on (see Clock).
+//Each step is SIM_STEP_MS of virtual time no matter how long the loop took, so the firmware
+//runs as fast as the emulated slaves answer (no conversion delays) instead of in real time.
+class Pack_Simulator
+{
+public:
+    Pack_Simulator(uint8_t total_ic, uint32_t seed, float (* v_to_celsius)(float, float));
+
+    //Advances the virtual clock & the cells, with 'amps' (> 0 on discharge) through the pack
+    void step(float amps);
+
+    //Current of the drive cycle at the virtual time, repeats forever
+    float get_drive_amps();
+
+    LT_SPI * get_spi();
+    Pack_Model * get_pack();
+
+    uint32_t get_steps();
+
+    //Virtual clock (us), see Clock::set_source()
+    static uint64_t now_us();
+
+protected:
+    Pack_Model pack;
+    LTC_Emulator ltc;
+    uint32_t steps = 0;
+
+    static uint64_t clock_us;
+};
+
+#endif //SIM_H
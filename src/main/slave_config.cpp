@@ -0,0 +1,170 @@
+#include <Arduino.h>
+#include "config.h"
+#include "slave_config.h"
+
+//CFGR0 read back reflects the GPIO pin levels and the DTEN pin, so only REFON & ADCOPT are compared
+//CFGR5 read back has the discharge time left in DCTO, so only DCC 12~9 are compared
+static const uint8_t verify_mask[6] = {0x05, 0xFF, 0xFF, 0xFF, 0xFF, 0x0F};
+
+Slave_Config::Slave_Config(LTC6804_2 * ltc, uint8_t total_ic, const uint8_t conf[6], uint16_t refresh_ms) :
+    total_ic(total_ic), refresh_ms(refresh_ms), ltc(ltc)
+{
+    this->image = (uint8_t (*)[6]) malloc(sizeof(uint8_t) * 6 * total_ic);
+    set_all(conf);
+}
+
+Slave_Config::~Slave_Config()
+{
+    free(this->image);
+}
+
+void Slave_Config::set_byte(uint8_t ic, uint8_t byte, uint8_t value)
+{
+    if(image[ic][byte] != value)
+    {
+        image[ic][byte] = value;
+        dirty |= 1 << ic;
+    }
+}
+
+void Slave_Config::set_all(const uint8_t conf[6])
+{
+    for(uint8_t ic = 0; ic < total_ic; ic++)
+    {
+        for(uint8_t byte = 0; byte < 6; byte++)
+        {
+            set_byte(ic, byte, conf[byte]);
+        }
+    }
+}
+
+void Slave_Config::set_dcc(uint8_t ic, uint16_t dcc, uint8_t dcto)
+{
+    set_byte(ic, 4, dcc & 0xFF);
+    set_byte(ic, 5, ((dcto & 0x0F) << 4) | ((dcc >> 8) & 0x0F));
+}
+
+/* CFGR1: VUV[7~0]
+   CFGR2: VOV[3~0] VUV[11~8]
+   CFGR3: VOV[11~4] */
+void Slave_Config::set_thresholds(uint8_t ic, uint16_t vuv, uint16_t vov)
+{
+    set_byte(ic, 1, vuv & 0xFF);
+    set_byte(ic, 2, ((vov & 0x0F) << 4) | ((vuv >> 8) & 0x0F));
+    set_byte(ic, 3, (vov >> 4) & 0xFF);
+}
+
+uint16_t Slave_Config::encode_vuv(float volts)
+{
+    float code = volts / 0.0016 - 1;
+    return code <= 0 ? 0 : (code >= 0xFFF ? 0xFFF : (uint16_t) code);
+}
+
+uint16_t Slave_Config::encode_vov(float volts)
+{
+    float code = volts / 0.0016;
+    return code <= 0 ? 0 : (code >= 0xFFF ? 0xFFF : (uint16_t) code);
+}
+
+void Slave_Config::set_gpio(uint8_t ic, uint8_t gpio)
+{
+    set_byte(ic, 0, ((gpio & 0x1F) << 3) | (image[ic][0] & 0x07));
+}
+
+uint8_t const * Slave_Config::get(uint8_t ic){ return image[ic]; }
+
+bool Slave_Config::is_dirty(uint8_t ic){ return dirty & (1 << ic); }
+
+uint8_t Slave_Config::flush(uint32_t now_ms)
+{
+    //Stagger the refresh, so that every slave is rewritten once per refresh_ms
+    if(now_ms - last_refresh_ms >= refresh_ms / total_ic)
+    {
+        last_refresh_ms = now_ms;
+        dirty |= 1 << refresh_index;
+        refresh_index = (refresh_index + 1) % total_ic;
+    }
+
+    uint16_t mask = dirty & ((1 << total_ic) - 1);
+    if(mask == 0)
+    {
+        return 0;
+    }
+
+    ltc->wrcfg(total_ic, image, mask);
+    dirty = 0;
+
+    uint8_t written = 0;
+    for(; mask != 0; mask &= mask - 1)
+    {
+        written++;
+    }
+    return written;
+}
+
+int8_t Slave_Config::verify(uint8_t ic)
+{
+    uint8_t r_cfg[8];
+
+    if(ltc->rdcfg_ic(ic, r_cfg) == -1)
+    {
+        return SLAVE_CONFIG_PEC;
+    }
+
+    for(uint8_t byte = 0; byte < 6; byte++)
+    {
+        if((r_cfg[byte] & verify_mask[byte]) != (image[ic][byte] & verify_mask[byte]))
+        {
+#if DEBUG
+            Serial.print("Slave ");
+            Serial.print(ic);
+            Serial.println(" does not hold its configuration, rewriting it");
+#endif
+            dirty |= 1 << ic;
+            if(++mismatches[ic] >= SLAVE_CONFIG_MAX_MISMATCHES)
+            {
+                return SLAVE_CONFIG_LOST;
+            }
+            return SLAVE_CONFIG_MISMATCH;
+        }
+    }
+
+    mismatches[ic] = 0;
+    return SLAVE_CONFIG_OK;
+}
+
+int8_t Slave_Config::verify_next()
+{
+    //A slave with a pending write would mismatch for no reason
+    uint8_t ic = verify_index;
+    verify_index = (verify_index + 1) % total_ic;
+
+    if(is_dirty(ic))
+    {
+        return SLAVE_CONFIG_OK;
+    }
+
+    return verify(ic);
+}
+
+int8_t Slave_Config::write_all_and_verify()
+{
+    ltc->wrcfg(total_ic, image);
+    dirty = 0;
+
+    int8_t result = SLAVE_CONFIG_OK;
+    for(uint8_t ic = 0; ic < total_ic; ic++)
+    {
+        int8_t r = verify(ic);
+        if(r == SLAVE_CONFIG_PEC)
+        {
+            return r;
+        }
+        if(r != SLAVE_CONFIG_OK)
+        {
+            //A single mismatch on startup is already a lost slave
+            result = SLAVE_CONFIG_LOST;
+        }
+    }
+    return result;
+}
@@ -0,0 +1,85 @@
+/* Per slave shadow of the LTC6804 configuration register group */
+#ifndef SLAVE_CONFIG_H
+#define SLAVE_CONFIG_H
+
+#include <stdint.h>
+#include "LTC6804_2.h"
+
+//LTC6804-2 has a 4 bit address, so a stack holds up to 16 slaves (one bit each on the masks below)
+#define SLAVE_CONFIG_MAX_IC 16
+
+//The watchdog of the LTC6804 resets the configuration after ~2s of silence,
+//so every slave is rewritten well within that, even if nothing changed
+#define SLAVE_CONFIG_REFRESH_MS 1000
+
+//Consecutive read back mismatches of a slave before it is considered lost
+#define SLAVE_CONFIG_MAX_MISMATCHES 3
+
+#define SLAVE_CONFIG_OK 0
+#define SLAVE_CONFIG_PEC -1
+#define SLAVE_CONFIG_MISMATCH 1 /* Slave gets rewritten on next flush */
+#define SLAVE_CONFIG_LOST 2 /* Slave keeps ignoring its configuration */
+
+//Holds the 6 byte configuration (CFGR0~5) of every slave. Changes are staged here
+//and on flush() only the slaves whose image changed get rewritten, along with a
+//staggered refresh of one slave at a time that stays ahead of the watchdog.
+//Read backs are staggered as well, one slave per verify_next().
+class Slave_Config
+{
+public:
+    Slave_Config(LTC6804_2 * ltc, uint8_t total_ic, const uint8_t conf[6],
+                 uint16_t refresh_ms = SLAVE_CONFIG_REFRESH_MS);
+    ~Slave_Config();
+
+    //Resets the image of every slave to the provided configuration
+    void set_all(const uint8_t conf[6]);
+
+    //CFGR4 DCC 8~1, CFGR5 DCTO[3~0] DCC 12~9
+    void set_dcc(uint8_t ic, uint16_t dcc, uint8_t dcto);
+
+    //CFGR1~3, raw comparison codes (16 * 100uV/LSB)
+    void set_thresholds(uint8_t ic, uint16_t vuv, uint16_t vov);
+
+    //Comparison voltages are (VUV + 1) * 1.6mV and VOV * 1.6mV
+    static uint16_t encode_vuv(float volts);
+    static uint16_t encode_vov(float volts);
+
+    //GPIO 5~1 bits of CFGR0, writing 0 turns the pull down of that GPIO on
+    void set_gpio(uint8_t ic, uint8_t gpio);
+
+    uint8_t const * get(uint8_t ic);
+    bool is_dirty(uint8_t ic);
+
+    //Writes every dirty slave, returns the number of slaves written
+    uint8_t flush(uint32_t now_ms);
+
+    //Reads back the next slave (round robin) and compares it against its image
+    //See SLAVE_CONFIG_* above for return values
+    int8_t verify_next();
+
+    //Writes and reads back every slave at once. Used on startup
+    int8_t write_all_and_verify();
+
+    const uint8_t total_ic;
+    const uint16_t refresh_ms;
+
+protected:
+    void set_byte(uint8_t ic, uint8_t byte, uint8_t value);
+    int8_t verify(uint8_t ic);
+
+    LTC6804_2 * const ltc;
+
+    uint8_t (* image)[6];
+
+    //Bit n means slave n needs to be written
+    uint16_t dirty = 0xFFFF;
+
+    uint8_t mismatches[SLAVE_CONFIG_MAX_IC] = {0};
+
+    uint8_t refresh_index = 0;
+    uint32_t last_refresh_ms = 0;
+
+    uint8_t verify_index = 0;
+};
+
+#endif //SLAVE_CONFIG_H
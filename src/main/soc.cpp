@@ -0,0 +1,233 @@
+#include <Arduino.h>
+#include "config.h"
+#include "soc.h"
+
+/* Rest voltage of an INR18650-13Q cell every 10% of SOC (100uV/LSB).
+   Approximated from the discharge curves of the spec at low rates */
+static const uint16_t ocv_table[11] = {30000, 34500, 35500, 36200, 36800, 37500, 38300, 39200, 40000, 40800, 41800};
+
+float cell_ocv(float soc, float * slope)
+{
+    float position = soc * 10;
+    int8_t i = position;
+    if(i < 0)
+    {
+        i = 0;
+    }
+    else if(i > 9)
+    {
+        i = 9;
+    }
+
+    float low = ocv_table[i] * 0.0001, high = ocv_table[i + 1] * 0.0001;
+    *slope = (high - low) * 10;
+    return low + (high - low) * (position - i);
+}
+
+Coulomb_Counter::Coulomb_Counter(uint16_t capacity_mah, uint16_t cell_num, Eeprom_Journal * journal, int8_t current_sign) :
+    cell_num(cell_num), current_sign(current_sign),
+    charge(0), capacity((int64_t) capacity_mah * 3600 * 1000000), journal(journal)
+{
+    this->offsets = (int16_t *) malloc(sizeof(int16_t) * cell_num);
+
+    for(uint16_t i = 0; i < cell_num; i++)
+    {
+        *(offsets + i) = 0;
+    }
+}
+
+Coulomb_Counter::~Coulomb_Counter()
+{
+    free(this->offsets);
+}
+
+uint16_t Coulomb_Counter::ocv_to_soc(uint16_t code)
+{
+    if(code <= ocv_table[0])
+    {
+        return 0;
+    }
+    if(code >= ocv_table[10])
+    {
+        return SOC_FULL;
+    }
+
+    uint8_t i = 1;
+    while(code > ocv_table[i])
+    {
+        i++;
+    }
+
+    //Linear between the 2 points of the table
+    uint32_t low = ocv_table[i - 1], high = ocv_table[i];
+    return (i - 1) * 1000 + (uint32_t) (code - low) * 1000 / (high - low);
+}
+
+void Coulomb_Counter::set_soc(uint16_t soc)
+{
+    this->charge = capacity * soc / SOC_FULL;
+    this->initialized = true;
+}
+
+uint16_t Coulomb_Counter::get_soc()
+{
+    if(charge <= 0)
+    {
+        return 0;
+    }
+    if(charge >= capacity)
+    {
+        return SOC_FULL;
+    }
+    return charge * SOC_FULL / capacity;
+}
+
+uint16_t Coulomb_Counter::get_cell_soc(uint16_t cell)
+{
+    int32_t soc = (int32_t) get_soc() + *(offsets + cell);
+    return soc < 0 ? 0 : (soc > SOC_FULL ? SOC_FULL : soc);
+}
+
+uint16_t Coulomb_Counter::get_min_cell_soc()
+{
+    int16_t offset = *(offsets);
+    for(uint16_t i = 1; i < cell_num; i++)
+    {
+        if(*(offsets + i) < offset)
+        {
+            offset = *(offsets + i);
+        }
+    }
+    int32_t soc = (int32_t) get_soc() + offset;
+    return soc < 0 ? 0 : (soc > SOC_FULL ? SOC_FULL : soc);
+}
+
+uint16_t Coulomb_Counter::get_max_cell_soc()
+{
+    int16_t offset = *(offsets);
+    for(uint16_t i = 1; i < cell_num; i++)
+    {
+        if(*(offsets + i) > offset)
+        {
+            offset = *(offsets + i);
+        }
+    }
+    int32_t soc = (int32_t) get_soc() + offset;
+    return soc < 0 ? 0 : (soc > SOC_FULL ? SOC_FULL : soc);
+}
+
+bool Coulomb_Counter::is_resting(){ return this->resting; }
+uint32_t Coulomb_Counter::get_dropped(){ return this->dropped; }
+
+void Coulomb_Counter::update(Sample_Cache const * amps)
+{
+    if(amps->get_sequence() == last_sequence)
+    {
+        return;
+    }
+
+    int32_t ma = amps->get_value() * 1000 * current_sign;
+    uint32_t rx_us = amps->get_rx_us();
+
+    if(last_sequence != 0)
+    {
+        uint32_t dt = rx_us - last_rx_us;
+
+        //Frames that never made it just widen the step, the trapezoid keeps it fair
+        uint32_t period = amps->get_period_us();
+        if(period != 0 && dt > period * SOC_DROP_PERIODS)
+        {
+            dropped += dt / period - 1;
+        }
+
+        this->charge -= (int64_t) (last_ma + ma) * dt / 2;
+    }
+
+    //Rest detection
+    if(ma < SOC_REST_CURRENT_MA && ma > -SOC_REST_CURRENT_MA)
+    {
+        if(!(last_ma < SOC_REST_CURRENT_MA && last_ma > -SOC_REST_CURRENT_MA) || last_sequence == 0)
+        {
+            rest_since_us = rx_us;
+        }
+        resting = rx_us - rest_since_us >= SOC_REST_TIME_US;
+    }
+    else
+    {
+        resting = false;
+    }
+
+    last_ma = ma;
+    last_rx_us = rx_us;
+    last_sequence = amps->get_sequence();
+
+    persist();
+}
+
+void Coulomb_Counter::rest_correct(const uint16_t * cell_codes)
+{
+    if(initialized && !resting)
+    {
+        return;
+    }
+
+    uint32_t sum = 0;
+    for(uint16_t i = 0; i < cell_num; i++)
+    {
+        sum += *(cell_codes + i);
+    }
+    uint16_t avg_soc = ocv_to_soc(sum / cell_num);
+
+    if(!initialized)
+    {
+        set_soc(avg_soc);
+    }
+    else
+    {
+        int32_t soc = get_soc();
+        set_soc(soc + (((int32_t) avg_soc - soc) >> SOC_REST_GAIN_SHIFT));
+    }
+
+    for(uint16_t i = 0; i < cell_num; i++)
+    {
+        *(offsets + i) = (int32_t) ocv_to_soc(*(cell_codes + i)) - avg_soc;
+    }
+
+    persist();
+}
+
+void Coulomb_Counter::load()
+{
+    uint32_t value;
+    uint16_t soc = 0xFFFF;
+
+    //Nothing in the journal leaves it uninitialized, for rest_correct() to seed
+    if(journal->read(JOURNAL_KEY_SOC, &value))
+    {
+        soc = value;
+    }
+
+    if(soc <= SOC_FULL)
+    {
+        set_soc(soc);
+#if DEBUG
+        Serial.print("Restored SOC -> ");
+        Serial.println(soc * 0.01);
+#endif
+        persist();
+    }
+}
+
+void Coulomb_Counter::persist()
+{
+    uint16_t soc = get_soc();
+    int32_t diff = (int32_t) soc - persisted;
+
+    if(!initialized || (persisted != 0xFFFF && diff < SOC_PERSIST_STEP && diff > -SOC_PERSIST_STEP))
+    {
+        return;
+    }
+
+    journal->write(JOURNAL_KEY_SOC, soc);
+    this->persisted = soc;
+}
@@ -0,0 +1,93 @@
+/* State of charge estimation */
+#ifndef SOC_H
+#define SOC_H
+
+#include <stdint.h>
+#include "sample_cache.h"
+#include "journal.h"
+
+//SOC is kept in 0.01% units
+#define SOC_FULL 10000
+
+//Below this current (mA) the pack is considered to be at rest
+#define SOC_REST_CURRENT_MA 500
+//Time at rest before the cell voltages are trusted as OCV
+#define SOC_REST_TIME_US 30000000
+//Weight (1 / 2^n) that each rest correction moves the SOC towards the OCV one
+#define SOC_REST_GAIN_SHIFT 4
+
+//A gap bigger than this many estimated periods counts as dropped frames
+#define SOC_DROP_PERIODS 2
+
+//SOC is persisted whenever it moves by this much (0.01%) since the last write
+#define SOC_PERSIST_STEP 100
+
+//Rest voltage (V) of a cell at the provided SOC (0~1), along with its slope (V per unit of SOC)
+//from the same table the coulomb counter uses
+float cell_ocv(float soc, float * slope);
+
+//Coulomb counter fed by the IVT current samples. The charge integrated between two
+//samples uses their receive timestamps (trapezoid, so a dropped frame just widens the step)
+//and all the math per sample is fixed point and constant time.
+//When the pack rests, the SOC is pulled towards the one of the OCV-SOC table
+//for the average cell, and per cell offsets are refreshed from each cell's OCV.
+class Coulomb_Counter
+{
+public:
+    Coulomb_Counter(uint16_t capacity_mah,
+                    uint16_t cell_num,
+                    Eeprom_Journal * journal,
+                    int8_t current_sign = 1); //Sign that makes discharge current positive
+
+    ~Coulomb_Counter();
+
+    //Restores the SOC persisted on a previous run, if any
+    void load();
+
+    //Integrates the latest current sample if it is a new one. Meant to run on every sample
+    //(see IVT::set_amps_callback), a sample replaced before this sees it is only counted as dropped
+    void update(Sample_Cache const * amps);
+
+    //Feeds the latest cell array (BMS layout), only does anything when resting (or never initialized)
+    void rest_correct(const uint16_t * cell_codes);
+
+    uint16_t get_soc();
+    uint16_t get_cell_soc(uint16_t cell);
+    uint16_t get_min_cell_soc();
+    uint16_t get_max_cell_soc();
+
+    bool is_resting();
+    uint32_t get_dropped();
+
+    //OCV (100uV/LSB) to SOC (0.01%) from the cell table
+    static uint16_t ocv_to_soc(uint16_t code);
+
+    const uint16_t cell_num;
+    const int8_t current_sign;
+
+protected:
+    void set_soc(uint16_t soc);
+    void persist();
+
+    //Nano coulombs (mA * us) in the pack & its full capacity
+    int64_t charge;
+    const int64_t capacity;
+
+    bool initialized = false;
+
+    int32_t last_ma = 0;
+    uint32_t last_rx_us = 0;
+    uint32_t last_sequence = 0;
+    uint32_t rest_since_us = 0;
+    bool resting = false;
+
+    uint32_t dropped = 0;
+    uint16_t persisted = 0xFFFF;
+
+    //Per cell SOC offset from the pack SOC, as of the last rest (0.01%)
+    int16_t * offsets;
+
+    Eeprom_Journal * const journal;
+};
+
+#endif //SOC_H
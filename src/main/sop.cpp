@@ -0,0 +1,80 @@
+#include "sop.h"
+
+Power_Limits::Power_Limits(float max_discharge_amps, float max_charge_amps, float default_ohms) :
+    max_discharge_amps(max_discharge_amps), max_charge_amps(max_charge_amps), default_ohms(default_ohms) {}
+
+float Power_Limits::get_discharge_amps(){ return this->discharge_amps; }
+float Power_Limits::get_charge_amps(){ return this->charge_amps; }
+uint8_t Power_Limits::get_discharge_reason(){ return this->discharge_reason; }
+uint8_t Power_Limits::get_charge_reason(){ return this->charge_reason; }
+
+float Power_Limits::slew(float previous, float target, float dt_s)
+{
+    float rise = SOP_RISE_AMPS_PER_S * dt_s;
+    if(target > previous + rise)
+    {
+        return previous + rise;
+    }
+    return target;
+}
+
+float Power_Limits::temp_factor(float min_temp, float max_temp, float undertemp, float overtemp)
+{
+    float factor = 1;
+
+    float hot = (overtemp - max_temp) / SOP_TEMP_DERATE_BAND;
+    if(hot < factor)
+    {
+        factor = hot;
+    }
+
+    float cold = (min_temp - undertemp) / SOP_TEMP_DERATE_BAND;
+    if(cold < factor)
+    {
+        factor = cold;
+    }
+
+    return factor < 0 ? 0 : factor;
+}
+
+void Power_Limits::compute(float min_volts, float max_volts, float amps,
+                           float min_temp, float max_temp,
+                           float ohms,
+                           float undervolts, float overvolts,
+                           float undertemp, float overtemp,
+                           uint32_t now_ms)
+{
+    if(ohms <= 0)
+    {
+        ohms = default_ohms;
+    }
+
+    float factor = temp_factor(min_temp, max_temp, undertemp, overtemp);
+
+    //Lowest cell sags by I * R on discharge, highest one rises by I * R on charge,
+    //on top of what the current they were measured under already did to them
+    float discharge = amps + (min_volts - undervolts) / ohms;
+    float charge = -amps + (overvolts - max_volts) / ohms;
+
+    uint8_t discharge_reason = SOP_LIMIT_VOLTS, charge_reason = SOP_LIMIT_VOLTS;
+
+    if(discharge > max_discharge_amps * factor)
+    {
+        discharge = max_discharge_amps * factor;
+        discharge_reason = factor < 1 ? SOP_LIMIT_TEMP : SOP_LIMIT_MAX;
+    }
+    if(charge > max_charge_amps * factor)
+    {
+        charge = max_charge_amps * factor;
+        charge_reason = factor < 1 ? SOP_LIMIT_TEMP : SOP_LIMIT_MAX;
+    }
+
+    float dt_s = computed ? (uint32_t) (now_ms - computed_ms) / 1000.0 : 0;
+    this->computed_ms = now_ms;
+    this->computed = true;
+
+    this->discharge_amps = slew(discharge_amps, discharge < 0 ? 0 : discharge, dt_s);
+    this->charge_amps = slew(charge_amps, charge < 0 ? 0 : charge, dt_s);
+    this->discharge_reason = discharge_reason;
+    this->charge_reason = charge_reason;
+}
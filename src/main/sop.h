@@ -0,0 +1,62 @@
+/* State of power, current limits for the drivetrain */
+#ifndef SOP_H
+#define SOP_H
+
+#include <stdint.h>
+
+//Width (Celsius) of the band below overtemp & above undertemp where the limits ramp down to 0
+#define SOP_TEMP_DERATE_BAND 10.0
+
+//Max rise of a limit (A/s), drops apply at once. Limits start at 0 & ramp up from the first computation
+#define SOP_RISE_AMPS_PER_S 50.0
+
+//Used until the cell resistance is known (Ohm)
+#define SOP_DEFAULT_OHMS 0.030
+
+//What is currently holding a limit back
+#define SOP_LIMIT_MAX 0x00 /* Rated current */
+#define SOP_LIMIT_VOLTS 0x01 /* Cell voltage headroom */
+#define SOP_LIMIT_TEMP 0x02 /* Temperature derating */
+
+//Allowed discharge & charge (regen) currents, out of the headroom that the weakest cells have
+//before undervolting/overvolting over their resistance, derated close to the temperature limits
+//and capped to the rated currents. The cell voltages already carry the I * R of the current they
+//were measured under, so the headroom adds to it. Each computation is constant time over the pack statistics.
+class Power_Limits
+{
+public:
+    Power_Limits(float max_discharge_amps, float max_charge_amps,
+                 float default_ohms = SOP_DEFAULT_OHMS);
+
+    //Limits are in the configuration units (V, Celsius), ohms <= 0 falls back to the default.
+    //amps is the current the cells were measured under (> 0 on discharge)
+    void compute(float min_volts, float max_volts, float amps,
+                 float min_temp, float max_temp,
+                 float ohms,
+                 float undervolts, float overvolts,
+                 float undertemp, float overtemp,
+                 uint32_t now_ms);
+
+    float get_discharge_amps();
+    float get_charge_amps();
+
+    uint8_t get_discharge_reason();
+    uint8_t get_charge_reason();
+
+    const float max_discharge_amps, max_charge_amps;
+    const float default_ohms;
+
+protected:
+    //Applies the rise limit over dt_s, returns the new value
+    static float slew(float previous, float target, float dt_s);
+
+    //0~1 derating factor of the temperatures
+    static float temp_factor(float min_temp, float max_temp, float undertemp, float overtemp);
+
+    float discharge_amps = 0, charge_amps = 0;
+    uint8_t discharge_reason = SOP_LIMIT_MAX, charge_reason = SOP_LIMIT_MAX;
+    uint32_t computed_ms = 0;
+    bool computed = false;
+};
+
+#endif //SOP_H
@@ -0,0 +1,133 @@
+#include <Arduino.h>
+#include "config.h"
+#include "trace.h"
+
+#ifndef F_CPU
+#define F_CPU 72000000
+#endif
+
+#if !defined(__arm__)
+#include <chrono>
+#endif
+
+static Trace_Span_t spans[TRACE_SPANS];
+
+void trace_init()
+{
+#if defined(__arm__)
+    ARM_DEMCR |= ARM_DEMCR_TRCENA;
+    ARM_DWT_CTRL |= ARM_DWT_CTRL_CYCCNTENA;
+#endif
+    trace_reset();
+}
+
+uint32_t trace_cycles()
+{
+#if defined(__arm__)
+    return ARM_DWT_CYCCNT;
+#else
+    uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    return ns * (F_CPU / 1000000) / 1000;
+#endif
+}
+
+static uint8_t bucket(uint32_t cycles)
+{
+    if(cycles < 4)
+    {
+        return cycles;
+    }
+    uint8_t octave = 31 - __builtin_clz(cycles);
+    return (octave - 1) * 4 + ((cycles >> (octave - 2)) & 3);
+}
+
+static uint32_t bucket_top(uint8_t b)
+{
+    if(b + 1 >= TRACE_BUCKETS)
+    {
+        return 0xFFFFFFFF;
+    }
+    b++;
+    uint32_t next = b < 4 ? b : (uint32_t) (4 + b % 4) << (b / 4 - 1);
+    return next - 1;
+}
+
+void trace_record(uint8_t span, uint32_t cycles)
+{
+    Trace_Span_t * s = &spans[span];
+    s->count++;
+    s->sum += cycles;
+    s->min = cycles < s->min ? cycles : s->min;
+    s->max = cycles > s->max ? cycles : s->max;
+
+    uint16_t * b = &s->buckets[bucket(cycles)];
+    if(*b != 0xFFFF)
+    {
+        (*b)++;
+    }
+}
+
+Trace_Span_t const * trace_get(uint8_t span){ return &spans[span]; }
+
+uint32_t trace_mean(uint8_t span)
+{
+    return spans[span].count == 0 ? 0 : spans[span].sum / spans[span].count;
+}
+
+uint32_t trace_percentile(uint8_t span, uint8_t percent)
+{
+    uint32_t total = 0;
+    for(uint8_t b = 0; b < TRACE_BUCKETS; b++)
+    {
+        total += spans[span].buckets[b];
+    }
+
+    uint32_t target = (total * percent + 99) / 100, seen = 0;
+    for(uint8_t b = 0; b < TRACE_BUCKETS; b++)
+    {
+        seen += spans[span].buckets[b];
+        if(seen >= target && seen != 0)
+        {
+            uint32_t top = bucket_top(b);
+            return top < spans[span].max ? top : spans[span].max;
+        }
+    }
+    return 0;
+}
+
+uint32_t trace_cycles_to_us(uint32_t cycles)
+{
+    return cycles / (F_CPU / 1000000);
+}
+
+void trace_reset()
+{
+    for(uint8_t i = 0; i < TRACE_SPANS; i++)
+    {
+        spans[i] = Trace_Span_t{};
+        spans[i].min = 0xFFFFFFFF;
+    }
+}
+
+void trace_print()
+{
+#if DEBUG
+    static const char * names[TRACE_SPANS] = {"bms tick", "ltc spi", "can rx", "pec"};
+
+    Serial.println("span: count min/mean/p99/max (us)");
+    for(uint8_t i = 0; i < TRACE_SPANS; i++)
+    {
+        Serial.print(names[i]);
+        Serial.print(": ");
+        Serial.print(spans[i].count);
+        Serial.print(" ");
+        Serial.print(trace_cycles_to_us(spans[i].count == 0 ? 0 : spans[i].min));
+        Serial.print("/");
+        Serial.print(trace_cycles_to_us(trace_mean(i)));
+        Serial.print("/");
+        Serial.print(trace_cycles_to_us(trace_percentile(i, 99)));
+        Serial.print("/");
+        Serial.println(trace_cycles_to_us(spans[i].max));
+    }
+#endif
+}
@@ -0,0 +1,62 @@
+/* Cycle accurate timing of the hot paths */
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include "config.h"
+
+//Spans
+#define TRACE_BMS_TICK 0
+#define TRACE_LTC_SPI 1 /* Every transfer with the slaves */
+#define TRACE_CAN_RX 2 /* tick_can_sensors() */
+#define TRACE_PEC 3
+#define TRACE_SPANS 4
+
+/* Log buckets, 4 per power of 2 (so within 25%): bucket b < 4 holds b cycles,
+   anything else holds (4 + b % 4) << (b / 4 - 1) cycles and up */
+#define TRACE_BUCKETS 124
+
+typedef struct trace_span
+{
+    uint32_t count;
+    uint32_t min, max; /* Cycles */
+    uint64_t sum;
+    uint16_t buckets[TRACE_BUCKETS]; /* Saturate */
+} Trace_Span_t;
+
+//Starts the counter (DWT CYCCNT on target, a steady clock scaled to F_CPU anywhere else)
+void trace_init();
+uint32_t trace_cycles();
+
+void trace_record(uint8_t span, uint32_t cycles);
+Trace_Span_t const * trace_get(uint8_t span);
+
+//Upper bound (cycles) of the bucket the percentile (0~100) falls in
+uint32_t trace_percentile(uint8_t span, uint8_t percent);
+uint32_t trace_mean(uint8_t span);
+uint32_t trace_cycles_to_us(uint32_t cycles);
+
+void trace_reset();
+//min/mean/p99/max of every span in us
+void trace_print();
+
+//Times the enclosing scope
+class Trace_Scope
+{
+public:
+    Trace_Scope(uint8_t span) : span(span), start(trace_cycles()) {}
+    ~Trace_Scope() { trace_record(span, trace_cycles() - start); }
+
+protected:
+    const uint8_t span;
+    const uint32_t start;
+};
+
+//Expand to nothing unless TRACE_ENABLE
+#if TRACE_ENABLE
+#define TRACE_SCOPE(span) Trace_Scope trace_scope_##span(span)
+#else
+#define TRACE_SCOPE(span)
+#endif
+
+#endif //TRACE_H
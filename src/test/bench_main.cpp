@@ -0,0 +1,329 @@
+/* Benchmark of BMS::tick() against the LTC6804 emulator, for pack layouts that are not wired yet.
+   The real BMS & LTC6804_2 run unchanged, the time a tick takes on target is modeled out of
+   the delays the driver waits for (virtual time), the bytes it shifts over SPI and the bytes
+   the DEBUG_* flags print over serial. Build with other DEBUG_* flags to see what they cost. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include "framework.h"
+#include "host.h"
+
+//Ticks timed per case, at least two full read backs of the slowest scan period
+#define BENCH_TICKS 20
+
+//Nominal clock of SPI_CLOCK_DIV16, for the modeled transfer time
+#define BENCH_SPI_HZ 1000000
+//Serial of a Teensy is USB full speed whatever the baud rate, about this much reaches the PC
+#define BENCH_SERIAL_BYTES_PER_S 1000000
+
+//MAX_MEASURE_CYCLE_DURATION_MS of main.ino
+#define BENCH_BUDGET_US 500000
+
+#define BENCH_SEED 13
+
+//Default tolerance of -b, a case regresses once a figure grew by more than this fraction
+#define BENCH_TOLERANCE 0.02
+
+//Conversions of main.ino, the same the firmware hands to BMS
+float volts_to_celsius(float, float);
+float uint16_volts_to_float(uint16_t);
+
+typedef struct bench_case
+{
+    uint8_t total_ic;
+    uint8_t md;
+    uint8_t scan_period;
+    uint8_t cell_start, cell_end;
+    uint8_t aux_start, aux_end;
+
+    //Mean per tick
+    uint32_t delay_us;
+    uint32_t spi_bytes;
+    uint32_t pec;
+    uint32_t spi_us;
+    uint32_t serial_bytes;
+    uint32_t serial_us;
+    uint32_t modeled_us;
+    //Slowest tick, the one that has to fit in the budget
+    uint32_t max_modeled_us;
+    bool fits;
+} Bench_Case_t;
+
+typedef struct bench_flags
+{
+    unsigned debug, debug_pec, debug_cells, debug_temps, debug_current;
+} Bench_Flags_t;
+
+static const Bench_Flags_t build_flags = {DEBUG, DEBUG_PEC, DEBUG_CELL_VALUES, DEBUG_TEMP_VALUES, DEBUG_CURRENT_VALUES};
+
+//GPIO pull-downs off & REFON, as drive_config of main.ino
+static const uint8_t bench_config[6] = {0B00000100, 0, 0, 0, 0, 0};
+
+static void ignore_critical(BmsCriticalFrame_t){}
+
+static uint32_t spi_us(uint32_t bytes){ return (uint64_t) bytes * 8 * 1000000 / BENCH_SPI_HZ; }
+static uint32_t serial_us(uint32_t bytes){ return (uint64_t) bytes * 1000000 / BENCH_SERIAL_BYTES_PER_S; }
+
+static void run_case(Bench_Case_t * c)
+{
+    Pack_Model pack(c->total_ic * SIM_CELLS_PER_IC, BENCH_SEED);
+    LTC_Emulator slaves(&pack, c->total_ic, &volts_to_celsius);
+    LTC6804_2 ltc(&slaves, c->md);
+    IVT ivt;
+    BMS bms(&ltc, &ivt, c->total_ic, 4.2, 3.0, 60, 0,
+            c->cell_start, c->cell_end, c->aux_start, c->aux_end,
+            bench_config, &ignore_critical, &uint16_volts_to_float, &volts_to_celsius);
+    bms.set_full_scan_period(c->scan_period);
+
+    uint16_t ticks = c->scan_period * 2 > BENCH_TICKS ? c->scan_period * 2 : BENCH_TICKS;
+    uint64_t delay_sum = 0, spi_sum = 0, pec_sum = 0, serial_sum = 0, modeled_sum = 0;
+    c->max_modeled_us = 0;
+
+    for(uint16_t i = 0; i < ticks; i++)
+    {
+        uint32_t start = micros();
+        uint32_t bytes = ltc.get_spi_bytes(), pecs = LTC6804_2::get_pec_num(), printed = host_serial_bytes();
+
+        bms.tick();
+
+        uint32_t delay = micros() - start;
+        bytes = ltc.get_spi_bytes() - bytes;
+        printed = host_serial_bytes() - printed;
+        uint32_t modeled = delay + spi_us(bytes) + serial_us(printed);
+
+        delay_sum += delay;
+        spi_sum += bytes;
+        pec_sum += LTC6804_2::get_pec_num() - pecs;
+        serial_sum += printed;
+        modeled_sum += modeled;
+        c->max_modeled_us = modeled > c->max_modeled_us ? modeled : c->max_modeled_us;
+    }
+
+    c->delay_us = delay_sum / ticks;
+    c->spi_bytes = spi_sum / ticks;
+    c->pec = pec_sum / ticks;
+    c->spi_us = spi_us(c->spi_bytes);
+    c->serial_bytes = serial_sum / ticks;
+    c->serial_us = serial_us(c->serial_bytes);
+    c->modeled_us = modeled_sum / ticks;
+    c->fits = c->max_modeled_us <= BENCH_BUDGET_US;
+}
+
+//total_ic 1~16, every ADC mode, read back on every tick & only when flagged, all or some of the cells & GPIOs
+static std::vector<Bench_Case_t> run_all()
+{
+    static const uint8_t modes[] = {MD_FAST, MD_NORMAL, MD_FILTERED};
+    static const uint8_t periods[] = {1, 255};
+    static const uint8_t cell_ranges[][2] = {{0, 12}, {0, 10}};
+    static const uint8_t aux_ranges[][2] = {{0, 5}, {0, 2}};
+
+    std::vector<Bench_Case_t> cases;
+    for(uint8_t total_ic = 1; total_ic <= 16; total_ic++)
+    for(uint8_t m = 0; m < sizeof(modes); m++)
+    for(uint8_t p = 0; p < sizeof(periods); p++)
+    for(uint8_t cr = 0; cr < 2; cr++)
+    for(uint8_t ar = 0; ar < 2; ar++)
+    {
+        Bench_Case_t c;
+        memset(&c, 0, sizeof(c));
+        c.total_ic = total_ic;
+        c.md = modes[m];
+        c.scan_period = periods[p];
+        c.cell_start = cell_ranges[cr][0];
+        c.cell_end = cell_ranges[cr][1];
+        c.aux_start = aux_ranges[ar][0];
+        c.aux_end = aux_ranges[ar][1];
+        run_case(&c);
+        cases.push_back(c);
+    }
+    return cases;
+}
+
+/* One case a line, so the baseline diffs line by line & reads back with sscanf */
+#define HEADER_FORMAT "{\"bench\":\"bms_tick\",\"budget_us\":%u,\"debug\":%u,\"debug_pec\":%u," \
+                      "\"debug_cells\":%u,\"debug_temps\":%u,\"debug_current\":%u,\"cases\":["
+#define KEY_FORMAT "{\"total_ic\":%u,\"md\":%u,\"scan_period\":%u,\"cell_start\":%u,\"cell_end\":%u," \
+                   "\"aux_start\":%u,\"aux_end\":%u,"
+#define CASE_FORMAT KEY_FORMAT "\"delay_us\":%u,\"spi_bytes\":%u,\"pec\":%u,\"spi_us\":%u," \
+                    "\"serial_bytes\":%u,\"serial_us\":%u,\"modeled_us\":%u,\"max_modeled_us\":%u,\"fits\":%u}"
+
+static void write_json(FILE * out, std::vector<Bench_Case_t> const & cases)
+{
+    fprintf(out, HEADER_FORMAT "\n", BENCH_BUDGET_US, build_flags.debug, build_flags.debug_pec,
+            build_flags.debug_cells, build_flags.debug_temps, build_flags.debug_current);
+    for(size_t i = 0; i < cases.size(); i++)
+    {
+        Bench_Case_t const & c = cases[i];
+        fprintf(out, CASE_FORMAT "%s\n",
+                c.total_ic, c.md, c.scan_period, c.cell_start, c.cell_end, c.aux_start, c.aux_end,
+                (unsigned) c.delay_us, (unsigned) c.spi_bytes, (unsigned) c.pec, (unsigned) c.spi_us,
+                (unsigned) c.serial_bytes, (unsigned) c.serial_us, (unsigned) c.modeled_us,
+                (unsigned) c.max_modeled_us, c.fits ? 1 : 0, i + 1 < cases.size() ? "," : "");
+    }
+    fprintf(out, "]}\n");
+}
+
+static bool read_json(const char * path, Bench_Flags_t * flags, std::vector<Bench_Case_t> * cases)
+{
+    FILE * in = fopen(path, "r");
+    if(in == nullptr)
+    {
+        return false;
+    }
+
+    char line[512];
+    bool header = false;
+    unsigned budget;
+    while(fgets(line, sizeof(line), in) != nullptr)
+    {
+        unsigned v[16];
+        if(sscanf(line, HEADER_FORMAT, &budget, &flags->debug, &flags->debug_pec,
+                  &flags->debug_cells, &flags->debug_temps, &flags->debug_current) == 6)
+        {
+            header = true;
+        }
+        else if(sscanf(line, CASE_FORMAT, v, v + 1, v + 2, v + 3, v + 4, v + 5, v + 6, v + 7, v + 8,
+                       v + 9, v + 10, v + 11, v + 12, v + 13, v + 14, v + 15) == 16)
+        {
+            Bench_Case_t c;
+            c.total_ic = v[0]; c.md = v[1]; c.scan_period = v[2];
+            c.cell_start = v[3]; c.cell_end = v[4]; c.aux_start = v[5]; c.aux_end = v[6];
+            c.delay_us = v[7]; c.spi_bytes = v[8]; c.pec = v[9]; c.spi_us = v[10];
+            c.serial_bytes = v[11]; c.serial_us = v[12]; c.modeled_us = v[13]; c.max_modeled_us = v[14];
+            c.fits = v[15];
+            cases->push_back(c);
+        }
+    }
+    fclose(in);
+    return header;
+}
+
+static bool same_key(Bench_Case_t const & a, Bench_Case_t const & b)
+{
+    return a.total_ic == b.total_ic && a.md == b.md && a.scan_period == b.scan_period &&
+           a.cell_start == b.cell_start && a.cell_end == b.cell_end &&
+           a.aux_start == b.aux_start && a.aux_end == b.aux_end;
+}
+
+static void print_key(Bench_Case_t const & c)
+{
+    fprintf(stderr, "total_ic %2u md %u scan %3u cells %u~%u aux %u~%u ",
+            c.total_ic, c.md, c.scan_period, c.cell_start, c.cell_end, c.aux_start, c.aux_end);
+}
+
+//Prints every figure that moved past the tolerance, true if any of them got worse
+static bool compare(const char * name, uint32_t then, uint32_t now, float tolerance, Bench_Case_t const & c)
+{
+    bool worse = now > then * (1 + tolerance);
+    bool better = now < then * (1 - tolerance);
+    if(worse || better)
+    {
+        print_key(c);
+        fprintf(stderr, "%-14s %8u -> %8u %s\n", name, (unsigned) then, (unsigned) now, worse ? "REGRESSION" : "improved");
+    }
+    return worse;
+}
+
+static bool diff(std::vector<Bench_Case_t> const & baseline, std::vector<Bench_Case_t> const & cases, float tolerance)
+{
+    uint32_t regressions = 0;
+    for(size_t i = 0; i < cases.size(); i++)
+    {
+        Bench_Case_t const & now = cases[i];
+        Bench_Case_t const * then = nullptr;
+        for(size_t j = 0; j < baseline.size() && then == nullptr; j++)
+        {
+            then = same_key(baseline[j], now) ? &baseline[j] : nullptr;
+        }
+        if(then == nullptr)
+        {
+            print_key(now);
+            fprintf(stderr, "not in the baseline\n");
+            continue;
+        }
+
+        regressions += compare("spi_bytes", then->spi_bytes, now.spi_bytes, tolerance, now);
+        regressions += compare("pec", then->pec, now.pec, tolerance, now);
+        regressions += compare("serial_bytes", then->serial_bytes, now.serial_bytes, tolerance, now);
+        regressions += compare("modeled_us", then->modeled_us, now.modeled_us, tolerance, now);
+        regressions += compare("max_modeled_us", then->max_modeled_us, now.max_modeled_us, tolerance, now);
+        if(then->fits && !now.fits)
+        {
+            print_key(now);
+            fprintf(stderr, "no longer fits in %u us REGRESSION\n", BENCH_BUDGET_US);
+            regressions++;
+        }
+    }
+    fprintf(stderr, "%u cases, %u regressions\n", (unsigned) cases.size(), (unsigned) regressions);
+    return regressions > 0;
+}
+
+static void usage()
+{
+    printf("bench [-o out.json] [-b baseline.json] [-t tolerance]\n"
+           "  -o  writes the results there instead of stdout\n"
+           "  -b  compares against a baseline, the diff goes to stderr\n"
+           "  -t  fraction a figure may grow before it regresses (%.2f)\n"
+           "Exits with 1 on a regression, 2 if the baseline is missing or built with other DEBUG_* flags\n",
+           BENCH_TOLERANCE);
+}
+
+int main(int argc, char ** argv)
+{
+    const char * out_path = nullptr;
+    const char * baseline_path = nullptr;
+    float tolerance = BENCH_TOLERANCE;
+    for(int i = 1; i < argc; i++)
+    {
+        if(strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+        {
+            out_path = argv[++i];
+        }
+        else if(strcmp(argv[i], "-b") == 0 && i + 1 < argc)
+        {
+            baseline_path = argv[++i];
+        }
+        else if(strcmp(argv[i], "-t") == 0 && i + 1 < argc)
+        {
+            tolerance = strtof(argv[++i], nullptr);
+        }
+        else
+        {
+            usage();
+            return 2;
+        }
+    }
+
+    std::vector<Bench_Case_t> cases = run_all();
+
+    FILE * out = out_path == nullptr ? stdout : fopen(out_path, "w");
+    if(out == nullptr)
+    {
+        fprintf(stderr, "Can't write %s\n", out_path);
+        return 2;
+    }
+    write_json(out, cases);
+    if(out != stdout)
+    {
+        fclose(out);
+    }
+
+    if(baseline_path != nullptr)
+    {
+        Bench_Flags_t flags;
+        std::vector<Bench_Case_t> baseline;
+        if(!read_json(baseline_path, &flags, &baseline))
+        {
+            fprintf(stderr, "No baseline in %s\n", baseline_path);
+            return 2;
+        }
+        if(memcmp(&flags, &build_flags, sizeof(flags)) != 0)
+        {
+            fprintf(stderr, "%s was taken with other DEBUG_* flags\n", baseline_path);
+            return 2;
+        }
+        return diff(baseline, cases, tolerance) ? 1 : 0;
+    }
+    return 0;
+}
@@ -0,0 +1,81 @@
+/* Host stand-in of the Teensyduino core, just enough for the firmware to build & run on a PC.
+   Time only moves through delay() & host_advance_us(), so every run is deterministic. */
+#ifndef ARDUINO_H
+#define ARDUINO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#define HIGH 1
+#define LOW 0
+
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+
+#define DEC 10
+#define HEX 16
+#define BIN 2
+
+#define F_CPU 72000000
+
+//Pins of the SPI bus on the Teensy 3.x
+#define SS 10
+#define MOSI 11
+#define MISO 12
+#define SCK 13
+
+typedef uint8_t byte;
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+int digitalRead(uint8_t pin);
+
+uint32_t millis();
+uint32_t micros();
+void delay(uint32_t ms);
+void delayMicroseconds(uint32_t us);
+void yield();
+
+//Discards everything unless host_serial_echo() is on, reads whatever host_serial_input() queued
+class HardwareSerial
+{
+public:
+    void begin(uint32_t baud);
+    int available();
+    int read();
+
+    size_t print(const char * text);
+    size_t print(char c);
+    size_t print(unsigned char value, int base = DEC);
+    size_t print(int value, int base = DEC);
+    size_t print(unsigned int value, int base = DEC);
+    size_t print(long value, int base = DEC);
+    size_t print(unsigned long value, int base = DEC);
+    size_t print(double value, int digits = 2);
+
+    size_t println();
+    template <typename T> size_t println(T value)
+    {
+        size_t n = print(value);
+        return n + println();
+    }
+    template <typename T> size_t println(T value, int format)
+    {
+        size_t n = print(value, format);
+        return n + println();
+    }
+};
+
+extern HardwareSerial Serial;
+
+//Data & status registers of the AVR SPI port LT_SPI talks to, transfers complete at once
+extern volatile uint8_t SPDR;
+extern volatile uint8_t SPSR;
+#define SPIF 7
+#define _BV(bit) (1 << (bit))
+
+#endif //ARDUINO_H
@@ -0,0 +1,20 @@
+/* Host stand-in of the EEPROM library, 2K like the Teensy 3.1/3.2, blank (0xFF) on start */
+#ifndef EEPROM_H
+#define EEPROM_H
+
+#include <Arduino.h>
+
+#define HOST_EEPROM_SIZE 2048
+
+class EEPROMClass
+{
+public:
+    uint8_t read(int address);
+    void write(int address, uint8_t value);
+    void update(int address, uint8_t value);
+    uint16_t length();
+};
+
+extern EEPROMClass EEPROM;
+
+#endif //EEPROM_H
@@ -0,0 +1,34 @@
+/* Host stand-in of the SD library, files live in memory (see host_sd_file()) */
+#ifndef SD_H
+#define SD_H
+
+#include <Arduino.h>
+
+#define FILE_READ 0
+#define FILE_WRITE 1
+
+class File
+{
+public:
+    File(int index = -1);
+
+    size_t write(const uint8_t * data, size_t len);
+    void flush();
+    void close();
+    operator bool() const;
+
+protected:
+    int index;
+};
+
+class SDClass
+{
+public:
+    bool begin(uint8_t cs_pin);
+    bool exists(const char * name);
+    File open(const char * name, uint8_t mode = FILE_READ);
+};
+
+extern SDClass SD;
+
+#endif //SD_H
@@ -0,0 +1,21 @@
+/* Host stand-in of the SPI library, the slaves sit behind LTC_Emulator instead */
+#ifndef SPI_H
+#define SPI_H
+
+#include <Arduino.h>
+
+#define SPI_CLOCK_DIV16 0x01
+#define SPI_MODE3 0x0C
+
+class SPIClass
+{
+public:
+    void begin();
+    void end();
+    void setClockDivider(uint8_t divider);
+    void setDataMode(uint8_t mode);
+};
+
+extern SPIClass SPI;
+
+#endif //SPI_H
@@ -0,0 +1,267 @@
+#include <Arduino.h>
+#include <SPI.h>
+#include <EEPROM.h>
+#include <SD.h>
+#include <stdio.h>
+#include <map>
+#include <string>
+#include "host.h"
+
+HardwareSerial Serial;
+SPIClass SPI;
+EEPROMClass EEPROM;
+SDClass SD;
+
+volatile uint8_t SPDR = 0;
+volatile uint8_t SPSR = _BV(SPIF);
+
+//Time
+
+static uint64_t now_us = 0;
+
+void host_advance_us(uint32_t us){ now_us += us; }
+
+uint32_t millis(){ return (uint32_t) (now_us / 1000); }
+uint32_t micros(){ return (uint32_t) now_us; }
+void delay(uint32_t ms){ now_us += (uint64_t) ms * 1000; }
+void delayMicroseconds(uint32_t us){ now_us += us; }
+void yield(){}
+
+//Pins
+
+#define HOST_PINS 64
+#define HOST_PIN_UNSET 0xFF
+
+static uint8_t modes[HOST_PINS];
+static uint8_t outputs[HOST_PINS];
+static uint8_t inputs[HOST_PINS];
+static bool inputs_ready = false;
+
+static void init_inputs()
+{
+    if(!inputs_ready)
+    {
+        memset(inputs, HOST_PIN_UNSET, sizeof(inputs));
+        inputs_ready = true;
+    }
+}
+
+void pinMode(uint8_t pin, uint8_t mode){ modes[pin % HOST_PINS] = mode; }
+void digitalWrite(uint8_t pin, uint8_t value){ outputs[pin % HOST_PINS] = value ? HIGH : LOW; }
+
+int digitalRead(uint8_t pin)
+{
+    init_inputs();
+    pin %= HOST_PINS;
+    if(inputs[pin] != HOST_PIN_UNSET)
+    {
+        return inputs[pin];
+    }
+    return modes[pin] == INPUT_PULLUP ? HIGH : LOW;
+}
+
+void host_set_input(uint8_t pin, uint8_t level)
+{
+    init_inputs();
+    inputs[pin % HOST_PINS] = level ? HIGH : LOW;
+}
+
+uint8_t host_get_output(uint8_t pin){ return outputs[pin % HOST_PINS]; }
+
+//Serial
+
+static bool echo = false;
+static std::string serial_input;
+static uint32_t serial_bytes = 0;
+
+void host_serial_echo(bool on){ echo = on; }
+void host_serial_input(const char * text){ serial_input += text; }
+uint32_t host_serial_bytes(){ return serial_bytes; }
+
+static size_t out(const char * text)
+{
+    if(echo)
+    {
+        fputs(text, stdout);
+    }
+    size_t len = strlen(text);
+    serial_bytes += len;
+    return len;
+}
+
+static size_t out_integer(unsigned long long value, bool negative, int base)
+{
+    char text[72];
+    char * p = text + sizeof(text) - 1;
+    *p = '\0';
+    do
+    {
+        *--p = "0123456789ABCDEF"[value % base];
+        value /= base;
+    } while(value != 0);
+    if(negative)
+    {
+        *--p = '-';
+    }
+    return out(p);
+}
+
+void HardwareSerial::begin(uint32_t){}
+int HardwareSerial::available(){ return serial_input.size(); }
+
+int HardwareSerial::read()
+{
+    if(serial_input.empty())
+    {
+        return -1;
+    }
+    int c = (uint8_t) serial_input[0];
+    serial_input.erase(0, 1);
+    return c;
+}
+
+size_t HardwareSerial::print(const char * text){ return out(text); }
+size_t HardwareSerial::print(char c){ char text[2] = {c, '\0'}; return out(text); }
+size_t HardwareSerial::print(unsigned char value, int base){ return out_integer(value, false, base); }
+size_t HardwareSerial::print(unsigned int value, int base){ return out_integer(value, false, base); }
+size_t HardwareSerial::print(unsigned long value, int base){ return out_integer(value, false, base); }
+
+size_t HardwareSerial::print(int value, int base){ return print((long) value, base); }
+
+size_t HardwareSerial::print(long value, int base)
+{
+    //Like the core, only decimals get a sign
+    if(base == DEC && value < 0)
+    {
+        return out_integer(-(unsigned long long) value, true, base);
+    }
+    return out_integer((unsigned long) value, false, base);
+}
+
+size_t HardwareSerial::print(double value, int digits)
+{
+    char text[64];
+    snprintf(text, sizeof(text), "%.*f", digits, value);
+    return out(text);
+}
+
+size_t HardwareSerial::println(){ return out("\r\n"); }
+
+//SPI
+
+void SPIClass::begin(){}
+void SPIClass::end(){}
+void SPIClass::setClockDivider(uint8_t){}
+void SPIClass::setDataMode(uint8_t){}
+
+//EEPROM
+
+static uint8_t eeprom[HOST_EEPROM_SIZE];
+static uint32_t wear[HOST_EEPROM_SIZE];
+static bool eeprom_ready = false;
+static int32_t writes_left = -1;
+
+static void init_eeprom()
+{
+    if(!eeprom_ready)
+    {
+        host_eeprom_erase();
+    }
+}
+
+void host_eeprom_erase()
+{
+    memset(eeprom, 0xFF, sizeof(eeprom));
+    memset(wear, 0, sizeof(wear));
+    eeprom_ready = true;
+    writes_left = -1;
+}
+
+uint32_t host_eeprom_wear(uint16_t address){ return wear[address % HOST_EEPROM_SIZE]; }
+void host_eeprom_cut_after(int32_t writes){ writes_left = writes; }
+
+uint8_t EEPROMClass::read(int address)
+{
+    init_eeprom();
+    return eeprom[address % HOST_EEPROM_SIZE];
+}
+
+void EEPROMClass::write(int address, uint8_t value)
+{
+    init_eeprom();
+    if(writes_left == 0)
+    {
+        return;
+    }
+    if(writes_left > 0)
+    {
+        writes_left--;
+    }
+
+    address %= HOST_EEPROM_SIZE;
+    if(eeprom[address] != value)
+    {
+        wear[address]++;
+    }
+    eeprom[address] = value;
+}
+
+void EEPROMClass::update(int address, uint8_t value)
+{
+    if(read(address) != value)
+    {
+        write(address, value);
+    }
+}
+
+uint16_t EEPROMClass::length(){ return HOST_EEPROM_SIZE; }
+
+//SD
+
+static std::map<std::string, int> names;
+static std::vector<std::vector<uint8_t>> files;
+
+std::vector<uint8_t> const * host_sd_file(const char * name)
+{
+    std::map<std::string, int>::iterator file = names.find(name);
+    return file == names.end() ? nullptr : &files[file->second];
+}
+
+void host_sd_clear()
+{
+    names.clear();
+    files.clear();
+}
+
+File::File(int index) : index(index) {}
+
+size_t File::write(const uint8_t * data, size_t len)
+{
+    if(index < 0)
+    {
+        return 0;
+    }
+    files[index].insert(files[index].end(), data, data + len);
+    return len;
+}
+
+void File::flush(){}
+void File::close(){ this->index = -1; }
+File::operator bool() const { return index >= 0; }
+
+bool SDClass::begin(uint8_t){ return true; }
+bool SDClass::exists(const char * name){ return names.count(name) != 0; }
+
+File SDClass::open(const char * name, uint8_t mode)
+{
+    if(!exists(name))
+    {
+        if(mode != FILE_WRITE)
+        {
+            return File();
+        }
+        names[name] = files.size();
+        files.push_back(std::vector<uint8_t>());
+    }
+    return File(names[name]);
+}
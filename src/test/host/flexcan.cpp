@@ -0,0 +1,148 @@
+/* FlexCAN on the virtual bus of host.h, in place of FlexCAN.cpp */
+#include <map>
+#include <deque>
+#include "FlexCAN.h"
+#include "host.h"
+
+#define HOST_CAN_FILTERS 8
+
+typedef struct host_node
+{
+    bool begun;
+    CAN_filter_t mask;
+    uint32_t filters[HOST_CAN_FILTERS];
+    std::deque<CAN_message_t> fifo;
+    uint32_t overflows;
+} Host_Node_t;
+
+//Function statics, FlexCANs are globals of their own (e.g. the one of main.ino)
+static std::map<FlexCAN const *, Host_Node_t> & nodes()
+{
+    static std::map<FlexCAN const *, Host_Node_t> nodes;
+    return nodes;
+}
+
+static std::vector<CAN_message_t> & bus_log()
+{
+    static std::vector<CAN_message_t> log;
+    return log;
+}
+
+static bool accepts(Host_Node_t const * node, uint32_t id)
+{
+    for(uint8_t n = 0; n < HOST_CAN_FILTERS; n++)
+    {
+        if((id & node->mask.id) == (node->filters[n] & node->mask.id))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+FlexCAN::FlexCAN(uint32_t)
+{
+    defaultMask.rtr = 0;
+    defaultMask.ext = 0;
+    defaultMask.id = 0;
+    nodes()[this] = Host_Node_t{false, defaultMask, {0}, std::deque<CAN_message_t>(), 0};
+}
+
+void FlexCAN::begin(const CAN_filter_t &mask)
+{
+    Host_Node_t * node = &nodes()[this];
+    node->mask = mask;
+    node->begun = true;
+}
+
+void FlexCAN::setFilter(const CAN_filter_t &filter, uint8_t n)
+{
+    if(n < HOST_CAN_FILTERS)
+    {
+        nodes()[this].filters[n] = filter.id;
+    }
+}
+
+void FlexCAN::end(void)
+{
+    nodes()[this].begun = false;
+}
+
+int FlexCAN::available(void)
+{
+    return nodes()[this].fifo.empty() ? 0 : 1;
+}
+
+int FlexCAN::write(const CAN_message_t &msg)
+{
+    bus_log().push_back(msg);
+
+    for(std::map<FlexCAN const *, Host_Node_t>::iterator it = nodes().begin(); it != nodes().end(); ++it)
+    {
+        Host_Node_t * node = &it->second;
+        if(it->first == this || !node->begun || !accepts(node, msg.id))
+        {
+            continue;
+        }
+
+        if(node->fifo.size() >= HOST_CAN_FIFO_DEPTH)
+        {
+            node->overflows++;
+            continue;
+        }
+        node->fifo.push_back(msg);
+    }
+    return 1;
+}
+
+int FlexCAN::read(CAN_message_t &msg)
+{
+    Host_Node_t * node = &nodes()[this];
+    if(node->fifo.empty())
+    {
+        return 0;
+    }
+    msg = node->fifo.front();
+    node->fifo.pop_front();
+    return 1;
+}
+
+void host_can_clear()
+{
+    bus_log().clear();
+    for(std::map<FlexCAN const *, Host_Node_t>::iterator it = nodes().begin(); it != nodes().end(); ++it)
+    {
+        it->second.fifo.clear();
+        it->second.overflows = 0;
+    }
+}
+
+std::vector<CAN_message_t> const * host_can_log(){ return &bus_log(); }
+
+uint32_t host_can_count(uint32_t id)
+{
+    uint32_t count = 0;
+    for(size_t i = 0; i < bus_log().size(); i++)
+    {
+        count += bus_log()[i].id == id;
+    }
+    return count;
+}
+
+bool host_can_last(uint32_t id, CAN_message_t * message)
+{
+    for(size_t i = bus_log().size(); i > 0; i--)
+    {
+        if(bus_log()[i - 1].id == id)
+        {
+            *message = bus_log()[i - 1];
+            return true;
+        }
+    }
+    return false;
+}
+
+uint32_t host_can_overflows(FlexCAN const * node)
+{
+    return nodes()[node].overflows;
+}
@@ -0,0 +1,50 @@
+/* Hooks of the host stand-ins, for the tests & tools to drive the "board" */
+#ifndef HOST_H
+#define HOST_H
+
+#include <stdint.h>
+#include <vector>
+#include "FlexCAN.h"
+
+//Moves micros() & millis() forward, delay() does the same
+void host_advance_us(uint32_t us);
+
+//Level digitalRead() gets on an input (unset pins read HIGH with INPUT_PULLUP, LOW otherwise)
+void host_set_input(uint8_t pin, uint8_t level);
+//Last level digitalWrite() put on a pin
+uint8_t host_get_output(uint8_t pin);
+
+//Back to blank, with the write counters cleared
+void host_eeprom_erase();
+//Writes that actually changed a byte so far (the wear of the cell)
+uint32_t host_eeprom_wear(uint16_t address);
+//Power goes away after this many more writes, the rest are lost (-1 keeps it on)
+void host_eeprom_cut_after(int32_t writes);
+
+//Serial output to stdout
+void host_serial_echo(bool on);
+//Bytes Serial.read() hands out next
+void host_serial_input(const char * text);
+//Bytes written to Serial so far, echoed or not
+uint32_t host_serial_bytes();
+
+//Contents of a file written through SD, nullptr if there is none
+std::vector<uint8_t> const * host_sd_file(const char * name);
+void host_sd_clear();
+
+/* Every FlexCAN is a node on one virtual bus: a frame written by one of them goes through
+   the mask & filters of every other node that has begun, into a rx fifo as deep as the
+   hardware one (overflows are lost). The bus keeps a log of every frame put on it. */
+#define HOST_CAN_FIFO_DEPTH 6
+
+void host_can_clear();
+//Frames put on the bus since the last clear, in order
+std::vector<CAN_message_t> const * host_can_log();
+//How many of them had that id
+uint32_t host_can_count(uint32_t id);
+//Latest frame of an id on the bus, false if none
+bool host_can_last(uint32_t id, CAN_message_t * message);
+//Frames a node lost to a full fifo
+uint32_t host_can_overflows(FlexCAN const * node);
+
+#endif //HOST_H
@@ -0,0 +1,72 @@
+/* Prints the records of a Data_Logger file (LOGnn.BIN off the card, or sim -l) as CSV:
+   ms,tick,<cell codes>,<aux codes>,mA,mV  or  ms,event,<LOG_EVENT_*>,<data> */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "log_reader.h"
+
+static void usage()
+{
+    printf("log file [-f ms] [-t ms]\n"
+           "  -f  from this time on (0)\n"
+           "  -t  up to this time (the end)\n"
+           "Exits with 1 if a block didn't decode\n");
+}
+
+int main(int argc, char ** argv)
+{
+    const char * path = nullptr;
+    uint32_t from_ms = 0, to_ms = 0xFFFFFFFF;
+    for(int i = 1; i < argc; i++)
+    {
+        if(strcmp(argv[i], "-f") == 0 && i + 1 < argc)
+        {
+            from_ms = strtoul(argv[++i], nullptr, 10);
+        }
+        else if(strcmp(argv[i], "-t") == 0 && i + 1 < argc)
+        {
+            to_ms = strtoul(argv[++i], nullptr, 10);
+        }
+        else if(!path && argv[i][0] != '-')
+        {
+            path = argv[i];
+        }
+        else
+        {
+            usage();
+            return 2;
+        }
+    }
+
+    Log_Reader reader;
+    if(!path || !reader.map(path))
+    {
+        fprintf(stderr, "No log in %s\n", path ? path : "nothing");
+        return 2;
+    }
+
+    std::vector<Log_Record_t> records;
+    reader.read(from_ms, to_ms, &records);
+    for(size_t i = 0; i < records.size(); i++)
+    {
+        Log_Record_t const * record = &records[i];
+        if(record->type == LOG_RECORD_TICK)
+        {
+            printf("%lu,tick", (unsigned long) record->ms);
+            for(size_t c = 0; c < record->codes.size(); c++)
+            {
+                printf(",%u", record->codes[c]);
+            }
+            printf(",%ld,%ld\n", (long) record->ma, (long) record->mv);
+        }
+        else
+        {
+            printf("%lu,event,%u,%lu\n", (unsigned long) record->ms, record->event, (unsigned long) record->data);
+        }
+    }
+
+    fprintf(stderr, "%lu blocks of %u cells & %u aux, %lu records, %lu bad blocks\n",
+            (unsigned long) reader.get_block_num(), reader.get_cell_num(), reader.get_aux_num(),
+            (unsigned long) records.size(), (unsigned long) reader.get_errors());
+    return reader.get_errors() ? 1 : 0;
+}
@@ -0,0 +1,222 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "log_reader.h"
+
+Log_Reader::~Log_Reader()
+{
+    close();
+}
+
+bool Log_Reader::map(const char * path)
+{
+    close();
+    int fd = ::open(path, O_RDONLY);
+    if(fd < 0)
+    {
+        return false;
+    }
+
+    struct stat info;
+    void * mapping = MAP_FAILED;
+    if(fstat(fd, &info) == 0 && info.st_size >= LOG_BLOCK_SIZE)
+    {
+        mapping = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    ::close(fd);
+
+    if(mapping == MAP_FAILED)
+    {
+        return false;
+    }
+    this->mapped = info.st_size;
+    return open((const uint8_t *) mapping, info.st_size);
+}
+
+bool Log_Reader::open(const uint8_t * data, size_t size)
+{
+    this->data = data;
+    this->size = size;
+    this->errors = 0;
+    return get_block_num() > 0;
+}
+
+void Log_Reader::close()
+{
+    if(mapped)
+    {
+        munmap((void *) data, mapped);
+    }
+    this->data = nullptr;
+    this->size = 0;
+    this->mapped = 0;
+}
+
+uint32_t Log_Reader::get_block_num(){ return size / LOG_BLOCK_SIZE; }
+uint32_t Log_Reader::get_errors(){ return this->errors; }
+
+uint16_t Log_Reader::get_cell_num()
+{
+    const uint8_t * block = get_block(0);
+    return block ? block[12] << 8 | block[13] : 0;
+}
+
+uint8_t Log_Reader::get_aux_num()
+{
+    const uint8_t * block = get_block(0);
+    return block ? block[14] : 0;
+}
+
+const uint8_t * Log_Reader::get_block(uint32_t block)
+{
+    if(block >= get_block_num())
+    {
+        return nullptr;
+    }
+    const uint8_t * start = data + (size_t) block * LOG_BLOCK_SIZE;
+    return start[0] == 'B' && start[1] == 'L' && start[2] == LOG_FORMAT_VERSION ? start : nullptr;
+}
+
+static uint32_t get_u32(const uint8_t * bytes)
+{
+    return (uint32_t) bytes[0] << 24 | (uint32_t) bytes[1] << 16 | (uint32_t) bytes[2] << 8 | bytes[3];
+}
+
+bool Log_Reader::get_header(uint32_t block, uint32_t * sequence, uint32_t * first_ms)
+{
+    const uint8_t * start = get_block(block);
+    if(!start)
+    {
+        return false;
+    }
+    *sequence = get_u32(start + 4);
+    *first_ms = get_u32(start + 8);
+    return true;
+}
+
+uint32_t Log_Reader::seek(uint32_t ms)
+{
+    //First block starting at or after 'ms', a block that doesn't decode counts as one that does.
+    //Records of 'ms' may end the block before it, unless it is the first
+    uint32_t low = 0, high = get_block_num();
+    while(low < high)
+    {
+        uint32_t middle = low + (high - low) / 2;
+        const uint8_t * start = data + (size_t) middle * LOG_BLOCK_SIZE;
+        if(get_u32(start + 8) < ms)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+    return low > 0 ? low - 1 : 0;
+}
+
+//Varint at 'pos', false if it runs past 'end' or over 32 bits
+static bool get_varint(const uint8_t ** pos, const uint8_t * end, uint32_t * value)
+{
+    *value = 0;
+    for(uint8_t shift = 0; shift < 35 && *pos < end; shift += 7)
+    {
+        uint8_t byte = *(*pos)++;
+        *value |= (uint32_t) (byte & 0x7F) << shift;
+        if(!(byte & 0x80))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool get_delta(const uint8_t ** pos, const uint8_t * end, int32_t last, int32_t * value)
+{
+    uint32_t zigzag;
+    if(!get_varint(pos, end, &zigzag))
+    {
+        return false;
+    }
+    *value = last + (int32_t) ((zigzag >> 1) ^ -(zigzag & 1));
+    return true;
+}
+
+bool Log_Reader::read_block(uint32_t block, std::vector<Log_Record_t> * records)
+{
+    const uint8_t * start = get_block(block);
+    if(!start)
+    {
+        this->errors++;
+        return false;
+    }
+
+    const uint8_t * pos = start + LOG_HEADER_SIZE, * end = start + LOG_BLOCK_SIZE;
+    uint16_t code_num = (start[12] << 8 | start[13]) + start[14];
+    uint32_t ms = get_u32(start + 8);
+    std::vector<int32_t> last(code_num, 0);
+    int32_t last_ma = 0, last_mv = 0;
+    size_t first = records->size();
+
+    for(uint8_t i = 0; i < start[3]; i++)
+    {
+        Log_Record_t record = {};
+        uint32_t dt;
+        record.type = pos < end ? *pos++ : LOG_RECORD_END;
+        bool ok = get_varint(&pos, end, &dt);
+        record.ms = ms += dt;
+
+        if(record.type == LOG_RECORD_TICK)
+        {
+            record.codes.resize(code_num);
+            for(uint16_t c = 0; ok && c < code_num; c++)
+            {
+                ok = get_delta(&pos, end, last[c], &last[c]);
+                record.codes[c] = last[c];
+            }
+            ok = ok && get_delta(&pos, end, last_ma, &last_ma) && get_delta(&pos, end, last_mv, &last_mv);
+            record.ma = last_ma;
+            record.mv = last_mv;
+        }
+        else if(record.type == LOG_RECORD_EVENT)
+        {
+            record.event = pos < end ? *pos++ : 0;
+            ok = ok && get_varint(&pos, end, &record.data);
+        }
+        else
+        {
+            ok = false;
+        }
+
+        if(!ok)
+        {
+            records->resize(first);
+            this->errors++;
+            return false;
+        }
+        records->push_back(record);
+    }
+    return true;
+}
+
+void Log_Reader::read(uint32_t from_ms, uint32_t to_ms, std::vector<Log_Record_t> * records)
+{
+    std::vector<Log_Record_t> block_records;
+    for(uint32_t block = seek(from_ms); block < get_block_num(); block++)
+    {
+        block_records.clear();
+        read_block(block, &block_records);
+        for(size_t i = 0; i < block_records.size(); i++)
+        {
+            if(block_records[i].ms > to_ms)
+            {
+                return;
+            }
+            if(block_records[i].ms >= from_ms)
+            {
+                records->push_back(block_records[i]);
+            }
+        }
+    }
+}
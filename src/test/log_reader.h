@@ -0,0 +1,64 @@
+/* Host reader of the files Data_Logger writes (format in logger.h), memory mapped or in memory */
+#ifndef LOG_READER_H
+#define LOG_READER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+#include "logger.h"
+
+typedef struct log_record
+{
+    uint8_t type;
+    uint32_t ms;
+
+    //LOG_RECORD_TICK, cell codes then aux codes
+    std::vector<uint16_t> codes;
+    int32_t ma, mv;
+
+    //LOG_RECORD_EVENT
+    uint8_t event;
+    uint32_t data;
+} Log_Record_t;
+
+class Log_Reader
+{
+public:
+    ~Log_Reader();
+
+    //Maps a log file, false if it can't be or holds no whole block
+    bool map(const char * path);
+    //Reads a log the caller keeps in memory (host_sd_file() for one)
+    bool open(const uint8_t * data, size_t size);
+    void close();
+
+    //Whole blocks only, a torn last one is left out
+    uint32_t get_block_num();
+    //Of the first block, every block carries its own
+    uint16_t get_cell_num();
+    uint8_t get_aux_num();
+    //Blocks that failed to decode so far
+    uint32_t get_errors();
+
+    //False if the block is not one of a log
+    bool get_header(uint32_t block, uint32_t * sequence, uint32_t * first_ms);
+
+    //Block to start from for the records at or after 'ms': a binary search over the block headers
+    uint32_t seek(uint32_t ms);
+
+    //Appends the records of a block, false (and nothing appended) if it doesn't decode
+    bool read_block(uint32_t block, std::vector<Log_Record_t> * records);
+    //Appends every record from 'from_ms' to 'to_ms' (both in), skipping blocks that don't decode
+    void read(uint32_t from_ms, uint32_t to_ms, std::vector<Log_Record_t> * records);
+
+protected:
+    const uint8_t * get_block(uint32_t block);
+
+    const uint8_t * data = nullptr;
+    size_t size = 0;
+    //Set when 'data' is mapped & ours to unmap
+    size_t mapped = 0;
+    uint32_t errors = 0;
+};
+
+#endif //LOG_READER_H
@@ -0,0 +1,132 @@
+/* Runs main.ino on the simulated pack (SIMULATION_ENABLE) as fast as the host goes:
+   every timer of the firmware follows the virtual clock, a loop() is SIM_STEP_MS of it. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "framework.h"
+#include "host.h"
+
+//CHARGE_PIN of main.ino, HIGH boots into the charge loop
+#define SIM_CHARGE_PIN 16
+
+void setup();
+void loop();
+
+extern bool shut_down;
+extern CAN_message_t shutdown_periodic;
+extern Pack_Simulator * simulator;
+extern BMS * bms;
+extern Coulomb_Counter * soc;
+extern Soc_Ekf * ekf;
+#if LOG_ENABLE
+extern Data_Logger * logger;
+#endif
+
+static float true_soc()
+{
+    Pack_Model * pack = simulator->get_pack();
+    float sum = 0;
+    for(uint16_t cell = 0; cell < pack->cell_num; cell++)
+    {
+        sum += pack->get_cell_soc(cell);
+    }
+    return sum / pack->cell_num;
+}
+
+static void report(uint32_t now_ms)
+{
+    printf("%6lu s  pack %6.2f V %6.2f A  cells %.3f~%.3f V  soc %5.1f%% counted %5.1f%% ekf %5.1f%%\n",
+           (unsigned long) (now_ms / 1000),
+           simulator->get_pack()->get_pack_volts(), simulator->get_pack()->get_amps(),
+           bms->get_min_volts().value, bms->get_max_volts().value,
+           true_soc() * 100, soc->get_soc() / 100.0, ekf->get_soc() * 100);
+}
+
+//The SD log of the run, for ./build/log
+static bool save_log(const char * path)
+{
+#if LOG_ENABLE
+    logger->flush();
+#endif
+    std::vector<uint8_t> const * log = host_sd_file("LOG00.BIN");
+    FILE * file = fopen(path, "wb");
+    if(!log || !file)
+    {
+        if(file)
+        {
+            fclose(file);
+        }
+        return false;
+    }
+    bool ok = fwrite(log->data(), 1, log->size(), file) == log->size();
+    return fclose(file) == 0 && ok;
+}
+
+static void usage()
+{
+    printf("sim [-m minutes] [-c] [-v] [-l file]\n"
+           "  -m  virtual minutes to run (60)\n"
+           "  -c  boot into the charge loop\n"
+           "  -v  echo the serial output of the firmware\n"
+           "  -l  write the SD log of the run to a file\n"
+           "Exits with 1 if the firmware shut the car down\n");
+}
+
+int main(int argc, char ** argv)
+{
+    uint32_t minutes = 60;
+    const char * log_path = nullptr;
+    for(int i = 1; i < argc; i++)
+    {
+        if(strcmp(argv[i], "-m") == 0 && i + 1 < argc)
+        {
+            minutes = strtoul(argv[++i], nullptr, 10);
+        }
+        else if(strcmp(argv[i], "-c") == 0)
+        {
+            host_set_input(SIM_CHARGE_PIN, HIGH);
+        }
+        else if(strcmp(argv[i], "-v") == 0)
+        {
+            host_serial_echo(true);
+        }
+        else if(strcmp(argv[i], "-l") == 0 && i + 1 < argc)
+        {
+            log_path = argv[++i];
+        }
+        else
+        {
+            usage();
+            return 2;
+        }
+    }
+
+    setup();
+
+    uint32_t start_ms = Clock::now_ms();
+    uint32_t report_ms = start_ms;
+    while(!shut_down && Clock::now_ms() - start_ms < minutes * 60000)
+    {
+        loop();
+
+        if(Clock::now_ms() - report_ms >= 60000)
+        {
+            report_ms = Clock::now_ms();
+            report(report_ms - start_ms);
+        }
+    }
+    report(Clock::now_ms() - start_ms);
+
+    if(log_path && !save_log(log_path))
+    {
+        fprintf(stderr, "No log written to %s\n", log_path);
+    }
+
+    if(shut_down)
+    {
+        printf("Shut down after %lu s, error 0x%02X\n",
+               (unsigned long) ((Clock::now_ms() - start_ms) / 1000), shutdown_periodic.buf[7]);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,37 @@
+/* Minimal test runner of the host build: TEST() registers a test, CHECK*() report & keep going */
+#ifndef TEST_H
+#define TEST_H
+
+#include <stdio.h>
+#include <math.h>
+
+class Test_Case
+{
+public:
+    Test_Case(const char * name, void (* body)());
+
+    const char * const name;
+    void (* const body)();
+    Test_Case * next = nullptr;
+};
+
+void test_fail(const char * file, int line, const char * text);
+void test_fail_near(const char * file, int line, const char * text, double value, double expected, double tolerance);
+
+//Run in the order they are declared and share the host stand-ins (see host.h), which start blank
+#define TEST(name) \
+    static void test_##name(); \
+    static Test_Case test_case_##name(#name, &test_##name); \
+    static void test_##name()
+
+#define CHECK(condition) \
+    do { if(!(condition)) test_fail(__FILE__, __LINE__, #condition); } while(0)
+
+#define CHECK_NEAR(value, expected, tolerance) \
+    do { \
+        double check_value = (value), check_expected = (expected); \
+        if(!(fabs(check_value - check_expected) <= (tolerance))) \
+            test_fail_near(__FILE__, __LINE__, #value, check_value, check_expected, (tolerance)); \
+    } while(0)
+
+#endif //TEST_H
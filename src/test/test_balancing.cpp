@@ -0,0 +1,169 @@
+/* Balancing decisions, their schedule & the time a simulated pack takes to balance */
+#include "balancing.h"
+#include "framework.h"
+#include "sim.h"
+#include "host.h"
+#include "test.h"
+
+#define THRESHOLD 100 /* 100uV/LSB */
+#define BALANCE_TICKS 3
+#define BASE 37000
+
+static const uint8_t blank_config[6] = {0B00000100, 0, 0, 0, 0, 0};
+
+static void no_critical(BmsCriticalFrame_t){}
+
+static float volts_to_celsius(float, float){ return 25; }
+static float uint16_volts_to_float(uint16_t volts){ return volts * 0.0001; }
+
+//Runs the schedule until the next decision has been taken, bleeding ticks included
+static void decide(Balancer * balancer, const uint16_t * codes)
+{
+    while(!balancer->is_measurement_window())
+    {
+        balancer->update(codes);
+    }
+    balancer->update(codes);
+}
+
+TEST(bleeds_the_highest_cells_above_the_threshold)
+{
+    Pack_Model pack(SIM_CELLS_PER_IC, 1);
+    LTC_Emulator slaves(&pack, 1, &volts_to_celsius);
+    LTC6804_2 ltc(&slaves);
+    Slave_Config cfg(&ltc, 1, blank_config);
+    Balancer balancer(1, 0, 12, THRESHOLD, 2, DCTO_30_SEC, BALANCE_TICKS);
+
+    uint16_t codes[12];
+    for(uint8_t i = 0; i < 12; i++)
+    {
+        codes[i] = BASE;
+    }
+    codes[3] = BASE + 300;
+    codes[5] = BASE + 200;
+    codes[7] = BASE + 150;
+    codes[9] = BASE + 50;
+
+    //Nothing bleeds before the first decision on rested cells
+    balancer.enable();
+    balancer.apply(&cfg);
+    CHECK(cfg.get(0)[4] == 0);
+    decide(&balancer, codes);
+
+    //3 cells above the threshold, only the 2 highest of them fit
+    CHECK(balancer.get_dcc(0) == ((1 << 3) | (1 << 5)));
+    CHECK(balancer.get_bleeding_num() == 2);
+    CHECK(!balancer.is_balanced());
+    balancer.apply(&cfg);
+    CHECK(cfg.get(0)[4] == ((1 << 3) | (1 << 5)));
+    CHECK(cfg.get(0)[5] == DCTO_30_SEC << 4);
+
+    //Every bleeder is off for the measurement, the decision stays
+    for(uint8_t i = 0; i < BALANCE_TICKS; i++)
+    {
+        balancer.update(codes);
+    }
+    balancer.apply(&cfg);
+    CHECK(cfg.get(0)[4] == 0);
+    CHECK(balancer.get_dcc(0) != 0);
+
+    //Cell 4 keeps on until it is within half the threshold, cell 6 is there, cell 8 gets its turn
+    codes[3] = BASE + THRESHOLD / 2 + 10;
+    codes[5] = BASE + THRESHOLD / 2 - 10;
+    decide(&balancer, codes);
+    CHECK(balancer.get_dcc(0) == ((1 << 3) | (1 << 7)));
+
+    for(uint8_t i = 0; i < 12; i++)
+    {
+        codes[i] = BASE + 20;
+    }
+    codes[0] = BASE;
+    decide(&balancer, codes);
+    CHECK(balancer.get_dcc(0) == 0);
+    CHECK(balancer.is_balanced());
+
+    //Off means the slaves stop bleeding on the next write, timeout included
+    balancer.disable();
+    balancer.apply(&cfg);
+    CHECK(cfg.get(0)[5] == 0);
+}
+
+TEST(balances_towards_the_floor_of_the_pack)
+{
+    Balancer balancer(1, 0, 12, THRESHOLD, 4, DCTO_30_SEC, BALANCE_TICKS);
+    uint16_t codes[12];
+    for(uint8_t i = 0; i < 12; i++)
+    {
+        codes[i] = BASE;
+    }
+
+    balancer.enable();
+    decide(&balancer, codes);
+    CHECK(balancer.is_balanced());
+
+    //The other box is lower, the 4 cells a slave may bleed at once start on it
+    balancer.set_floor(BASE - 2 * THRESHOLD);
+    decide(&balancer, codes);
+    CHECK(balancer.get_bleeding_num() == 4);
+    CHECK(!balancer.is_balanced());
+}
+
+//Cells of a seeded pack at rest, every tick a second: the spread has to get within the threshold
+TEST(simulated_pack_balances)
+{
+    Pack_Model pack(SIM_CELLS_PER_IC, 13);
+    LTC_Emulator slaves(&pack, 1, &volts_to_celsius);
+    LTC6804_2 ltc(&slaves, MD_NORMAL, DCP_DISABLED, CELL_CH_ALL, AUX_CH_ALL, 0);
+    IVT ivt;
+    BMS bms(&ltc, &ivt, 1, 4.25, 2.5, 60, 0, 0, 12, 0, 5, blank_config,
+            &no_critical, &uint16_volts_to_float, &volts_to_celsius);
+    Balancer balancer(1, 0, 12, THRESHOLD, 4, DCTO_30_SEC, 10);
+    bms.set_full_scan_period(255);
+    bms.set_balancer(&balancer);
+    balancer.enable();
+
+    float start_spread = 0;
+    uint32_t seconds = 0;
+    uint8_t max_bleeding = 0;
+    for(; seconds < 4 * 3600 && !(seconds > 12 && balancer.is_balanced()); seconds++)
+    {
+        bms.tick();
+        pack.step(0, 1.0);
+
+        max_bleeding = balancer.get_bleeding_num() > max_bleeding ? balancer.get_bleeding_num() : max_bleeding;
+        if(seconds == 12)
+        {
+            start_spread = bms.get_max_volts().value - bms.get_min_volts().value;
+            CHECK(start_spread > THRESHOLD * 0.0001);
+        }
+    }
+    printf("  balanced in %lu s, %.1f mV to %.1f mV\n", (unsigned long) seconds,
+           start_spread * 1000, (bms.get_max_volts().value - bms.get_min_volts().value) * 1000);
+
+    CHECK(balancer.is_balanced());
+    CHECK(seconds < 4 * 3600);
+    CHECK(max_bleeding <= 4);
+    CHECK(bms.get_max_volts().value - bms.get_min_volts().value <= THRESHOLD * 0.0001);
+}
+
+//The discharge timer counts down in the read back, which is no reason to rewrite the slave
+TEST(running_discharge_timer_is_not_a_mismatch)
+{
+    Pack_Model pack(SIM_CELLS_PER_IC, 1);
+    LTC_Emulator slaves(&pack, 1, &volts_to_celsius);
+    LTC6804_2 ltc(&slaves);
+    Slave_Config cfg(&ltc, 1, blank_config);
+
+    cfg.set_dcc(0, 1 << 3, DCTO_5_MIN);
+    CHECK(cfg.write_all_and_verify() == SLAVE_CONFIG_OK);
+
+    uint8_t r_cfg[8];
+    for(uint8_t i = 0; i < 2 * SLAVE_CONFIG_MAX_MISMATCHES; i++)
+    {
+        host_advance_us(60000000);
+        CHECK(cfg.verify_next() == SLAVE_CONFIG_OK);
+        CHECK(!cfg.is_dirty(0));
+    }
+    //Ran out by now, the bleeders are still compared
+    CHECK(ltc.rdcfg_ic(0, r_cfg) != -1 && r_cfg[5] >> 4 == 0 && r_cfg[4] == 1 << 3);
+}
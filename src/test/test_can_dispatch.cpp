@@ -0,0 +1,117 @@
+/* Dispatch table & the hardware filters it programs, on the virtual bus */
+#include "framework.h"
+#include "host.h"
+#include "test.h"
+
+//Records the last message, listens to whatever ids it is given
+class Fake_Sensor : public Can_Sensor
+{
+public:
+    Fake_Sensor(uint32_t const * ids, uint32_t id_num) : ids(ids), id_num(id_num) {}
+
+    void update(CAN_message_t message) { last = message; updates++; }
+    uint32_t const * get_ids() { return ids; }
+    uint32_t get_id_num() { return id_num; }
+
+    CAN_message_t last;
+    uint32_t updates = 0;
+
+protected:
+    uint32_t const * ids;
+    uint32_t id_num;
+};
+
+static FlexCAN sender(500000);
+
+//Drains the node, true if a frame of that id was in it
+static bool received(FlexCAN * node, uint32_t id)
+{
+    bool found = false;
+    CAN_message_t msg;
+    while(node->available())
+    {
+        node->read(msg);
+        found = found || msg.id == id;
+    }
+    return found;
+}
+
+static void send(uint32_t id)
+{
+    CAN_message_t msg;
+    msg.id = id;
+    msg.len = 0;
+    sender.write(msg);
+}
+
+TEST(routes_every_id_to_its_sensor)
+{
+    static const uint32_t a_ids[] = {0x522, 0x521};
+    static const uint32_t b_ids[] = {0x4FC};
+    Fake_Sensor a(a_ids, 2), b(b_ids, 1);
+    Can_Dispatch dispatch;
+    dispatch.add(&a);
+    dispatch.add(&b);
+    dispatch.listen(0x4FE);
+    dispatch.sort();
+
+    CAN_message_t msg;
+    msg.id = 0x521;
+    CHECK(dispatch.dispatch(msg) && a.updates == 1);
+    msg.id = 0x4FC;
+    CHECK(dispatch.dispatch(msg) && b.updates == 1);
+    //Listened to, but handled by the caller
+    msg.id = 0x4FE;
+    CHECK(!dispatch.dispatch(msg));
+    msg.id = 0x523;
+    CHECK(!dispatch.dispatch(msg));
+    CHECK(a.updates == 1 && b.updates == 1);
+}
+
+TEST(exact_filters_while_the_ids_fit)
+{
+    static const uint32_t ids[] = {0x521, 0x522, 0x6AA};
+    Fake_Sensor sensor(ids, 3);
+    Can_Dispatch dispatch;
+    dispatch.add(&sensor);
+
+    FlexCAN node(500000);
+    sender.begin();
+    dispatch.begin(&node);
+    CHECK(dispatch.get_mask() == 0x7FF);
+
+    send(0x521);
+    CHECK(received(&node, 0x521));
+    send(0x6AA);
+    CHECK(received(&node, 0x6AA));
+    send(0x523);
+    CHECK(!received(&node, 0x523));
+    node.end();
+}
+
+TEST(more_ids_than_filters_still_filter)
+{
+    //The ids of a box on a 2 box pack, more than CAN_HW_FILTERS
+    static const uint32_t ids[] = {0x521, 0x522, 0x503, 0x504, 0x505, 0x6AA, 0x4FC, 0x4FA, 0x700, 0x4FE};
+    Fake_Sensor sensor(ids, 10);
+    Can_Dispatch dispatch;
+    dispatch.add(&sensor);
+
+    FlexCAN node(500000);
+    dispatch.begin(&node);
+    CHECK(dispatch.get_mask() != 0);
+    CHECK((dispatch.get_mask() & 0x700) == 0x700);
+
+    //Every id gets through
+    for(uint8_t i = 0; i < 10; i++)
+    {
+        send(ids[i]);
+        CHECK(received(&node, ids[i]));
+    }
+    //Far from all of them, dropped in hardware
+    send(0x123);
+    CHECK(!received(&node, 0x123));
+    send(0x618);
+    CHECK(!received(&node, 0x618));
+    node.end();
+}
@@ -0,0 +1,94 @@
+/* CC-CV charge of the simulated cells, the way charge_cycle() drives it */
+#include "charging.h"
+#include "sim.h"
+#include "test.h"
+
+#define CV_VOLTS 4.2
+#define CC_AMPS 0.65
+#define TAPER_AMPS 0.065
+
+static float max_cell(Pack_Model * pack)
+{
+    float max = pack->get_cell_volts(0);
+    for(uint16_t cell = 1; cell < pack->cell_num; cell++)
+    {
+        max = pack->get_cell_volts(cell) > max ? pack->get_cell_volts(cell) : max;
+    }
+    return max;
+}
+
+TEST(idle_until_started)
+{
+    Charge_Controller charge(CC_AMPS, CV_VOLTS, TAPER_AMPS);
+    charge.update(0, 3.8, 4);
+    CHECK(charge.get_state() == CHARGE_IDLE);
+    CHECK(charge.get_amps() == 0);
+
+    charge.start();
+    charge.update(100, 3.8, 4);
+    CHECK(charge.get_state() == CHARGE_CC);
+    CHECK_NEAR(charge.get_amps(), CC_AMPS, 0.001);
+
+    //Derated below the CC current
+    charge.update(200, 3.8, 0.3);
+    CHECK_NEAR(charge.get_amps(), 0.3, 0.001);
+}
+
+TEST(straight_to_cv_on_a_full_cell)
+{
+    Charge_Controller charge(CC_AMPS, CV_VOLTS, TAPER_AMPS);
+    charge.start();
+    //Already past CV, the same update lowers the current
+    charge.update(0, CV_VOLTS + 0.05, 4);
+    CHECK(charge.get_state() == CHARGE_CV);
+    CHECK(charge.get_amps() == 0);
+}
+
+TEST(charges_the_simulated_cells_to_done)
+{
+    Pack_Model pack(12, 7);
+    //The OCV of the model tops out at 4.18V, CV has to be below it for the current to taper
+    Charge_Controller charge(CC_AMPS, 4.15, TAPER_AMPS);
+    charge.start();
+
+    uint32_t ms = 0, cv_ms = 0;
+    float highest = 0;
+    //4 hours at most
+    for(; ms < 4 * 3600000UL && !charge.is_done(); ms += SIM_STEP_MS)
+    {
+        charge.update(ms, max_cell(&pack), 4);
+        if(charge.get_state() == CHARGE_CV && cv_ms == 0)
+        {
+            cv_ms = ms;
+        }
+        pack.step(-charge.get_amps(), SIM_STEP_MS / 1000.0);
+        highest = max_cell(&pack) > highest ? max_cell(&pack) : highest;
+    }
+
+    CHECK(charge.is_done());
+    CHECK(cv_ms > 0);
+    CHECK(charge.get_amps() == 0);
+    //CV holds the highest cell, the gain only lets it overshoot a little
+    CHECK(highest < 4.15 + 0.01);
+    float soc = 0;
+    for(uint16_t cell = 0; cell < pack.cell_num; cell++)
+    {
+        soc = pack.get_cell_soc(cell) > soc ? pack.get_cell_soc(cell) : soc;
+    }
+    CHECK(soc > 0.9);
+}
+
+TEST(derating_is_not_a_taper)
+{
+    Charge_Controller charge(CC_AMPS, CV_VOLTS, TAPER_AMPS, 1000);
+    charge.start();
+    charge.update(0, CV_VOLTS, 4);
+    CHECK(charge.get_state() == CHARGE_CV);
+
+    //Held at 0A by the limit for far longer than the taper time
+    for(uint32_t ms = 0; ms < 10000; ms += 100)
+    {
+        charge.update(ms, CV_VOLTS - 0.1, 0);
+    }
+    CHECK(!charge.is_done());
+}
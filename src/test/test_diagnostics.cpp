@@ -0,0 +1,134 @@
+/* Open wire check (ADOW) on emulated slaves with broken sense wires */
+#include "diagnostics.h"
+#include "framework.h"
+#include "sim.h"
+#include "test.h"
+
+#define TOTAL_IC 2
+
+static const uint8_t blank_config[6] = {0B00000100, 0, 0, 0, 0, 0};
+
+static float volts_to_celsius(float, float){ return 25; }
+static float uint16_volts_to_float(uint16_t volts){ return volts * 0.0001; }
+
+static BmsCriticalFrame_t criticals[16];
+static uint8_t critical_num = 0;
+
+static void record_critical(BmsCriticalFrame_t frame)
+{
+    if(critical_num < 16)
+    {
+        criticals[critical_num++] = frame;
+    }
+}
+
+//Both steps of one slave
+static int8_t check_slave(Open_Wire_Detector * detector)
+{
+    int8_t result = detector->step();
+    return result == OPEN_WIRE_NONE ? detector->step() : result;
+}
+
+TEST(finds_every_wire_of_the_slave_it_is_on)
+{
+    Pack_Model pack(TOTAL_IC * SIM_CELLS_PER_IC, 13);
+    LTC_Emulator slaves(&pack, TOTAL_IC, &volts_to_celsius);
+    LTC6804_2 ltc(&slaves, MD_NORMAL, DCP_DISABLED, CELL_CH_ALL, AUX_CH_ALL, 0);
+    Open_Wire_Detector detector(&ltc, TOTAL_IC, 0, 12);
+
+    //Healthy stack
+    CHECK(check_slave(&detector) == OPEN_WIRE_NONE);
+    CHECK(check_slave(&detector) == OPEN_WIRE_NONE);
+
+    for(uint8_t wire = 0; wire <= 12; wire++)
+    {
+        slaves.set_open_wire(1, wire, true);
+
+        //One slave per cycle, the healthy one first
+        CHECK(check_slave(&detector) == OPEN_WIRE_NONE);
+        CHECK(detector.get_ic() == 0);
+        CHECK(check_slave(&detector) == OPEN_WIRE_FOUND);
+        CHECK(detector.get_ic() == 1);
+        CHECK(detector.get_open_wires() == 1 << wire);
+
+        //Cell on top of the wire, C0 & C12 belong to the bottom & top cells
+        uint8_t cell = wire == 0 ? 0 : (wire == 12 ? 11 : wire);
+        CHECK(detector.get_cell_index(wire) == SIM_CELLS_PER_IC + cell);
+
+        slaves.set_open_wire(1, wire, false);
+    }
+
+    //Two at once
+    slaves.set_open_wire(0, 3, true);
+    slaves.set_open_wire(0, 7, true);
+    CHECK(check_slave(&detector) == OPEN_WIRE_FOUND);
+    CHECK(detector.get_open_wires() == ((1 << 3) | (1 << 7)));
+}
+
+TEST(ignored_cells_are_not_checked)
+{
+    Pack_Model pack(SIM_CELLS_PER_IC, 13);
+    LTC_Emulator slaves(&pack, 1, &volts_to_celsius);
+    LTC6804_2 ltc(&slaves, MD_NORMAL, DCP_DISABLED, CELL_CH_ALL, AUX_CH_ALL, 0);
+    Open_Wire_Detector detector(&ltc, 1, 0, 10);
+
+    //C12 & C11 only touch cells 11 & 12, which are not wired in
+    slaves.set_open_wire(0, 12, true);
+    slaves.set_open_wire(0, 11, true);
+    CHECK(check_slave(&detector) == OPEN_WIRE_NONE);
+
+    //C10 tops cell 10, the last one in
+    slaves.set_open_wire(0, 10, true);
+    CHECK(check_slave(&detector) == OPEN_WIRE_FOUND);
+    CHECK(detector.get_open_wires() == 1 << 10);
+    CHECK(detector.get_cell_index(10) == 9);
+}
+
+//Every step costs 2 conversions & a cell read back of one slave, whatever the stack
+TEST(one_step_fits_in_a_tick)
+{
+    Pack_Model pack(16 * SIM_CELLS_PER_IC, 13);
+    LTC_Emulator slaves(&pack, 16, &volts_to_celsius);
+    LTC6804_2 ltc(&slaves);
+    Open_Wire_Detector detector(&ltc, 16, 0, 12);
+
+    for(uint8_t i = 0; i < 4; i++)
+    {
+        uint32_t start = micros(), bytes = ltc.get_spi_bytes();
+        detector.step();
+        CHECK(micros() - start <= OPEN_WIRE_CONVERSIONS * 3000 + 1000);
+        CHECK(ltc.get_spi_bytes() - bytes <= OPEN_WIRE_CONVERSIONS * 4 + 4 * (4 + 8));
+    }
+}
+
+//The BMS reports each wire with the cell on top of it, one slave every other tick
+TEST(bms_reports_the_wire_and_cell)
+{
+    Pack_Model pack(TOTAL_IC * SIM_CELLS_PER_IC, 13);
+    LTC_Emulator slaves(&pack, TOTAL_IC, &volts_to_celsius);
+    LTC6804_2 ltc(&slaves, MD_NORMAL, DCP_DISABLED, CELL_CH_ALL, AUX_CH_ALL, 0);
+    IVT ivt;
+    BMS bms(&ltc, &ivt, TOTAL_IC, 4.25, 2.5, 60, 0, 0, 12, 0, 5, blank_config,
+            &record_critical, &uint16_volts_to_float, &volts_to_celsius);
+    Open_Wire_Detector detector(&ltc, TOTAL_IC, 0, 12);
+    bms.set_open_wire_detector(&detector);
+
+    slaves.set_open_wire(1, 5, true);
+
+    uint8_t found = 0;
+    for(uint8_t tick = 0; tick < 2 * TOTAL_IC; tick++)
+    {
+        critical_num = 0;
+        bms.tick();
+        for(uint8_t i = 0; i < critical_num; i++)
+        {
+            if(criticals[i].mode == bms_open_wire_error.mode)
+            {
+                CHECK(criticals[i].volts.value == 5);
+                CHECK(criticals[i].volts.index == SIM_CELLS_PER_IC + 5);
+                found++;
+            }
+        }
+    }
+    CHECK(found == 1);
+}
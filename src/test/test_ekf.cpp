@@ -0,0 +1,104 @@
+/* EKF accuracy against a simulated pack, and its cost per update */
+#include <time.h>
+#include "ekf.h"
+#include "sim.h"
+#include "test.h"
+
+#define CELLS 12
+#define STEP_US 100000
+
+//25s pulses: 10s discharging, 10s resting, 5s of regen
+static float drive_amps(uint32_t step)
+{
+    uint32_t s = step * STEP_US / 1000000 % 25;
+    return s < 10 ? 6 : (s < 20 ? 0 : -3);
+}
+
+static float average_soc(Pack_Model * pack)
+{
+    float sum = 0;
+    for(uint16_t cell = 0; cell < pack->cell_num; cell++)
+    {
+        sum += pack->get_cell_soc(cell);
+    }
+    return sum / pack->cell_num;
+}
+
+//Runs the drive cycle for 'seconds', the filter seeing the average cell. Returns the worst SOC error after 'settle_s'
+static float drive(Pack_Model * pack, Soc_Ekf * ekf, uint32_t seconds, uint32_t settle_s, uint32_t * step)
+{
+    float worst = 0;
+    for(uint32_t end = *step + seconds * 1000000 / STEP_US; *step < end; (*step)++)
+    {
+        float amps = drive_amps(*step);
+        pack->step(amps, STEP_US * 0.000001);
+        ekf->update(amps, pack->get_pack_volts() / pack->cell_num, *step * STEP_US);
+
+        float error = fabs(ekf->get_soc() - average_soc(pack));
+        if(*step * STEP_US / 1000000 >= settle_s && error > worst)
+        {
+            worst = error;
+        }
+    }
+    return worst;
+}
+
+TEST(tracks_the_soc_and_r0_of_a_simulated_pack)
+{
+    Pack_Model pack(CELLS, 13);
+    Soc_Ekf ekf(SIM_CAPACITY_AH);
+    uint32_t step = 0;
+
+    //Half an hour of pulses, from 90% down to ~20%
+    float worst = drive(&pack, &ekf, 1800, 300, &step);
+    printf("  soc %.1f%% vs %.1f%%, worst %.2f%%, r0 %.1f mOhm\n",
+           ekf.get_soc() * 100, average_soc(&pack) * 100, worst * 100, ekf.get_r0() * 1000);
+
+    CHECK(average_soc(&pack) < 0.5);
+    CHECK(worst < 0.03);
+    CHECK_NEAR(ekf.get_soc(), average_soc(&pack), 0.02);
+    CHECK_NEAR(ekf.get_r0(), SIM_R0, SIM_R0 * 0.25);
+    CHECK(fabs(ekf.get_residual()) < 0.02);
+}
+
+TEST(recovers_from_a_wrong_start)
+{
+    Pack_Model pack(CELLS, 13);
+    Soc_Ekf ekf(SIM_CAPACITY_AH);
+    uint32_t step = 1;
+
+    //First reading taken under a heavy load, it starts far too low
+    ekf.update(0, 3.6, 0);
+    CHECK(average_soc(&pack) - ekf.get_soc() > 0.2);
+
+    float worst = drive(&pack, &ekf, 1200, 600, &step);
+    CHECK(worst < 0.05);
+}
+
+//Cells hold 20% less than the nominal capacity the filter was given
+TEST(follows_capacity_fade)
+{
+    Pack_Model pack(CELLS, 13);
+    Soc_Ekf ekf(SIM_CAPACITY_AH / 0.8);
+    uint32_t step = 0;
+
+    float worst = drive(&pack, &ekf, 1800, 300, &step);
+    printf("  capacity %.2f of nominal, worst %.2f%%\n", ekf.get_capacity_ratio(), worst * 100);
+    CHECK_NEAR(ekf.get_capacity_ratio(), 0.8, 0.05);
+    CHECK(worst < 0.03);
+}
+
+TEST(cost_of_an_update)
+{
+    Soc_Ekf ekf(SIM_CAPACITY_AH);
+    const uint32_t updates = 100000;
+
+    clock_t start = clock();
+    for(uint32_t i = 0; i < updates; i++)
+    {
+        ekf.update(drive_amps(i), 3.7 - drive_amps(i) * 0.02, i * STEP_US);
+    }
+    double ns = (double) (clock() - start) / CLOCKS_PER_SEC * 1e9 / updates;
+    printf("  %.0f ns an update on the host\n", ns);
+    CHECK(ekf.get_soc() >= 0 && ekf.get_soc() <= 1);
+}
@@ -0,0 +1,161 @@
+/* Safety properties of the policy per mode, debounce, escalation & what latches */
+#include "fault_policy.h"
+#include "test.h"
+
+#define REPORT_MS 100
+#define NEVER 0xFFFF
+
+//Reports a fault every REPORT_MS for 'ms', returns the weakest & strongest action it got
+static void report_for(Fault_Policy * policy, uint8_t mode, uint8_t fault, uint32_t ms, uint8_t * weakest, uint8_t * strongest)
+{
+    *weakest = FAULT_ACTION_SHUTDOWN;
+    *strongest = FAULT_ACTION_NONE;
+    for(uint32_t t = 0; t <= ms; t += REPORT_MS)
+    {
+        uint8_t action = policy->report(mode, fault, 1000 + t);
+        *weakest = action < *weakest ? action : *weakest;
+        *strongest = action > *strongest ? action : *strongest;
+    }
+}
+
+//Nothing in drive or precharge is left to a charger, whatever the class
+TEST(drive_and_precharge_shut_down_at_once)
+{
+    static const uint8_t modes[] = {FAULT_MODE_DRIVE, FAULT_MODE_PRECHARGE};
+    for(uint8_t m = 0; m < 2; m++)
+    {
+        for(uint8_t fault = 0; fault < FAULT_CLASSES; fault++)
+        {
+            Fault_Policy policy;
+            uint8_t weakest, strongest;
+            report_for(&policy, modes[m], fault, 10000, &weakest, &strongest);
+            if(weakest != FAULT_ACTION_SHUTDOWN)
+            {
+                printf("  mode %u fault %u: %u\n", modes[m], fault, weakest);
+            }
+            CHECK(weakest == FAULT_ACTION_SHUTDOWN);
+        }
+    }
+}
+
+TEST(charge_overvolt_stops_the_charger_then_shuts_down)
+{
+    Fault_Policy policy;
+    CHECK(policy.report(FAULT_MODE_CHARGE, FAULT_OVERVOLT, 1000) >= FAULT_ACTION_STOP_CHARGER);
+    CHECK(policy.limit_charge_amps(10, 1000) == 0);
+
+    uint8_t weakest, strongest;
+    report_for(&policy, FAULT_MODE_CHARGE, FAULT_OVERVOLT, 10000, &weakest, &strongest);
+    CHECK(weakest >= FAULT_ACTION_STOP_CHARGER);
+    CHECK(strongest == FAULT_ACTION_SHUTDOWN);
+}
+
+//No current into cells below the temperature limit (plating), for as long as it lasts & after
+TEST(charge_undertemp_never_lets_current_through)
+{
+    Fault_Policy policy;
+    CHECK(policy.report(FAULT_MODE_CHARGE, FAULT_UNDERTEMP, 0) >= FAULT_ACTION_STOP_CHARGER);
+    CHECK(policy.limit_charge_amps(10, 0) == 0);
+
+    for(uint32_t t = 0; t <= 60000; t += REPORT_MS)
+    {
+        uint8_t action = policy.report(FAULT_MODE_CHARGE, FAULT_UNDERTEMP, t);
+        if(action < FAULT_ACTION_STOP_CHARGER || policy.limit_charge_amps(10, t) != 0)
+        {
+            printf("  at %lu ms: %u\n", (unsigned long) t, action);
+            CHECK(false);
+            break;
+        }
+    }
+    CHECK(policy.limit_charge_amps(10, 120000) == 0);
+}
+
+//Whatever the rule of a class says, report() takes its action after the debounce, the
+//escalated one after escalate_ms and never backs off while the reports keep coming
+TEST(every_rule_debounces_and_escalates_on_time)
+{
+    for(uint8_t mode = 0; mode < FAULT_MODES; mode++)
+    {
+        for(uint8_t fault = 0; fault < FAULT_CLASSES; fault++)
+        {
+            Fault_Rule_t const * rule = Fault_Policy::get_rule(mode, fault);
+            Fault_Policy policy;
+            uint8_t last = FAULT_ACTION_NONE;
+
+            CHECK(rule->escalate_ms == NEVER || rule->escalated >= rule->action);
+            for(uint32_t t = 0; t <= 10000; t += REPORT_MS)
+            {
+                uint8_t action = policy.report(mode, fault, 1000 + t);
+                uint8_t want = FAULT_ACTION_NONE;
+                if(rule->escalate_ms != NEVER && t >= rule->escalate_ms)
+                {
+                    want = rule->escalated;
+                }
+                else if(t >= rule->debounce_ms)
+                {
+                    want = rule->action;
+                }
+
+                if(action != want || action < last)
+                {
+                    printf("  mode %u fault %u at %lu ms: %u, expected %u\n",
+                           mode, fault, (unsigned long) t, action, want);
+                    CHECK(action == want && action >= last);
+                    break;
+                }
+                last = action;
+            }
+        }
+    }
+}
+
+TEST(debounce_starts_over_once_the_fault_is_gone)
+{
+    Fault_Policy policy;
+
+    CHECK(policy.report(FAULT_MODE_CHARGE, FAULT_IVT, 0) == FAULT_ACTION_NONE);
+    CHECK(policy.report(FAULT_MODE_CHARGE, FAULT_IVT, 400) == FAULT_ACTION_NONE);
+
+    //Silent past FAULT_CLEAR_MS, the 500ms start over
+    CHECK(policy.report(FAULT_MODE_CHARGE, FAULT_IVT, 400 + FAULT_CLEAR_MS + 1) == FAULT_ACTION_NONE);
+    CHECK(policy.report(FAULT_MODE_CHARGE, FAULT_IVT, 400 + FAULT_CLEAR_MS + 400) == FAULT_ACTION_NONE);
+    CHECK(policy.report(FAULT_MODE_CHARGE, FAULT_IVT, 400 + FAULT_CLEAR_MS + 501) == FAULT_ACTION_STOP_CHARGER);
+
+    //Another class has a timer of its own
+    CHECK(policy.report(FAULT_MODE_CHARGE, FAULT_OVERTEMP, 2000) == FAULT_ACTION_DERATE);
+}
+
+TEST(derating_lasts_as_long_as_reports_keep_coming)
+{
+    Fault_Policy policy;
+    CHECK(policy.get_action(0) == FAULT_ACTION_NONE);
+    CHECK(policy.limit_charge_amps(10, 0) == 10);
+
+    policy.report(FAULT_MODE_CHARGE, FAULT_OVERTEMP, 100);
+    CHECK(policy.is_derating(100));
+    CHECK(policy.get_action(100) == FAULT_ACTION_DERATE);
+    CHECK_NEAR(policy.limit_charge_amps(10, 100), 10 * FAULT_DERATE_FACTOR, 0.0001);
+
+    //Cooled down
+    CHECK(!policy.is_derating(100 + FAULT_CLEAR_MS + 1));
+    CHECK(policy.limit_charge_amps(10, 100 + FAULT_CLEAR_MS + 1) == 10);
+    CHECK(!policy.is_charger_stopped());
+}
+
+TEST(stopping_the_charger_latches)
+{
+    Fault_Policy policy;
+    CHECK(policy.report(FAULT_MODE_CHARGE, FAULT_UNDERTEMP, 0) == FAULT_ACTION_STOP_CHARGER);
+    CHECK(policy.is_charger_stopped());
+    CHECK(policy.get_action(60000) == FAULT_ACTION_STOP_CHARGER);
+    CHECK(policy.limit_charge_amps(10, 60000) == 0);
+}
+
+TEST(out_of_range_is_an_unknown_fault_in_drive)
+{
+    CHECK(Fault_Policy::get_rule(FAULT_MODES, 0) == Fault_Policy::get_rule(FAULT_MODE_DRIVE, FAULT_UNKNOWN));
+    CHECK(Fault_Policy::get_rule(FAULT_MODE_CHARGE, FAULT_CLASSES) == Fault_Policy::get_rule(FAULT_MODE_DRIVE, FAULT_UNKNOWN));
+
+    Fault_Policy policy;
+    CHECK(policy.report(FAULT_MODE_CHARGE, 0xFF, 0) == FAULT_ACTION_SHUTDOWN);
+}
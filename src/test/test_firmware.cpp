@@ -0,0 +1,127 @@
+/* main.ino on the simulated pack, every test picks up where the previous one left */
+#include "framework.h"
+#include "identity.h"
+#include "host.h"
+#include "test.h"
+
+void setup();
+void loop();
+
+extern bool shut_down;
+extern BMS * bms;
+extern Self_Test * self_test;
+extern Pack_Simulator * simulator;
+extern Coulomb_Counter * soc;
+extern Dcir_Estimator * dcir;
+
+uint8_t fault_class(BmsCriticalFrame_t);
+
+static void run_ms(uint32_t ms)
+{
+    uint32_t start = Clock::now_ms();
+    while(!shut_down && Clock::now_ms() - start < ms)
+    {
+        loop();
+    }
+}
+
+TEST(boots_on_the_simulated_pack)
+{
+    setup();
+
+    CHECK(!shut_down);
+    for(uint8_t ic = 0; ic < bms->total_ic; ic++)
+    {
+        CHECK(self_test->get_health(ic)->cycles == 1);
+        CHECK(self_test->get_health(ic)->failed == 0);
+    }
+    //The boot measurement is there before the first tick
+    CHECK_NEAR(bms->get_total_voltage(), simulator->get_pack()->get_pack_volts(), 0.05);
+}
+
+TEST(drives_ten_minutes)
+{
+    uint16_t cycles = self_test->get_health(0)->cycles;
+    run_ms(600000);
+
+    CHECK(!shut_down);
+    //Self tests kept running in the background, the sum of cells check included
+    CHECK(self_test->get_health(0)->cycles > cycles + 100);
+    CHECK((self_test->get_health(0)->failed & HEALTH_SUM_OF_CELLS) == 0);
+    CHECK_NEAR(self_test->get_health(0)->sum_of_cells, bms->get_total_voltage(), 0.5);
+
+    //Every IVT sample got integrated, the SOC follows the one of the cells
+    float cells = 0;
+    for(uint16_t cell = 0; cell < simulator->get_pack()->cell_num; cell++)
+    {
+        cells += simulator->get_pack()->get_cell_soc(cell);
+    }
+    cells /= simulator->get_pack()->cell_num;
+    CHECK(soc->get_dropped() == 0);
+    CHECK_NEAR(soc->get_soc() * 0.0001, cells, 0.03);
+
+    //Every 10A step of the drive cycle is read back right after it, R0 with a little of R1
+    CHECK(dcir->get_steps() > 10);
+    CHECK(dcir->get_worst() != 0xFFFF);
+    CHECK_NEAR(dcir->get_average(), SIM_R0, SIM_R0 * 0.25);
+}
+
+//Another node on the bus, e.g. the tool of the bench
+static FlexCAN tester(500000);
+
+TEST(answers_on_the_ids_of_its_box)
+{
+    tester.begin();
+    host_can_clear();
+
+    //Blank EEPROM & open strapping pins, box 0
+    CHECK(box_identity.box_id == BOX_LEFT);
+
+    CAN_message_t msg;
+    msg.len = 8;
+    msg.buf[7] = CONFIGURATION_DISCARD;
+    msg.buf[6] = 0;
+    //The configuration id of the next box is not ours
+    msg.id = 0x6AC;
+    tester.write(msg);
+    msg.id = 0x6AA;
+    tester.write(msg);
+    msg.id = 0x4F0 + HEALTH_REQUEST_OFFSET;
+    tester.write(msg);
+    run_ms(1000);
+
+    CAN_message_t ack;
+    CHECK(host_can_count(0x6AB) == 1);
+    CHECK(host_can_count(0x6AD) == 0);
+    CHECK(host_can_last(0x6AB, &ack) && ack.buf[0] == box_identity.error_offset);
+    CHECK(ack.buf[1] == CONFIGURATION_ACK_STAGED);
+    CHECK(host_can_count(0x4F0 + HEALTH_RESPONSE_OFFSET) == bms->total_ic);
+    //Telemetry of the box keeps going out on its own base
+    CHECK(host_can_count(0x4F0 + SOC_PACK_OFFSET) > 0);
+    CHECK(host_can_count(0x4E0 + SOC_PACK_OFFSET) == 0);
+}
+
+//Classed by the member that went off-limit, whatever its value
+TEST(fault_class_of_the_limit_checks)
+{
+    BmsCriticalFrame_t frame = bms_volts_error;
+    //Shorted or open sense lead of cell 5
+    frame.volts = Float_Index_Tuple_t{0, 5};
+    CHECK(fault_class(frame) == FAULT_UNDERVOLT);
+    frame.volts.value = bms->ov + 0.1;
+    CHECK(fault_class(frame) == FAULT_OVERVOLT);
+
+    frame = bms_temp_error;
+    frame.temp = Float_Index_Tuple_t{bms->ut - 1, 3};
+    CHECK(fault_class(frame) == FAULT_UNDERTEMP);
+    frame.temp.value = 0;
+    CHECK(fault_class(frame) == (bms->ot + bms->ut > 0 ? FAULT_UNDERTEMP : FAULT_OVERTEMP));
+    frame.temp.value = bms->ot + 1;
+    CHECK(fault_class(frame) == FAULT_OVERTEMP);
+
+    CHECK(fault_class(bms_amps_error) == FAULT_AMPS);
+    CHECK(fault_class(bms_open_wire_error) == FAULT_OPEN_WIRE);
+    CHECK(fault_class(bms_critical_error) == FAULT_UNKNOWN);
+    //A frame of no check at all is not taken for a temperature
+    CHECK(fault_class(BmsCriticalFrame_t{0, empty_float_index, empty_float_index, empty_float_index}) == FAULT_UNKNOWN);
+}
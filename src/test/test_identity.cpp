@@ -0,0 +1,58 @@
+/* Box identity: EEPROM first, strapping pins next, never a box past the end of the pack */
+#include <Arduino.h>
+#include <EEPROM.h>
+#include "identity.h"
+#include "host.h"
+#include "test.h"
+
+#define PIN_0 20
+#define PIN_1 21
+
+static void write_id(uint8_t id)
+{
+    EEPROM.write(BOX_ID_EEPROM_ADDRESS, id);
+    EEPROM.write(BOX_ID_EEPROM_ADDRESS + 1, ~id);
+}
+
+TEST(blank_eeprom_and_open_pins_are_box_0)
+{
+    CHECK(load_box_identity(PIN_0, PIN_1, 2));
+    CHECK(box_identity.box_id == BOX_LEFT);
+    CHECK(box_identity.source == BOX_ID_SOURCE_PINS);
+}
+
+TEST(eeprom_wins_over_the_pins)
+{
+    write_id(BOX_RIGHT);
+    CHECK(load_box_identity(PIN_0, PIN_1, 2));
+    CHECK(box_identity.box_id == BOX_RIGHT);
+    CHECK(box_identity.source == BOX_ID_SOURCE_EEPROM);
+    //Every id of the box moves with it
+    CHECK(box_identity.error_offset == 32);
+    CHECK(box_identity.telemetry_canid == 0x4E0);
+    CHECK(box_identity.config_canid == 0x6AC);
+}
+
+TEST(eeprom_past_the_pack_falls_back_to_the_pins)
+{
+    write_id(3);
+    host_set_input(PIN_0, LOW);
+    CHECK(load_box_identity(PIN_0, PIN_1, 2));
+    CHECK(box_identity.box_id == BOX_RIGHT);
+    CHECK(box_identity.source == BOX_ID_SOURCE_PINS);
+
+    //Fine on a 4 box pack
+    CHECK(load_box_identity(PIN_0, PIN_1, 4));
+    CHECK(box_identity.box_id == 3);
+    CHECK(box_identity.source == BOX_ID_SOURCE_EEPROM);
+}
+
+TEST(pins_past_the_pack_are_flagged)
+{
+    host_eeprom_erase();
+    host_set_input(PIN_0, HIGH);
+    host_set_input(PIN_1, LOW);
+    CHECK(!load_box_identity(PIN_0, PIN_1, 2));
+    CHECK(box_identity.box_id == 2);
+    CHECK(box_identity.source == BOX_ID_SOURCE_INVALID);
+}
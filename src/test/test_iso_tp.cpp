@@ -0,0 +1,185 @@
+/* ISO-TP between two nodes of the virtual bus, timed as a 500 kbit/s bus */
+#include "framework.h"
+#include "host.h"
+#include "test.h"
+
+#define A_TO_B 0x700
+#define B_TO_A 0x701
+
+//11 bit id, 8 data bytes, no stuff bits & the interframe space
+#define FRAME_BITS 111
+#define BUS_BPS 500000
+#define FRAME_US (FRAME_BITS * 1000000 / BUS_BPS)
+
+static FlexCAN node_a(BUS_BPS), node_b(BUS_BPS);
+
+static void deliver(FlexCAN * node, Iso_Tp * tp)
+{
+    CAN_message_t message;
+    while(node->read(message))
+    {
+        tp->update(message);
+    }
+}
+
+//Both sides ticked every 'service_us' until the message is in or 'limit_ms' went by. The clock
+//moves by the service period or by the time the frames put on the bus took, whichever is longer
+static uint32_t run(Iso_Tp * a, Iso_Tp * b, uint32_t service_us, uint32_t limit_ms)
+{
+    uint32_t start = micros();
+    while(!b->available() && micros() - start < limit_ms * 1000)
+    {
+        size_t frames = host_can_log()->size();
+        a->tick(Clock::now_ms());
+        deliver(&node_b, b);
+        b->tick(Clock::now_ms());
+        deliver(&node_a, a);
+
+        uint32_t bus_us = (host_can_log()->size() - frames) * FRAME_US;
+        host_advance_us(bus_us > service_us ? bus_us : service_us);
+    }
+    return micros() - start;
+}
+
+static void begin()
+{
+    node_a.begin();
+    node_b.begin();
+    host_can_clear();
+}
+
+TEST(longest_message_arrives_whole)
+{
+    begin();
+    Iso_Tp a(&node_a, B_TO_A, A_TO_B), b(&node_b, A_TO_B, B_TO_A);
+
+    uint8_t data[ISO_TP_MAX_LEN];
+    for(uint16_t i = 0; i < ISO_TP_MAX_LEN; i++)
+    {
+        data[i] = i * 7 + (i >> 8);
+    }
+
+    CHECK(a.send(data, ISO_TP_MAX_LEN));
+    CHECK(!a.send(data, 10));
+    uint32_t us = run(&a, &b, 100, 5000);
+
+    CHECK(b.available());
+    CHECK(b.get_rx_len() == ISO_TP_MAX_LEN);
+    CHECK(memcmp(b.get_rx(), data, ISO_TP_MAX_LEN) == 0);
+    CHECK(!a.is_sending());
+    CHECK(a.get_errors() == 0 && b.get_errors() == 0);
+    CHECK(host_can_overflows(&node_a) == 0 && host_can_overflows(&node_b) == 0);
+
+    //First frame + 146 consecutive frames, a flow control every block
+    uint32_t consecutive = (ISO_TP_MAX_LEN - 6 + 6) / 7; /* 6 bytes in the first frame, 7 a frame rounded up */
+    CHECK(host_can_count(A_TO_B) == 1 + consecutive);
+    CHECK(host_can_count(B_TO_A) == 1 + (consecutive - 1) / ISO_TP_BLOCK_SIZE);
+
+    //STmin is the limit: a frame a millisecond
+    float bytes_per_s = ISO_TP_MAX_LEN * 1000000.0 / us;
+    float bus_load = host_can_log()->size() * FRAME_US / (float) us;
+    printf("  %u bytes in %.1f ms, %.0f B/s at %.0f%% of a 500 kbit/s bus\n",
+           ISO_TP_MAX_LEN, us / 1000.0, bytes_per_s, bus_load * 100);
+    CHECK(us >= consecutive * ISO_TP_ST_MIN_MS * 1000);
+    CHECK(bytes_per_s > 0.9 * 7000 / ISO_TP_ST_MIN_MS);
+    CHECK(bus_load < 0.5);
+
+    //Held until released, the next one gets refused meanwhile
+    CHECK(a.send(data, 100));
+    deliver(&node_b, &b);
+    deliver(&node_a, &a);
+    CHECK(b.get_rx_len() == ISO_TP_MAX_LEN);
+    CHECK(b.get_errors() == 1);
+    //Told so by the overflow flow control
+    CHECK(!a.is_sending());
+    CHECK(a.get_errors() == 1);
+    b.release();
+}
+
+TEST(throughput_follows_the_service_period)
+{
+    begin();
+    Iso_Tp a(&node_a, B_TO_A, A_TO_B), b(&node_b, A_TO_B, B_TO_A);
+    uint8_t data[512] = {0};
+
+    static const uint32_t periods_us[] = {1000, 5000, 20000};
+    for(uint8_t p = 0; p < 3; p++)
+    {
+        CHECK(a.send(data, sizeof(data)));
+        uint32_t us = run(&a, &b, periods_us[p], 60000);
+        CHECK(b.available() && b.get_rx_len() == sizeof(data));
+        b.release();
+
+        //Sent from tick(), so a consecutive frame per service period once STmin is below it
+        uint32_t frames = (sizeof(data) - 6 + 6) / 7; /* as above */
+        printf("  ticked every %lu us: %.0f B/s\n", (unsigned long) periods_us[p], sizeof(data) * 1000000.0 / us);
+        CHECK(us <= (frames + 2) * periods_us[p] + frames * FRAME_US);
+    }
+    CHECK(a.get_errors() == 0 && b.get_errors() == 0);
+}
+
+TEST(single_frame)
+{
+    begin();
+    Iso_Tp a(&node_a, B_TO_A, A_TO_B), b(&node_b, A_TO_B, B_TO_A);
+    uint8_t data[7] = {1, 2, 3, 4, 5, 6, 7};
+
+    CHECK(a.send(data, 7));
+    CHECK(!a.is_sending());
+    deliver(&node_b, &b);
+    CHECK(b.available() && b.get_rx_len() == 7 && memcmp(b.get_rx(), data, 7) == 0);
+    CHECK(host_can_count(A_TO_B) == 1);
+    CHECK(!a.send(data, 0));
+    CHECK(!a.send(data, ISO_TP_MAX_LEN + 1));
+}
+
+TEST(stalled_sessions_time_out)
+{
+    begin();
+    Iso_Tp a(&node_a, B_TO_A, A_TO_B), b(&node_b, A_TO_B, B_TO_A);
+    uint8_t data[100] = {0};
+
+    //Nobody answers the first frame
+    node_b.end();
+    CHECK(a.send(data, sizeof(data)));
+    a.tick(Clock::now_ms());
+    host_advance_us(ISO_TP_TIMEOUT_MS * 1000 + 1000);
+    a.tick(Clock::now_ms());
+    CHECK(!a.is_sending());
+    CHECK(a.get_errors() == 1);
+
+    //The sender goes away in the middle of a block
+    node_b.begin();
+    host_can_clear();
+    CHECK(a.send(data, sizeof(data)));
+    deliver(&node_b, &b);
+    deliver(&node_a, &a);
+    host_advance_us(ISO_TP_ST_MIN_MS * 1000);
+    a.tick(Clock::now_ms());
+    deliver(&node_b, &b);
+    host_advance_us(ISO_TP_TIMEOUT_MS * 1000 + 1000);
+    b.tick(Clock::now_ms());
+    CHECK(!b.available());
+    CHECK(b.get_errors() == 1);
+}
+
+TEST(lost_frame_drops_the_session)
+{
+    begin();
+    Iso_Tp a(&node_a, B_TO_A, A_TO_B), b(&node_b, A_TO_B, B_TO_A);
+    uint8_t data[100] = {0};
+
+    CHECK(a.send(data, sizeof(data)));
+    deliver(&node_b, &b);
+    deliver(&node_a, &a);
+    host_advance_us(ISO_TP_ST_MIN_MS * 1000);
+    a.tick(Clock::now_ms());
+    //Consecutive frame #1 never makes it, #2 is out of sequence
+    CAN_message_t lost;
+    node_b.read(lost);
+    host_advance_us(ISO_TP_ST_MIN_MS * 1000);
+    a.tick(Clock::now_ms());
+    deliver(&node_b, &b);
+    CHECK(b.get_errors() == 1);
+    CHECK(!b.available());
+}
@@ -0,0 +1,124 @@
+/* Journal on the host EEPROM: recovery, wear & power lost at every single byte */
+#include "journal.h"
+#include "host.h"
+#include "test.h"
+
+#define RECORD_NUM (JOURNAL_PAGES * JOURNAL_PAGE_RECORDS)
+#define END (JOURNAL_START + RECORD_NUM * JOURNAL_RECORD_SIZE)
+
+static uint32_t max_wear()
+{
+    uint32_t worst = 0;
+    for(uint16_t address = JOURNAL_START; address < END; address++)
+    {
+        worst = host_eeprom_wear(address) > worst ? host_eeprom_wear(address) : worst;
+    }
+    return worst;
+}
+
+TEST(reads_back_after_a_reboot)
+{
+    host_eeprom_erase();
+    Eeprom_Journal journal;
+    journal.load();
+
+    uint32_t value;
+    CHECK(!journal.read(JOURNAL_KEY_SOC, &value));
+    CHECK(!journal.read(JOURNAL_MAX_KEYS, &value));
+
+    journal.write(JOURNAL_KEY_SOC, 5000);
+    journal.write(JOURNAL_KEY_SHUTDOWNS, 3);
+    journal.write(JOURNAL_KEY_SOC, 4999);
+    //Same value, nothing written
+    journal.write(JOURNAL_KEY_SOC, 4999);
+    CHECK(journal.get_writes() == 3);
+
+    Eeprom_Journal rebooted;
+    rebooted.load();
+    CHECK(rebooted.read(JOURNAL_KEY_SOC, &value) && value == 4999);
+    CHECK(rebooted.read(JOURNAL_KEY_SHUTDOWNS, &value) && value == 3);
+    CHECK(!rebooted.read(JOURNAL_KEY_CHARGE_CYCLES, &value));
+    CHECK(rebooted.get_sequence() == 3);
+}
+
+//Written in place, every one of these would hit the same bytes
+TEST(spreads_the_wear_and_keeps_rare_keys)
+{
+    host_eeprom_erase();
+    Eeprom_Journal journal;
+    journal.load();
+
+    journal.write(JOURNAL_KEY_SHUTDOWNS, 7);
+    journal.write(JOURNAL_KEY_LAST_SHUTDOWN, 0x42);
+    const uint32_t writes = 10000;
+    for(uint32_t i = 0; i < writes; i++)
+    {
+        journal.write(JOURNAL_KEY_SOC, i);
+    }
+
+    //Keys written once got carried along every lap, at a cost of a few records a lap
+    uint32_t laps = writes / RECORD_NUM;
+    CHECK(journal.get_writes() < writes + 2 + laps * 2 * JOURNAL_PAGES);
+    printf("  %lu writes, worst byte written %lu times\n", (unsigned long) writes, (unsigned long) max_wear());
+    //Every record outside the reserve takes its turn, the key byte twice a turn (blanked, then committed)
+    CHECK(max_wear() <= 2 * writes / (JOURNAL_PAGES * (JOURNAL_PAGE_RECORDS - JOURNAL_RESERVED_RECORDS)) + 2);
+
+    Eeprom_Journal rebooted;
+    rebooted.load();
+    uint32_t value;
+    CHECK(rebooted.read(JOURNAL_KEY_SOC, &value) && value == writes - 1);
+    CHECK(rebooted.read(JOURNAL_KEY_SHUTDOWNS, &value) && value == 7);
+    CHECK(rebooted.read(JOURNAL_KEY_LAST_SHUTDOWN, &value) && value == 0x42);
+}
+
+//Power goes away after every possible number of byte writes, in the middle of a lap that moves
+//a rare key out of the page the head is about to enter. A reboot finds the rare key and either
+//the old or a newer SOC, never an older one than the last reboot found
+TEST(survives_power_loss_at_every_byte)
+{
+    //Head 10 records short of the reserve of the last page, the rare key sits in the first one
+    const uint32_t setup_writes = (JOURNAL_PAGES - 1) * (JOURNAL_PAGE_RECORDS - JOURNAL_RESERVED_RECORDS) - 10;
+    const uint32_t attempts = 20;
+    uint32_t previous = 0;
+    bool ok = true;
+
+    for(int32_t cut = 0; ok && cut <= (int32_t) (attempts + JOURNAL_RESERVED_RECORDS) * JOURNAL_RECORD_SIZE; cut++)
+    {
+        host_eeprom_erase();
+        Eeprom_Journal journal;
+        journal.load();
+        journal.write(JOURNAL_KEY_SHUTDOWNS, 7);
+        for(uint32_t i = 1; i <= setup_writes; i++)
+        {
+            journal.write(JOURNAL_KEY_SOC, i);
+        }
+
+        host_eeprom_cut_after(cut);
+        for(uint32_t i = 1; i <= attempts; i++)
+        {
+            journal.write(JOURNAL_KEY_SOC, setup_writes + i);
+        }
+        host_eeprom_cut_after(-1);
+
+        Eeprom_Journal rebooted;
+        rebooted.load();
+        uint32_t soc = 0, shutdowns = 0;
+        ok = rebooted.read(JOURNAL_KEY_SOC, &soc) && rebooted.read(JOURNAL_KEY_SHUTDOWNS, &shutdowns) &&
+             shutdowns == 7 && soc >= setup_writes && soc <= setup_writes + attempts && soc >= previous;
+        if(!ok)
+        {
+            printf("  power lost after %ld bytes: soc %lu (last %lu), shutdowns %lu\n",
+                   (long) cut, (unsigned long) soc, (unsigned long) previous, (unsigned long) shutdowns);
+        }
+        previous = soc;
+
+        //Carries on from where it was
+        rebooted.write(JOURNAL_KEY_SOC, 1);
+        Eeprom_Journal again;
+        again.load();
+        ok = ok && again.read(JOURNAL_KEY_SOC, &soc) && soc == 1 && again.read(JOURNAL_KEY_SHUTDOWNS, &shutdowns) && shutdowns == 7;
+    }
+    CHECK(ok);
+    //Every attempt made it in the end
+    CHECK(previous == setup_writes + attempts);
+}
@@ -0,0 +1,237 @@
+/* Data_Logger onto the host SD, read back through the host log reader */
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "logger.h"
+#include "log_reader.h"
+#include "host.h"
+#include "test.h"
+
+#define CELLS 12
+#define AUX 3
+#define TICK_MS 100
+
+static uint16_t code(uint32_t tick, uint16_t i)
+{
+    //Mostly small steps, now & then a jump across the whole range
+    if(tick % 37 == 5)
+    {
+        return i % 2 ? 0 : 0xFFFF;
+    }
+    return 30000 + i * 500 + (tick * 7 + i * 13) % 50;
+}
+
+static float amps(uint32_t tick){ return tick % 10 < 5 ? -125.5 : 3.25; }
+
+//Ticks every TICK_MS from 'start_ms', an event every 10th, serviced as the loop does if 'service'
+static void log_ticks(Data_Logger * logger, uint32_t start_ms, uint32_t ticks, bool service)
+{
+    uint16_t codes[CELLS + AUX];
+    for(uint32_t tick = 0; tick < ticks; tick++)
+    {
+        for(uint16_t i = 0; i < CELLS + AUX; i++)
+        {
+            codes[i] = code(tick, i);
+        }
+        uint32_t now_ms = start_ms + tick * TICK_MS;
+        logger->log_tick(now_ms, codes, codes + CELLS, amps(tick), 400 - tick * 0.001);
+        if(tick % 10 == 9)
+        {
+            logger->log_event(now_ms, LOG_EVENT_FAULT, tick << 8 | 2);
+        }
+        if(service)
+        {
+            logger->service();
+        }
+    }
+}
+
+static bool is_tick(Log_Record_t const * record, uint32_t start_ms, uint32_t tick)
+{
+    if(record->type != LOG_RECORD_TICK || record->ms != start_ms + tick * TICK_MS || record->codes.size() != CELLS + AUX)
+    {
+        return false;
+    }
+    for(uint16_t i = 0; i < CELLS + AUX; i++)
+    {
+        if(record->codes[i] != code(tick, i))
+        {
+            return false;
+        }
+    }
+    return record->ma == (int32_t) (amps(tick) * 1000) && record->mv == (int32_t) ((float) (400 - tick * 0.001) * 1000);
+}
+
+TEST(reads_back_every_record)
+{
+    host_sd_clear();
+    Data_Logger logger(10, CELLS, AUX);
+    CHECK(logger.begin());
+    const uint32_t ticks = 1000, start_ms = 5000;
+    log_ticks(&logger, start_ms, ticks, true);
+    logger.flush();
+    CHECK(logger.get_dropped() == 0);
+
+    std::vector<uint8_t> const * file = host_sd_file("LOG00.BIN");
+    CHECK(file && file->size() == logger.get_blocks() * LOG_BLOCK_SIZE);
+    Log_Reader reader;
+    CHECK(reader.open(file->data(), file->size()));
+    CHECK(reader.get_cell_num() == CELLS && reader.get_aux_num() == AUX);
+    printf("  %lu ticks in %lu blocks, %.1f bytes a tick\n", (unsigned long) ticks,
+           (unsigned long) reader.get_block_num(), file->size() / (float) ticks);
+
+    //Blocks numbered in order, every one decodable on its own
+    std::vector<Log_Record_t> records;
+    for(uint32_t block = 0; block < reader.get_block_num(); block++)
+    {
+        uint32_t sequence, first_ms;
+        CHECK(reader.get_header(block, &sequence, &first_ms) && sequence == block);
+        CHECK(reader.read_block(block, &records));
+    }
+    CHECK(reader.get_errors() == 0);
+
+    bool ok = records.size() == ticks + ticks / 10;
+    for(uint32_t tick = 0, r = 0; ok && tick < ticks; tick++)
+    {
+        ok = is_tick(&records[r++], start_ms, tick);
+        if(ok && tick % 10 == 9)
+        {
+            Log_Record_t const * event = &records[r++];
+            ok = event->type == LOG_RECORD_EVENT && event->ms == start_ms + tick * TICK_MS &&
+                 event->event == LOG_EVENT_FAULT && event->data == (tick << 8 | 2);
+        }
+    }
+    CHECK(ok);
+
+    //The next boot logs to a file of its own
+    Data_Logger next(10, CELLS, AUX);
+    CHECK(next.begin());
+    next.log_event(0, LOG_EVENT_CONFIG, 1);
+    next.flush();
+    CHECK(host_sd_file("LOG01.BIN") && host_sd_file("LOG01.BIN")->size() == LOG_BLOCK_SIZE);
+}
+
+TEST(seeks_by_time)
+{
+    host_sd_clear();
+    Data_Logger logger(10, CELLS, AUX);
+    logger.begin();
+    const uint32_t ticks = 2000, start_ms = 1000;
+    log_ticks(&logger, start_ms, ticks, true);
+    logger.flush();
+
+    std::vector<uint8_t> const * file = host_sd_file("LOG00.BIN");
+    Log_Reader reader;
+    CHECK(reader.open(file->data(), file->size()));
+
+    bool ok = true;
+    for(uint32_t tick = 0; ok && tick < ticks; tick += 97)
+    {
+        uint32_t ms = start_ms + tick * TICK_MS, sequence, first_ms;
+        //The block found starts before 'ms', the next one at or after it
+        uint32_t block = reader.seek(ms);
+        ok = reader.get_header(block, &sequence, &first_ms) && (block == 0 || first_ms < ms);
+        ok = ok && (block + 1 == reader.get_block_num() || (reader.get_header(block + 1, &sequence, &first_ms) && first_ms >= ms));
+
+        //A second's worth: the ticks & the events between them
+        std::vector<Log_Record_t> records;
+        reader.read(ms, ms + 999, &records);
+        ok = ok && records.size() >= 10 && records.size() <= 11 && is_tick(&records[0], start_ms, tick);
+        ok = ok && records.back().ms == ms + 900;
+    }
+    CHECK(ok);
+
+    std::vector<Log_Record_t> records;
+    CHECK(reader.seek(0) == 0);
+    CHECK(reader.seek(0xFFFFFFFF) == reader.get_block_num() - 1);
+    reader.read(start_ms + ticks * TICK_MS, 0xFFFFFFFF, &records);
+    CHECK(records.empty());
+}
+
+//The loop falls behind on service(): records past two blocks are dropped & counted, never waited for
+TEST(counts_what_it_drops)
+{
+    host_sd_clear();
+    Data_Logger logger(10, CELLS, AUX);
+    logger.begin();
+    const uint32_t ticks = 100;
+    log_ticks(&logger, 0, ticks, false);
+    CHECK(logger.get_dropped() > 0);
+    logger.flush();
+    CHECK(logger.get_blocks() == 2);
+
+    std::vector<uint8_t> const * file = host_sd_file("LOG00.BIN");
+    Log_Reader reader;
+    CHECK(reader.open(file->data(), file->size()));
+    std::vector<Log_Record_t> records;
+    reader.read(0, 0xFFFFFFFF, &records);
+
+    //What made it is the start of the run, in order
+    uint32_t logged = ticks + ticks / 10;
+    CHECK(records.size() + logger.get_dropped() == logged);
+    CHECK(is_tick(&records[0], 0, 0));
+    printf("  %lu of %lu records kept in two blocks\n", (unsigned long) records.size(), (unsigned long) logged);
+
+    //Keeps going once serviced again
+    logger.log_event(1000000, LOG_EVENT_SHUTDOWN, 0x12);
+    logger.flush();
+    records.clear();
+    CHECK(reader.open(file->data(), file->size()));
+    reader.read(1000000, 1000000, &records);
+    CHECK(records.size() == 1 && records[0].event == LOG_EVENT_SHUTDOWN && records[0].data == 0x12);
+}
+
+//A block the card mangled costs its own records only
+TEST(skips_a_bad_block)
+{
+    host_sd_clear();
+    Data_Logger logger(10, CELLS, AUX);
+    logger.begin();
+    log_ticks(&logger, 0, 500, true);
+    logger.flush();
+
+    std::vector<uint8_t> log = *host_sd_file("LOG00.BIN");
+    Log_Reader reader;
+    CHECK(reader.open(log.data(), log.size()));
+    std::vector<Log_Record_t> all;
+    reader.read(0, 0xFFFFFFFF, &all);
+
+    std::vector<Log_Record_t> records;
+    CHECK(reader.read_block(2, &records) && reader.read_block(4, &records));
+    size_t lost = records.size();
+    //Header gone & a record cut short
+    log[2 * LOG_BLOCK_SIZE] = 0;
+    memset(&log[4 * LOG_BLOCK_SIZE + LOG_HEADER_SIZE], 0xFF, 8);
+
+    records.clear();
+    CHECK(!reader.read_block(4, &records) && records.empty());
+    records.clear();
+    reader.read(0, 0xFFFFFFFF, &records);
+    CHECK(records.size() == all.size() - lost);
+    CHECK(reader.get_errors() == 3);
+    //Still whole past the torn end of the file
+    CHECK(reader.open(log.data(), log.size() - 100));
+    CHECK(reader.get_block_num() == log.size() / LOG_BLOCK_SIZE - 1);
+}
+
+TEST(maps_a_file)
+{
+    std::vector<uint8_t> const * log = host_sd_file("LOG00.BIN");
+    char path[] = "/tmp/bms_logXXXXXX";
+    int fd = mkstemp(path);
+    CHECK(fd >= 0 && write(fd, log->data(), log->size()) == (ssize_t) log->size());
+    close(fd);
+
+    Log_Reader reader, memory;
+    CHECK(reader.map(path));
+    CHECK(memory.open(log->data(), log->size()));
+    std::vector<Log_Record_t> mapped, read;
+    reader.read(0, 0xFFFFFFFF, &mapped);
+    memory.read(0, 0xFFFFFFFF, &read);
+    CHECK(!mapped.empty() && mapped.size() == read.size());
+    CHECK(reader.get_block_num() == memory.get_block_num());
+    reader.close();
+    unlink(path);
+
+    CHECK(!reader.map(path));
+}
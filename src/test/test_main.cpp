@@ -0,0 +1,57 @@
+#include <string.h>
+#include "test.h"
+
+static Test_Case * first = nullptr;
+static Test_Case * last = nullptr;
+static const char * running = nullptr;
+static unsigned failures = 0;
+
+Test_Case::Test_Case(const char * name, void (* body)()) : name(name), body(body)
+{
+    if(last == nullptr)
+    {
+        first = this;
+    }
+    else
+    {
+        last->next = this;
+    }
+    last = this;
+}
+
+void test_fail(const char * file, int line, const char * text)
+{
+    printf("  %s:%d: %s: CHECK(%s) failed\n", file, line, running, text);
+    failures++;
+}
+
+void test_fail_near(const char * file, int line, const char * text, double value, double expected, double tolerance)
+{
+    printf("  %s:%d: %s: %s = %g, expected %g +- %g\n", file, line, running, text, value, expected, tolerance);
+    failures++;
+}
+
+//Runs every test, or only those whose name contains argv[1]
+int main(int argc, char ** argv)
+{
+    unsigned run = 0, failed = 0;
+    for(Test_Case * test = first; test != nullptr; test = test->next)
+    {
+        if(argc > 1 && strstr(test->name, argv[1]) == nullptr)
+        {
+            continue;
+        }
+
+        unsigned before = failures;
+        running = test->name;
+        test->body();
+        run++;
+
+        bool passed = failures == before;
+        failed += !passed;
+        printf("%s %s\n", passed ? "PASS" : "FAIL", test->name);
+    }
+
+    printf("%u/%u passed\n", run - failed, run);
+    return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,132 @@
+/* Precharge sequence on a simulated RC bus */
+#include <math.h>
+#include "precharge.h"
+#include "test.h"
+
+#define PACK_VOLTS 300.0
+#define OTHER_VOLTS 300.0
+//Precharge resistor & the bus capacitance
+#define TAU_MS 500.0
+
+static uint8_t relay_state = PRECHARGE_IDLE;
+static uint16_t relay_changes = 0;
+
+static void relays(uint8_t state)
+{
+    relay_state = state;
+    relay_changes++;
+}
+
+//Steps a precharge every 10ms for 'ms', the IVT sending the bus voltage every 'sample_ms'
+//(0 sends nothing). The bus charges through the resistor once the relay closes
+class Bus
+{
+public:
+    Sample_Cache volts{100000};
+    uint32_t ms = 0;
+    float value = 0;
+
+    void run(Precharge * precharge, uint32_t duration_ms, uint32_t sample_ms, uint8_t until = 0xFF)
+    {
+        for(uint32_t end = ms + duration_ms; ms < end && precharge->get_state() != until; ms += 10)
+        {
+            if(relay_state == PRECHARGE_CHARGING || relay_state == PRECHARGE_CLOSING || relay_state == PRECHARGE_DONE)
+            {
+                value += (PACK_VOLTS + OTHER_VOLTS - value) * (1 - exp(-10 / TAU_MS));
+            }
+            if(sample_ms != 0 && ms % sample_ms == 0)
+            {
+                volts.put(value, ms * 1000);
+            }
+            precharge->step(ms, ms * 1000, &volts, PACK_VOLTS, OTHER_VOLTS);
+        }
+    }
+};
+
+TEST(precharges_a_healthy_bus)
+{
+    Precharge precharge(true, &relays);
+    Bus bus;
+    precharge.start(0);
+    CHECK(relay_state == PRECHARGE_WAIT);
+
+    bus.run(&precharge, 10000, 10, PRECHARGE_DONE);
+    CHECK(precharge.get_state() == PRECHARGE_DONE);
+    CHECK(relay_state == PRECHARGE_DONE);
+    //Every state went through the relays once
+    CHECK(relay_changes == 4);
+    CHECK(precharge.get_bus_volts() >= PRECHARGE_DEFAULT_RATIO * (PACK_VOLTS + OTHER_VOLTS));
+    //Past 90% already, it's the slope that holds it back: 600V / tau down to 50V/s takes ln(24) tau
+    CHECK(bus.ms > 3 * TAU_MS && bus.ms < 4 * TAU_MS);
+}
+
+TEST(other_box_has_nothing_to_do)
+{
+    Precharge precharge(false, &relays);
+    relay_changes = 0;
+    precharge.start(0);
+    CHECK(precharge.get_state() == PRECHARGE_DONE);
+    CHECK(relay_changes == 0);
+}
+
+TEST(bus_sample_from_before_the_relay_does_not_count)
+{
+    Precharge precharge(true, &relays);
+    Bus bus;
+    //Bus still charged from a previous run
+    bus.value = PACK_VOLTS + OTHER_VOLTS;
+    bus.volts.put(bus.value, 0);
+    precharge.start(0);
+
+    //Straight into CHARGING with that sample, then the IVT goes quiet
+    bus.run(&precharge, PRECHARGE_CHARGING_TIMEOUT_MS + 100, 0);
+    CHECK(precharge.get_state() == PRECHARGE_FAILED);
+    CHECK(precharge.get_failed_state() == PRECHARGE_CHARGING);
+    CHECK(relay_state == PRECHARGE_FAILED);
+}
+
+TEST(stale_bus_voltage_does_not_count)
+{
+    Precharge precharge(true, &relays);
+    Bus bus;
+    precharge.start(0);
+
+    //Samples stop right after the bus got there
+    bus.run(&precharge, 20, 10);
+    CHECK(precharge.get_state() == PRECHARGE_CHARGING);
+    bus.value = PACK_VOLTS + OTHER_VOLTS;
+    bus.volts.put(bus.value, bus.ms * 1000);
+    bus.ms += 200;
+    bus.run(&precharge, 1000, 0);
+    CHECK(precharge.get_state() == PRECHARGE_CHARGING);
+
+    //Back with fresh ones
+    bus.run(&precharge, 1000, 10, PRECHARGE_DONE);
+    CHECK(precharge.get_state() == PRECHARGE_DONE);
+}
+
+TEST(waits_for_the_other_box)
+{
+    Precharge precharge(true, &relays);
+    Sample_Cache volts(100000);
+    precharge.start(0);
+    for(uint32_t ms = 0; ms <= PRECHARGE_WAIT_TIMEOUT_MS + 10; ms += 10)
+    {
+        precharge.step(ms, ms * 1000, &volts, PACK_VOLTS, 0);
+    }
+    CHECK(precharge.get_state() == PRECHARGE_FAILED);
+    CHECK(precharge.get_failed_state() == PRECHARGE_WAIT);
+}
+
+TEST(abort_opens_the_relays)
+{
+    Precharge precharge(true, &relays);
+    Bus bus;
+    precharge.start(0);
+    bus.run(&precharge, 100, 10);
+    CHECK(precharge.is_active());
+    precharge.abort(bus.ms);
+    CHECK(precharge.get_state() == PRECHARGE_FAILED);
+    CHECK(relay_state == PRECHARGE_FAILED);
+    CHECK(!precharge.is_active());
+}
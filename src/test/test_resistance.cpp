@@ -0,0 +1,94 @@
+/* DCIR out of current steps: pairing, age of both scans, outliers & weak cells */
+#include "resistance.h"
+#include "test.h"
+
+#define CELLS 3
+#define OCV 37000 /* 100uV/LSB */
+
+static Sample_Cache amps(100000);
+
+//Cells at OCV - I * R, with the current sampled along with them
+static bool scan(Dcir_Estimator * dcir, float current, const float * ohms, uint32_t now_us)
+{
+    uint16_t codes[CELLS];
+    for(uint8_t i = 0; i < CELLS; i++)
+    {
+        codes[i] = OCV - current * ohms[i] * 10000;
+    }
+    amps.put(current, now_us);
+    return dcir->update(codes, &amps, 1, now_us);
+}
+
+static const float ohms[CELLS] = {0.020, 0.022, 0.045};
+
+TEST(settles_on_the_resistance_of_every_cell)
+{
+    Dcir_Estimator dcir(CELLS);
+    uint32_t us = 0;
+
+    CHECK(!scan(&dcir, 0, ohms, us));
+    CHECK(dcir.get_worst() == 0xFFFF);
+    for(uint8_t n = 0; n < DCIR_SETTLE_STEPS; n++)
+    {
+        us += 100000;
+        CHECK(scan(&dcir, n % 2 == 0 ? 20 : 0, ohms, us));
+    }
+
+    CHECK(dcir.get_steps() == DCIR_SETTLE_STEPS);
+    CHECK_NEAR(dcir.get_cell(0), 0.020, 0.001);
+    CHECK_NEAR(dcir.get_cell(2), 0.045, 0.001);
+    CHECK(dcir.get_worst() == 2);
+    CHECK(dcir.is_weak(2));
+    CHECK(!dcir.is_weak(0));
+    CHECK(dcir.get_weak_num() == 1);
+}
+
+TEST(small_changes_are_not_steps)
+{
+    Dcir_Estimator dcir(CELLS);
+    CHECK(!scan(&dcir, 0, ohms, 0));
+    CHECK(!scan(&dcir, DCIR_STEP_AMPS / 2, ohms, 100000));
+    CHECK(dcir.get_steps() == 0);
+}
+
+TEST(stale_previous_scan_is_not_paired)
+{
+    Dcir_Estimator dcir(CELLS);
+    CHECK(!scan(&dcir, 0, ohms, 0));
+    //The step is there, but the scan before it is too old to tell what happened in between
+    CHECK(!scan(&dcir, 20, ohms, DCIR_MAX_PAIR_US + 1));
+    CHECK(dcir.get_steps() == 0);
+    //Still the start of the next pair
+    CHECK(scan(&dcir, 0, ohms, DCIR_MAX_PAIR_US + 100000));
+}
+
+TEST(stale_current_breaks_the_pair)
+{
+    Dcir_Estimator dcir(CELLS);
+    CHECK(!scan(&dcir, 0, ohms, 0));
+
+    //Cells read with a current sample from before they were converted
+    uint16_t codes[CELLS] = {OCV - 4000, OCV - 4400, OCV - 8000};
+    CHECK(!dcir.update(codes, &amps, 1, DCIR_MAX_SKEW_US + 1));
+    //And the one after is not paired with it either
+    CHECK(!scan(&dcir, 20, ohms, DCIR_MAX_SKEW_US + 100000));
+    CHECK(dcir.get_steps() == 0);
+}
+
+TEST(outliers_of_a_settled_cell_are_rejected)
+{
+    Dcir_Estimator dcir(CELLS);
+    uint32_t us = 0;
+    scan(&dcir, 0, ohms, us);
+    for(uint8_t n = 0; n < DCIR_SETTLE_STEPS; n++)
+    {
+        us += 100000;
+        scan(&dcir, n % 2 == 0 ? 20 : 0, ohms, us);
+    }
+
+    const float bad[CELLS] = {0.020, 0.022, 0.100};
+    us += 100000;
+    scan(&dcir, DCIR_SETTLE_STEPS % 2 == 0 ? 20 : 0, bad, us);
+    CHECK(dcir.get_rejected() == 1);
+    CHECK_NEAR(dcir.get_cell(2), 0.045, 0.001);
+}
@@ -0,0 +1,106 @@
+/* Timestamped samples & the IVT freshness built on them, on the virtual clock */
+#include "sample_cache.h"
+#include "framework.h"
+#include "host.h"
+#include "test.h"
+
+//IVT result frame: 6 bytes, the signal signed big endian in mA (mV) from byte 2
+static CAN_message_t ivt_frame(uint32_t id, float si)
+{
+    CAN_message_t message;
+    memset(&message, 0, sizeof(message));
+    int32_t value = si * 1000;
+    message.id = id;
+    message.len = 6;
+    message.buf[2] = value >> 24;
+    message.buf[3] = value >> 16;
+    message.buf[4] = value >> 8;
+    message.buf[5] = value;
+    return message;
+}
+
+TEST(latest_value_no_older_than)
+{
+    Sample_Cache cache(100000);
+    float value = -1;
+
+    CHECK(!cache.has_value());
+    CHECK(!cache.get(&value, 1000000, 0));
+    CHECK(!cache.is_fresh(0));
+
+    cache.put(12.5, 1000);
+    CHECK(cache.has_value());
+    CHECK(cache.get(&value, 50000, 51000));
+    CHECK(value == 12.5);
+    CHECK(!cache.get(&value, 50000, 51001));
+    CHECK(cache.is_fresh(101000));
+    CHECK(!cache.is_fresh(101001));
+    CHECK(cache.get_age_us(31000) == 30000);
+    CHECK(cache.get_sequence() == 1);
+}
+
+TEST(ages_across_the_wrap_of_micros)
+{
+    Sample_Cache cache(100000);
+    float value;
+
+    cache.put(1, 0xFFFFFFFF - 9999);
+    CHECK(cache.get_age_us(40000) == 50000);
+    CHECK(cache.get(&value, 100000, 40000));
+    CHECK(!cache.is_fresh(100000));
+}
+
+TEST(estimates_the_rate)
+{
+    Sample_Cache cache(100000);
+    CHECK(cache.get_period_us() == 0);
+    CHECK(cache.get_rate_hz() == 0);
+
+    uint32_t us = 0;
+    for(uint8_t i = 0; i < 50; i++, us += 10000)
+    {
+        cache.put(i, us);
+    }
+    CHECK(cache.get_sequence() == 50);
+    CHECK(cache.get_period_us() == 10000);
+    CHECK_NEAR(cache.get_rate_hz(), 100, 0.01);
+
+    //Slows down to 20Hz, the estimate follows within a few dozen samples
+    for(uint8_t i = 0; i < 50; i++, us += 50000)
+    {
+        cache.put(i, us);
+    }
+    CHECK_NEAR(cache.get_rate_hz(), 20, 0.5);
+}
+
+TEST(ivt_freshness_follows_elapsed_time)
+{
+    IVT ivt;
+
+    //Nothing received yet
+    CHECK(ivt.tick().success == IVT_OLD_MEASUREMENT);
+    host_advance_us(IVT_LOSS_TIMEOUT_US + 1);
+    CHECK(ivt.is_lost());
+
+    ivt.update(ivt_frame(IVT_CURRENT_CANID, -12.345));
+    ivt.update(ivt_frame(IVT_VOLTAGE_CANID, 301.5));
+    IVTMeasureFrame_t frame = ivt.tick();
+    CHECK(frame.success == IVT_SUCCESS);
+    CHECK_NEAR(frame.amps, -12.345, 0.0005);
+    CHECK_NEAR(frame.volts, 301.5, 0.0005);
+    CHECK(!ivt.is_lost());
+
+    //Old past IVT_MAX_AGE_US, whatever the number of ticks in between
+    host_advance_us(IVT_MAX_AGE_US + 1);
+    CHECK(ivt.tick().success == IVT_OLD_MEASUREMENT);
+    CHECK(!ivt.is_lost());
+
+    //Only the current keeps coming, the voltage gets lost on its own
+    for(uint32_t us = 0; us <= IVT_LOSS_TIMEOUT_US; us += 10000)
+    {
+        ivt.update(ivt_frame(IVT_CURRENT_CANID, 1));
+        host_advance_us(10000);
+    }
+    CHECK(ivt.get_amps()->is_fresh(Can_Sensor::now_us()));
+    CHECK(ivt.is_lost());
+}
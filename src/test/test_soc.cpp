@@ -0,0 +1,128 @@
+/* Coulomb counter: integration per sample, drops, rest detection & persistence */
+#include <Arduino.h>
+#include <EEPROM.h>
+#include "soc.h"
+#include "journal.h"
+#include "host.h"
+#include "test.h"
+
+#define CAPACITY_MAH 1000
+#define CELLS 4
+
+//Every cell at the OCV of 50%
+static const uint16_t half[CELLS] = {37500, 37500, 37500, 37500};
+
+static Eeprom_Journal * fresh_journal()
+{
+    host_eeprom_erase();
+    Eeprom_Journal * journal = new Eeprom_Journal();
+    journal->load();
+    return journal;
+}
+
+TEST(first_rest_correction_sets_the_soc)
+{
+    Eeprom_Journal * journal = fresh_journal();
+    Coulomb_Counter soc(CAPACITY_MAH, CELLS, journal);
+    soc.rest_correct(half);
+    CHECK(soc.get_soc() == 5000);
+
+    //And it is persisted for the next boot
+    Coulomb_Counter next(CAPACITY_MAH, CELLS, journal);
+    next.load();
+    CHECK(next.get_soc() == 5000);
+    delete journal;
+}
+
+//Whatever else is in the EEPROM, the SOC only comes from the journal
+TEST(blank_journal_leaves_it_to_the_cells)
+{
+    Eeprom_Journal * journal = fresh_journal();
+    //Looks like a SOC of 20% followed by its inverse
+    EEPROM.write(64, 0x07);
+    EEPROM.write(65, 0xD0);
+    EEPROM.write(66, 0xF8);
+    EEPROM.write(67, 0x2F);
+
+    Coulomb_Counter soc(CAPACITY_MAH, CELLS, journal);
+    soc.load();
+    soc.rest_correct(half);
+    CHECK(soc.get_soc() == 5000);
+    delete journal;
+}
+
+TEST(every_sample_is_integrated)
+{
+    Eeprom_Journal * journal = fresh_journal();
+    Coulomb_Counter per_sample(CAPACITY_MAH, CELLS, journal);
+    Coulomb_Counter per_tick(CAPACITY_MAH, CELLS, journal);
+    per_sample.rest_correct(half);
+    per_tick.rest_correct(half);
+
+    //Square wave at the IVT rate (10ms), looked at by a 100ms loop
+    Sample_Cache amps(100000);
+    uint32_t us = 0;
+    for(uint32_t n = 0; n < 3600; n++, us += 10000)
+    {
+        amps.put(n % 2 == 0 ? 20.0 : 0.0, us);
+        per_sample.update(&amps);
+        if(n % 10 == 0)
+        {
+            per_tick.update(&amps);
+        }
+    }
+
+    //36s at an average of 10A take 100mAh out of 1Ah, 10%
+    CHECK_NEAR(per_sample.get_soc(), 4000, 5);
+    CHECK(per_sample.get_dropped() == 0);
+    //The loop only ever saw 20A, and counted the samples in between as dropped
+    CHECK_NEAR(per_tick.get_soc(), 3000, 5);
+    CHECK(per_tick.get_dropped() > 0);
+    delete journal;
+}
+
+TEST(rests_after_a_while_at_low_current)
+{
+    Eeprom_Journal * journal = fresh_journal();
+    Coulomb_Counter soc(CAPACITY_MAH, CELLS, journal, -1);
+    soc.rest_correct(half);
+
+    Sample_Cache amps(100000);
+    uint32_t us = 0;
+    //Charging (negative with this sign), the SOC goes up
+    for(uint32_t n = 0; n < 1000; n++, us += 10000)
+    {
+        amps.put(10.0, us);
+        soc.update(&amps);
+    }
+    CHECK(soc.get_soc() > 5000);
+    CHECK(!soc.is_resting());
+
+    for(uint32_t n = 0; us < SOC_REST_TIME_US + 20000000; n++, us += 10000)
+    {
+        amps.put(0.1, us);
+        soc.update(&amps);
+    }
+    CHECK(soc.is_resting());
+
+    //Pulled towards the OCV, 1 / 2^SOC_REST_GAIN_SHIFT of the way at a time
+    uint16_t before = soc.get_soc();
+    soc.rest_correct(half);
+    CHECK(soc.get_soc() < before);
+    CHECK(soc.get_soc() > 5000);
+    delete journal;
+}
+
+TEST(cell_offsets_from_their_ocv)
+{
+    Eeprom_Journal * journal = fresh_journal();
+    Coulomb_Counter soc(CAPACITY_MAH, CELLS, journal);
+    const uint16_t spread[CELLS] = {36800, 37500, 37500, 38300};
+    soc.rest_correct(spread);
+
+    CHECK(soc.get_min_cell_soc() < soc.get_soc());
+    CHECK(soc.get_max_cell_soc() > soc.get_soc());
+    CHECK(soc.get_cell_soc(0) == soc.get_min_cell_soc());
+    CHECK(soc.get_cell_soc(3) == soc.get_max_cell_soc());
+    delete journal;
+}
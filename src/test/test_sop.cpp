@@ -0,0 +1,111 @@
+/* Current limits: headroom under load, derating & the rise limit */
+#include "sop.h"
+#include "sim.h"
+#include "test.h"
+
+#define UV 3.0
+#define OV 4.2
+#define UT 0.0
+#define OT 60.0
+
+TEST(headroom_adds_to_the_current_the_cells_are_under)
+{
+    Power_Limits sop(100, 100, 0.030);
+
+    //OCV 3.6V, 0.3V of it already sagged away under 10A
+    sop.compute(3.3, 3.3, 10, 25, 25, 0.030, UV, OV, UT, OT, 0);
+    sop.compute(3.3, 3.3, 10, 25, 25, 0.030, UV, OV, UT, OT, 10000);
+    CHECK_NEAR(sop.get_discharge_amps(), 20, 0.01);
+    CHECK(sop.get_discharge_reason() == SOP_LIMIT_VOLTS);
+    //The same cells at rest have 3.6V, so 20A down to 3V as well
+    Power_Limits rest(100, 100, 0.030);
+    rest.compute(3.6, 3.6, 0, 25, 25, 0.030, UV, OV, UT, OT, 0);
+    rest.compute(3.6, 3.6, 0, 25, 25, 0.030, UV, OV, UT, OT, 10000);
+    CHECK_NEAR(rest.get_discharge_amps(), sop.get_discharge_amps(), 0.01);
+
+    //Charging at 2A lifts a 4.0V cell by 0.06V, 4.2V is (4.2 - 3.94) / 0.03 away
+    sop.compute(3.5, 4.0, -2, 25, 25, 0.030, UV, OV, UT, OT, 20000);
+    CHECK_NEAR(sop.get_charge_amps(), (OV - 3.94) / 0.030, 0.01);
+}
+
+TEST(rated_and_temperature_caps)
+{
+    Power_Limits sop(20, 4, 0.030);
+    sop.compute(3.8, 3.8, 0, 25, 25, 0.030, UV, OV, UT, OT, 0);
+    sop.compute(3.8, 3.8, 0, 25, 25, 0.030, UV, OV, UT, OT, 10000);
+    CHECK_NEAR(sop.get_discharge_amps(), 20, 0.01);
+    CHECK_NEAR(sop.get_charge_amps(), 4, 0.01);
+    CHECK(sop.get_discharge_reason() == SOP_LIMIT_MAX);
+
+    //Half way into the band below overtemp
+    sop.compute(3.8, 3.8, 0, 25, OT - SOP_TEMP_DERATE_BAND / 2, 0.030, UV, OV, UT, OT, 20000);
+    CHECK_NEAR(sop.get_discharge_amps(), 10, 0.01);
+    CHECK(sop.get_discharge_reason() == SOP_LIMIT_TEMP);
+    CHECK(sop.get_charge_reason() == SOP_LIMIT_TEMP);
+
+    //Cells out of headroom, nothing allowed either way
+    sop.compute(2.9, 4.3, 0, 25, 25, 0.030, UV, OV, UT, OT, 30000);
+    CHECK(sop.get_discharge_amps() == 0);
+    CHECK(sop.get_charge_amps() == 0);
+}
+
+TEST(rise_is_per_second_not_per_computation)
+{
+    //60A of headroom
+    Power_Limits fast(100, 100, 0.010), slow(100, 100, 0.010);
+
+    //Starts from 0
+    fast.compute(3.6, 3.6, 0, 25, 25, 0.010, UV, OV, UT, OT, 0);
+    slow.compute(3.6, 3.6, 0, 25, 25, 0.010, UV, OV, UT, OT, 0);
+    CHECK(fast.get_discharge_amps() == 0);
+
+    //Same second, 10 computations or 1
+    for(uint32_t ms = 100; ms <= 1000; ms += 100)
+    {
+        fast.compute(3.6, 3.6, 0, 25, 25, 0.010, UV, OV, UT, OT, ms);
+    }
+    slow.compute(3.6, 3.6, 0, 25, 25, 0.010, UV, OV, UT, OT, 1000);
+    CHECK_NEAR(fast.get_discharge_amps(), SOP_RISE_AMPS_PER_S, 0.01);
+    CHECK_NEAR(slow.get_discharge_amps(), SOP_RISE_AMPS_PER_S, 0.01);
+
+    //Drops apply at once
+    fast.compute(3.1, 3.6, 0, 25, 25, 0.010, UV, OV, UT, OT, 1100);
+    CHECK_NEAR(fast.get_discharge_amps(), 0.1 / 0.010, 0.01);
+}
+
+static float min_cell(Pack_Model * pack)
+{
+    float min = pack->get_cell_volts(0);
+    for(uint16_t cell = 1; cell < pack->cell_num; cell++)
+    {
+        min = pack->get_cell_volts(cell) < min ? pack->get_cell_volts(cell) : min;
+    }
+    return min;
+}
+
+TEST(simulated_pack_stays_above_undervolts_at_the_limit)
+{
+    Pack_Model pack(12, 1);
+    //Worst resistance of the spread, so the limit errs on the safe side
+    float ohms = SIM_R0 * (1 + SIM_R0_SPREAD);
+    uint32_t ms = 0;
+
+    for(uint8_t load = 0; load < 3; load++)
+    {
+        Power_Limits sop(1000, 1000, SIM_R0);
+        float amps = 2 + load * 2;
+        for(uint16_t step = 0; step < 300; step++, ms += 100)
+        {
+            pack.step(amps, 0.1);
+        }
+
+        sop.compute(min_cell(&pack), 4.0, amps, 25, 25, ohms, 3.3, OV, UT, OT, ms);
+        sop.compute(min_cell(&pack), 4.0, amps, 25, 25, ohms, 3.3, OV, UT, OT, ms + 100000);
+        CHECK(sop.get_discharge_amps() > amps);
+
+        //A step to the limit sags the weakest cell down to undervolts, not past it
+        pack.step(sop.get_discharge_amps(), 0);
+        CHECK(min_cell(&pack) >= 3.3);
+        CHECK_NEAR(min_cell(&pack), 3.3, 0.05);
+    }
+}